@@ -28,6 +28,7 @@
 #include <vmm_compiler.h>
 #include <vmm_stdio.h>
 #include <vmm_error.h>
+#include <arch_regs.h>
 #include <libs/kallsyms.h>
 #include <libs/stacktrace.h>
 
@@ -129,3 +130,23 @@ void arch_save_stacktrace(struct stack_trace *trace)
 	walk_stackframe(&frame, save_trace, &data);
 }
 
+void arch_sample_stacktrace(struct arch_regs *regs, struct stack_trace *trace)
+{
+	struct stack_trace_data data;
+	struct stackframe frame;
+
+	/* Only hypervisor (HYP mode) context can be unwound */
+	if ((regs->cpsr & CPSR_MODE_MASK) != CPSR_MODE_HYPERVISOR) {
+		return;
+	}
+
+	data.trace = trace;
+	data.skip = 0;
+
+	frame.fp = regs->gpr[11];
+	frame.sp = regs->sp;
+	frame.lr = regs->lr;
+	frame.pc = regs->pc;
+
+	walk_stackframe(&frame, save_trace, &data);
+}
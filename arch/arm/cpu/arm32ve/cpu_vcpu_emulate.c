@@ -24,6 +24,7 @@
 #include <vmm_types.h>
 #include <vmm_error.h>
 #include <vmm_vcpu_irq.h>
+#include <vmm_scheduler.h>
 #include <vmm_host_aspace.h>
 #include <vmm_devemu.h>
 #include <cpu_inline_asm.h>
@@ -159,9 +160,11 @@ int cpu_vcpu_emulate_wfi_wfe(struct vmm_vcpu *vcpu,
 		goto done;
 	}
 
-	/* If WFE trapped then only yield */
+	/* If WFE trapped then guest is most likely spinning on a lock
+	 * so yield in favour of a preempted sibling VCPU
+	 */
 	if (iss & ISS_WFI_WFE_TI_MASK) {
-		vmm_scheduler_yield();
+		vmm_scheduler_yield_directed();
 		goto done;
 	}
 
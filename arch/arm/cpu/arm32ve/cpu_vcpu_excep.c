@@ -26,6 +26,7 @@
 #include <vmm_cache.h>
 #include <vmm_host_aspace.h>
 #include <vmm_guest_aspace.h>
+#include <vmm_trace.h>
 #include <libs/stringlib.h>
 #include <generic_mmu.h>
 
@@ -47,6 +48,8 @@ static int cpu_vcpu_stage2_map(struct vmm_vcpu *vcpu,
 
 	memset(&pg, 0, sizeof(pg));
 
+	vmm_trace(VMM_TRACE_STAGE2_FAULT, vcpu, fipa, 0, 0);
+
 	inaddr = fipa & TTBL_L3_MAP_MASK;
 	size = TTBL_L3_BLOCK_SIZE;
 
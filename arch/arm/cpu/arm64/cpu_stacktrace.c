@@ -28,6 +28,7 @@
 #include <vmm_compiler.h>
 #include <vmm_stdio.h>
 #include <vmm_error.h>
+#include <arch_regs.h>
 #include <libs/kallsyms.h>
 #include <libs/stacktrace.h>
 
@@ -122,4 +123,32 @@ void arch_save_stacktrace(struct stack_trace *trace)
 	walk_stackframe(&frame, save_trace, &data);
 }
 
+void arch_sample_stacktrace(struct arch_regs *regs, struct stack_trace *trace)
+{
+	unsigned long fp, sp, high;
+
+	/* Only hypervisor (EL2) context can be unwound */
+	if (((regs->pstate & PSR_MODE_MASK) != PSR_MODE64_EL2t) &&
+	    ((regs->pstate & PSR_MODE_MASK) != PSR_MODE64_EL2h)) {
+		return;
+	}
 
+	if (trace->nr_entries >= trace->max_entries) {
+		return;
+	}
+	trace->entries[trace->nr_entries++] = regs->pc;
+
+	/* Only unwind frame records within page of interrupted stack */
+	fp = regs->gpr[29];
+	sp = regs->sp;
+	high = (sp + 0x1000) & ~0xfffUL;
+	while (trace->nr_entries < trace->max_entries) {
+		if ((fp < sp) || ((fp + 0x10) > high) || (fp & 0x7)) {
+			break;
+		}
+		trace->entries[trace->nr_entries++] =
+					*(unsigned long *)(fp + 8);
+		sp = fp + 0x10;
+		fp = *(unsigned long *)(fp);
+	}
+}
@@ -25,6 +25,8 @@
 #include <vmm_stdio.h>
 #include <vmm_host_aspace.h>
 #include <vmm_guest_aspace.h>
+#include <vmm_trace.h>
+#include <arch_atomic64.h>
 #include <libs/stringlib.h>
 #include <generic_mmu.h>
 
@@ -35,6 +37,63 @@
 #include <emulate_arm.h>
 #include <emulate_thumb.h>
 
+static void cpu_vcpu_stage2_fault_around(struct vmm_guest *guest,
+					 struct mmu_page *fpg)
+{
+	int dir;
+	u32 i, reg_flags;
+	struct mmu_page pg;
+	physical_addr_t inaddr, outaddr;
+	physical_size_t availsz;
+	struct arm_guest_priv *gp = arm_guest_priv(guest);
+
+	/* Map upto stage2_fault_around blocks of same size on
+	 * both sides of faulting block. We stop in a direction
+	 * as soon as we hit a non-RAM/ROM block or a block which
+	 * cannot be mapped with same size.
+	 */
+	for (dir = -1; dir <= 1; dir += 2) {
+		for (i = 1; i <= gp->stage2_fault_around; i++) {
+			if (dir < 0) {
+				if (fpg->ia < (i * fpg->sz)) {
+					break;
+				}
+				inaddr = fpg->ia - (i * fpg->sz);
+			} else {
+				inaddr = fpg->ia + (i * fpg->sz);
+			}
+
+			/* Skip blocks which are already mapped */
+			memset(&pg, 0, sizeof(pg));
+			if (!mmu_get_page(gp->ttbl, inaddr, &pg)) {
+				continue;
+			}
+
+			reg_flags = 0x0;
+			if (vmm_guest_physical_map(guest, inaddr, fpg->sz,
+					&outaddr, &availsz, &reg_flags)) {
+				break;
+			}
+			if (!(reg_flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM)) ||
+			    (availsz < fpg->sz) ||
+			    (outaddr & (fpg->sz - 1))) {
+				break;
+			}
+
+			memset(&pg, 0, sizeof(pg));
+			pg.ia = inaddr;
+			pg.sz = fpg->sz;
+			pg.oa = outaddr;
+			arch_mmu_pgflags_set(&pg.flags, MMU_STAGE2, reg_flags);
+
+			/* Another VCPU may have mapped it meanwhile */
+			if (!mmu_map_page(gp->ttbl, &pg)) {
+				arch_atomic64_add(&gp->stage2_around_count, 1);
+			}
+		}
+	}
+}
+
 static int cpu_vcpu_stage2_map(struct vmm_vcpu *vcpu,
 			       arch_regs_t *regs,
 			       physical_addr_t fipa)
@@ -47,6 +106,9 @@ static int cpu_vcpu_stage2_map(struct vmm_vcpu *vcpu,
 
 	memset(&pg, 0, sizeof(pg));
 
+	vmm_trace(VMM_TRACE_STAGE2_FAULT, vcpu, fipa, 0, 0);
+	arch_atomic64_add(&arm_guest_priv(vcpu->guest)->stage2_fault_count, 1);
+
 	inaddr = fipa & TTBL_L3_MAP_MASK;
 	size = TTBL_L3_BLOCK_SIZE;
 
@@ -111,11 +173,97 @@ static int cpu_vcpu_stage2_map(struct vmm_vcpu *vcpu,
 			return rc1;
 		}
 		rc = VMM_OK;
+	} else if ((pg_reg_flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM)) &&
+		   arm_guest_priv(vcpu->guest)->stage2_fault_around) {
+		cpu_vcpu_stage2_fault_around(vcpu->guest, &pg);
 	}
 
 	return rc;
 }
 
+struct stage2_prepopulate_priv {
+	int rc;
+	u64 count;
+};
+
+static void cpu_vcpu_stage2_prepopulate_mapping(struct vmm_guest *guest,
+						struct vmm_region *reg,
+						physical_addr_t gphys_addr,
+						physical_addr_t hphys_addr,
+						physical_size_t phys_size,
+						void *priv)
+{
+	struct mmu_page pg;
+	physical_size_t size;
+	struct stage2_prepopulate_priv *p = priv;
+	struct mmu_pgtbl *ttbl = arm_guest_priv(guest)->ttbl;
+
+	while (!p->rc && (phys_size >= TTBL_L3_BLOCK_SIZE)) {
+		/* Use largest block for which both addresses are aligned */
+		if ((phys_size >= TTBL_L1_BLOCK_SIZE) &&
+		    !(gphys_addr & (TTBL_L1_BLOCK_SIZE - 1)) &&
+		    !(hphys_addr & (TTBL_L1_BLOCK_SIZE - 1))) {
+			size = TTBL_L1_BLOCK_SIZE;
+		} else if ((phys_size >= TTBL_L2_BLOCK_SIZE) &&
+			   !(gphys_addr & (TTBL_L2_BLOCK_SIZE - 1)) &&
+			   !(hphys_addr & (TTBL_L2_BLOCK_SIZE - 1))) {
+			size = TTBL_L2_BLOCK_SIZE;
+		} else {
+			size = TTBL_L3_BLOCK_SIZE;
+		}
+
+		memset(&pg, 0, sizeof(pg));
+		pg.ia = gphys_addr;
+		pg.sz = size;
+		pg.oa = hphys_addr;
+		arch_mmu_pgflags_set(&pg.flags, MMU_STAGE2, reg->flags);
+
+		if (mmu_map_page(ttbl, &pg)) {
+			/* Already mapped (e.g. before Guest reset) is fine */
+			memset(&pg, 0, sizeof(pg));
+			p->rc = mmu_get_page(ttbl, gphys_addr, &pg);
+		} else {
+			p->count++;
+		}
+
+		gphys_addr += size;
+		hphys_addr += size;
+		phys_size -= size;
+	}
+}
+
+int cpu_vcpu_stage2_prepopulate(struct vmm_guest *guest,
+				struct vmm_region *reg)
+{
+	struct stage2_prepopulate_priv p;
+
+	if (!guest || !reg) {
+		return VMM_EINVALID;
+	}
+	if (!(reg->flags & VMM_REGION_REAL) ||
+	    !(reg->flags & VMM_REGION_MEMORY) ||
+	    !(reg->flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM)) ||
+	    (reg->flags & VMM_REGION_ALIAS)) {
+		return VMM_OK;
+	}
+
+	p.rc = VMM_OK;
+	p.count = 0;
+	vmm_guest_iterate_mapping(guest, reg,
+				  cpu_vcpu_stage2_prepopulate_mapping, &p);
+	if (p.rc) {
+		vmm_printf("%s: guest=%s region=%s prepopulate failed "
+			   "(error %d)\n", __func__, guest->name,
+			   reg->node->name, p.rc);
+		return p.rc;
+	}
+
+	arch_atomic64_add(&arm_guest_priv(guest)->stage2_prepop_count,
+			  p.count);
+
+	return VMM_OK;
+}
+
 int cpu_vcpu_inst_abort(struct vmm_vcpu *vcpu,
 			arch_regs_t *regs,
 			u32 il, u32 iss,
@@ -25,6 +25,7 @@
 #include <vmm_heap.h>
 #include <vmm_smp.h>
 #include <vmm_stdio.h>
+#include <arch_atomic64.h>
 #include <arch_barrier.h>
 #include <libs/stringlib.h>
 #include <libs/mathlib.h>
@@ -35,6 +36,7 @@
 #include <cpu_vcpu_vfp.h>
 #include <cpu_vcpu_ptrauth.h>
 #include <cpu_vcpu_helper.h>
+#include <cpu_vcpu_excep.h>
 #include <generic_timer.h>
 #include <arm_features.h>
 #include <arch_cache.h>
@@ -301,6 +303,60 @@ void cpu_vcpu_reg_write(struct vmm_vcpu *vcpu,
 	}
 }
 
+/* Max. neighbouring blocks mapped on each side of a Stage2 fault */
+#define STAGE2_FAULT_AROUND_MAX	16
+
+/* Number of VMIDs supported by VTTBR_EL2 */
+#define STAGE2_VMID_COUNT	((VTTBR_VMID_MASK >> VTTBR_VMID_SHIFT) + 1)
+
+/* Per-host CPU record of the Guest instance (VMID generation) and the
+ * VCPU which last ran with a given VMID on that host CPU. Guest TLB
+ * entries of a VMID on a host CPU can be stale only if this record
+ * does not match the VCPU being switched-in.
+ */
+struct stage2_vmid_info {
+	u64 gen;
+	u32 vcpu_subid;
+};
+
+static struct stage2_vmid_info
+	stage2_vmid_info[CONFIG_CPU_COUNT][STAGE2_VMID_COUNT];
+static atomic64_t stage2_vmid_gen = ARCH_ATOMIC64_INITIALIZER(0);
+
+static void cpu_vcpu_stage2_vmid_flush(struct vmm_vcpu *vcpu)
+{
+	u32 cpu = vmm_smp_processor_id();
+	struct arm_guest_priv *gp = arm_guest_priv(vcpu->guest);
+	struct stage2_vmid_info *vi =
+			&stage2_vmid_info[cpu][mmu_stage2_current_vmid()];
+
+	/* Moving to new host CPU used to broadcast flush all guest
+	 * TLB entries on every host CPU.
+	 */
+	if (arm_priv(vcpu)->last_hcpu != cpu) {
+		arch_atomic64_inc(&gp->stage2_flush_avoided_count);
+	}
+
+	/* Guest TLB maintenance is broadcasted (HCR_EL2.FB) so guest
+	 * TLB entries of our VMID on this host CPU are stale only when
+	 * they were created by an older Guest instance sharing the VMID
+	 * or by some other VCPU of this Guest (VCPUs can have conflicting
+	 * stage1 translations for same ASID). In both cases, it is enough
+	 * to invalidate guest TLB entries of our VMID locally.
+	 */
+	if ((vi->gen == gp->vmid_gen) && (vi->vcpu_subid == vcpu->subid)) {
+		return;
+	}
+
+	/* VTTBR_EL2 was just updated so synchronize before TLB flush */
+	isb();
+	inv_tlb_guest_cur_local();
+	arch_atomic64_inc(&gp->stage2_flush_local_count);
+
+	vi->gen = gp->vmid_gen;
+	vi->vcpu_subid = vcpu->subid;
+}
+
 int arch_guest_init(struct vmm_guest *guest)
 {
 	u32 pgtbl_attr;
@@ -327,8 +383,35 @@ int arch_guest_init(struct vmm_guest *guest)
 			/* By default, assume PSCI v0.1 */
 			arm_guest_priv(guest)->psci_version = 1;
 		}
+
+		if (vmm_devtree_read_u32(guest->node,
+				"stage2_fault_around",
+				&arm_guest_priv(guest)->stage2_fault_around)) {
+			/* By default, no fault-around */
+			arm_guest_priv(guest)->stage2_fault_around = 0;
+		}
+		if (STAGE2_FAULT_AROUND_MAX <
+				arm_guest_priv(guest)->stage2_fault_around) {
+			arm_guest_priv(guest)->stage2_fault_around =
+						STAGE2_FAULT_AROUND_MAX;
+		}
+
+		ARCH_ATOMIC64_INIT(&arm_guest_priv(guest)->stage2_fault_count, 0);
+		ARCH_ATOMIC64_INIT(&arm_guest_priv(guest)->stage2_around_count, 0);
+		ARCH_ATOMIC64_INIT(&arm_guest_priv(guest)->stage2_prepop_count, 0);
+		ARCH_ATOMIC64_INIT(
+			&arm_guest_priv(guest)->stage2_flush_local_count, 0);
+		ARCH_ATOMIC64_INIT(
+			&arm_guest_priv(guest)->stage2_flush_avoided_count, 0);
 	}
 
+	/* New VMID generation for every Guest instance (or reset) so
+	 * that stale guest TLB entries of our VMID are flushed lazily
+	 * on each host CPU.
+	 */
+	arm_guest_priv(guest)->vmid_gen =
+			arch_atomic64_add_return(&stage2_vmid_gen, 1);
+
 	return VMM_OK;
 }
 
@@ -348,6 +431,10 @@ int arch_guest_deinit(struct vmm_guest *guest)
 
 int arch_guest_add_region(struct vmm_guest *guest, struct vmm_region *region)
 {
+	if (region->flags & VMM_REGION_PREPOPULATE) {
+		return cpu_vcpu_stage2_prepopulate(guest, region);
+	}
+
 	return VMM_OK;
 }
 
@@ -751,7 +838,7 @@ void arch_vcpu_switch(struct vmm_vcpu *tvcpu,
 			arm_vgic_save(tvcpu);
 			/* Save sysregs context */
 			cpu_vcpu_sysregs_save(tvcpu);
-			/* Save VFP and SIMD context */
+			/* Save VFP and SIMD context (lazy) */
 			cpu_vcpu_vfp_save(tvcpu);
 			/* Save PTRAUTH context */
 			cpu_vcpu_ptrauth_save(tvcpu);
@@ -778,7 +865,7 @@ void arch_vcpu_switch(struct vmm_vcpu *tvcpu,
 		}
 		/* Restore PTRAUTH context */
 		cpu_vcpu_ptrauth_restore(vcpu);
-		/* Restore VFP and SIMD context */
+		/* Restore VFP and SIMD context (lazy) */
 		cpu_vcpu_vfp_restore(vcpu);
 		/* Restore sysregs context */
 		cpu_vcpu_sysregs_restore(vcpu);
@@ -792,17 +879,8 @@ void arch_vcpu_switch(struct vmm_vcpu *tvcpu,
 		msr(hstr_el2, arm_priv(vcpu)->hstr);
 		/* Update hypervisor Stage2 MMU context */
 		mmu_stage2_change_pgtbl(arm_guest_priv(vcpu->guest)->ttbl);
-		/* Flush TLB if moved to new host CPU */
-		if (arm_priv(vcpu)->last_hcpu != vmm_smp_processor_id()) {
-			/* Invalidate all guest TLB enteries because
-			 * we might have stale guest TLB enteries from
-			 * our previous run on new_hcpu host CPU
-			 */
-			inv_tlb_guest_allis();
-			/* Ensure changes are visible */
-			dsb(sy);
-			isb();
-		}
+		/* Flush stale guest TLB entries of our VMID locally */
+		cpu_vcpu_stage2_vmid_flush(vcpu);
 	}
 	/* Clear exclusive monitor */
 	clrex();
@@ -895,5 +973,23 @@ void arch_vcpu_regs_dump(struct vmm_chardev *cdev, struct vmm_vcpu *vcpu)
 
 void arch_vcpu_stat_dump(struct vmm_chardev *cdev, struct vmm_vcpu *vcpu)
 {
-	/* For now no arch specific stats */
+	struct arm_guest_priv *gp;
+
+	/* For only Normal VCPUs */
+	if (!vcpu->is_normal) {
+		return;
+	}
+
+	/* Stage2 stats are per-Guest */
+	gp = arm_guest_priv(vcpu->guest);
+	vmm_cprintf(cdev, "Stage2 Faults    : %"PRIu64"\n",
+			  arch_atomic64_read(&gp->stage2_fault_count));
+	vmm_cprintf(cdev, "Stage2 Around    : %"PRIu64"\n",
+			  arch_atomic64_read(&gp->stage2_around_count));
+	vmm_cprintf(cdev, "Stage2 Prepop    : %"PRIu64"\n",
+			  arch_atomic64_read(&gp->stage2_prepop_count));
+	vmm_cprintf(cdev, "Stage2 TLB Flush : %"PRIu64"\n",
+			  arch_atomic64_read(&gp->stage2_flush_local_count));
+	vmm_cprintf(cdev, "Stage2 TLB Avoid : %"PRIu64"\n",
+			  arch_atomic64_read(&gp->stage2_flush_avoided_count));
 }
@@ -23,7 +23,12 @@
  */
 
 #include <vmm_error.h>
+#include <vmm_smp.h>
 #include <vmm_stdio.h>
+#include <vmm_scheduler.h>
+#include <arch_atomic.h>
+#include <arch_cpu_irq.h>
+#include <arch_barrier.h>
 #include <arch_regs.h>
 #include <cpu_inline_asm.h>
 #include <cpu_vcpu_switch.h>
@@ -31,10 +36,75 @@
 
 #include <arm_features.h>
 
+/* Invalid value of vfp_hcpu (VFP context not live on any host CPU) */
+#define VFP_HCPU_NONE		0xFFFFFFFF
+
+/* VCPU owning live VFP context of each host CPU
+ * (Only updated by the host CPU itself with interrupts disabled)
+ */
+static struct vmm_vcpu *vfp_owner[CONFIG_CPU_COUNT];
+
+/* Save live VFP context of current owner back to its VCPU and drop
+ * ownership of given host CPU. Must be called on given host CPU with
+ * interrupts disabled and VFP access enabled in CPTR_EL2.
+ */
+static void vfp_owner_release(u32 cpu)
+{
+	struct vmm_vcpu *owner = vfp_owner[cpu];
+
+	if (!owner) {
+		return;
+	}
+
+	/* Owner might have been reset since it last loaded VFP
+	 * context on this host CPU in which case live context
+	 * is stale and must not be saved.
+	 */
+	if (arm_priv(owner)->vfp_hcpu == cpu) {
+		cpu_vcpu_vfp_regs_save(&arm_priv(owner)->vfp);
+		arch_smp_wmb();
+		arm_priv(owner)->vfp_hcpu = VFP_HCPU_NONE;
+	}
+
+	vfp_owner[cpu] = NULL;
+}
+
+static void vfp_ipi_release(void *vcpu_ptr, void *dummy1, void *dummy2)
+{
+	u64 cptr;
+	irq_flags_t flags;
+	struct vmm_vcpu *vcpu = vcpu_ptr;
+	u32 cpu = vmm_smp_processor_id();
+
+	arch_cpu_irq_save(flags);
+
+	/* Nothing to do if VCPU is not owner anymore or VCPU is
+	 * running on this host CPU again with its live VFP context.
+	 */
+	if ((vfp_owner[cpu] != vcpu) ||
+	    (vmm_scheduler_current_vcpu() == vcpu)) {
+		goto done;
+	}
+
+	cptr = mrs(cptr_el2);
+	msr(cptr_el2, cptr & ~CPTR_TFP_MASK);
+	isb();
+
+	vfp_owner_release(cpu);
+
+	msr(cptr_el2, cptr);
+	isb();
+
+done:
+	/* Allow VCPU to request release again */
+	arch_atomic_write(&arm_priv(vcpu)->vfp_release_pending, 0);
+
+	arch_cpu_irq_restore(flags);
+}
+
 void cpu_vcpu_vfp_save(struct vmm_vcpu *vcpu)
 {
 	struct arm_priv *p = arm_priv(vcpu);
-	struct arm_priv_vfp *vfp = &p->vfp;
 
 	/* Do nothing if:
 	 * 1. VCPU does not have VFPv3 feature
@@ -43,14 +113,19 @@ void cpu_vcpu_vfp_save(struct vmm_vcpu *vcpu)
 		return;
 	}
 
-	/* Low-level VFP register save */
-	cpu_vcpu_vfp_regs_save(vfp);
+	/* VFP context is switched lazily so we leave live VFP
+	 * context as-is in host CPU and save it only when some
+	 * other VCPU traps on its first VFP access.
+	 */
+	if (vfp_owner[vmm_smp_processor_id()] == vcpu) {
+		p->vfp_save_skip_count++;
+	}
 }
 
 void cpu_vcpu_vfp_restore(struct vmm_vcpu *vcpu)
 {
 	struct arm_priv *p = arm_priv(vcpu);
-	struct arm_priv_vfp *vfp = &p->vfp;
+	u32 cpu = vmm_smp_processor_id();
 
 	/* Do nothing if:
 	 * 1. VCPU does not have VFPv3 feature
@@ -59,16 +134,66 @@ void cpu_vcpu_vfp_restore(struct vmm_vcpu *vcpu)
 		return;
 	}
 
-	/* Low-level VFP register restore */
-	cpu_vcpu_vfp_regs_restore(vfp);
+	/* If VCPU still owns live VFP context of this host CPU
+	 * then allow VFP access right away otherwise trap first
+	 * VFP access and load VFP context in cpu_vcpu_vfp_trap().
+	 */
+	if ((vfp_owner[cpu] == vcpu) && (p->vfp_hcpu == cpu)) {
+		p->cptr &= ~CPTR_TFP_MASK;
+	} else {
+		p->cptr |= CPTR_TFP_MASK;
+	}
 }
 
 int cpu_vcpu_vfp_trap(struct vmm_vcpu *vcpu,
 		      arch_regs_t *regs,
 		      u32 il, u32 iss)
 {
-	/* For now we don't handle VFP trap so just return failure. */
-	return VMM_EFAIL;
+	u32 hcpu, cpu = vmm_smp_processor_id();
+	struct arm_priv *p = arm_priv(vcpu);
+
+	/* Only first VFP access trapped by CPTR_EL2.TFP is handled
+	 * here. Rest of the VFP traps are not handled so just return
+	 * failure for them.
+	 */
+	if (!arm_feature(vcpu, ARM_FEATURE_VFP3) ||
+	    !(p->cptr & CPTR_TFP_MASK)) {
+		return VMM_EFAIL;
+	}
+
+	p->vfp_trap_count++;
+
+	/* If VFP context of VCPU is still live on some other host
+	 * CPU then ask that host CPU to save it and return without
+	 * updating PC so that VCPU retries the VFP instruction.
+	 * The VCPU keeps trapping till the release is done hence
+	 * only one release request is kept outstanding.
+	 */
+	hcpu = p->vfp_hcpu;
+	arch_smp_rmb();
+	if ((hcpu != VFP_HCPU_NONE) && (hcpu != cpu)) {
+		if (!arch_atomic_cmpxchg(&p->vfp_release_pending, 0, 1)) {
+			vmm_smp_ipi_async_call(vmm_cpumask_of(hcpu),
+					vfp_ipi_release, vcpu, NULL, NULL);
+		}
+		return VMM_OK;
+	}
+
+	/* Enable VFP access for hypervisor and VCPU */
+	p->cptr &= ~CPTR_TFP_MASK;
+	msr(cptr_el2, p->cptr);
+	isb();
+
+	/* Take ownership of live VFP context of this host CPU */
+	if (vfp_owner[cpu] != vcpu || hcpu != cpu) {
+		vfp_owner_release(cpu);
+		cpu_vcpu_vfp_regs_restore(&p->vfp);
+		vfp_owner[cpu] = vcpu;
+		p->vfp_hcpu = cpu;
+	}
+
+	/* Don't update PC so that VCPU retries the VFP instruction */
+	return VMM_OK;
 }
 
 void cpu_vcpu_vfp_dump(struct vmm_chardev *cdev, struct vmm_vcpu *vcpu)
@@ -83,6 +208,12 @@ void cpu_vcpu_vfp_dump(struct vmm_chardev *cdev, struct vmm_vcpu *vcpu)
 		return;
 	}
 
+	vmm_cprintf(cdev, "VFP Lazy Switch\n");
+	vmm_cprintf(cdev, " %11s=0x%08"PRIx32"         %11s=%"PRIu64"\n",
+		    "LIVE_HCPU", arm_priv(vcpu)->vfp_hcpu,
+		    "TRAPS", arm_priv(vcpu)->vfp_trap_count);
+	vmm_cprintf(cdev, " %11s=%"PRIu64"\n",
+		    "SAVE_SKIPS", arm_priv(vcpu)->vfp_save_skip_count);
 	vmm_cprintf(cdev, "VFP Feature Registers\n");
 	vmm_cprintf(cdev, " %11s=0x%08"PRIx32"         %11s=0x%08"PRIx32"\n",
 		    "MVFR0_EL1", vfp->mvfr0,
@@ -114,6 +245,15 @@ int cpu_vcpu_vfp_init(struct vmm_vcpu *vcpu)
 	/* Clear VCPU VFP context */
 	memset(vfp, 0, sizeof(struct arm_priv_vfp));
 
+	/* VFP context is not live on any host CPU. If VCPU is being
+	 * reset then stale live VFP context (if any) is simply dropped
+	 * by vfp_owner_release() because vfp_hcpu does not match.
+	 */
+	p->vfp_hcpu = VFP_HCPU_NONE;
+	arch_atomic_write(&p->vfp_release_pending, 0);
+	p->vfp_trap_count = 0;
+	p->vfp_save_skip_count = 0;
+
 	/* If host HW does not have VFP (i.e. software VFP) then
 	 * clear all VFP feature flags so that VCPU always gets
 	 * undefined exception when accessing VFP registers.
@@ -123,11 +263,11 @@ int cpu_vcpu_vfp_init(struct vmm_vcpu *vcpu)
 	}
 
 	/* If Host HW does not support VFPv3 or higher then
-	 * don't allow VFP access to VCPU using CPTR_EL2
+	 * don't allow VFP access to VCPU using CPTR_EL2 otherwise
+	 * trap first VFP access for lazy VFP context switching
 	 */
-	if (arm_feature(vcpu, ARM_FEATURE_VFP3)) {
-		p->cptr &= ~CPTR_TFP_MASK;
-	} else {
+	p->cptr |= CPTR_TFP_MASK;
+	if (!arm_feature(vcpu, ARM_FEATURE_VFP3)) {
 		goto no_vfp_for_vcpu;
 	}
 
@@ -151,6 +291,13 @@ no_vfp_for_vcpu:
 
 int cpu_vcpu_vfp_deinit(struct vmm_vcpu *vcpu)
 {
-	/* For now nothing to do here. */
+	/* Drop ownership of live VFP context on all host CPUs
+	 * so that no host CPU refers this VCPU afterwards.
+	 */
+	if (arm_feature(vcpu, ARM_FEATURE_VFP3)) {
+		vmm_smp_ipi_sync_call(cpu_online_mask, 1000,
+				      vfp_ipi_release, vcpu, NULL, NULL);
+	}
+
 	return VMM_OK;
 }
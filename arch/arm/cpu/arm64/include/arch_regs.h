@@ -148,6 +148,13 @@ struct arm_priv {
 	vmm_cpumask_t dflush_needed;
 	/* VFP & SMID context */
 	struct arm_priv_vfp vfp;
+	/* Host CPU holding live VFP & SMID context (lazy switching) */
+	u32 vfp_hcpu;
+	/* Release of live VFP & SMID context requested from vfp_hcpu */
+	atomic_t vfp_release_pending;
+	/* Lazy VFP & SMID switching statistics */
+	u64 vfp_trap_count;
+	u64 vfp_save_skip_count;
 	/* Pointer Authentication context */
 	struct arm_priv_ptrauth ptrauth;
 	/* Last host CPU on which this VCPU ran */
@@ -170,6 +177,18 @@ struct arm_guest_priv {
 	 * Bits[15:0] = Minor number
 	 */
 	u32 psci_version;
+	/* Number of neighbouring blocks mapped on each side of a
+	 * Stage2 translation fault (0 = fault-around disabled)
+	 */
+	u32 stage2_fault_around;
+	/* VMID generation of this Guest instance */
+	u64 vmid_gen;
+	/* Stage2 statistics */
+	atomic64_t stage2_fault_count;
+	atomic64_t stage2_around_count;
+	atomic64_t stage2_prepop_count;
+	atomic64_t stage2_flush_local_count;
+	atomic64_t stage2_flush_avoided_count;
 };
 
 #define arm_regs(vcpu)		(&((vcpu)->regs))
@@ -97,6 +97,11 @@
 					     "isb\n\t" \
 					     ::: "memory", "cc")
 
+#define inv_tlb_guest_cur_local()	asm volatile("tlbi vmalls12e1\n\t" \
+					     "dsb nsh\n\t" \
+					     "isb\n\t" \
+					     ::: "memory", "cc")
+
 #define inv_tlb_hyp_vais(va)	asm volatile("tlbi vae2is, %0\n\t" \
 					     "dsb ish\n\t" \
 					     "isb\n\t" \
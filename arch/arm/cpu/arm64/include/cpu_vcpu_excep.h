@@ -38,4 +38,8 @@ int cpu_vcpu_data_abort(struct vmm_vcpu *vcpu,
 			u32 il, u32 iss, 
 			physical_addr_t fipa);
 
+/** Map complete guest region in stage2 using largest possible blocks */
+int cpu_vcpu_stage2_prepopulate(struct vmm_guest *guest,
+				struct vmm_region *reg);
+
 #endif /* _CPU_VCPU_EXCEP_H__ */
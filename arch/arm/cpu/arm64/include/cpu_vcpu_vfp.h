@@ -28,10 +28,14 @@
 #include <vmm_chardev.h>
 #include <vmm_manager.h>
 
-/** Save VFP context for given VCPU */
+/** Save VFP context for given VCPU
+ *  (Live VFP context stays in host CPU until other VCPU needs it)
+ */
 void cpu_vcpu_vfp_save(struct vmm_vcpu *vcpu);
 
-/** Restore VFP context for given VCPU */
+/** Restore VFP context for given VCPU
+ *  (Actual restore is deferred until first VFP access trap)
+ */
 void cpu_vcpu_vfp_restore(struct vmm_vcpu *vcpu);
 
 /** Handle VFP trap for given VCPU */
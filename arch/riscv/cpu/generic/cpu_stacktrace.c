@@ -25,6 +25,8 @@
 #include <vmm_macros.h>
 #include <vmm_stdio.h>
 #include <vmm_error.h>
+#include <arch_regs.h>
+#include <riscv_encoding.h>
 #include <libs/kallsyms.h>
 #include <libs/stacktrace.h>
 
@@ -109,3 +111,23 @@ void arch_save_stacktrace(struct stack_trace *trace)
 
 	walk_stackframe(&frame, save_trace, &data);
 }
+
+void arch_sample_stacktrace(struct arch_regs *regs, struct stack_trace *trace)
+{
+	struct stack_trace_data data;
+	struct stackframe frame;
+
+	/* Only hypervisor (HS-mode) context can be unwound */
+	if (regs->hstatus & HSTATUS_SPV) {
+		return;
+	}
+
+	data.trace = trace;
+	data.skip = 0;
+
+	frame.sp = regs->sp;
+	frame.ll.fp = regs->s0;
+	frame.ll.ra = regs->sepc + 0x4;
+
+	walk_stackframe(&frame, save_trace, &data);
+}
@@ -27,6 +27,8 @@
 #include <vmm_guest_aspace.h>
 #include <vmm_devemu.h>
 #include <vmm_vcpu_irq.h>
+#include <vmm_scheduler.h>
+#include <vmm_trace.h>
 #include <libs/stringlib.h>
 
 #include <generic_mmu.h>
@@ -119,6 +121,8 @@ static int cpu_vcpu_stage2_map(struct vmm_vcpu *vcpu,
 
 	memset(&pg, 0, sizeof(pg));
 
+	vmm_trace(VMM_TRACE_STAGE2_FAULT, vcpu, fault_addr, 0, 0);
+
 	inaddr = fault_addr & PGTBL_L0_MAP_MASK;
 	size = PGTBL_L0_BLOCK_SIZE;
 
@@ -819,6 +823,24 @@ static int wfi_insn(struct vmm_vcpu *vcpu, arch_regs_t *regs, ulong insn)
 	return VMM_OK;
 }
 
+static int wrs_insn(struct vmm_vcpu *vcpu, arch_regs_t *regs, ulong insn)
+{
+	/*
+	 * Trap from virtual-VS and virtual-VU modes should be forwarded to
+	 * virtual-HS mode as a virtual instruction trap.
+	 */
+	if (riscv_nested_virt(vcpu)) {
+		return TRAP_RETURN_VIRTUAL_INSN;
+	}
+
+	/*
+	 * Guest is polling a reservation set (most likely spinning on
+	 * a lock) so yield in favour of a preempted sibling VCPU.
+	 */
+	vmm_scheduler_yield_directed();
+	return VMM_OK;
+}
+
 static int hfence_vvma_insn(struct vmm_vcpu *vcpu,
 			    arch_regs_t *regs, ulong insn)
 {
@@ -1125,6 +1147,16 @@ static const struct system_opcode_func system_opcode_funcs[] = {
 		.match = INSN_MATCH_WFI,
 		.func  = wfi_insn,
 	},
+	{
+		.mask  = INSN_MASK_WRS_NTO,
+		.match = INSN_MATCH_WRS_NTO,
+		.func  = wrs_insn,
+	},
+	{
+		.mask  = INSN_MASK_WRS_STO,
+		.match = INSN_MATCH_WRS_STO,
+		.func  = wrs_insn,
+	},
 	{
 		.mask  = INSN_MASK_HFENCE_VVMA,
 		.match = INSN_MATCH_HFENCE_VVMA,
@@ -942,6 +942,12 @@
 #define INSN_MATCH_WFI			0x10500073
 #define INSN_MASK_WFI			0xffffffff
 
+#define INSN_MATCH_WRS_NTO		0x00d00073
+#define INSN_MASK_WRS_NTO		0xffffffff
+
+#define INSN_MATCH_WRS_STO		0x01d00073
+#define INSN_MASK_WRS_STO		0xffffffff
+
 #define INSN_MATCH_HFENCE_VVMA		0x22000073
 #define INSN_MASK_HFENCE_VVMA		0xfe007fff
 
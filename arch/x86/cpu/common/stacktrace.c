@@ -79,3 +79,25 @@ void arch_save_stacktrace_regs(struct arch_regs *regs, struct stack_trace *trace
 	if (trace->nr_entries < trace->max_entries)
 		trace->entries[trace->nr_entries++] = 0UL;
 }
+
+void arch_sample_stacktrace(struct arch_regs *regs, struct stack_trace *trace)
+{
+	unsigned long bp, sp, high;
+
+	if (trace->nr_entries >= trace->max_entries)
+		return;
+	trace->entries[trace->nr_entries++] = regs->rip;
+
+	/* Only unwind frames within page of interrupted stack */
+	bp = regs->rbp;
+	sp = regs->rsp;
+	high = (sp + 0x1000) & ~0xfffUL;
+	while (trace->nr_entries < trace->max_entries) {
+		if ((bp < sp) || ((bp + 0x10) > high) || (bp & 0x7))
+			break;
+		trace->entries[trace->nr_entries++] =
+					*(unsigned long *)(bp + 8);
+		sp = bp + 0x10;
+		bp = *(unsigned long *)(bp);
+	}
+}
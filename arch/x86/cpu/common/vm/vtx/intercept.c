@@ -34,6 +34,7 @@
 #include <vmm_devemu.h>
 #include <vmm_manager.h>
 #include <vmm_main.h>
+#include <vmm_trace.h>
 #include <vm/vmcs.h>
 #include <vm/vmx.h>
 #include <vm/ept.h>
@@ -401,6 +402,8 @@ int vmx_handle_vmexit(struct vcpu_hw_context *context, u32 exit_reason)
 {
 	switch (exit_reason) {
 	case EXIT_REASON_EPT_VIOLATION:
+		vmm_trace(VMM_TRACE_STAGE2_FAULT, context->assoc_vcpu,
+			  vmr(GUEST_PHYSICAL_ADDRESS), 0, 0);
 		/* Guest in real mode */
 		if (guest_in_real_mode(context)) {
 			if (is_guest_linear_address_valid(VMX_GUEST_EQ(context))) {
@@ -55,6 +55,8 @@ static int cmd_blockdev_info(struct vmm_chardev *cdev,
 	vmm_cprintf(cdev, "Description: %s\n", bdev->desc);
 	vmm_cprintf(cdev, "Access     : %s\n",
 		(bdev->flags & VMM_BLOCKDEV_RW) ? "Read-Write" : "Read-Only");
+	vmm_cprintf(cdev, "Scatter IO : %s\n",
+		(bdev->flags & VMM_BLOCKDEV_SG) ? "Yes" : "No");
 	vmm_cprintf(cdev, "Start LBA  : %"PRIu64"\n", bdev->start_lba);
 	vmm_cprintf(cdev, "Block Size : %"PRIu32"\n", bdev->block_size);
 	vmm_cprintf(cdev, "Block Count: %"PRIu64"\n", bdev->num_blocks);
@@ -55,6 +55,7 @@ static void cmd_guest_usage(struct vmm_chardev *cdev)
 			  "[mem_sz]\n");
 	vmm_cprintf(cdev, "   guest region_list <guest_name>\n");
 	vmm_cprintf(cdev, "   guest region  <guest_name> <gphys_addr>\n");
+	vmm_cprintf(cdev, "   guest copystat <guest_name>\n");
 	vmm_cprintf(cdev, "Note:\n");
 	vmm_cprintf(cdev, "   <guest_name> = node name under /guests "
 			  "device tree node\n");
@@ -328,6 +329,11 @@ static void cmd_guest_print_region(struct vmm_guest *guest,
 	vmm_cprintf(cdev, "Region maps count            : %u\n",
 		    VMM_REGION_MAPS_COUNT(reg));
 
+	if (VMM_REGION_HMAP_VA(reg)) {
+		vmm_cprintf(cdev, "Region host virtual address  : "
+			    "0x%"PRIADDR"\n", VMM_REGION_HMAP_VA(reg));
+	}
+
 	vmm_cprintf(cdev, "Region mappings              :\n");
 
 	vmm_guest_iterate_mapping(guest, reg,
@@ -377,6 +383,24 @@ static int cmd_guest_region(struct vmm_chardev *cdev, const char *name,
 	return VMM_OK;
 }
 
+static int cmd_guest_copystat(struct vmm_chardev *cdev, const char *name)
+{
+	u64 hmap_count = 0, legacy_count = 0;
+	struct vmm_guest *guest = vmm_manager_guest_find(name);
+
+	if (!guest) {
+		vmm_cprintf(cdev, "Failed to find guest\n");
+		return VMM_ENOTAVAIL;
+	}
+
+	vmm_guest_memory_copy_stats(guest, &hmap_count, &legacy_count);
+
+	vmm_cprintf(cdev, "Host mapped copies : %"PRIu64"\n", hmap_count);
+	vmm_cprintf(cdev, "Legacy copies      : %"PRIu64"\n", legacy_count);
+
+	return VMM_OK;
+}
+
 static int cmd_guest_param(struct vmm_chardev *cdev, int argc, char **argv,
 			   physical_addr_t *src_addr, u32 *size)
 {
@@ -441,6 +465,8 @@ static int cmd_guest_exec(struct vmm_chardev *cdev, int argc, char **argv)
 			return ret;
 		}
 		return cmd_guest_region(cdev, argv[2], src_addr);
+	} else if (strcmp(argv[1], "copystat") == 0) {
+		return cmd_guest_copystat(cdev, argv[2]);
 	} else {
 		cmd_guest_usage(cdev);
 		return VMM_EFAIL;
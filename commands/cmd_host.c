@@ -61,6 +61,7 @@ static void cmd_host_usage(struct vmm_chardev *cdev)
 	vmm_cprintf(cdev, "   host cpu info\n");
 	vmm_cprintf(cdev, "   host cpu poke [<hcpu>]\n");
 	vmm_cprintf(cdev, "   host cpu stats\n");
+	vmm_cprintf(cdev, "   host timer stats\n");
 	vmm_cprintf(cdev, "   host irq stats\n");
 	vmm_cprintf(cdev, "   host irq set_affinity <hirq> <hcpu>\n");
 	vmm_cprintf(cdev, "   host extirq stats\n");
@@ -256,6 +257,36 @@ static int cmd_host_cpu_stats(struct vmm_chardev *cdev)
 	return VMM_OK;
 }
 
+static int cmd_host_timer_stats(struct vmm_chardev *cdev)
+{
+	int rc;
+	u32 c;
+	u64 starts, programs, skips, coalesced;
+
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	vmm_cprintf(cdev, " %4s %18s %18s %18s %16s\n",
+			  "CPU#", "Starts", "Programs", "Program Skips",
+			  "Coalesced");
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+
+	for_each_online_cpu(c) {
+		rc = vmm_timer_stats(c, &starts, &programs,
+				     &skips, &coalesced);
+		if (rc)
+			return rc;
+		vmm_cprintf(cdev, " %4d %18"PRIu64" %18"PRIu64
+			    " %18"PRIu64" %16"PRIu64"\n",
+			    c, starts, programs, skips, coalesced);
+	}
+
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+
+	return VMM_OK;
+}
+
 static void irq_stats_print(struct vmm_chardev *cdev, u32 irqno)
 {
 	struct vmm_host_irq *irq;
@@ -737,6 +768,10 @@ static int cmd_host_exec(struct vmm_chardev *cdev, int argc, char **argv)
 		} else if (strcmp(argv[2], "stats") == 0) {
 			return cmd_host_cpu_stats(cdev);
 		}
+	} else if ((strcmp(argv[1], "timer") == 0) && (2 < argc)) {
+		if (strcmp(argv[2], "stats") == 0) {
+			return cmd_host_timer_stats(cdev);
+		}
 	} else if ((strcmp(argv[1], "irq") == 0) && (2 < argc)) {
 		if (strcmp(argv[2], "stats") == 0) {
 			cmd_host_irq_stats(cdev);
@@ -28,10 +28,14 @@
 #include <vmm_host_aspace.h>
 #include <vmm_modules.h>
 #include <vmm_cmdmgr.h>
+#include <vmm_cpumask.h>
+#include <arch_atomic64.h>
+#include <net/vmm_mbuf.h>
 #include <net/vmm_netport.h>
 #include <net/vmm_netswitch.h>
 #include <net/vmm_protocol.h>
 #include <libs/stringlib.h>
+#include <libs/mathlib.h>
 
 #define MODULE_DESC			"Command net"
 #define MODULE_AUTHOR			"Sukanto Ghosh"
@@ -48,7 +52,10 @@ static void cmd_net_usage(struct vmm_chardev *cdev)
 	vmm_cprintf(cdev, "   net switch list\n");
 	vmm_cprintf(cdev, "   net switch create <policy_name> <switch_name> ...\n");
 	vmm_cprintf(cdev, "   net switch destroy <switch_name>\n");
+	vmm_cprintf(cdev, "   net switch stats <switch_name>\n");
 	vmm_cprintf(cdev, "   net port list\n");
+	vmm_cprintf(cdev, "   net bh stats\n");
+	vmm_cprintf(cdev, "   net mbuf stats\n");
 }
 
 struct cmd_net_list_priv {
@@ -163,6 +170,39 @@ static int cmd_net_switch_destroy(struct vmm_chardev *cdev,
 	return VMM_OK;
 }
 
+static int cmd_net_switch_stats(struct vmm_chardev *cdev,
+				const char *switch_name)
+{
+	u64 rx, ucast, flood, lookup_ns;
+	struct vmm_netswitch *nsw;
+
+	nsw = vmm_netswitch_find(switch_name);
+	if (!nsw) {
+		vmm_cprintf(cdev, "Failed to find %s switch\n", switch_name);
+		return VMM_EINVALID;
+	}
+
+	rx = arch_atomic64_read(&nsw->stats.rx_frames);
+	ucast = arch_atomic64_read(&nsw->stats.unicast);
+	flood = arch_atomic64_read(&nsw->stats.flood);
+	lookup_ns = arch_atomic64_read(&nsw->stats.lookup_ns);
+
+	vmm_cprintf(cdev, "Switch            : %s\n", nsw->name);
+	vmm_cprintf(cdev, "Policy            : %s\n", nsw->policy->name);
+	vmm_cprintf(cdev, "RX Frames         : %"PRIu64"\n", rx);
+	vmm_cprintf(cdev, "Unicast Frames    : %"PRIu64"\n", ucast);
+	vmm_cprintf(cdev, "Flooded Frames    : %"PRIu64"\n", flood);
+	vmm_cprintf(cdev, "Learned Addresses : %"PRIu64"\n",
+		    arch_atomic64_read(&nsw->stats.learned));
+	vmm_cprintf(cdev, "Aged Addresses    : %"PRIu64"\n",
+		    arch_atomic64_read(&nsw->stats.aged));
+	vmm_cprintf(cdev, "Lookup Time (ns)  : %"PRIu64"\n", lookup_ns);
+	vmm_cprintf(cdev, "Lookup Avg (ns)   : %"PRIu64"\n",
+		    (ucast + flood) ? udiv64(lookup_ns, ucast + flood) : 0);
+
+	return VMM_OK;
+}
+
 static int cmd_net_port_list_iter(struct vmm_netport *port, void *data)
 {
 	char hwaddr[20];
@@ -203,6 +243,66 @@ static int cmd_net_port_list(struct vmm_chardev *cdev,
 	return VMM_OK;
 }
 
+static int cmd_net_bh_stats(struct vmm_chardev *cdev,
+			    int argc, char **argv)
+{
+	u32 c;
+	struct vmm_netswitch_bh_stats st;
+
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	vmm_cprintf(cdev, " %-5s %-16s %-16s %-10s %-10s %-16s\n",
+		    "CPU#", "Bursts", "Frames", "Avg-Burst", "Max-Burst",
+		    "Drops");
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	for_each_online_cpu(c) {
+		if (vmm_netswitch_bh_stats(c, &st)) {
+			continue;
+		}
+		vmm_cprintf(cdev, " %-5d %-16"PRIu64" %-16"PRIu64
+			    " %-10"PRIu64" %-10d %-16"PRIu64"\n", c,
+			    st.bursts, st.frames,
+			    (st.bursts) ? udiv64(st.frames, st.bursts) : 0,
+			    st.max_burst, st.drops);
+	}
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+
+	return VMM_OK;
+}
+
+static int cmd_net_mbuf_stats(struct vmm_chardev *cdev,
+			      int argc, char **argv)
+{
+	u32 p, hit_pct;
+	u64 total;
+	struct vmm_mbufpool_stats st;
+
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	vmm_cprintf(cdev, " %-10s %-7s %-7s %-7s %-7s %-14s %-14s %-4s\n",
+		    "Pool", "BufSize", "Total", "Free", "Cached",
+		    "Hits", "Misses", "Hit%");
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	for (p = 0; p < vmm_mbufpool_count(); p++) {
+		if (vmm_mbufpool_stats(p, &st)) {
+			continue;
+		}
+		total = st.hits + st.misses;
+		hit_pct = (total) ? (u32)udiv64(st.hits * 100, total) : 0;
+		vmm_cprintf(cdev, " %-10s %-7d %-7d %-7d %-7d %-14"PRIu64
+			    " %-14"PRIu64" %-4d\n", st.name, st.buf_size,
+			    st.total, st.free, st.cached,
+			    st.hits, st.misses, hit_pct);
+	}
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+
+	return VMM_OK;
+}
+
 static int cmd_net_exec(struct vmm_chardev *cdev, int argc, char **argv)
 {
 	if (argc <= 1) {
@@ -230,10 +330,22 @@ static int cmd_net_exec(struct vmm_chardev *cdev, int argc, char **argv)
 		   (strcmp(argv[2], "destroy") == 0)) {
 		return cmd_net_switch_destroy(cdev, argv[3],
 					      argc - 4, &argv[4]);
+	} else if ((argc >= 4) &&
+		   (strcmp(argv[1], "switch") == 0) &&
+		   (strcmp(argv[2], "stats") == 0)) {
+		return cmd_net_switch_stats(cdev, argv[3]);
 	} else if ((argc >= 3) &&
 		   (strcmp(argv[1], "port") == 0) &&
 		   (strcmp(argv[2], "list") == 0)) {
 		return cmd_net_port_list(cdev, argc - 3, &argv[3]);
+	} else if ((argc >= 3) &&
+		   (strcmp(argv[1], "bh") == 0) &&
+		   (strcmp(argv[2], "stats") == 0)) {
+		return cmd_net_bh_stats(cdev, argc - 3, &argv[3]);
+	} else if ((argc >= 3) &&
+		   (strcmp(argv[1], "mbuf") == 0) &&
+		   (strcmp(argv[2], "stats") == 0)) {
+		return cmd_net_mbuf_stats(cdev, argc - 3, &argv[3]);
 	}
 
 fail:
@@ -26,6 +26,7 @@
 #include <vmm_modules.h>
 #include <vmm_cmdmgr.h>
 #include <vmm_heap.h>
+#include <vmm_smp.h>
 #include <vmm_timer.h>
 #include <vmm_profiler.h>
 #include <arch_atomic.h>
@@ -42,17 +43,28 @@
 #define	MODULE_INIT			cmd_profile_init
 #define	MODULE_EXIT			cmd_profile_exit
 
+#ifdef CONFIG_PROFILE
 static bool cmd_profile_updated = FALSE;
+#endif
 
 static void cmd_profile_usage(struct vmm_chardev *cdev)
 {
 	vmm_cprintf(cdev, "Usage: \n");
 	vmm_cprintf(cdev, "   profile help\n");
+#ifdef CONFIG_PROFILE
 	vmm_cprintf(cdev, "   profile start\n");
 	vmm_cprintf(cdev, "   profile stop\n");
 	vmm_cprintf(cdev, "   profile status\n");
 	vmm_cprintf(cdev,
 		    "   profile dump [name|count|total_time|single_time]\n");
+#endif
+#ifdef CONFIG_PROFILE_SAMPLING
+	vmm_cprintf(cdev, "   profile sample_start [<period_usecs>]\n");
+	vmm_cprintf(cdev, "   profile sample_stop\n");
+	vmm_cprintf(cdev, "   profile sample_status\n");
+	vmm_cprintf(cdev, "   profile sample_flat [<count>]\n");
+	vmm_cprintf(cdev, "   profile sample_graph [<count>]\n");
+#endif
 }
 
 static int cmd_profile_help(struct vmm_chardev *cdev, char *dummy)
@@ -62,6 +74,7 @@ static int cmd_profile_help(struct vmm_chardev *cdev, char *dummy)
 	return VMM_OK;
 }
 
+#ifdef CONFIG_PROFILE
 static int cmd_profile_status(struct vmm_chardev *cdev, char *dummy)
 {
 	if (vmm_profiler_isactive()) {
@@ -333,16 +346,353 @@ static int cmd_profile_stop(struct vmm_chardev *cdev, char *dummy)
 {
 	return vmm_profiler_stop();
 }
+#endif
+
+#ifdef CONFIG_PROFILE_SAMPLING
+#define CMD_PROFILE_SAMPLE_TOP_COUNT	20
+#define CMD_PROFILE_SAMPLE_CALLER_COUNT	4
+
+struct cmd_profile_sample_hist {
+	u32 *self;
+	u32 *incl;
+	u32 *caller;
+	u32 callee;
+	u64 total;
+	u64 guest;
+	u64 other;
+};
+
+static int cmd_profile_sample_account(struct vmm_profiler_sample *s,
+				      void *priv)
+{
+	u32 i, j, pos[VMM_PROFILE_SAMPLE_DEPTH];
+	struct cmd_profile_sample_hist *h = priv;
+
+	h->total++;
+
+	if (!s->depth) {
+		if (s->guest_id != VMM_PROFILE_SAMPLE_NO_ID) {
+			h->guest++;
+		} else {
+			h->other++;
+		}
+		return VMM_OK;
+	}
+
+	for (i = 0; i < s->depth; i++) {
+		pos[i] = kallsyms_get_symbol_pos(s->pc[i], NULL, NULL);
+		/* recursive functions are counted once per sample */
+		for (j = 0; j < i; j++) {
+			if (pos[j] == pos[i]) {
+				break;
+			}
+		}
+		if (j == i) {
+			h->incl[pos[i]]++;
+		}
+	}
+	h->self[pos[0]]++;
+
+	return VMM_OK;
+}
+
+static int cmd_profile_sample_account_caller(struct vmm_profiler_sample *s,
+					     void *priv)
+{
+	struct cmd_profile_sample_hist *h = priv;
+
+	if ((s->depth < 2) ||
+	    (kallsyms_get_symbol_pos(s->pc[0], NULL, NULL) != h->callee)) {
+		return VMM_OK;
+	}
+
+	h->caller[kallsyms_get_symbol_pos(s->pc[1], NULL, NULL)]++;
+
+	return VMM_OK;
+}
+
+static int cmd_profile_sample_collect(struct vmm_chardev *cdev,
+			int (*iter)(struct vmm_profiler_sample *, void *),
+			struct cmd_profile_sample_hist *h)
+{
+	int rc;
+	u32 cpu;
+
+	for_each_possible_cpu(cpu) {
+		rc = vmm_profiler_sample_iterate(cpu, iter, h);
+		if (rc) {
+			vmm_cprintf(cdev, "Failed to read samples of CPU%d "
+				    "(error %d)\n", cpu, rc);
+			return rc;
+		}
+	}
+
+	return VMM_OK;
+}
+
+static int cmd_profile_sample_prepare(struct vmm_chardev *cdev,
+				      struct cmd_profile_sample_hist *h,
+				      bool need_caller)
+{
+	if (vmm_profiler_sample_isactive()) {
+		vmm_cprintf(cdev, "Can't dump while sampling is active\n");
+		return VMM_EFAIL;
+	}
+
+	if (!kallsyms_num_syms) {
+		vmm_cprintf(cdev, "No kernel symbols available\n");
+		return VMM_EFAIL;
+	}
+
+	memset(h, 0, sizeof(*h));
+	h->self = vmm_zalloc(kallsyms_num_syms * sizeof(u32));
+	h->incl = vmm_zalloc(kallsyms_num_syms * sizeof(u32));
+	if (need_caller) {
+		h->caller = vmm_zalloc(kallsyms_num_syms * sizeof(u32));
+	}
+	if (!h->self || !h->incl || (need_caller && !h->caller)) {
+		vmm_cprintf(cdev, "Failed to allocate histogram\n");
+		goto fail;
+	}
+
+	if (cmd_profile_sample_collect(cdev,
+				cmd_profile_sample_account, h)) {
+		goto fail;
+	}
+
+	return VMM_OK;
+
+fail:
+	if (h->self) {
+		vmm_free(h->self);
+	}
+	if (h->incl) {
+		vmm_free(h->incl);
+	}
+	if (h->caller) {
+		vmm_free(h->caller);
+	}
+	return VMM_EFAIL;
+}
+
+static void cmd_profile_sample_cleanup(struct cmd_profile_sample_hist *h)
+{
+	vmm_free(h->self);
+	vmm_free(h->incl);
+	if (h->caller) {
+		vmm_free(h->caller);
+	}
+}
+
+/* Pick symbol with highest count and clear it so next call picks another */
+static u32 cmd_profile_sample_pick(u32 *count, u32 *val)
+{
+	u32 i, best = kallsyms_num_syms;
+
+	*val = 0;
+	for (i = 0; i < kallsyms_num_syms; i++) {
+		if (count[i] > *val) {
+			*val = count[i];
+			best = i;
+		}
+	}
+
+	if (best < kallsyms_num_syms) {
+		count[best] = 0;
+	}
+
+	return best;
+}
+
+static u32 cmd_profile_sample_percent(u64 count, u64 total)
+{
+	return (total) ? (u32)udiv64(count * 10000, total) : 0;
+}
+
+static void cmd_profile_sample_summary(struct vmm_chardev *cdev,
+				       struct cmd_profile_sample_hist *h)
+{
+	u32 pct;
+
+	vmm_cprintf(cdev, "Sampling period: %"PRIu64" usecs\n",
+		    udiv64(vmm_profiler_sample_period(), 1000));
+	vmm_cprintf(cdev, "Total samples  : %"PRIu64"\n", h->total);
+	pct = cmd_profile_sample_percent(h->guest, h->total);
+	vmm_cprintf(cdev, "Guest samples  : %"PRIu64" (%u.%02u%%)\n",
+		    h->guest, pct / 100, pct % 100);
+	pct = cmd_profile_sample_percent(h->other, h->total);
+	vmm_cprintf(cdev, "Other samples  : %"PRIu64" (%u.%02u%%)\n",
+		    h->other, pct / 100, pct % 100);
+}
+
+static int cmd_profile_sample_start(struct vmm_chardev *cdev, char *period)
+{
+	int rc, usecs = 0;
+
+	if (period) {
+		usecs = atoi(period);
+		if (usecs <= 0) {
+			cmd_profile_usage(cdev);
+			return VMM_EINVALID;
+		}
+	}
+
+	rc = vmm_profiler_sample_start((u64)usecs * 1000);
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to start sampling (error %d)\n", rc);
+	}
+
+	return rc;
+}
+
+static int cmd_profile_sample_stop(struct vmm_chardev *cdev, char *dummy)
+{
+	int rc = vmm_profiler_sample_stop();
+
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to stop sampling (error %d)\n", rc);
+	}
+
+	return rc;
+}
+
+static int cmd_profile_sample_status(struct vmm_chardev *cdev, char *dummy)
+{
+	u32 cpu;
+
+	if (vmm_profiler_sample_isactive()) {
+		vmm_cprintf(cdev, "profile sampling is running\n");
+	} else {
+		vmm_cprintf(cdev, "profile sampling is not running\n");
+	}
+
+	vmm_cprintf(cdev, "Sampling period: %"PRIu64" usecs\n",
+		    udiv64(vmm_profiler_sample_period(), 1000));
+	for_each_possible_cpu(cpu) {
+		if (!vmm_profiler_sample_count(cpu)) {
+			continue;
+		}
+		vmm_cprintf(cdev, "CPU%-3d samples: %"PRIu64"\n",
+			    cpu, vmm_profiler_sample_count(cpu));
+	}
+
+	return VMM_OK;
+}
+
+static int cmd_profile_sample_flat(struct vmm_chardev *cdev, char *count)
+{
+	int i, top = CMD_PROFILE_SAMPLE_TOP_COUNT;
+	u32 pos, self, spct, ipct;
+	char name[KSYM_NAME_LEN];
+	struct cmd_profile_sample_hist h;
+
+	if (count && (atoi(count) > 0)) {
+		top = atoi(count);
+	}
+
+	if (cmd_profile_sample_prepare(cdev, &h, FALSE)) {
+		return VMM_EFAIL;
+	}
+
+	cmd_profile_sample_summary(cdev, &h);
+	vmm_cprintf(cdev, "\n%10s %7s %10s %7s  %s\n",
+		    "Self", "Self%", "Incl", "Incl%", "Symbol");
+
+	for (i = 0; i < top; i++) {
+		pos = cmd_profile_sample_pick(h.self, &self);
+		if (pos >= kallsyms_num_syms) {
+			break;
+		}
+
+		name[0] = name[KSYM_NAME_LEN - 1] = 0;
+		kallsyms_expand_symbol(kallsyms_get_symbol_offset(pos), name);
+		spct = cmd_profile_sample_percent(self, h.total);
+		ipct = cmd_profile_sample_percent(h.incl[pos], h.total);
+		vmm_cprintf(cdev, "%10u %3u.%02u%% %10u %3u.%02u%%  %s\n",
+			    self, spct / 100, spct % 100,
+			    h.incl[pos], ipct / 100, ipct % 100, name);
+	}
+
+	cmd_profile_sample_cleanup(&h);
+
+	return VMM_OK;
+}
+
+static int cmd_profile_sample_graph(struct vmm_chardev *cdev, char *count)
+{
+	int i, j, top = CMD_PROFILE_SAMPLE_TOP_COUNT;
+	u32 pos, cpos, self, calls, pct;
+	char name[KSYM_NAME_LEN];
+	struct cmd_profile_sample_hist h;
+
+	if (count && (atoi(count) > 0)) {
+		top = atoi(count);
+	}
+
+	if (cmd_profile_sample_prepare(cdev, &h, TRUE)) {
+		return VMM_EFAIL;
+	}
+
+	cmd_profile_sample_summary(cdev, &h);
+
+	for (i = 0; i < top; i++) {
+		pos = cmd_profile_sample_pick(h.self, &self);
+		if (pos >= kallsyms_num_syms) {
+			break;
+		}
+
+		name[0] = name[KSYM_NAME_LEN - 1] = 0;
+		kallsyms_expand_symbol(kallsyms_get_symbol_offset(pos), name);
+		pct = cmd_profile_sample_percent(self, h.total);
+		vmm_cprintf(cdev, "\n%10u %3u.%02u%%  %s\n",
+			    self, pct / 100, pct % 100, name);
+
+		memset(h.caller, 0, kallsyms_num_syms * sizeof(u32));
+		h.callee = pos;
+		if (cmd_profile_sample_collect(cdev,
+				cmd_profile_sample_account_caller, &h)) {
+			break;
+		}
+
+		for (j = 0; j < CMD_PROFILE_SAMPLE_CALLER_COUNT; j++) {
+			cpos = cmd_profile_sample_pick(h.caller, &calls);
+			if (cpos >= kallsyms_num_syms) {
+				break;
+			}
+
+			name[0] = name[KSYM_NAME_LEN - 1] = 0;
+			kallsyms_expand_symbol(
+				kallsyms_get_symbol_offset(cpos), name);
+			pct = cmd_profile_sample_percent(calls, self);
+			vmm_cprintf(cdev, "%10u %3u.%02u%%    <- %s\n",
+				    calls, pct / 100, pct % 100, name);
+		}
+	}
+
+	cmd_profile_sample_cleanup(&h);
+
+	return VMM_OK;
+}
+#endif
 
 static const struct {
 	char *name;
 	int (*function) (struct vmm_chardev *, char *);
 } const command[] = {
 	{"help", cmd_profile_help},
+#ifdef CONFIG_PROFILE
 	{"start", cmd_profile_start},
 	{"stop", cmd_profile_stop},
 	{"status", cmd_profile_status},
 	{"dump", cmd_profile_dump},
+#endif
+#ifdef CONFIG_PROFILE_SAMPLING
+	{"sample_start", cmd_profile_sample_start},
+	{"sample_stop", cmd_profile_sample_stop},
+	{"sample_status", cmd_profile_sample_status},
+	{"sample_flat", cmd_profile_sample_flat},
+	{"sample_graph", cmd_profile_sample_graph},
+#endif
 	{NULL, NULL},
 };
 
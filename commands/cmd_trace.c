@@ -0,0 +1,270 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file cmd_trace.c
+ * @author agent (agent@local)
+ * @brief command for hypervisor event tracing.
+ */
+
+#include <vmm_error.h>
+#include <vmm_stdio.h>
+#include <vmm_heap.h>
+#include <vmm_smp.h>
+#include <vmm_trace.h>
+#include <vmm_modules.h>
+#include <vmm_cmdmgr.h>
+#include <libs/stringlib.h>
+#include <libs/vfs.h>
+
+#define MODULE_DESC			"Command trace"
+#define MODULE_AUTHOR			"agent"
+#define MODULE_LICENSE			"GPL"
+#define MODULE_IPRIORITY		0
+#define	MODULE_INIT			cmd_trace_init
+#define	MODULE_EXIT			cmd_trace_exit
+
+#define TRACE_BATCH_COUNT		64
+
+static void cmd_trace_usage(struct vmm_chardev *cdev)
+{
+	vmm_cprintf(cdev, "Usage:\n");
+	vmm_cprintf(cdev, "   trace help\n");
+	vmm_cprintf(cdev, "   trace events\n");
+	vmm_cprintf(cdev, "   trace status\n");
+	vmm_cprintf(cdev, "   trace start [<event_mask>]\n");
+	vmm_cprintf(cdev, "   trace stop\n");
+	vmm_cprintf(cdev, "   trace dump [<count>]\n");
+	vmm_cprintf(cdev, "   trace save <file_path>\n");
+	vmm_cprintf(cdev, "Note:\n");
+	vmm_cprintf(cdev, "   dump and save consume buffered records so "
+			  "they can be used\n");
+	vmm_cprintf(cdev, "   while tracing is active. The save command "
+			  "appends raw\n");
+	vmm_cprintf(cdev, "   struct vmm_trace_record entries to given "
+			  "file.\n");
+}
+
+static int cmd_trace_events(struct vmm_chardev *cdev)
+{
+	u32 e, mask = vmm_trace_get_event_mask();
+
+	vmm_cprintf(cdev, "%-4s %-12s %-16s %s\n",
+		    "ID", "Mask", "Name", "Enabled");
+	for (e = 0; e < VMM_TRACE_MAX_EVENT; e++) {
+		vmm_cprintf(cdev, "%-4d 0x%08x   %-16s %s\n",
+			    e, 1U << e, vmm_trace_event_name(e),
+			    (mask & (1U << e)) ? "yes" : "no");
+	}
+
+	return VMM_OK;
+}
+
+static int cmd_trace_status(struct vmm_chardev *cdev)
+{
+	u32 cpu;
+
+	vmm_cprintf(cdev, "State       : %s\n",
+		    (vmm_trace_isactive()) ? "active" : "inactive");
+	vmm_cprintf(cdev, "Event Mask  : 0x%08x\n",
+		    vmm_trace_get_event_mask());
+	vmm_cprintf(cdev, "Buffer Size : %d records per CPU\n",
+		    vmm_trace_buffer_size());
+	vmm_cprintf(cdev, "Record Size : %d bytes\n",
+		    (u32)sizeof(struct vmm_trace_record));
+
+	vmm_cprintf(cdev, "%-6s %-12s %s\n", "CPU", "Pending", "Lost");
+	for_each_possible_cpu(cpu) {
+		vmm_cprintf(cdev, "%-6d %-12d %"PRIu64"\n",
+			    cpu, vmm_trace_pending(cpu), vmm_trace_lost(cpu));
+	}
+
+	return VMM_OK;
+}
+
+static int cmd_trace_start(struct vmm_chardev *cdev, u32 event_mask)
+{
+	int rc = vmm_trace_start(event_mask);
+
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to start tracing (error %d)\n", rc);
+	}
+
+	return rc;
+}
+
+static int cmd_trace_stop(struct vmm_chardev *cdev)
+{
+	int rc = vmm_trace_stop();
+
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to stop tracing (error %d)\n", rc);
+	}
+
+	return rc;
+}
+
+static int cmd_trace_dump(struct vmm_chardev *cdev, u32 count)
+{
+	u32 cpu, i, rcount, dcount, pending;
+	struct vmm_trace_record *recs, *r;
+
+	recs = vmm_malloc(TRACE_BATCH_COUNT * sizeof(*recs));
+	if (!recs) {
+		return VMM_ENOMEM;
+	}
+
+	vmm_cprintf(cdev, "%-4s %-20s %-14s %-6s %-6s %-18s %-18s %s\n",
+		    "CPU", "Timestamp", "Event", "Guest", "VCPU",
+		    "Arg0", "Arg1", "Arg2");
+	for_each_possible_cpu(cpu) {
+		/* Don't chase records logged while we are dumping */
+		pending = min(count, vmm_trace_pending(cpu));
+		dcount = 0;
+		while (dcount < pending) {
+			rcount = pending - dcount;
+			if (TRACE_BATCH_COUNT < rcount) {
+				rcount = TRACE_BATCH_COUNT;
+			}
+			rcount = vmm_trace_read(cpu, recs, rcount);
+			if (!rcount) {
+				break;
+			}
+			for (i = 0; i < rcount; i++) {
+				r = &recs[i];
+				vmm_cprintf(cdev, "%-4d %-20"PRIu64" %-14s "
+					    "%-6d %-6d 0x%016"PRIx64" "
+					    "0x%016"PRIx64" 0x%x\n",
+					    r->cpu, r->tstamp,
+					    vmm_trace_event_name(r->event),
+					    (int)r->guest_id, (int)r->vcpu_id,
+					    r->arg0, r->arg1, r->arg2);
+			}
+			dcount += rcount;
+		}
+	}
+
+	vmm_free(recs);
+
+	return VMM_OK;
+}
+
+static int cmd_trace_save(struct vmm_chardev *cdev, const char *path)
+{
+	int fd, rc = VMM_OK;
+	u64 total = 0;
+	u32 cpu, rcount, pending;
+	size_t len, wlen;
+	struct vmm_trace_record *recs;
+
+	recs = vmm_malloc(TRACE_BATCH_COUNT * sizeof(*recs));
+	if (!recs) {
+		return VMM_ENOMEM;
+	}
+
+	fd = vfs_open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		vmm_cprintf(cdev, "Failed to open %s\n", path);
+		vmm_free(recs);
+		return fd;
+	}
+
+	for_each_possible_cpu(cpu) {
+		/* Don't chase records logged while we are saving */
+		pending = vmm_trace_pending(cpu);
+		while (pending) {
+			rcount = min(pending, (u32)TRACE_BATCH_COUNT);
+			rcount = vmm_trace_read(cpu, recs, rcount);
+			if (!rcount) {
+				break;
+			}
+			pending -= rcount;
+			len = rcount * sizeof(*recs);
+			wlen = vfs_write(fd, recs, len);
+			if (wlen != len) {
+				vmm_cprintf(cdev, "Failed to write %s\n", path);
+				rc = VMM_EIO;
+				goto done;
+			}
+			total += rcount;
+		}
+	}
+
+done:
+	vfs_close(fd);
+	vmm_free(recs);
+
+	vmm_cprintf(cdev, "Saved %"PRIu64" records to %s\n", total, path);
+
+	return rc;
+}
+
+static int cmd_trace_exec(struct vmm_chardev *cdev, int argc, char **argv)
+{
+	if (argc == 2) {
+		if (strcmp(argv[1], "help") == 0) {
+			cmd_trace_usage(cdev);
+			return VMM_OK;
+		} else if (strcmp(argv[1], "events") == 0) {
+			return cmd_trace_events(cdev);
+		} else if (strcmp(argv[1], "status") == 0) {
+			return cmd_trace_status(cdev);
+		} else if (strcmp(argv[1], "start") == 0) {
+			return cmd_trace_start(cdev, 0);
+		} else if (strcmp(argv[1], "stop") == 0) {
+			return cmd_trace_stop(cdev);
+		} else if (strcmp(argv[1], "dump") == 0) {
+			return cmd_trace_dump(cdev, vmm_trace_buffer_size());
+		}
+	} else if (argc == 3) {
+		if (strcmp(argv[1], "start") == 0) {
+			return cmd_trace_start(cdev,
+					       strtoul(argv[2], NULL, 0));
+		} else if (strcmp(argv[1], "dump") == 0) {
+			return cmd_trace_dump(cdev,
+					      strtoul(argv[2], NULL, 0));
+		} else if (strcmp(argv[1], "save") == 0) {
+			return cmd_trace_save(cdev, argv[2]);
+		}
+	}
+	cmd_trace_usage(cdev);
+	return VMM_EFAIL;
+}
+
+static struct vmm_cmd cmd_trace = {
+	.name = "trace",
+	.desc = "hypervisor event tracing",
+	.usage = cmd_trace_usage,
+	.exec = cmd_trace_exec,
+};
+
+static int __init cmd_trace_init(void)
+{
+	return vmm_cmdmgr_register_cmd(&cmd_trace);
+}
+
+static void __exit cmd_trace_exit(void)
+{
+	vmm_cmdmgr_unregister_cmd(&cmd_trace);
+}
+
+VMM_DECLARE_MODULE(MODULE_DESC,
+			MODULE_AUTHOR,
+			MODULE_LICENSE,
+			MODULE_IPRIORITY,
+			MODULE_INIT,
+			MODULE_EXIT);
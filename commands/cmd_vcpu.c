@@ -23,10 +23,12 @@
 
 #include <vmm_error.h>
 #include <vmm_stdio.h>
+#include <vmm_heap.h>
 #include <vmm_delay.h>
 #include <vmm_devtree.h>
 #include <vmm_manager.h>
 #include <vmm_scheduler.h>
+#include <vmm_devemu.h>
 #include <vmm_host_ram.h>
 #include <vmm_host_vapool.h>
 #include <vmm_host_aspace.h>
@@ -59,8 +61,14 @@ static void cmd_vcpu_usage(struct vmm_chardev *cdev)
 	vmm_cprintf(cdev, "   vcpu set_hcpu <vcpu_id> <hcpu>\n");
 	vmm_cprintf(cdev, "   vcpu set_affinity <vcpu_id> "
 			  "<hcpu0> <hcpu1> <hcpu2> ...\n");
+	vmm_cprintf(cdev, "   vcpu set_deadline <vcpu_id> <runtime_usecs> "
+			  "<deadline_usecs> <period_usecs>\n");
+	vmm_cprintf(cdev, "   vcpu deadline_misses <hcpu>\n");
 	vmm_cprintf(cdev, "   vcpu dumpreg <vcpu_id>\n");
 	vmm_cprintf(cdev, "   vcpu dumpstat <vcpu_id>\n");
+	vmm_cprintf(cdev, "Note:\n");
+	vmm_cprintf(cdev, "   set_deadline with zero runtime moves "
+			  "vcpu back to normal class\n");
 }
 
 static int cmd_vcpu_help(struct vmm_chardev *cdev,
@@ -440,6 +448,98 @@ static int cmd_vcpu_set_hcpu(struct vmm_chardev *cdev,
 	return ret;
 }
 
+static int cmd_vcpu_set_deadline(struct vmm_chardev *cdev,
+				 int argc, char **argv)
+{
+	int ret, id;
+	u64 runtime, deadline, period;
+	struct vmm_vcpu *vcpu;
+
+	if (argc != 4) {
+		vmm_cprintf(cdev, "Must provide vcpu ID, runtime, "
+				  "deadline and period\n");
+		cmd_vcpu_usage(cdev);
+		return VMM_EINVALID;
+	}
+	id = atoi(argv[0]);
+	runtime = strtoull(argv[1], NULL, 0) * 1000ULL;
+	deadline = strtoull(argv[2], NULL, 0) * 1000ULL;
+	period = strtoull(argv[3], NULL, 0) * 1000ULL;
+
+	vcpu = vmm_manager_vcpu(id);
+	if (!vcpu) {
+		vmm_cprintf(cdev, "Failed to find vcpu\n");
+		return VMM_EFAIL;
+	}
+
+	ret = vmm_scheduler_dl_set(vcpu, runtime, deadline, period);
+	if (ret == VMM_ENOSPC) {
+		vmm_cprintf(cdev, "%s: Not enough bandwidth on host CPU\n",
+			    vcpu->name);
+	} else if (ret) {
+		vmm_cprintf(cdev, "%s: Failed to set deadline class "
+			    "(error %d)\n", vcpu->name, ret);
+	} else if (runtime) {
+		vmm_cprintf(cdev, "%s: Deadline class set\n", vcpu->name);
+	} else {
+		vmm_cprintf(cdev, "%s: Normal class set\n", vcpu->name);
+	}
+
+	return ret;
+}
+
+static int cmd_vcpu_deadline_misses(struct vmm_chardev *cdev,
+				    int argc, char **argv)
+{
+	u32 i, count, bw;
+	int hcpu;
+	struct vmm_scheduler_dl_miss *misses;
+
+	if (argc != 1) {
+		vmm_cprintf(cdev, "Must provide host CPU\n");
+		cmd_vcpu_usage(cdev);
+		return VMM_EINVALID;
+	}
+	hcpu = atoi(argv[0]);
+	if ((hcpu < 0) || (CONFIG_CPU_COUNT <= hcpu) ||
+	    !vmm_cpu_online(hcpu)) {
+		vmm_cprintf(cdev, "Invalid host CPU%d\n", hcpu);
+		return VMM_EINVALID;
+	}
+
+	misses = vmm_malloc(sizeof(*misses) *
+			    CONFIG_SCHED_DL_MISS_TRACE_SIZE);
+	if (!misses) {
+		return VMM_ENOMEM;
+	}
+
+	bw = vmm_scheduler_dl_bandwidth(hcpu);
+	count = vmm_scheduler_dl_misses(hcpu, misses,
+					CONFIG_SCHED_DL_MISS_TRACE_SIZE);
+
+	vmm_cprintf(cdev, "Host CPU%d reserved bandwidth: %d.%d%%\n",
+		    hcpu, bw / 10, bw % 10);
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------\n");
+	vmm_cprintf(cdev, " %-6s %-22s %-22s %-20s\n",
+			  "VCPU", "Timestamp (ns)", "Deadline (ns)",
+			  "Lateness (ns)");
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------\n");
+	for (i = 0; i < count; i++) {
+		vmm_cprintf(cdev, " %-6d %-22"PRIu64" %-22"PRIu64
+				  " %-20"PRIu64"\n",
+			    misses[i].vcpu_id, misses[i].tstamp,
+			    misses[i].deadline, misses[i].lateness);
+	}
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------\n");
+
+	vmm_free(misses);
+
+	return VMM_OK;
+}
+
 static int cmd_vcpu_set_affinity(struct vmm_chardev *cdev,
 				 int argc, char **argv)
 {
@@ -537,6 +637,11 @@ static int cmd_vcpu_dumpstat(struct vmm_chardev *cdev,
 	u64 last_reset_nsecs, total_nsecs;
 	u64 ready_nsecs, running_nsecs, paused_nsecs;
 	u64 halted_nsecs, system_nsecs;
+	u64 ready_max_nsecs, vruntime_nsecs;
+	u64 dl_runtime, dl_deadline, dl_period, dl_remaining;
+	u32 dl_throttle_count, dl_miss_count;
+	bool dl_throttled;
+	u64 rcache_hit, rcache_miss;
 	struct vmm_vcpu *vcpu;
 
 	if (!argc) {
@@ -557,7 +662,8 @@ static int cmd_vcpu_dumpstat(struct vmm_chardev *cdev,
 				  &reset_count, &last_reset_nsecs,
 				  &ready_nsecs, &running_nsecs,
 				  &paused_nsecs, &halted_nsecs,
-				  &system_nsecs);
+				  &system_nsecs, &ready_max_nsecs,
+				  &vruntime_nsecs);
 	if (ret) {
 		vmm_cprintf(cdev, "%s: Failed to get stats\n",
 				  vcpu->name);
@@ -617,6 +723,12 @@ static int cmd_vcpu_dumpstat(struct vmm_chardev *cdev,
 	nsecs_to_hhmmsstt(system_nsecs, &h, &m, &s, &ms);
 	vmm_cprintf(cdev, "System Time      : %d:%02d:%02d:%03d\n",
 			  h, m, s, ms);
+	nsecs_to_hhmmsstt(ready_max_nsecs, &h, &m, &s, &ms);
+	vmm_cprintf(cdev, "Max Ready Wait   : %d:%02d:%02d:%03d\n",
+			  h, m, s, ms);
+	nsecs_to_hhmmsstt(vruntime_nsecs, &h, &m, &s, &ms);
+	vmm_cprintf(cdev, "Virtual Runtime  : %d:%02d:%02d:%03d\n",
+			  h, m, s, ms);
 	vmm_cprintf(cdev, "\n");
 	vmm_cprintf(cdev, "Reset Count      : %d\n", reset_count);
 	nsecs_to_hhmmsstt(last_reset_nsecs, &h, &m, &s, &ms);
@@ -624,6 +736,35 @@ static int cmd_vcpu_dumpstat(struct vmm_chardev *cdev,
 			  h, m, s, ms);
 	vmm_cprintf(cdev, "\n");
 
+	vmm_scheduler_dl_stats(vcpu, &dl_runtime, &dl_deadline, &dl_period,
+			       &dl_remaining, &dl_throttled,
+			       &dl_throttle_count, &dl_miss_count);
+	if (dl_runtime) {
+		vmm_cprintf(cdev, "DL Runtime       : %"PRIu64" ns\n",
+				  dl_runtime);
+		vmm_cprintf(cdev, "DL Deadline      : %"PRIu64" ns\n",
+				  dl_deadline);
+		vmm_cprintf(cdev, "DL Period        : %"PRIu64" ns\n",
+				  dl_period);
+		vmm_cprintf(cdev, "DL Remaining     : %"PRIu64" ns%s\n",
+				  dl_remaining,
+				  (dl_throttled) ? " (throttled)" : "");
+		vmm_cprintf(cdev, "DL Throttle Count: %d\n",
+				  dl_throttle_count);
+		vmm_cprintf(cdev, "DL Miss Count    : %d\n",
+				  dl_miss_count);
+		vmm_cprintf(cdev, "\n");
+	}
+
+	if (vcpu->is_normal) {
+		vmm_devemu_vcpu_rcache_stats(vcpu, &rcache_hit, &rcache_miss);
+		vmm_cprintf(cdev, "Region Cache Hit : %"PRIu64"\n",
+				  rcache_hit);
+		vmm_cprintf(cdev, "Region Cache Miss: %"PRIu64"\n",
+				  rcache_miss);
+		vmm_cprintf(cdev, "\n");
+	}
+
 	/* Architecture specific dumpstat */
 	arch_vcpu_stat_dump(cdev, vcpu);
 
@@ -647,6 +788,8 @@ static const struct {
 	{"halt", cmd_vcpu_halt, 1},
 	{"set_hcpu", cmd_vcpu_set_hcpu, 2},
 	{"set_affinity", cmd_vcpu_set_affinity, 2},
+	{"set_deadline", cmd_vcpu_set_deadline, 4},
+	{"deadline_misses", cmd_vcpu_deadline_misses, 1},
 	{"dumpreg", cmd_vcpu_dumpreg, 1},
 	{"dumpstat", cmd_vcpu_dumpstat, 1},
 	{NULL, NULL, 0},
@@ -185,6 +185,11 @@ int vmm_blockdev_submit_request(struct vmm_blockdev *bdev,
 		goto failed;
 	}
 
+	if (r->sg && !(bdev->flags & VMM_BLOCKDEV_SG)) {
+		rc = VMM_ENOTSUPP;
+		goto failed;
+	}
+
 	if (bdev->num_blocks < r->bcnt) {
 		rc = VMM_ERANGE;
 		goto failed;
@@ -326,6 +331,8 @@ static int blockdev_rw_blocks(struct vmm_blockdev *bdev,
 	rw.req.lba = bdev->start_lba + lba;
 	rw.req.bcnt = bcnt;
 	rw.req.data = buf;
+	rw.req.sg = NULL;
+	rw.req.sg_count = 0;
 	rw.req.priv = &rw;
 	rw.req.completed = blockdev_rw_completed;
 	rw.req.failed = blockdev_rw_failed;
@@ -41,6 +41,12 @@ enum vmm_request_type {
 	VMM_REQUEST_WRITE=2
 };
 
+/** Representation of a scatter list entry of block IO request */
+struct vmm_request_sg {
+	physical_addr_t addr; /* Host physical address */
+	u32 len;
+};
+
 /** Representation of a block IO request */
 struct vmm_request {
 	struct dlist head;
@@ -54,6 +60,13 @@ struct vmm_request {
 	u32 bcnt;
 	void *data;
 
+	/* If sg is set then data is ignored and IO is done directly
+	 * on host physical memory described by the scatter list.
+	 * Only allowed for block devices with VMM_BLOCKDEV_SG flag.
+	 */
+	struct vmm_request_sg *sg;
+	u32 sg_count;
+
 	void (*completed)(struct vmm_request *);
 	void (*failed)(struct vmm_request *);
 	void *priv;
@@ -132,6 +145,7 @@ struct vmm_request_queue {
 /* Block device flags */
 #define VMM_BLOCKDEV_RDONLY				0x00000001
 #define VMM_BLOCKDEV_RW					0x00000002
+#define VMM_BLOCKDEV_SG					0x00000004
 
 /** Block device */
 struct vmm_blockdev {
@@ -91,6 +91,7 @@
 #include <vmm_macros.h>
 #include <vmm_stdio.h>
 #include <vmm_heap.h>
+#include <vmm_spinlocks.h>
 #include <libs/list.h>
 
 struct vmm_mbuf;
@@ -111,6 +112,24 @@ struct m_hdr {
  */
 struct m_pkthdr {
 	int	len;			/* total packet length */
+	int	csum_flags;		/* checksum offload flags; see below */
+	u16	csum_start;		/* offset to start checksumming from */
+	u16	csum_offset;		/* offset after csum_start to store csum */
+	u16	gso_type;		/* segmentation offload type; see below */
+	u16	gso_size;		/* payload bytes per segment */
+	u16	hdr_len;		/* length of L2 + L3 + L4 headers */
+};
+
+/*
+ * host physical scatter entry describing frame data which is not
+ * copied into mbuf buffer (e.g. data still in sender guest memory)
+ *
+ * Readers hold ext_sg_lock (if set) for read while accessing scatter
+ * data so that its owner can detach it by taking the lock for write.
+ */
+struct vmm_mbuf_sg {
+	physical_addr_t addr;		/* host physical address */
+	u32 len;			/* length of data */
 };
 
 struct m_ext {
@@ -120,6 +139,9 @@ struct m_ext {
 	void (*ext_free)		/* free routine if not the usual */
 		(struct vmm_mbuf *, void *, u32, void *);
 	void *ext_arg;			/* argument for ext_free */
+	struct vmm_mbuf_sg *ext_sg;	/* data following buffer (M_EXT_SG) */
+	u32 ext_sg_count;		/* number of scatter entries */
+	vmm_rwlock_t *ext_sg_lock;	/* protects scatter data (optional) */
 };
 
 struct vmm_mbuf {
@@ -136,11 +158,20 @@ struct vmm_mbuf {
 #define	m_len		m_hdr.mh_len
 #define	m_flags		m_hdr.mh_flags
 #define m_pktlen	m_pkthdr.len
+#define m_csum_flags	m_pkthdr.csum_flags
+#define m_csum_start	m_pkthdr.csum_start
+#define m_csum_offset	m_pkthdr.csum_offset
+#define m_gso_type	m_pkthdr.gso_type
+#define m_gso_size	m_pkthdr.gso_size
+#define m_hdr_len	m_pkthdr.hdr_len
 #define m_extbuf	m_ext.ext_buf
 #define m_extlen	m_ext.ext_size
 #define m_extref	m_ext.ext_refcnt
 #define m_extfree	m_ext.ext_free
 #define m_extarg	m_ext.ext_arg
+#define m_extsg		m_ext.ext_sg
+#define m_extsgcnt	m_ext.ext_sg_count
+#define m_extsglock	m_ext.ext_sg_lock
 #define m_freefn	m_hdr.mh_freefn
 
 #define m_list_entry(l)	list_entry(l, struct vmm_mbuf, m_list)
@@ -161,6 +192,18 @@ struct vmm_mbuf {
 #define	M_EXT_POOL	0x08000000	/* ext storage is pool alloced */
 #define	M_EXT_HEAP	0x10000000	/* ext storage is normal heap alloced */
 #define	M_EXT_DMA	0x20000000	/* ext storage is dma heap alloced */
+#define	M_EXT_SG	0x40000000	/* data continues in ext scatter list */
+
+/* checksum offload flags (m_csum_flags) */
+#define	M_CSUM_PARTIAL	0x0001	/* L4 csum to be completed from csum_start */
+#define	M_CSUM_VALID	0x0002	/* L4 csum already verified by sender */
+
+/* segmentation offload types (m_gso_type) */
+#define	M_GSO_NONE	0x0000	/* not a large segment */
+#define	M_GSO_TCPV4	0x0001	/* IPv4 TCP large segment */
+#define	M_GSO_TCPV6	0x0002	/* IPv6 TCP large segment */
+#define	M_GSO_TYPE_MASK	0x00ff
+#define	M_GSO_ECN	0x0100	/* TCP has ECN (CWR) set */
 
 /* flags copied when copying m_pkthdr */
 #define	M_COPYFLAGS	(M_PKTHDR)
@@ -287,11 +330,32 @@ struct vmm_mbuf *m_free(struct vmm_mbuf *m);
 struct vmm_mbuf *m_get(int nowait, int flags);
 void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how);
 void m_ext_dma_ensure(struct vmm_mbuf *m);
-void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp);
+int m_copydata(struct vmm_mbuf *m, int off, int len, void *vp);
+void m_copy_pkthdr(struct vmm_mbuf *to, struct vmm_mbuf *from);
+struct vmm_mbuf *m_dup(struct vmm_mbuf *m);
+int m_csum_help(struct vmm_mbuf *m);
+int m_gso_segment(struct vmm_mbuf *m, struct dlist *segs);
+u32 m_flow_hash(struct vmm_mbuf *m);
 void m_freem(struct vmm_mbuf *m);
 void m_ext_free(struct vmm_mbuf *m);
 void m_dump(struct vmm_mbuf *m);
 
+/*
+ * mbuf pool statistics.
+ */
+struct vmm_mbufpool_stats {
+	char name[16];
+	u32 buf_size;
+	u32 total;
+	u32 free;
+	u32 cached;
+	u64 hits;
+	u64 misses;
+};
+
+u32 vmm_mbufpool_count(void);
+int vmm_mbufpool_stats(u32 pool, struct vmm_mbufpool_stats *stats);
+
 /*
  * mbuf pool initializaton and exit.
  */
@@ -35,6 +35,13 @@
 /* Port Flags (should be defined as bits) */
 #define VMM_NETPORT_LINK_UP		1	/* If this bit is set link is up */
 
+/* Port offload features (should be defined as bits) */
+#define VMM_NETPORT_F_CSUM		0x1	/* Accepts partial L4 checksum */
+#define VMM_NETPORT_F_TSO4		0x2	/* Accepts IPv4 TCP large segments */
+#define VMM_NETPORT_F_TSO6		0x4	/* Accepts IPv6 TCP large segments */
+#define VMM_NETPORT_F_TSO_ECN		0x8	/* Accepts large segments with ECN */
+#define VMM_NETPORT_F_SG		0x10	/* Accepts host physical scatter data */
+
 /* Default per-port queue size */
 #define VMM_NETPORT_MAX_QUEUE_SIZE	256
 
@@ -64,15 +71,33 @@ do { \
 	(__lazy)->xfer = (__xfer); \
 } while (0)
 
+/* Lock-free single-producer single-consumer ring of mbufs from a port.
+ * Each port has one ring per host CPU; the producer is the port
+ * running on that CPU (with interrupts disabled) and the consumer is
+ * the netswitch bottom-half thread of that CPU.
+ */
+struct vmm_netport_ring {
+	struct dlist head;
+	struct vmm_netport *port;
+	atomic_t sched;
+	u32 mask;
+	volatile u32 prod;
+	volatile u32 cons;
+	struct vmm_mbuf **slots;
+};
+
 struct vmm_netport {
 	struct dlist head;
 	char name[VMM_FIELD_NAME_SIZE];
 	u32 queue_size;
 	int flags;
+	u32 features;
 	int mtu;
 	u8 macaddr[6];
 	struct vmm_netswitch *nsw;
 	struct vmm_device dev;
+	/* Per-CPU port to switch rings */
+	struct vmm_netport_ring *rings;
 
 	/* Link status changed */
 	void (*link_changed) (struct vmm_netport *);
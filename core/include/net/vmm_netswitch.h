@@ -39,6 +39,32 @@ struct vmm_netport;
 struct vmm_netport_lazy;
 struct vmm_mbuf;
 
+struct vmm_netswitch_stats {
+	/* Frames received from ports */
+	atomic64_t rx_frames;
+	/* Frames forwarded to a single port */
+	atomic64_t unicast;
+	/* Frames flooded to all ports */
+	atomic64_t flood;
+	/* Total time (nanoseconds) spent in forwarding decisions */
+	atomic64_t lookup_ns;
+	/* Addresses learned */
+	atomic64_t learned;
+	/* Addresses aged out */
+	atomic64_t aged;
+};
+
+struct vmm_netswitch_bh_stats {
+	/* Bursts processed by bottom-half */
+	u64 bursts;
+	/* Frames processed by bottom-half */
+	u64 frames;
+	/* Largest burst processed */
+	u32 max_burst;
+	/* Frames dropped due to full port ring */
+	u64 drops;
+};
+
 struct vmm_netswitch {
 	/* === Private members === */
 	/* Underly class device */
@@ -54,10 +80,16 @@ struct vmm_netswitch {
 	char name[VMM_FIELD_NAME_SIZE];
 	/* Flags */
 	int flags;
+	/* Forwarding statistics (updated by policy) */
+	struct vmm_netswitch_stats stats;
 	/* Handle RX packets from port to switch */
 	int (*port2switch_xfer) (struct vmm_netswitch *,
 				 struct vmm_netport *,
 				 struct vmm_mbuf *);
+	/* Handle burst of RX packets from port to switch (optional) */
+	int (*port2switch_xfer_burst) (struct vmm_netswitch *,
+				       struct vmm_netport *,
+				       struct vmm_mbuf **, u32);
 	/* Handle enabling of a port */
 	int (*port_add) (struct vmm_netswitch *,
 			 struct vmm_netport *);
@@ -84,6 +116,9 @@ struct vmm_netswitch_policy {
 int vmm_port2switch_xfer_mbuf(struct vmm_netport *src,
 			      struct vmm_mbuf *mbuf);
 
+/** Retrive bottom-half statistics of given host CPU */
+int vmm_netswitch_bh_stats(u32 cpu, struct vmm_netswitch_bh_stats *stats);
+
 /** Lazy transfer from port to switch */
 int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy);
 
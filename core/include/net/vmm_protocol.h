@@ -200,6 +200,13 @@ struct eth_header {
 #define ether_type(ether_frame)		vmm_be16_to_cpu(((struct eth_header *)(ether_frame))->ethertype)
 #define ether_payload(ether_frame)	(((struct eth_header *)(ether_frame))->payload)
 
+#define ETHER_TYPE_IP		0x0800
+#define ETHER_TYPE_ARP		0x0806
+#define ETHER_TYPE_VLAN		0x8100
+#define ETHER_TYPE_IPV6		0x86DD
+
+#define VLAN_HLEN		4
+
 struct ip_header {
 	u8 vhl;
 	u8 tos;
@@ -223,6 +230,27 @@ struct ip_header {
 #define ip_len(ip_frame)	vmm_be16_to_cpu(((struct ip_header *)(ip_frame))->len)
 #define ip_chksum(ip_frame)	vmm_be16_to_cpu(((struct ip_header *)(ip_frame))->ipchksum)
 #define ip_payload(ip_frame)	(((struct ip_header *)(ip_frame))->payload)
+#define ip_hlen(ip_frame)	((((struct ip_header *)(ip_frame))->vhl & 0xf) * 4)
+
+#define IP_PROTOCOL_ICMP	1
+#define IP_PROTOCOL_TCP		6
+#define IP_PROTOCOL_UDP		17
+
+struct ip6_header {
+	u32 vtcfl;
+	u16 len;
+	u8 nexthdr;
+	u8 hoplimit;
+	u8 srcipaddr[16];
+	u8 dstipaddr[16];
+	u8 payload[0];
+} __packed;
+
+#define IP6_HLEN	(sizeof(struct ip6_header))
+
+#define ip6_len(ip6_frame)	vmm_be16_to_cpu(((struct ip6_header *)(ip6_frame))->len)
+#define ip6_nexthdr(ip6_frame)	(((struct ip6_header *)(ip6_frame))->nexthdr)
+#define ip6_payload(ip6_frame)	(((struct ip6_header *)(ip6_frame))->payload)
 
 struct icmp_header {
 	u8 type;
@@ -265,6 +293,16 @@ struct tcp_header {
 #define tcp_checksum(tcp_frame)	vmm_be16_to_cpu(((struct tcp_header *)(tcp_frame))->checksum)
 #define tcp_urgent(tcp_frame)	vmm_be16_to_cpu(((struct tcp_header *)(tcp_frame))->urgent)
 #define tcp_payload(tcp_frame)	(((struct tcp_header *)(tcp_frame))->payload)
+#define tcp_hlen(tcp_frame)	((tcp_flags(tcp_frame) >> 12) * 4)
+
+#define TCP_FLAG_FIN		0x0001
+#define TCP_FLAG_SYN		0x0002
+#define TCP_FLAG_RST		0x0004
+#define TCP_FLAG_PSH		0x0008
+#define TCP_FLAG_ACK		0x0010
+#define TCP_FLAG_URG		0x0020
+#define TCP_FLAG_ECE		0x0040
+#define TCP_FLAG_CWR		0x0080
 
 struct arp_header {
 	u16 htype;
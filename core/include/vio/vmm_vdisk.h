@@ -177,6 +177,21 @@ int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
 			     enum vmm_vdisk_request_type type,
 			     u64 lba, void *data, u32 data_len);
 
+/** Check whether attached block device can do scatter list IO */
+bool vmm_vdisk_can_sg(struct vmm_vdisk *vdisk);
+
+/** Submit scatter list IO request to virtual disk
+ *  Note: The scatter list must remain valid until request completes
+ *  Note: If attached block device cannot do scatter list IO then
+ *  VMM_ENOTSUPP is returned without calling failed() callback so
+ *  that caller can fallback to vmm_vdisk_submit_request()
+ */
+int vmm_vdisk_submit_sg_request(struct vmm_vdisk *vdisk,
+				struct vmm_vdisk_request *vreq,
+				enum vmm_vdisk_request_type type,
+				u64 lba, struct vmm_request_sg *sg,
+				u32 sg_count, u32 data_len);
+
 /* Abort IO request from virtual disk */
 int vmm_vdisk_abort_request(struct vmm_vdisk *vdisk,
 			    struct vmm_vdisk_request *vreq);
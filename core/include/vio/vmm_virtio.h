@@ -76,6 +76,10 @@ struct vmm_virtio_queue {
 	physical_addr_t		host_addr;
 	/*队列所需的总物理空间*/
 	physical_size_t		total_size;
+	/* Scratch table used for reading indirect descriptor table
+	 * in one go (desc_count entries)
+	 */
+	struct vmm_vring_desc	*indirect_desc;
 };
 
 struct vmm_virtio_device_id {
@@ -209,6 +213,13 @@ int vmm_virtio_queue_get_desc(struct vmm_virtio_queue *vq, u16 indx,
 /*弹出下一个可用的描述符索引*/
 u16 vmm_virtio_queue_pop(struct vmm_virtio_queue *vq);
 
+/** Give back last count popped descriptors to available ring
+ *  Note: works only after queue setup is done and only for
+ *  descriptors which are not yet added to used ring
+ */
+/*将最近弹出但尚未使用的描述符退回可用环*/
+void vmm_virtio_queue_unpop(struct vmm_virtio_queue *vq, u16 count);
+
 /** Check whether any descriptor is available or not
  *  Note: works only after queue setup is done
  */
@@ -256,6 +267,8 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 
 /** Get guest IO vectors based on given head
  *  Note: works only after queue setup is done
+ *  Note: indirect descriptors are followed transparently
+ *  Note: iov must have space for vmm_virtio_queue_max_desc() entries
  */
 // 获取给定头部的guest IO向量
 int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
@@ -153,6 +153,13 @@ struct vmm_devemu_irqchip {
 	void (*notify_disabled) (u32 irq, int cpu, void *opaque);
 };
 
+/** Initialize region lookup cache of given VCPU */
+void vmm_devemu_vcpu_rcache_init(struct vmm_vcpu *vcpu);
+
+/** Retrive region lookup cache hit and miss counts of given VCPU */
+void vmm_devemu_vcpu_rcache_stats(struct vmm_vcpu *vcpu,
+				  u64 *hit_count, u64 *miss_count);
+
 /** Emulate memory read to virtual device for given VCPU */
 int vmm_devemu_emulate_read(struct vmm_vcpu *vcpu,
 			    physical_addr_t gphys_addr,
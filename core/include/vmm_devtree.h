@@ -103,6 +103,10 @@
 #define VMM_DEVTREE_TIME_SLICE_ATTR_NAME	"time_slice"
 #define VMM_DEVTREE_DEADLINE_ATTR_NAME		"deadline"
 #define VMM_DEVTREE_PERIODICITY_ATTR_NAME	"periodicity"
+#define VMM_DEVTREE_SCHED_WEIGHT_ATTR_NAME	"sched_weight"
+#define VMM_DEVTREE_DL_RUNTIME_ATTR_NAME	"dl_runtime"
+#define VMM_DEVTREE_DL_DEADLINE_ATTR_NAME	"dl_deadline"
+#define VMM_DEVTREE_DL_PERIOD_ATTR_NAME		"dl_period"
 #define VMM_DEVTREE_ADDRSPACE_NODE_NAME		"aspace"
 #define VMM_DEVTREE_GUESTIRQCNT_ATTR_NAME	"guest_irq_count"
 #define VMM_DEVTREE_MANIFEST_TYPE_ATTR_NAME	"manifest_type"
@@ -121,6 +125,7 @@
 #define VMM_DEVTREE_NUM_COLORS_ATTR_NAME	"num_colors"
 #define VMM_DEVTREE_SHARED_MEM_ATTR_NAME	"shared_mem"
 #define VMM_DEVTREE_MAP_ORDER_ATTR_NAME		"map_order"
+#define VMM_DEVTREE_PREPOPULATE_ATTR_NAME	"prepopulate"
 #define VMM_DEVTREE_SWITCH_ATTR_NAME		"switch"
 #define VMM_DEVTREE_DOMAIN_ATTR_NAME		"domain"
 #define VMM_DEVTREE_NODE_ADDR_ATTR_NAME		"node_addr"
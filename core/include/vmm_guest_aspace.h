@@ -32,6 +32,10 @@
 #define VMM_GUEST_ASPACE_EVENT_DEINIT		0x02
 /* Notifier event when guest aspace is reset */
 #define VMM_GUEST_ASPACE_EVENT_RESET		0x03
+/* Notifier event when a region is added to guest aspace */
+#define VMM_GUEST_ASPACE_EVENT_ADD_REGION	0x04
+/* Notifier event when a region is about to be deleted from guest aspace */
+#define VMM_GUEST_ASPACE_EVENT_DEL_REGION	0x05
 
 /** Representation of block device notifier event */
 struct vmm_guest_aspace_event {
@@ -93,6 +97,12 @@ u32 vmm_guest_memory_write(struct vmm_guest *guest,
 			   physical_addr_t gphys_addr, 
 			   void *src, u32 len, bool cacheable);
 
+/** Retrive number of guest memory copies done using persistent
+ *  host mapping of guest regions and using legacy per-page mapping
+ */
+void vmm_guest_memory_copy_stats(struct vmm_guest *guest,
+				 u64 *hmap_count, u64 *legacy_count);
+
 /** Map guest physical address to some host physical address */
 int vmm_guest_physical_map(struct vmm_guest *guest,
 			   physical_addr_t gphys_addr,
@@ -180,6 +180,14 @@ u32 vmm_host_memory_read(physical_addr_t hpa,
 u32 vmm_host_memory_write(physical_addr_t hpa,
 			  void *src, u32 len, bool cacheable);
 
+/** Copy from one host memory location to another without
+ *  intermediate buffer
+ *  Note: We assume non-IO (or non-device) physical addresses
+ */
+u32 vmm_host_memory_copy(physical_addr_t dst_hpa,
+			 physical_addr_t src_hpa,
+			 u32 len, bool cacheable);
+
 /** Write a byte pattern to host memory
  *  Note: We assume non-IO (or non-device) physical address
  */
@@ -32,6 +32,7 @@
 #include <vmm_devtree.h>
 #include <vmm_cpumask.h>
 #include <vmm_shmem.h>
+#include <vmm_timer.h>
 #include <libs/list.h>
 #include <libs/rbtree.h>
 
@@ -52,6 +53,7 @@ enum vmm_region_flags {
 	VMM_REGION_ISCOLORED=0x00002000,
 	VMM_REGION_ISSHARED=0x00004000,
 	VMM_REGION_ISDYNAMIC=0x00008000,
+	VMM_REGION_PREPOPULATE=0x00010000,
 };
 
 #define VMM_REGION_MANIFEST_MASK	(VMM_REGION_REAL | \
@@ -90,6 +92,7 @@ struct vmm_region {
 	u32 map_order;
 	u32 maps_count;
 	struct vmm_region_mapping *maps;
+	virtual_addr_t hmap_va;
 	void *devemu_priv;
 	void *priv;
 };
@@ -104,6 +107,7 @@ struct vmm_region {
 #define VMM_REGION_ALIGN_ORDER(reg)	((reg)->align_order)
 #define VMM_REGION_MAP_ORDER(reg)	((reg)->map_order)
 #define VMM_REGION_MAPS_COUNT(reg)	((reg)->maps_count)
+#define VMM_REGION_HMAP_VA(reg)		((reg)->hmap_va)
 
 struct vmm_guest_aspace {
 	struct vmm_devtree_node *node;
@@ -115,6 +119,8 @@ struct vmm_guest_aspace {
 	vmm_rwlock_t reg_memtree_lock;
 	struct rb_root reg_memtree;
 	struct dlist reg_memprobe_list;
+	atomic64_t hmap_copy_count;
+	atomic64_t legacy_copy_count;
 	void *devemu_priv;
 };
 
@@ -127,11 +133,15 @@ struct vmm_guest_request {
 struct vmm_vcpu_irq {
 	atomic_t assert;
 	u64 reason;
+	u32 rank;
 };
 
 struct vmm_vcpu_irqs {
 	u32 irq_count;
 	struct vmm_vcpu_irq *irq;
+	u32 rank_count;
+	u32 *rank_irq;
+	atomic_t *pending;
 	atomic_t execute_pending;
 	atomic64_t assert_count;
 	atomic64_t execute_count;
@@ -145,6 +155,42 @@ struct vmm_vcpu_irqs {
 	} wfi;
 };
 
+struct vmm_vcpu_rcache_entry {
+	physical_addr_t start;
+	physical_addr_t end;
+	u32 reg_flags;
+	struct vmm_region *reg;
+};
+
+struct vmm_vcpu_rcache {
+	u32 gen;
+	u32 victim;
+	struct vmm_vcpu_rcache_entry ent[CONFIG_VGPA2REG_CACHE_SIZE];
+	u64 hit_count;
+	u64 miss_count;
+};
+
+struct vmm_vcpu_dl {
+	/* Reservation (zero runtime means VCPU is in normal class) */
+	u64 runtime;
+	u64 deadline;
+	u64 period;
+	u64 bw;
+	/* Current period */
+	struct rb_node rb;
+	bool queued;
+	bool throttled;
+	bool missed;
+	u64 period_tstamp;
+	u64 abs_deadline;
+	u64 remaining;
+	u64 accounted_nsecs;
+	struct vmm_timer_event replenish_ev;
+	/* Statistics */
+	u32 throttle_count;
+	u32 miss_count;
+};
+
 struct vmm_guest {
 	struct dlist head;
 
@@ -228,6 +274,7 @@ struct vmm_vcpu {
 	atomic_t state;
 	u64 state_tstamp;
 	u64 state_ready_nsecs;
+	u64 state_ready_max_nsecs;
 	u64 state_running_nsecs;
 	u64 state_paused_nsecs;
 	u64 state_halted_nsecs;
@@ -236,6 +283,9 @@ struct vmm_vcpu {
 	u64 reset_tstamp;
 	u32 preempt_count;
 	bool resumed;
+	bool preempted;
+	u64 migrate_tstamp;
+	struct dlist ready_head;
 	void *sched_priv;
 
 	/* Scheduler static context */
@@ -244,6 +294,9 @@ struct vmm_vcpu {
 	u64 deadline;
 	u64 periodicity;
 
+	/* Deadline class context */
+	struct vmm_vcpu_dl dl;
+
 	/* Architecture specific context */
 	arch_regs_t regs;
 	void *arch_priv;
@@ -251,6 +304,9 @@ struct vmm_vcpu {
 	/* Virtual IRQ context */
 	struct vmm_vcpu_irqs irqs;
 
+	/* Guest region lookup cache for device emulation */
+	struct vmm_vcpu_rcache rcache;
+
 	/* Resources acquired */
 	vmm_spinlock_t res_lock;
 	struct dlist res_head;
@@ -71,4 +71,53 @@ struct vmm_profiler_stat *vmm_profiler_get_stat_array(void);
  */
 int vmm_profiler_init(void);
 
+#define VMM_PROFILE_SAMPLE_DEPTH	8
+#define VMM_PROFILE_SAMPLE_NO_ID	0xffffffff
+
+struct vmm_profiler_sample {
+	u64 tstamp;
+	u32 vcpu_id;
+	u32 guest_id;
+	u32 depth;
+	unsigned long pc[VMM_PROFILE_SAMPLE_DEPTH];
+};
+
+/**
+ * Check status of sampling profiler.
+ */
+bool vmm_profiler_sample_isactive(void);
+
+/**
+ * Start sampling profiler on all online host CPUs with given
+ * sampling period (zero period means default period).
+ * Called from some where (usually cmd_profile).
+ */
+int vmm_profiler_sample_start(u64 period_nsecs);
+
+/**
+ * Stop sampling profiler on all online host CPUs.
+ * Called from some where (usually cmd_profile).
+ */
+int vmm_profiler_sample_stop(void);
+
+/**
+ * Current (or last) sampling period in nanoseconds.
+ */
+u64 vmm_profiler_sample_period(void);
+
+/**
+ * Number of samples taken by given host CPU since last start
+ * (Samples older than buffer size are overwritten)
+ */
+u64 vmm_profiler_sample_count(u32 cpu);
+
+/**
+ * Iterate over buffered samples of given host CPU (oldest first)
+ * (Iteration stops when iter returns non-zero value)
+ * (Samples can be iterated only while sampling profiler is stopped)
+ */
+int vmm_profiler_sample_iterate(u32 cpu,
+			int (*iter)(struct vmm_profiler_sample *, void *),
+			void *priv);
+
 #endif
@@ -32,6 +32,9 @@ int vmm_schedalgo_vcpu_setup(struct vmm_vcpu *vcpu);
 /** Cleanup existing VCPU for scheduling algorithm */
 int vmm_schedalgo_vcpu_cleanup(struct vmm_vcpu *vcpu);
 
+/** Retrieve virtual runtime of VCPU (zero if not supported) */
+u64 vmm_schedalgo_vcpu_vruntime(struct vmm_vcpu *vcpu);
+
 /** Enqueue VCPU to a ready queue */
 int vmm_schedalgo_rq_enqueue(void *rq, struct vmm_vcpu *vcpu);
 
@@ -44,7 +44,41 @@ int vmm_scheduler_stats(struct vmm_vcpu *vcpu,
 			u32 *reset_count, u64 *last_reset_nsecs,
 			u64 *ready_nsecs, u64 *running_nsecs,
 			u64 *paused_nsecs, u64 *halted_nsecs,
-			u64 *system_nsecs);
+			u64 *system_nsecs, u64 *ready_max_nsecs,
+			u64 *vruntime_nsecs);
+
+/** Deadline miss record of deadline class */
+struct vmm_scheduler_dl_miss {
+	u64 tstamp;
+	u32 vcpu_id;
+	u64 deadline;
+	u64 lateness;
+};
+
+/** Update deadline class reservation of given VCPU
+ *  (runtime, deadline and period are in nanoseconds)
+ *  (zero runtime moves VCPU back to normal class)
+ *  (zero deadline means deadline same as period)
+ */
+int vmm_scheduler_dl_set(struct vmm_vcpu *vcpu,
+			 u64 runtime, u64 deadline, u64 period);
+
+/** Retrive deadline class reservation and statistics of given VCPU */
+int vmm_scheduler_dl_stats(struct vmm_vcpu *vcpu,
+			   u64 *runtime, u64 *deadline, u64 *period,
+			   u64 *remaining, bool *throttled,
+			   u32 *throttle_count, u32 *miss_count);
+
+/** Bandwidth reserved by deadline class on a host CPU
+ *  (in parts per thousand)
+ */
+u32 vmm_scheduler_dl_bandwidth(u32 hcpu);
+
+/** Retrive recent deadline misses on a host CPU (newest first)
+ *  and return number of records copied
+ */
+u32 vmm_scheduler_dl_misses(u32 hcpu,
+			    struct vmm_scheduler_dl_miss *misses, u32 count);
 
 /** Change the vcpu state
  *  (Do not call this function directly.)
@@ -82,6 +116,23 @@ bool vmm_scheduler_normal_context(void);
 /** Count number ready VCPUs with given priority on a host CPU */
 u32 vmm_scheduler_ready_count(u32 hcpu, u8 priority);
 
+/** Iterate over READY VCPUs in ready queue of a host CPU
+ *  (Iteration stops when iter returns non-zero value)
+ *  (Iter is called with ready queue lock held so it must not
+ *   block or change scheduling state of any VCPU)
+ */
+int vmm_scheduler_ready_iterate(u32 hcpu,
+				int (*iter)(struct vmm_vcpu *, void *),
+				void *priv);
+
+/** Update order of peer host CPUs checked by given host CPU when it
+ *  steals READY VCPUs before going idle (e.g. nearest first)
+ */
+int vmm_scheduler_set_steal_order(u32 hcpu, const u32 *order, u32 count);
+
+/** Number of READY VCPUs stolen by given host CPU before going idle */
+u64 vmm_scheduler_steal_count(u32 hcpu);
+
 /** Get scheduler sampling period in nanosecs */
 u64 vmm_scheduler_get_sample_period(u32 hcpu);
 
@@ -109,6 +160,17 @@ struct vmm_guest *vmm_scheduler_current_guest(void);
 /** Yield current vcpu (Should not be called in IRQ context) */
 void vmm_scheduler_yield(void);
 
+/** Yield current vcpu in favour of given vcpu which is boosted
+ *  to run next on its host CPU (Should not be called in IRQ context)
+ */
+int vmm_scheduler_yield_to(struct vmm_vcpu *vcpu);
+
+/** Yield current vcpu in favour of a sibling vcpu which was preempted
+ *  while running (e.g. lock holder) otherwise do normal yield
+ *  (Should not be called in IRQ context)
+ */
+void vmm_scheduler_yield_directed(void);
+
 /** Initialize scheduler */
 int vmm_scheduler_init(void);
 
@@ -217,6 +217,23 @@ extern void vmm_scheduler_preempt_enable(void);
 #define vmm_read_lock_lite(lock)	vmm_spin_lock_lite(lock)
 #endif
 
+/** Try to Lock the spinlock without preempt disable
+ *  PROTOTYPE: int vmm_spin_trylock_lite(vmm_spinlock_t *lock)
+ */
+#if defined(CONFIG_SMP)
+#define vmm_spin_trylock_lite(lock)	arch_spin_trylock(&(lock)->__tlock)
+#define vmm_write_trylock_lite(lock)	arch_write_trylock(&(lock)->__tlock)
+#define vmm_read_trylock_lite(lock)	arch_read_trylock(&(lock)->__tlock)
+#else
+#define vmm_spin_trylock_lite(lock)	({ \
+					int ret = ((lock)->__tlock) ? 0 : 1; \
+					(lock)->__tlock = 1; \
+					ret; \
+					})
+#define vmm_write_trylock_lite(lock)	vmm_spin_trylock_lite(lock)
+#define vmm_read_trylock_lite(lock)	vmm_spin_trylock_lite(lock)
+#endif
+
 /** Unlock the spinlock without preempt enable
  *  PROTOTYPE: void vmm_spin_unlock_lite(vmm_spinlock_t *lock)
  */
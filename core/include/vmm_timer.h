@@ -26,6 +26,7 @@
 #include <vmm_types.h>
 #include <vmm_spinlocks.h>
 #include <libs/list.h>
+#include <libs/rbtree.h>
 
 struct vmm_timer_event;
 
@@ -35,10 +36,11 @@ struct vmm_timer_event {
 	u64 duration_nsecs;
 	void (*handler) (struct vmm_timer_event *);
 	void *priv;
+	u64 slack_nsecs;
 	/* Internal house-keeping info */
 	vmm_spinlock_t active_lock;
 	bool active_state;
-	struct dlist active_head;
+	struct rb_node active_rb;
 	u32 active_hcpu;
 };
 
@@ -48,8 +50,9 @@ struct vmm_timer_event {
 					(ev)->duration_nsecs = 0; \
 					(ev)->handler = _hndl; \
 					(ev)->priv = _priv; \
+					(ev)->slack_nsecs = 0; \
 					INIT_SPIN_LOCK(&(ev)->active_lock); \
-					INIT_LIST_HEAD(&(ev)->active_head); \
+					RB_CLEAR_NODE(&(ev)->active_rb); \
 					(ev)->active_state = FALSE; \
 					(ev)->active_hcpu = 0; \
 				} while (0)
@@ -60,8 +63,9 @@ struct vmm_timer_event {
 		.duration_nsecs = 0,					\
 		.handler = _hndl,					\
 		.priv = _priv,						\
+		.slack_nsecs = 0,					\
 		.active_lock = __SPINLOCK_INITIALIZER((ev).active_lock),\
-		.active_head = { &(ev).head, &(ev).head },		\
+		.active_rb = { (unsigned long)&(ev).active_rb, NULL, NULL },\
 		.active_state = FALSE,					\
 		.active_hcpu = 0,					\
 	}
@@ -92,12 +96,23 @@ static inline int vmm_timer_event_start(struct vmm_timer_event *ev,
 	return vmm_timer_event_start2(ev, duration_nsecs, NULL);
 }
 
+/** Update slack of a timer event which is the amount of nanoseconds
+ *  by which its expiry can be delayed so that it is processed together
+ *  with other nearby events using single clockchip programming
+ *  (Updated slack is used when clockchip is programmed next time)
+ */
+void vmm_timer_event_set_slack(struct vmm_timer_event *ev, u64 slack_nsecs);
+
 /** Restart a timer event */
 int vmm_timer_event_restart(struct vmm_timer_event *ev);
 
 /** Stop a timer event */
 int vmm_timer_event_stop(struct vmm_timer_event *ev);
 
+/** Retrive timer event statistics of given host CPU */
+int vmm_timer_stats(u32 hcpu, u64 *start_count, u64 *program_count,
+		    u64 *program_skip_count, u64 *coalesced_count);
+
 /** Convert given cycles to nanoseconds */
 u64 vmm_timer_cycles_to_ns(u64 cycles);
 
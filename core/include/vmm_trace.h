@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_trace.h
+ * @author agent (agent@local)
+ * @brief header file of hypervisor event tracing.
+ */
+
+#ifndef _VMM_TRACE_H__
+#define _VMM_TRACE_H__
+
+#include <vmm_types.h>
+#include <vmm_compiler.h>
+
+struct vmm_vcpu;
+
+/** Static tracepoints */
+enum vmm_trace_event {
+	VMM_TRACE_GUEST_EXIT=0,		/* arg0: 1 = exception, 0 = irq */
+	VMM_TRACE_GUEST_ENTRY=1,	/* no args */
+	VMM_TRACE_MMIO_READ=2,		/* arg0: gphys, arg1: len, arg2: rc */
+	VMM_TRACE_MMIO_WRITE=3,		/* arg0: gphys, arg1: len, arg2: rc */
+	VMM_TRACE_STAGE2_FAULT=4,	/* arg0: fault gphys */
+	VMM_TRACE_VCPU_STATE=5,		/* arg0: old state, arg1: new state */
+	VMM_TRACE_IRQ_ASSERT=6,		/* arg0: irq_no, arg1: reason */
+	VMM_TRACE_VIRTQ_NOTIFY=7,	/* arg0: queue, arg1: device type */
+	VMM_TRACE_MAX_EVENT=8,
+};
+
+#define VMM_TRACE_ALL_EVENTS		((1U << VMM_TRACE_MAX_EVENT) - 1)
+#define VMM_TRACE_NO_ID			0xffffffff
+
+/** Fixed size binary trace record
+ *  Note: Records are saved to file as-is (native endianness) so
+ *  layout of this structure is also the trace file format.
+ */
+struct vmm_trace_record {
+	u64 tstamp;
+	u16 event;
+	u16 cpu;
+	u32 guest_id;
+	u32 vcpu_id;
+	u32 arg2;
+	u64 arg0;
+	u64 arg1;
+};
+
+#ifdef CONFIG_TRACE
+
+extern u32 vmm_trace_event_mask;
+
+void __vmm_trace(u32 event, struct vmm_vcpu *vcpu,
+		 u64 arg0, u64 arg1, u32 arg2);
+
+/** Emit a trace record if given event is enabled
+ *  Note: Can be called from any context.
+ */
+#define vmm_trace(event, vcpu, arg0, arg1, arg2)			\
+do {									\
+	if (unlikely(vmm_trace_event_mask & (1U << (event)))) {		\
+		__vmm_trace((event), (vcpu), (u64)(arg0),		\
+			    (u64)(arg1), (u32)(arg2));			\
+	}								\
+} while (0)
+
+#else
+
+#define vmm_trace(event, vcpu, arg0, arg1, arg2)	do { } while (0)
+
+#endif
+
+/** Check whether tracing is active */
+bool vmm_trace_isactive(void);
+
+/** Retrive mask of enabled events */
+u32 vmm_trace_get_event_mask(void);
+
+/** Retrive name of given event */
+const char *vmm_trace_event_name(u32 event);
+
+/** Start tracing for given event mask (zero mask means all events)
+ *  Note: Buffered records of all host CPUs are discarded.
+ *  Note: Must be called from Orphan (or Thread) context.
+ */
+int vmm_trace_start(u32 event_mask);
+
+/** Stop tracing (buffered records are retained) */
+int vmm_trace_stop(void);
+
+/** Number of records per host CPU buffer */
+u32 vmm_trace_buffer_size(void);
+
+/** Number of unread records in buffer of given host CPU */
+u32 vmm_trace_pending(u32 cpu);
+
+/** Number of records overwritten before being read on given host CPU */
+u64 vmm_trace_lost(u32 cpu);
+
+/** Read (and consume) oldest unread records of given host CPU
+ *  Note: Reading is allowed while tracing is active.
+ *  Note: Must be called from Orphan (or Thread) context.
+ *  Returns number of records copied to recs.
+ */
+u32 vmm_trace_read(u32 cpu, struct vmm_trace_record *recs, u32 count);
+
+#endif
@@ -0,0 +1,617 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_loadbal_topo.c
+ * @author agent (agent@local)
+ * @brief source file for topology-aware load balancing algo
+ *
+ * This load balancer models host CPU topology using "cpu-map" and
+ * "next-level-cache" attributes of host CPU device tree nodes. Every
+ * balancing run moves upto CONFIG_LOADBAL_TOPO_MAX_MOVES READY VCPUs
+ * from the busiest host CPU to a less busy host CPU where:
+ * 1. Host CPUs sharing last-level cache are preferred over host CPUs
+ *    of same cluster which in-turn are preferred over other host CPUs.
+ *    Moves across farther host CPUs require larger imbalance.
+ * 2. VCPUs of a Guest are spread across host CPUs so that sibling
+ *    VCPUs are not co-located on same host CPU.
+ * 3. A VCPU is moved again only after it has run for at least
+ *    CONFIG_LOADBAL_TOPO_MIN_RUNTIME_MSECS on its current host CPU.
+ *
+ * The candidate VCPUs are found using per-host CPU ready lists of
+ * scheduler instead of iterating over all VCPUs in the system. The
+ * host CPU topology is also used as order in which idle host CPUs
+ * steal READY VCPUs from their peers.
+ */
+
+#include <vmm_error.h>
+#include <vmm_limits.h>
+#include <vmm_heap.h>
+#include <vmm_timer.h>
+#include <vmm_stdio.h>
+#include <vmm_devtree.h>
+#include <vmm_manager.h>
+#include <vmm_scheduler.h>
+#include <vmm_modules.h>
+#include <vmm_loadbal.h>
+#include <libs/stringlib.h>
+#include <libs/mathlib.h>
+
+#undef DEBUG
+
+#ifdef DEBUG
+#define DPRINTF(msg...)			vmm_printf(msg)
+#else
+#define DPRINTF(msg...)
+#endif
+
+#define MODULE_DESC			"Topology-aware Load Balancer"
+#define MODULE_AUTHOR			"agent"
+#define MODULE_LICENSE			"GPL"
+#define MODULE_IPRIORITY		0
+#define	MODULE_INIT			topo_init
+#define	MODULE_EXIT			topo_exit
+
+/* Distance levels between two host CPUs */
+#define TOPO_LEVEL_LLC			0
+#define TOPO_LEVEL_CLUSTER		1
+#define TOPO_LEVEL_SYSTEM		2
+#define TOPO_LEVEL_MAX			3
+
+/* Max candidate VCPUs picked from ready list of busiest host CPU */
+#define TOPO_MAX_CANDIDATES		8
+
+/* Source host CPU must be at least this busy (in percent) */
+#define TOPO_MIN_BUSY_PERCENT		50
+
+/* Score bonus for each sibling VCPU co-location removed */
+#define TOPO_SIBLING_BONUS		10
+
+#define TOPO_MIN_RUNTIME_NSECS		\
+	((u64)CONFIG_LOADBAL_TOPO_MIN_RUNTIME_MSECS * 1000000ULL)
+
+/* Minimum idle difference (in percent) required at each level */
+static const u32 topo_level_imbalance[TOPO_LEVEL_MAX] = {
+	10, 15, 25,
+};
+
+struct topo_vcpu {
+	u32 reset_count;
+	u64 migrate_running_ns;
+};
+
+struct topo_control {
+	/* Host CPU topology */
+	u32 cluster_id[CONFIG_CPU_COUNT];
+	u32 llc_id[CONFIG_CPU_COUNT];
+	/* Host CPU load (updated every balancing run) */
+	u32 idle_percent[CONFIG_CPU_COUNT];
+	u32 ready_count[CONFIG_CPU_COUNT];
+	bool exhausted[CONFIG_CPU_COUNT];
+	/* Migration hysteresis of each VCPU */
+	struct topo_vcpu vcpu[CONFIG_MAX_VCPU_COUNT];
+};
+
+static u32 topo_level(struct topo_control *topo, u32 cpu0, u32 cpu1)
+{
+	if (topo->llc_id[cpu0] == topo->llc_id[cpu1]) {
+		return TOPO_LEVEL_LLC;
+	}
+	if (topo->cluster_id[cpu0] == topo->cluster_id[cpu1]) {
+		return TOPO_LEVEL_CLUSTER;
+	}
+	return TOPO_LEVEL_SYSTEM;
+}
+
+static int topo_node_cpu(struct vmm_devtree_node *node, u32 *cpu)
+{
+	int rc;
+	physical_addr_t hwid;
+
+	rc = vmm_devtree_read_physaddr(node, VMM_DEVTREE_REG_ATTR_NAME, &hwid);
+	if (rc) {
+		return rc;
+	}
+
+	rc = vmm_smp_map_cpuid((unsigned long)hwid, cpu);
+	if (rc) {
+		return rc;
+	}
+
+	return (*cpu < CONFIG_CPU_COUNT) ? VMM_OK : VMM_ENOENT;
+}
+
+static void topo_parse_core(struct topo_control *topo,
+			    struct vmm_devtree_node *core, u32 cluster_id)
+{
+	u32 cpu;
+	struct vmm_devtree_node *cpun;
+
+	cpun = vmm_devtree_parse_phandle(core, "cpu", 0);
+	if (!cpun) {
+		return;
+	}
+
+	if (!topo_node_cpu(cpun, &cpu)) {
+		topo->cluster_id[cpu] = cluster_id;
+	}
+
+	vmm_devtree_dref_node(cpun);
+}
+
+static void topo_parse_cluster(struct topo_control *topo,
+			       struct vmm_devtree_node *cluster,
+			       u32 *cluster_id)
+{
+	bool have_core = FALSE;
+	struct vmm_devtree_node *child, *thread;
+
+	child = NULL;
+	vmm_devtree_for_each_child(child, cluster) {
+		if (!strncmp(child->name, "cluster", 7)) {
+			topo_parse_cluster(topo, child, cluster_id);
+		} else if (!strncmp(child->name, "core", 4)) {
+			have_core = TRUE;
+			if (vmm_devtree_have_child(child)) {
+				thread = NULL;
+				vmm_devtree_for_each_child(thread, child) {
+					topo_parse_core(topo, thread,
+							*cluster_id);
+				}
+			} else {
+				topo_parse_core(topo, child, *cluster_id);
+			}
+		}
+	}
+
+	/* Only leaf clusters (i.e. having cores) get cluster ID */
+	if (have_core) {
+		(*cluster_id)++;
+	}
+}
+
+static void topo_parse_llc(struct topo_control *topo,
+			   struct vmm_devtree_node *cpus)
+{
+	u32 c, cpu, count = 0;
+	const char *str;
+	struct vmm_devtree_node *cpun, *cache, *next;
+	struct vmm_devtree_node *llc[CONFIG_CPU_COUNT];
+
+	memset(llc, 0, sizeof(llc));
+
+	cpun = NULL;
+	vmm_devtree_for_each_child(cpun, cpus) {
+		str = NULL;
+		if (vmm_devtree_read_string(cpun,
+				VMM_DEVTREE_DEVICE_TYPE_ATTR_NAME, &str) ||
+		    !str || strcmp(str, VMM_DEVTREE_DEVICE_TYPE_VAL_CPU)) {
+			continue;
+		}
+		if (topo_node_cpu(cpun, &cpu)) {
+			continue;
+		}
+
+		/* Last cache in "next-level-cache" chain is LLC */
+		cache = vmm_devtree_parse_phandle(cpun,
+						  "next-level-cache", 0);
+		while (cache) {
+			next = vmm_devtree_parse_phandle(cache,
+						"next-level-cache", 0);
+			if (!next) {
+				break;
+			}
+			vmm_devtree_dref_node(cache);
+			cache = next;
+		}
+		if (!cache) {
+			continue;
+		}
+
+		/* Node pointer is only used as identity of LLC */
+		llc[cpu] = cache;
+		vmm_devtree_dref_node(cache);
+		count++;
+	}
+
+	/* Without cache description assume LLC is shared per-cluster */
+	if (!count) {
+		for (cpu = 0; cpu < CONFIG_CPU_COUNT; cpu++) {
+			topo->llc_id[cpu] = topo->cluster_id[cpu];
+		}
+		return;
+	}
+
+	for (cpu = 0; cpu < CONFIG_CPU_COUNT; cpu++) {
+		topo->llc_id[cpu] = cpu;
+		if (!llc[cpu]) {
+			continue;
+		}
+		for (c = 0; c < cpu; c++) {
+			if (llc[c] == llc[cpu]) {
+				topo->llc_id[cpu] = topo->llc_id[c];
+				break;
+			}
+		}
+	}
+}
+
+static void topo_parse(struct topo_control *topo)
+{
+	u32 cpu, cluster_id = 0;
+	struct vmm_devtree_node *cpus, *cpu_map;
+
+	/* By default, all host CPUs belong to one cluster */
+	for (cpu = 0; cpu < CONFIG_CPU_COUNT; cpu++) {
+		topo->cluster_id[cpu] = 0;
+		topo->llc_id[cpu] = 0;
+	}
+
+	cpus = vmm_devtree_getnode(VMM_DEVTREE_PATH_SEPARATOR_STRING "cpus");
+	if (!cpus) {
+		return;
+	}
+
+	cpu_map = vmm_devtree_getchild(cpus, "cpu-map");
+	if (cpu_map) {
+		topo_parse_cluster(topo, cpu_map, &cluster_id);
+		vmm_devtree_dref_node(cpu_map);
+	}
+
+	topo_parse_llc(topo, cpus);
+
+	vmm_devtree_dref_node(cpus);
+
+	for_each_online_cpu(cpu) {
+		DPRINTF("%s: cpu=%d cluster=%d llc=%d\n", __func__,
+			cpu, topo->cluster_id[cpu], topo->llc_id[cpu]);
+	}
+}
+
+/* Idle host CPUs steal READY VCPUs from nearest host CPUs first */
+static void topo_steal_order(struct topo_control *topo)
+{
+	u32 hcpu, peer, level, count;
+	u32 order[CONFIG_CPU_COUNT];
+
+	for_each_online_cpu(hcpu) {
+		count = 0;
+		for (level = 0; level < TOPO_LEVEL_MAX; level++) {
+			for_each_online_cpu(peer) {
+				if ((peer != hcpu) &&
+				    (topo_level(topo, hcpu, peer) == level)) {
+					order[count++] = peer;
+				}
+			}
+		}
+		vmm_scheduler_set_steal_order(hcpu, order, count);
+	}
+}
+
+static void topo_analyze(struct topo_control *topo)
+{
+	u8 p;
+	u32 hcpu;
+	u64 idle_ns, period_ns;
+
+	for_each_online_cpu(hcpu) {
+		idle_ns = vmm_scheduler_idle_time(hcpu);
+		period_ns = vmm_scheduler_get_sample_period(hcpu);
+		topo->idle_percent[hcpu] = (period_ns) ?
+				udiv64(idle_ns * 100, period_ns) : 100;
+		if (topo->idle_percent[hcpu] > 100) {
+			topo->idle_percent[hcpu] = 100;
+		}
+
+		/* Ready count excludes idle VCPU (i.e. min priority) */
+		topo->ready_count[hcpu] = 0;
+		for (p = VMM_VCPU_MIN_PRIORITY + 1;
+		     p <= VMM_VCPU_MAX_PRIORITY; p++) {
+			topo->ready_count[hcpu] +=
+					vmm_scheduler_ready_count(hcpu, p);
+		}
+
+		topo->exhausted[hcpu] = FALSE;
+	}
+}
+
+/**
+ * Find out busiest hcpu.
+ *
+ * A busiest hcpu is a hcpu who spends least time in idle and has
+ * READY VCPUs. If two hcpus have same idle time then hcpu with more
+ * number of READY VCPUs is considered busier among the two hcpus.
+ */
+static bool topo_busiest_hcpu(struct topo_control *topo, u32 *out)
+{
+	u32 hcpu;
+	bool found = FALSE;
+
+	for_each_online_cpu(hcpu) {
+		if (topo->exhausted[hcpu] || !topo->ready_count[hcpu]) {
+			continue;
+		}
+		if (!found ||
+		    (topo->idle_percent[hcpu] < topo->idle_percent[*out]) ||
+		    ((topo->idle_percent[hcpu] == topo->idle_percent[*out]) &&
+		     (topo->ready_count[hcpu] > topo->ready_count[*out]))) {
+			*out = hcpu;
+			found = TRUE;
+		}
+	}
+
+	return found;
+}
+
+struct topo_candidates {
+	struct topo_control *topo;
+	u32 count;
+	struct vmm_vcpu *vcpu[TOPO_MAX_CANDIDATES];
+};
+
+/* NOTE: Called with ready queue lock of host CPU held */
+static int topo_candidates_iter(struct vmm_vcpu *vcpu, void *priv)
+{
+	struct topo_vcpu *tv;
+	struct topo_candidates *tc = priv;
+
+	if ((vcpu->priority == VMM_VCPU_MIN_PRIORITY) ||
+	    vcpu->dl.runtime ||
+	    (vmm_cpumask_weight(vcpu->cpu_affinity) < 2)) {
+		return VMM_OK;
+	}
+
+	/* Migration hysteresis based on runtime after last move */
+	tv = &tc->topo->vcpu[vcpu->id];
+	if ((tv->reset_count == vcpu->reset_count) &&
+	    (vcpu->state_running_nsecs >= tv->migrate_running_ns) &&
+	    ((vcpu->state_running_nsecs - tv->migrate_running_ns) <
+						TOPO_MIN_RUNTIME_NSECS)) {
+		return VMM_OK;
+	}
+
+	tc->vcpu[tc->count++] = vcpu;
+
+	return (tc->count < TOPO_MAX_CANDIDATES) ? VMM_OK : VMM_ENOSPC;
+}
+
+struct topo_siblings {
+	struct vmm_vcpu *vcpu;
+	u32 hcpu_count[CONFIG_CPU_COUNT];
+};
+
+static int topo_siblings_iter(struct vmm_vcpu *vcpu, void *priv)
+{
+	u32 hcpu, state;
+	struct topo_siblings *ts = priv;
+
+	if (vcpu == ts->vcpu) {
+		return VMM_OK;
+	}
+
+	state = vmm_manager_vcpu_get_state(vcpu);
+	if (state != VMM_VCPU_STATE_READY &&
+	    state != VMM_VCPU_STATE_RUNNING &&
+	    state != VMM_VCPU_STATE_PAUSED) {
+		return VMM_OK;
+	}
+
+	if (!vmm_manager_vcpu_get_hcpu(vcpu, &hcpu) &&
+	    (hcpu < CONFIG_CPU_COUNT)) {
+		ts->hcpu_count[hcpu]++;
+	}
+
+	return VMM_OK;
+}
+
+/**
+ * Find out best hcpu and its score for moving given VCPU.
+ *
+ * Score is idle difference minus imbalance required at topology
+ * level plus bonus for each sibling VCPU co-location removed.
+ */
+static bool topo_best_hcpu(struct topo_control *topo,
+			   struct vmm_vcpu *vcpu, u32 src,
+			   struct topo_siblings *ts,
+			   u32 *best, int *best_score)
+{
+	int score;
+	u32 hcpu, level, diff;
+	bool found = FALSE;
+
+	for_each_online_cpu(hcpu) {
+		if ((hcpu == src) ||
+		    !vmm_cpumask_test_cpu(hcpu, vcpu->cpu_affinity) ||
+		    (topo->idle_percent[hcpu] <= topo->idle_percent[src])) {
+			continue;
+		}
+
+		level = topo_level(topo, src, hcpu);
+		diff = topo->idle_percent[hcpu] - topo->idle_percent[src];
+		if (diff < topo_level_imbalance[level]) {
+			continue;
+		}
+
+		/* Don't make sibling co-location worse */
+		if (ts->hcpu_count[hcpu] > ts->hcpu_count[src]) {
+			continue;
+		}
+
+		score = (int)diff - (int)topo_level_imbalance[level];
+		score += TOPO_SIBLING_BONUS *
+			 (int)(ts->hcpu_count[src] - ts->hcpu_count[hcpu]);
+		if (!found || (score > *best_score)) {
+			*best = hcpu;
+			*best_score = score;
+			found = TRUE;
+		}
+	}
+
+	return found;
+}
+
+static void topo_move(struct topo_control *topo,
+		      struct vmm_vcpu *vcpu, u32 src, u32 dst)
+{
+	u32 share;
+	struct topo_vcpu *tv = &topo->vcpu[vcpu->id];
+
+	DPRINTF("%s: vcpu=%s src=%d dst=%d level=%d\n",
+		__func__, vcpu->name, src, dst, topo_level(topo, src, dst));
+
+	if (vmm_manager_vcpu_set_hcpu(vcpu, dst)) {
+		return;
+	}
+
+	tv->reset_count = vcpu->reset_count;
+	tv->migrate_running_ns = vcpu->state_running_nsecs;
+
+	/* Estimate load moved so that next move sees updated load */
+	share = udiv32(100 - topo->idle_percent[src],
+		       topo->ready_count[src] + 1);
+	topo->idle_percent[src] += share;
+	topo->idle_percent[dst] -= (share < topo->idle_percent[dst]) ?
+				   share : topo->idle_percent[dst];
+	topo->ready_count[src]--;
+	topo->ready_count[dst]++;
+}
+
+static void topo_balance(struct vmm_loadbal_algo *algo)
+{
+	int score, best_score;
+	u32 i, moves, src = 0, dst = 0, best_dst;
+	struct vmm_vcpu *best_vcpu;
+	struct topo_candidates *tc;
+	struct topo_siblings *ts;
+	struct topo_control *topo = vmm_loadbal_get_algo_priv(algo);
+
+	if (!topo) {
+		return;
+	}
+
+	tc = vmm_zalloc(sizeof(*tc));
+	if (!tc) {
+		return;
+	}
+	ts = vmm_zalloc(sizeof(*ts));
+	if (!ts) {
+		vmm_free(tc);
+		return;
+	}
+	tc->topo = topo;
+
+	topo_analyze(topo);
+
+	moves = 0;
+	while ((moves < CONFIG_LOADBAL_TOPO_MAX_MOVES) &&
+	       topo_busiest_hcpu(topo, &src)) {
+		if (topo->idle_percent[src] >
+		    (100 - TOPO_MIN_BUSY_PERCENT)) {
+			break;
+		}
+
+		tc->count = 0;
+		vmm_scheduler_ready_iterate(src, topo_candidates_iter, tc);
+
+		best_vcpu = NULL;
+		best_dst = src;
+		best_score = 0;
+		for (i = 0; i < tc->count; i++) {
+			memset(ts, 0, sizeof(*ts));
+			ts->vcpu = tc->vcpu[i];
+			if (tc->vcpu[i]->is_normal) {
+				vmm_manager_guest_vcpu_iterate(
+						tc->vcpu[i]->guest,
+						topo_siblings_iter, ts);
+			}
+			if (!topo_best_hcpu(topo, tc->vcpu[i], src, ts,
+					    &dst, &score)) {
+				continue;
+			}
+			if (!best_vcpu || (score > best_score)) {
+				best_vcpu = tc->vcpu[i];
+				best_dst = dst;
+				best_score = score;
+			}
+		}
+
+		if (!best_vcpu) {
+			topo->exhausted[src] = TRUE;
+			continue;
+		}
+
+		topo_move(topo, best_vcpu, src, best_dst);
+		moves++;
+	}
+
+	vmm_free(ts);
+	vmm_free(tc);
+}
+
+static int topo_start(struct vmm_loadbal_algo *algo)
+{
+	struct topo_control *topo;
+
+	topo = vmm_zalloc(sizeof(*topo));
+	if (!topo) {
+		return VMM_ENOMEM;
+	}
+
+	topo_parse(topo);
+	topo_steal_order(topo);
+
+	vmm_loadbal_set_algo_priv(algo, topo);
+
+	return VMM_OK;
+}
+
+static void topo_stop(struct vmm_loadbal_algo *algo)
+{
+	struct topo_control *topo = vmm_loadbal_get_algo_priv(algo);
+
+	if (!topo) {
+		return;
+	}
+
+	vmm_loadbal_set_algo_priv(algo, NULL);
+	vmm_free(topo);
+}
+
+static struct vmm_loadbal_algo topo = {
+	.name = "Topology-aware Load Balancer",
+	.rating = 2,
+	.balance = topo_balance,
+	.start = topo_start,
+	.stop = topo_stop,
+};
+
+static int __init topo_init(void)
+{
+	return vmm_loadbal_register_algo(&topo);
+}
+
+static void __exit topo_exit(void)
+{
+	vmm_loadbal_unregister_algo(&topo);
+}
+
+VMM_DECLARE_MODULE(MODULE_DESC,
+			MODULE_AUTHOR,
+			MODULE_LICENSE,
+			MODULE_IPRIORITY,
+			MODULE_INIT,
+			MODULE_EXIT);
@@ -25,6 +25,7 @@
 #include <vmm_heap.h>
 #include <vmm_stdio.h>
 #include <vmm_timer.h>
+#include <arch_atomic64.h>
 #include <net/vmm_protocol.h>
 #include <net/vmm_mbuf.h>
 #include <net/vmm_netswitch.h>
@@ -40,134 +41,187 @@
 #define DPRINTF(fmt, ...) do {} while(0)
 #endif
 
-#define BRIDGE_MAC_TABLE_SZ	32
+#define BRIDGE_FDB_HASH_BITS	8
+#define BRIDGE_FDB_HASH_SZ	(1 << BRIDGE_FDB_HASH_BITS)
+#define BRIDGE_FDB_MAX_ENTRIES	1024
 #define BRIDGE_MAC_EXPIRY	30000000000LLU
-
-/* We maintain a table of learned mac addresses
- * (please note that the mac of the immediate netports are not
- * kept in this table) */
-struct bridge_mac_entry {
+#define BRIDGE_MAC_REFRESH	1000000000LLU
+#define BRIDGE_AGING_BATCH	16
+#define BRIDGE_AGING_PERIOD	(BRIDGE_MAC_EXPIRY / \
+				 (BRIDGE_FDB_HASH_SZ / BRIDGE_AGING_BATCH))
+
+/* We maintain a hashed forwarding database of learned (mac, vlan)
+ * addresses (please note that the mac of the immediate netports are
+ * not kept in this table)
+ */
+struct bridge_fdb_entry {
+	struct dlist head;
 	struct vmm_netport *port;
 	u8 macaddr[6];
+	u16 vlan;
 	u64 timestamp;
 };
 
+struct bridge_fdb_bucket {
+	vmm_rwlock_t lock;
+	struct dlist entry_list;
+};
+
 struct bridge_ctrl {
 	struct vmm_netswitch *nsw;
 	struct vmm_timer_event ev;
-	vmm_rwlock_t mac_table_lock;
-	u32 mac_table_sz;
-	struct bridge_mac_entry *mac_table;
+	u32 aging_next;
+	struct bridge_fdb_bucket fdb[BRIDGE_FDB_HASH_SZ];
+	vmm_spinlock_t free_lock;
+	struct dlist free_list;
+	struct bridge_fdb_entry *entries;
 };
 
-static void bridge_mactable_cleanup_port(struct bridge_ctrl *br,
-					 struct vmm_netport *port)
+static inline u32 bridge_fdb_hash(const u8 *mac, u16 vlan)
 {
-	u32 m;
-	irq_flags_t f;
+	u32 h;
+
+	h = ((u32)mac[2] << 24) | ((u32)mac[3] << 16) |
+	    ((u32)mac[4] << 8) | (u32)mac[5];
+	h ^= ((u32)mac[0] << 8 | (u32)mac[1]) ^ ((u32)vlan << 16);
+	h *= 0x9E370001UL;
+
+	return h >> (32 - BRIDGE_FDB_HASH_BITS);
+}
+
+static inline u16 bridge_frame_vlan(struct vmm_mbuf *mbuf)
+{
+	u8 *frame = mtod(mbuf, u8 *);
+
+	if ((mbuf->m_len >= (ETHER_HLEN + VLAN_HLEN)) &&
+	    (ether_type(frame) == ETHER_TYPE_VLAN)) {
+		return ((frame[ETHER_HLEN] << 8) |
+			frame[ETHER_HLEN + 1]) & 0xfff;
+	}
+
+	return 0;
+}
 
-	vmm_write_lock_irqsave_lite(&br->mac_table_lock, f);
-	for (m = 0; m < br->mac_table_sz; m++) {
-		if (br->mac_table[m].port == port) {
-			br->mac_table[m].port = NULL;
+/* Must be called with bucket lock held */
+static struct bridge_fdb_entry *bridge_fdb_find(struct bridge_fdb_bucket *b,
+						const u8 *mac, u16 vlan)
+{
+	struct bridge_fdb_entry *e;
+
+	list_for_each_entry(e, &b->entry_list, head) {
+		if ((e->vlan == vlan) &&
+		    !compare_ether_addr(e->macaddr, mac)) {
+			return e;
 		}
 	}
-	vmm_write_unlock_irqrestore_lite(&br->mac_table_lock, f);
+
+	return NULL;
 }
 
-static struct vmm_netport *bridge_mactable_learn_find(struct bridge_ctrl *br,
-						      const u8 *dstmac,
-						      const u8 *srcmac,
-						      struct vmm_netport *src)
+static struct bridge_fdb_entry *bridge_fdb_alloc(struct bridge_ctrl *br)
 {
-	u32 i;
-	u64 tstamp;
 	irq_flags_t f;
-	bool learn, update, found;
-	struct vmm_netport *dst;
-	struct bridge_mac_entry *m;
-
-	/* Acquire read lock */
-	vmm_read_lock_irqsave_lite(&br->mac_table_lock, f);
+	struct bridge_fdb_entry *e = NULL;
 
-	/* Check for for dstmac and whether we need
-	 * to Learn (srcmac, src) mapping ??
-	 */
-	learn = TRUE;
-	dst = NULL;
-	for (i = 0; i < br->mac_table_sz; i++) {
-		m = &br->mac_table[i];
-		/* If mac table entry is unused then continue */
-		if (!m->port) {
-			continue;
-		}
-		/* Match (srcmac, srcport) */
-		if (learn &&
-		    !compare_ether_addr(m->macaddr, srcmac) &&
-		    (m->port == src)) {
-			learn = FALSE;
-		}
-		/* Match (dstmac) */
-		if (!dst &&
-		    !compare_ether_addr(m->macaddr, dstmac)) {
-			dst = m->port;
-		}
-		/* If no need to learn and found
-		 * destination port then break
-		 */
-		if (!learn && dst) {
-			break;
-		}
+	vmm_spin_lock_irqsave_lite(&br->free_lock, f);
+	if (!list_empty(&br->free_list)) {
+		e = list_entry(list_pop(&br->free_list),
+			       struct bridge_fdb_entry, head);
 	}
+	vmm_spin_unlock_irqrestore_lite(&br->free_lock, f);
 
-	/* Release read lock */
-	vmm_read_unlock_irqrestore_lite(&br->mac_table_lock, f);
+	return e;
+}
 
-	/* If leaning required then update mac table */
-	if (learn) {
-		/* Retrive current timestamp */
-		tstamp = vmm_timer_timestamp();
+static void bridge_fdb_free(struct bridge_ctrl *br,
+			    struct bridge_fdb_entry *e)
+{
+	irq_flags_t f;
 
-		/* Acquire write lock */
-		vmm_write_lock_irqsave_lite(&br->mac_table_lock, f);
+	e->port = NULL;
+	vmm_spin_lock_irqsave_lite(&br->free_lock, f);
+	list_add_tail(&e->head, &br->free_list);
+	vmm_spin_unlock_irqrestore_lite(&br->free_lock, f);
+}
 
-		/* If mac entry already exist then
-		 * update only port and timestamp
-		 */
-		update = TRUE;
-		for (i = 0; i < br->mac_table_sz; i++) {
-			m = &br->mac_table[i];
-			if (!compare_ether_addr(m->macaddr, srcmac)) {
-				m->port = src;
-				m->timestamp = tstamp;
-				update = FALSE;
-				break;
+static void bridge_fdb_cleanup_port(struct bridge_ctrl *br,
+				    struct vmm_netport *port)
+{
+	u32 i;
+	irq_flags_t f;
+	struct bridge_fdb_bucket *b;
+	struct bridge_fdb_entry *e, *ne;
+
+	for (i = 0; i < BRIDGE_FDB_HASH_SZ; i++) {
+		b = &br->fdb[i];
+		vmm_write_lock_irqsave_lite(&b->lock, f);
+		list_for_each_entry_safe(e, ne, &b->entry_list, head) {
+			if (e->port == port) {
+				list_del(&e->head);
+				bridge_fdb_free(br, e);
 			}
 		}
+		vmm_write_unlock_irqrestore_lite(&b->lock, f);
+	}
+}
 
-		/* If mac entry does not exist then
-		 * save (mac, port, timestamp) in a
-		 * free mac table entry.
-		 */
-		if (update) {
-			found = FALSE;
-			for (i = 0; i < br->mac_table_sz; i++) {
-				m = &br->mac_table[i];
-				if (m->port == NULL) {
-					found = TRUE;
-					break;
-				}
-			}
-			if (found) {
-				m->port = src;
-				memcpy(m->macaddr, srcmac, 6);
-				m->timestamp = tstamp;
-			}
+static void bridge_fdb_learn(struct bridge_ctrl *br,
+			     const u8 *srcmac, u16 vlan,
+			     struct vmm_netport *src, u64 tstamp)
+{
+	irq_flags_t f;
+	bool fresh = FALSE;
+	struct bridge_fdb_entry *e;
+	struct bridge_fdb_bucket *b = &br->fdb[bridge_fdb_hash(srcmac, vlan)];
+
+	/* Common case: known address on same port which was
+	 * refreshed recently so no need for write lock.
+	 */
+	vmm_read_lock_irqsave_lite(&b->lock, f);
+	e = bridge_fdb_find(b, srcmac, vlan);
+	if (e && (e->port == src) &&
+	    ((tstamp - e->timestamp) < BRIDGE_MAC_REFRESH)) {
+		fresh = TRUE;
+	}
+	vmm_read_unlock_irqrestore_lite(&b->lock, f);
+	if (fresh) {
+		return;
+	}
+
+	vmm_write_lock_irqsave_lite(&b->lock, f);
+	e = bridge_fdb_find(b, srcmac, vlan);
+	if (!e) {
+		e = bridge_fdb_alloc(br);
+		if (e) {
+			memcpy(e->macaddr, srcmac, 6);
+			e->vlan = vlan;
+			list_add(&e->head, &b->entry_list);
+			arch_atomic64_add(&br->nsw->stats.learned, 1);
 		}
+	}
+	if (e) {
+		e->port = src;
+		e->timestamp = tstamp;
+	}
+	vmm_write_unlock_irqrestore_lite(&b->lock, f);
+}
 
-		/* Release write lock */
-		vmm_write_unlock_irqrestore_lite(&br->mac_table_lock, f);
+static struct vmm_netport *bridge_fdb_lookup(struct bridge_ctrl *br,
+					     const u8 *dstmac, u16 vlan,
+					     u64 tstamp)
+{
+	irq_flags_t f;
+	struct vmm_netport *dst = NULL;
+	struct bridge_fdb_entry *e;
+	struct bridge_fdb_bucket *b = &br->fdb[bridge_fdb_hash(dstmac, vlan)];
+
+	vmm_read_lock_irqsave_lite(&b->lock, f);
+	e = bridge_fdb_find(b, dstmac, vlan);
+	/* Expired entries are treated as unknown until aged out */
+	if (e && ((tstamp - e->timestamp) < BRIDGE_MAC_EXPIRY)) {
+		dst = e->port;
 	}
+	vmm_read_unlock_irqrestore_lite(&b->lock, f);
 
 	return dst;
 }
@@ -178,7 +232,8 @@ static void bridge_timer_event(struct vmm_timer_event *ev)
 	u64 tstamp;
 	irq_flags_t f;
 	struct bridge_ctrl *br = ev->priv;
-	struct bridge_mac_entry *m;
+	struct bridge_fdb_bucket *b;
+	struct bridge_fdb_entry *e, *ne;
 
 	DPRINTF("%s: bridge expiry event nsw=%s\n",
 		__func__, br->nsw->name);
@@ -186,66 +241,42 @@ static void bridge_timer_event(struct vmm_timer_event *ev)
 	/* Retrive current timestamp */
 	tstamp = vmm_timer_timestamp();
 
-	/* Acquire write lock */
-	vmm_write_lock_irqsave_lite(&br->mac_table_lock, f);
-
-	/* Purge old enteries */
-	for (i = 0; i < br->mac_table_sz; i++) {
-		m = &br->mac_table[i];
-		if (m->port &&
-		    ((m->timestamp - tstamp) > BRIDGE_MAC_EXPIRY)) {
-			DPRINTF("%s: purge port=%s\n",
-				__func__, m->port->name);
-			m->port = NULL;
-			memset(m->macaddr, 0, 6);
-			m->timestamp = 0;
+	/* Purge old enteries from next batch of buckets */
+	for (i = 0; i < BRIDGE_AGING_BATCH; i++) {
+		b = &br->fdb[br->aging_next];
+		br->aging_next = (br->aging_next + 1) &
+				 (BRIDGE_FDB_HASH_SZ - 1);
+
+		vmm_write_lock_irqsave_lite(&b->lock, f);
+		list_for_each_entry_safe(e, ne, &b->entry_list, head) {
+			if ((tstamp - e->timestamp) > BRIDGE_MAC_EXPIRY) {
+				DPRINTF("%s: purge port=%s\n",
+					__func__, e->port->name);
+				list_del(&e->head);
+				bridge_fdb_free(br, e);
+				arch_atomic64_add(&br->nsw->stats.aged, 1);
+			}
 		}
+		vmm_write_unlock_irqrestore_lite(&b->lock, f);
 	}
 
-	/* Release write lock */
-	vmm_write_unlock_irqrestore_lite(&br->mac_table_lock, f);
-
 	/* Again start the bridge timer event */
-	vmm_timer_event_start(&br->ev, BRIDGE_MAC_EXPIRY);
+	vmm_timer_event_start(&br->ev, BRIDGE_AGING_PERIOD);
 }
 
-/**
- *  Thread body responsible for sending the RX buffer packets
- *  to the destination port(s)
- */
-static int bridge_rx_handler(struct vmm_netswitch *nsw,
-			     struct vmm_netport *src,
-			     struct vmm_mbuf *mbuf)
+static void bridge_forward(struct vmm_netswitch *nsw,
+			   struct vmm_netport *src,
+			   struct vmm_netport *dst,
+			   struct vmm_mbuf *mbuf)
 {
 	irq_flags_t f;
-	const u8 *srcmac, *dstmac;
-	bool broadcast = TRUE;
 	struct dlist *l, *l1;
-	struct vmm_netport *dst, *port;
-	struct bridge_ctrl *br = nsw->priv;
-
-	/* Get source and destination mac addresses */
-	srcmac = ether_srcmac(mtod(mbuf, u8 *));
-	dstmac = ether_dstmac(mtod(mbuf, u8 *));
-
-	/* Learn source mac address and find port
-	 * matching destination mac address
-	 */
-	dst = bridge_mactable_learn_find(br, dstmac, srcmac, src);
-
-	/* If the frame below cases then it should be unicast.
-	 *
-	 * Case 1: destination MAC address is not broadcast address
-	 * Case 2: We found port matching destination mac address
-	 */
-	if (!is_broadcast_ether_addr(dstmac) && dst) {
-		/* Find port fordestination mac address */
-		broadcast = FALSE;
-	}
+	struct vmm_netport *port;
 
 	/* Transfer mbuf to appropriate ports */
-	if (broadcast) {
+	if (!dst) {
 		DPRINTF("%s: broadcasting\n", __func__);
+		arch_atomic64_add(&nsw->stats.flood, 1);
 		vmm_read_lock_irqsave_lite(&nsw->port_list_lock, f);
 		list_for_each_safe(l, l1, &nsw->port_list) {
 			port = list_port(l);
@@ -257,14 +288,88 @@ static int bridge_rx_handler(struct vmm_netswitch *nsw,
 			vmm_read_lock_irqsave_lite(&nsw->port_list_lock, f);
 		}
 		vmm_read_unlock_irqrestore_lite(&nsw->port_list_lock, f);
-	} else {
+	} else if (dst != src) {
 		DPRINTF("%s: unicasting to \"%s\"\n", __func__, dst->name);
+		arch_atomic64_add(&nsw->stats.unicast, 1);
 		vmm_switch2port_xfer_mbuf(nsw, dst, mbuf);
 	}
+}
+
+/**
+ *  Forward a burst of RX packets from same source port to the
+ *  destination port(s). The timestamp, learned source address and
+ *  last destination lookup are shared by all packets of the burst
+ *  whereas packets are always delivered in order.
+ */
+static int bridge_rx_burst_handler(struct vmm_netswitch *nsw,
+				   struct vmm_netport *src,
+				   struct vmm_mbuf **mbufs, u32 count)
+{
+	u32 i;
+	u16 vlan;
+	u64 tstamp;
+	const u8 *srcmac, *dstmac;
+	bool learn_valid = FALSE, lookup_valid = FALSE;
+	u8 learn_mac[6], lookup_mac[6];
+	u16 learn_vlan = 0, lookup_vlan = 0;
+	struct vmm_netport *dst, *lookup_dst = NULL;
+	struct bridge_ctrl *br = nsw->priv;
+
+	/* Retrive current timestamp */
+	tstamp = vmm_timer_timestamp();
+
+	for (i = 0; i < count; i++) {
+		/* Get source and destination mac addresses */
+		srcmac = ether_srcmac(mtod(mbufs[i], u8 *));
+		dstmac = ether_dstmac(mtod(mbufs[i], u8 *));
+		vlan = bridge_frame_vlan(mbufs[i]);
+
+		/* Learn source mac address unless it was just learned */
+		if (!is_multicast_ether_addr(srcmac) &&
+		    (!learn_valid || (learn_vlan != vlan) ||
+		     memcmp(learn_mac, srcmac, 6))) {
+			bridge_fdb_learn(br, srcmac, vlan, src, tstamp);
+			memcpy(learn_mac, srcmac, 6);
+			learn_vlan = vlan;
+			learn_valid = TRUE;
+		}
+
+		/* Find port matching destination mac address. The
+		 * multicast and broadcast frames are always flooded.
+		 */
+		dst = NULL;
+		if (!is_multicast_ether_addr(dstmac)) {
+			if (!lookup_valid || (lookup_vlan != vlan) ||
+			    memcmp(lookup_mac, dstmac, 6)) {
+				lookup_dst = bridge_fdb_lookup(br, dstmac,
+							       vlan, tstamp);
+				memcpy(lookup_mac, dstmac, 6);
+				lookup_vlan = vlan;
+				lookup_valid = TRUE;
+			}
+			dst = lookup_dst;
+		}
+
+		bridge_forward(nsw, src, dst, mbufs[i]);
+	}
+
+	arch_atomic64_add(&nsw->stats.lookup_ns,
+			  vmm_timer_timestamp() - tstamp);
 
 	return VMM_OK;
 }
 
+/**
+ *  Thread body responsible for sending the RX buffer packets
+ *  to the destination port(s)
+ */
+static int bridge_rx_handler(struct vmm_netswitch *nsw,
+			     struct vmm_netport *src,
+			     struct vmm_mbuf *mbuf)
+{
+	return bridge_rx_burst_handler(nsw, src, &mbuf, 1);
+}
+
 static int bridge_port_add(struct vmm_netswitch *nsw,
 			   struct vmm_netport *port)
 {
@@ -277,8 +382,8 @@ static int bridge_port_remove(struct vmm_netswitch *nsw,
 {
 	struct bridge_ctrl *br = nsw->priv;
 
-	/* Cleanup mactable enteries for this port */
-	bridge_mactable_cleanup_port(br, port);
+	/* Cleanup forwarding database enteries for this port */
+	bridge_fdb_cleanup_port(br, port);
 
 	return VMM_OK;
 }
@@ -288,6 +393,7 @@ static struct vmm_netswitch *bridge_create(
 				const char *name, int argc, char **argv)
 {
 	int rc;
+	u32 i;
 	struct bridge_ctrl *br;
 	struct vmm_netswitch *nsw = NULL;
 
@@ -296,6 +402,7 @@ static struct vmm_netswitch *bridge_create(
 		goto bridge_netswitch_alloc_failed;
 	}
 	nsw->port2switch_xfer = bridge_rx_handler;
+	nsw->port2switch_xfer_burst = bridge_rx_burst_handler;
 	nsw->port_add = bridge_port_add;
 	nsw->port_remove = bridge_port_remove;
 
@@ -306,12 +413,20 @@ static struct vmm_netswitch *bridge_create(
 
 	br->nsw = nsw;
 	INIT_TIMER_EVENT(&br->ev, bridge_timer_event, br);
-	INIT_RW_LOCK(&br->mac_table_lock);
-	br->mac_table_sz = BRIDGE_MAC_TABLE_SZ;
-	br->mac_table = vmm_zalloc(sizeof(struct bridge_mac_entry) *
-				   br->mac_table_sz);
-	if (!br->mac_table) {
-		goto bridge_alloc_mac_table_fail;
+	for (i = 0; i < BRIDGE_FDB_HASH_SZ; i++) {
+		INIT_RW_LOCK(&br->fdb[i].lock);
+		INIT_LIST_HEAD(&br->fdb[i].entry_list);
+	}
+	INIT_SPIN_LOCK(&br->free_lock);
+	INIT_LIST_HEAD(&br->free_list);
+	br->entries = vmm_zalloc(sizeof(struct bridge_fdb_entry) *
+				 BRIDGE_FDB_MAX_ENTRIES);
+	if (!br->entries) {
+		goto bridge_alloc_entries_fail;
+	}
+	for (i = 0; i < BRIDGE_FDB_MAX_ENTRIES; i++) {
+		INIT_LIST_HEAD(&br->entries[i].head);
+		list_add_tail(&br->entries[i].head, &br->free_list);
 	}
 
 	rc = vmm_netswitch_register(nsw, NULL, br);
@@ -319,13 +434,13 @@ static struct vmm_netswitch *bridge_create(
 		goto bridge_netswitch_register_fail;
 	}
 
-	vmm_timer_event_start(&br->ev, BRIDGE_MAC_EXPIRY);
+	vmm_timer_event_start(&br->ev, BRIDGE_AGING_PERIOD);
 
 	return nsw;
 
 bridge_netswitch_register_fail:
-	vmm_free(br->mac_table);
-bridge_alloc_mac_table_fail:
+	vmm_free(br->entries);
+bridge_alloc_entries_fail:
 	vmm_free(br);
 bridge_alloc_failed:
 	vmm_netswitch_free(nsw);
@@ -347,7 +462,7 @@ static void bridge_destroy(struct vmm_netswitch_policy *policy,
 
 	vmm_netswitch_unregister(nsw);
 
-	vmm_free(br->mac_table);
+	vmm_free(br->entries);
 	vmm_free(br);
 
 	vmm_netswitch_free(nsw);
@@ -23,6 +23,7 @@
 
 #include <vmm_error.h>
 #include <vmm_stdio.h>
+#include <arch_atomic64.h>
 #include <net/vmm_mbuf.h>
 #include <net/vmm_netswitch.h>
 #include <net/vmm_netport.h>
@@ -37,19 +38,21 @@
 #endif
 
 /**
- *  Thread body responsible for sending the RX buffer packets
- *  to the destination port(s)
+ *  Broadcast a burst of RX packets to all ports except source port.
+ *  Each destination port receives the packets of burst in order.
  */
-static int hub_rx_handler(struct vmm_netswitch *nsw,
-			     struct vmm_netport *src,
-			     struct vmm_mbuf *mbuf)
+static int hub_rx_burst_handler(struct vmm_netswitch *nsw,
+				struct vmm_netport *src,
+				struct vmm_mbuf **mbufs, u32 count)
 {
+	u32 i;
 	irq_flags_t f;
 	struct dlist *l, *l1;
 	struct vmm_netport *port;
 
-	/* Broadcast mbuf to all ports except source port */
-	DPRINTF("%s: broadcasting\n", __func__);
+	/* Broadcast mbufs to all ports except source port */
+	DPRINTF("%s: broadcasting %d packets\n", __func__, count);
+	arch_atomic64_add(&nsw->stats.flood, count);
 	vmm_read_lock_irqsave_lite(&nsw->port_list_lock, f);
 	list_for_each_safe(l, l1, &nsw->port_list) {
 		port = list_port(l);
@@ -57,7 +60,9 @@ static int hub_rx_handler(struct vmm_netswitch *nsw,
 			continue;
 		}
 		vmm_read_unlock_irqrestore_lite(&nsw->port_list_lock, f);
-		vmm_switch2port_xfer_mbuf(nsw, port, mbuf);
+		for (i = 0; i < count; i++) {
+			vmm_switch2port_xfer_mbuf(nsw, port, mbufs[i]);
+		}
 		vmm_read_lock_irqsave_lite(&nsw->port_list_lock, f);
 	}
 	vmm_read_unlock_irqrestore_lite(&nsw->port_list_lock, f);
@@ -65,6 +70,17 @@ static int hub_rx_handler(struct vmm_netswitch *nsw,
 	return VMM_OK;
 }
 
+/**
+ *  Thread body responsible for sending the RX buffer packets
+ *  to the destination port(s)
+ */
+static int hub_rx_handler(struct vmm_netswitch *nsw,
+			     struct vmm_netport *src,
+			     struct vmm_mbuf *mbuf)
+{
+	return hub_rx_burst_handler(nsw, src, &mbuf, 1);
+}
+
 static int hub_port_add(struct vmm_netswitch *nsw,
 			struct vmm_netport *port)
 {
@@ -91,6 +107,7 @@ static struct vmm_netswitch *hub_create(struct vmm_netswitch_policy *policy,
 		goto hub_netswitch_alloc_failed;
 	}
 	nsw->port2switch_xfer = hub_rx_handler;
+	nsw->port2switch_xfer_burst = hub_rx_burst_handler;
 	nsw->port_add = hub_port_add;
 	nsw->port_remove = hub_port_remove;
 
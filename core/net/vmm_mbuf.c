@@ -91,7 +91,11 @@
 #include <vmm_heap.h>
 #include <vmm_host_aspace.h>
 #include <vmm_modules.h>
+#include <vmm_percpu.h>
+#include <vmm_cpumask.h>
+#include <arch_cpu_irq.h>
 #include <net/vmm_mbuf.h>
+#include <net/vmm_protocol.h>
 #include <libs/list.h>
 #include <libs/stringlib.h>
 #include <libs/mathlib.h>
@@ -100,16 +104,40 @@
 
 /*
  * Mbuffer pool.
+ *
+ * Pool 0 holds mbufs and remaining pools hold external storage of
+ * increasing size. Each host CPU caches free objects of every pool
+ * so that common allocations and frees do not touch the shared pool.
+ * The per-CPU caches are refilled from and flushed to the shared
+ * pool in batches. They are only accessed with interrupts disabled.
+ * Batch size is chosen per pool so that small pools (such as 64K
+ * jumbo buffers) cannot be emptied by the cache of one host CPU.
  */
 
-#define EPOOL_SLAB_COUNT		4
+#define MBUF_POOL			0
+#define EPOOL_SLAB_COUNT		7
+#define MBUF_POOL_COUNT			(1 + EPOOL_SLAB_COUNT)
+#define MBUF_CACHE_SIZE			CONFIG_NET_MBUF_CACHE_SIZE
+#define MBUF_CACHE_BATCH		((MBUF_CACHE_SIZE + 1) / 2)
 
 struct vmm_mbufpool_ctrl {
-	struct mempool *mpool;
-	struct mempool *epool_slabs[EPOOL_SLAB_COUNT];
+	struct mempool *pools[MBUF_POOL_COUNT];
+	u32 batch[MBUF_POOL_COUNT];
+};
+
+struct vmm_mbufpool_cache {
+	u32 count;
+	u64 hits;
+	u64 misses;
+	void *objs[MBUF_CACHE_SIZE];
+};
+
+struct vmm_mbufpool_cpu {
+	struct vmm_mbufpool_cache caches[MBUF_POOL_COUNT];
 };
 
 static struct vmm_mbufpool_ctrl mbpctrl;
+static DEFINE_PER_CPU(struct vmm_mbufpool_cpu, mbpcpu);
 
 static u32 epool_slab_buf_size(u32 slab)
 {
@@ -122,6 +150,13 @@ static u32 epool_slab_buf_size(u32 slab)
 		return 1536;
 	case 3:
 		return 2048;
+	case 4:
+		return 4096;
+	case 5:
+		return 9216;
+	case 6:
+		/* Full 64K GSO segment along with its headers */
+		return 65536 + 2048;
 	default:
 		break;
 	};
@@ -129,9 +164,9 @@ static u32 epool_slab_buf_size(u32 slab)
 	return 0;
 }
 
-static u32 epool_slab_buf_count(u32 pool_sz, u32 slab)
+static u32 epool_slab_buf_count(u32 slab)
 {
-	u32 slab_size, buf_size, weight, total_weight;
+	u32 pool_sz, slab_size, buf_size, weight, total_weight;
 
 	switch (slab) {
 	case 0:
@@ -146,10 +181,29 @@ static u32 epool_slab_buf_count(u32 pool_sz, u32 slab)
 	case 3:
 		weight = 2;
 		break;
+	case 4:
+		weight = 1;
+		break;
+	case 5:
+		weight = 1;
+		break;
+	case 6:
+		weight = 2;
+		break;
 	default:
 		return 0;
 	};
-	total_weight = 8;
+
+	/* Regular slabs share external storage pool whereas
+	 * jumbo slabs (4K, 9K and 64K) share jumbo pool.
+	 */
+	if (slab < 4) {
+		pool_sz = CONFIG_NET_MBUF_EXT_POOL_SIZE_KB * 1024;
+		total_weight = 8;
+	} else {
+		pool_sz = CONFIG_NET_MBUF_JUMBO_POOL_SIZE_KB * 1024;
+		total_weight = 4;
+	}
 
 	buf_size = epool_slab_buf_size(slab);
 	if (!buf_size) {
@@ -164,34 +218,172 @@ static u32 epool_slab_buf_count(u32 pool_sz, u32 slab)
 	return udiv32(slab_size, buf_size);
 }
 
+static u32 mbufpool_cache_batch(u32 b_count)
+{
+	u32 batch;
+
+	/* Caches of all host CPUs together hold at most whole pool */
+	batch = udiv32(b_count, 2 * vmm_num_possible_cpus());
+	if (MBUF_CACHE_BATCH < batch) {
+		batch = MBUF_CACHE_BATCH;
+	}
+
+	return (batch) ? batch : 1;
+}
+
+static const char *mbufpool_name(u32 pool)
+{
+	switch (pool) {
+	case 0:
+		return "mbuf";
+	case 1:
+		return "ext-512";
+	case 2:
+		return "ext-1K";
+	case 3:
+		return "ext-1536";
+	case 4:
+		return "ext-2K";
+	case 5:
+		return "ext-4K";
+	case 6:
+		return "ext-9K";
+	case 7:
+		return "ext-64K";
+	default:
+		break;
+	};
+
+	return "unknown";
+}
+
+/* Must be called with interrupts disabled */
+static void *mbufpool_cache_get(struct vmm_mbufpool_cpu *pc, u32 pool)
+{
+	struct vmm_mbufpool_cache *c = &pc->caches[pool];
+
+	if (c->count) {
+		c->hits++;
+	} else {
+		c->misses++;
+		c->count = mempool_malloc_bulk(mbpctrl.pools[pool],
+					       c->objs, mbpctrl.batch[pool]);
+		if (!c->count) {
+			return NULL;
+		}
+	}
+
+	return c->objs[--c->count];
+}
+
+/* Must be called with interrupts disabled */
+static void mbufpool_cache_put(struct vmm_mbufpool_cpu *pc,
+			       u32 pool, void *obj)
+{
+	u32 cnt, batch = mbpctrl.batch[pool];
+	struct vmm_mbufpool_cache *c = &pc->caches[pool];
+
+	if (c->count >= min(2 * batch, (u32)MBUF_CACHE_SIZE)) {
+		cnt = mempool_free_bulk(mbpctrl.pools[pool],
+					&c->objs[c->count - batch], batch);
+		BUG_ON(cnt != batch);
+		c->count -= cnt;
+	}
+
+	c->objs[c->count++] = obj;
+}
+
+static void *mbufpool_alloc(u32 pool)
+{
+	void *obj;
+	irq_flags_t flags;
+
+	if (!mbpctrl.pools[pool]) {
+		return NULL;
+	}
+
+	arch_cpu_irq_save(flags);
+	obj = mbufpool_cache_get(&this_cpu(mbpcpu), pool);
+	arch_cpu_irq_restore(flags);
+
+	return obj;
+}
+
+static void mbufpool_free(u32 pool, void *obj)
+{
+	irq_flags_t flags;
+
+	arch_cpu_irq_save(flags);
+	mbufpool_cache_put(&this_cpu(mbpcpu), pool, obj);
+	arch_cpu_irq_restore(flags);
+}
+
+u32 vmm_mbufpool_count(void)
+{
+	return MBUF_POOL_COUNT;
+}
+VMM_EXPORT_SYMBOL(vmm_mbufpool_count);
+
+int vmm_mbufpool_stats(u32 pool, struct vmm_mbufpool_stats *stats)
+{
+	u32 c;
+	struct vmm_mbufpool_cache *mc;
+
+	if ((MBUF_POOL_COUNT <= pool) || !stats) {
+		return VMM_EINVALID;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	strncpy(stats->name, mbufpool_name(pool), sizeof(stats->name));
+	stats->name[sizeof(stats->name) - 1] = '\0';
+	stats->buf_size = (pool == MBUF_POOL) ?
+		sizeof(struct vmm_mbuf) : epool_slab_buf_size(pool - 1);
+	if (!mbpctrl.pools[pool]) {
+		return VMM_OK;
+	}
+
+	stats->total = mempool_total_entities(mbpctrl.pools[pool]);
+	stats->free = mempool_free_entities(mbpctrl.pools[pool]);
+	for_each_possible_cpu(c) {
+		mc = &per_cpu(mbpcpu, c).caches[pool];
+		stats->cached += mc->count;
+		stats->hits += mc->hits;
+		stats->misses += mc->misses;
+	}
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_mbufpool_stats);
+
 int __init vmm_mbufpool_init(void)
 {
-	u32 slab, b_size, b_count, epool_sz;
+	u32 slab, b_size, b_count;
 
 	memset(&mbpctrl, 0, sizeof(mbpctrl));
 
 	/* Create mbuf pool */
 	b_size = sizeof(struct vmm_mbuf);
 	b_count = CONFIG_NET_MBUF_POOL_SIZE;
-	mbpctrl.mpool = mempool_ram_create(b_size,
+	mbpctrl.pools[MBUF_POOL] = mempool_ram_create(b_size,
 					VMM_SIZE_TO_PAGE(b_size * b_count),
 					VMM_PAGEPOOL_NORMAL);
-	if (!mbpctrl.mpool) {
+	if (!mbpctrl.pools[MBUF_POOL]) {
 		return VMM_ENOMEM;
 	}
+	mbpctrl.batch[MBUF_POOL] = mbufpool_cache_batch(b_count);
 
 	/* Create ext slab pools */
-	epool_sz = (CONFIG_NET_MBUF_EXT_POOL_SIZE_KB * 1024);
 	for (slab = 0; slab < EPOOL_SLAB_COUNT; slab++) {
 		b_size = epool_slab_buf_size(slab);
-		b_count = epool_slab_buf_count(epool_sz, slab);
+		b_count = epool_slab_buf_count(slab);
 		if (b_count && b_size) {
-			mbpctrl.epool_slabs[slab] = 
+			mbpctrl.pools[1 + slab] =
 				mempool_ram_create(b_size,
 					VMM_SIZE_TO_PAGE(b_size * b_count),
 					VMM_PAGEPOOL_NORMAL);
+			mbpctrl.batch[1 + slab] = mbufpool_cache_batch(b_count);
 		} else {
-			mbpctrl.epool_slabs[slab] = NULL;
+			mbpctrl.pools[1 + slab] = NULL;
 		}
 	}
 
@@ -200,18 +392,24 @@ int __init vmm_mbufpool_init(void)
 
 void __exit vmm_mbufpool_exit(void)
 {
-	u32 slab;
+	u32 c, pool;
+	struct vmm_mbufpool_cache *mc;
 
-	/* Destroy mbuf pool */
-	if (mbpctrl.mpool) {
-		mempool_destroy(mbpctrl.mpool);
-	}
+	for (pool = 0; pool < MBUF_POOL_COUNT; pool++) {
+		if (!mbpctrl.pools[pool]) {
+			continue;
+		}
 
-	/* Destroy ext slab pools */
-	for (slab = 0; slab < EPOOL_SLAB_COUNT; slab++) {
-		if (mbpctrl.epool_slabs[slab]) {
-			mempool_destroy(mbpctrl.epool_slabs[slab]);
+		/* Return cached objects before destroying pool */
+		for_each_possible_cpu(c) {
+			mc = &per_cpu(mbpcpu, c).caches[pool];
+			mempool_free_bulk(mbpctrl.pools[pool],
+					  mc->objs, mc->count);
+			mc->count = 0;
 		}
+
+		mempool_destroy(mbpctrl.pools[pool]);
+		mbpctrl.pools[pool] = NULL;
 	}
 }
 
@@ -219,11 +417,63 @@ void __exit vmm_mbufpool_exit(void)
  * Mbuffer utility routines.
  */
 
+/*
+ * Copy data of an mbuf referencing host physical scatter list.
+ * The scatter list is guest supplied so failures are returned
+ * to the caller instead of being fatal.
+ */
+static int m_sg_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
+{
+	int rc = VMM_OK;
+	u32 i, count;
+	void *cp = vp;
+	irq_flags_t flags;
+	struct vmm_mbuf_sg *sg;
+
+	/* Part of data in mbuf buffer */
+	if (off < m->m_len) {
+		count = min(m->m_len - off, len);
+		memcpy(cp, mtod(m, char *) + off, count);
+		len -= count;
+		cp = (char *)cp + count;
+		off = 0;
+	} else {
+		off -= m->m_len;
+	}
+
+	/* Remaining data from host physical scatter list */
+	if (m->m_extsglock)
+		vmm_read_lock_irqsave_lite(m->m_extsglock, flags);
+	for (i = 0; (i < m->m_extsgcnt) && (len > 0); i++) {
+		sg = &m->m_extsg[i];
+		if (off >= sg->len) {
+			off -= sg->len;
+			continue;
+		}
+		count = min(sg->len - off, (u32)len);
+		if (vmm_host_memory_read(sg->addr + off,
+					 cp, count, TRUE) != count) {
+			rc = VMM_EIO;
+			break;
+		}
+		len -= count;
+		cp = (char *)cp + count;
+		off = 0;
+	}
+	if (m->m_extsglock)
+		vmm_read_unlock_irqrestore_lite(m->m_extsglock, flags);
+
+	if (!rc && (len > 0))
+		rc = VMM_EINVALID;
+
+	return rc;
+}
+
 /*
  * Copy data from an mbuf chain starting "off" bytes from the beginning,
  * continuing for "len" bytes, into the indicated buffer.
  */
-void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
+int m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
 {
 	unsigned count;
 	void *cp = vp;
@@ -232,6 +482,8 @@ void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
 		vmm_panic("%s: either m or vp is NULL\n", __func__);
 	if (off < 0 || len < 0)
 		vmm_panic("%s: off %d, len %d", __func__, off, len);
+	if (m->m_flags & M_EXT_SG)
+		return m_sg_copydata(m, off, len, vp);
 	while (off > 0) {
 		if (m == NULL)
 			vmm_panic("%s: m == NULL, off %d", __func__, off);
@@ -248,12 +500,380 @@ void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
 		off = 0;
 		m = m->m_next;
 	}
+
+	return VMM_OK;
 }
 VMM_EXPORT_SYMBOL(m_copydata);
 
+/*
+ * Copy packet header (including offload metadata) of "from" into "to".
+ */
+void m_copy_pkthdr(struct vmm_mbuf *to, struct vmm_mbuf *from)
+{
+	to->m_flags = (from->m_flags & M_COPYFLAGS) |
+		      (to->m_flags & M_EXT_FLAGS);
+	to->m_pkthdr = from->m_pkthdr;
+}
+VMM_EXPORT_SYMBOL(m_copy_pkthdr);
+
+/*
+ * Allocate a packet mbuf with a single writable external
+ * buffer of "len" bytes.
+ */
+static struct vmm_mbuf *m_get_linear(u32 len)
+{
+	struct vmm_mbuf *m;
+
+	MGETHDR(m, 0, 0);
+	if (!m) {
+		return NULL;
+	}
+
+	if (!MEXTMALLOC(m, len, 0)) {
+		m->m_freefn(m);
+		return NULL;
+	}
+	m->m_len = m->m_pktlen = len;
+
+	return m;
+}
+
+/*
+ * Make a private linear copy of a packet mbuf chain.
+ */
+struct vmm_mbuf *m_dup(struct vmm_mbuf *m)
+{
+	struct vmm_mbuf *n;
+
+	if (!m || !(m->m_flags & M_PKTHDR)) {
+		return NULL;
+	}
+
+	n = m_get_linear(m->m_pktlen);
+	if (!n) {
+		return NULL;
+	}
+
+	m_copy_pkthdr(n, m);
+	if (m_copydata(m, 0, m->m_pktlen, mtod(n, void *))) {
+		m_freem(n);
+		return NULL;
+	}
+
+	return n;
+}
+VMM_EXPORT_SYMBOL(m_dup);
+
+/*
+ * Internet checksum (RFC 1071) helpers working on big-endian
+ * 16-bit words so they are independent of buffer alignment.
+ */
+static u32 m_csum_add(u32 sum, const u8 *buf, u32 len)
+{
+	while (len > 1) {
+		sum += ((u32)buf[0] << 8) | buf[1];
+		buf += 2;
+		len -= 2;
+	}
+	if (len) {
+		sum += (u32)buf[0] << 8;
+	}
+
+	return sum;
+}
+
+static u16 m_csum_fold(u32 sum)
+{
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return (u16)~sum;
+}
+
+static void m_csum_store(u8 *p, u16 csum)
+{
+	p[0] = (csum >> 8) & 0xff;
+	p[1] = csum & 0xff;
+}
+
+/*
+ * m_csum_help: Complete a partial L4 checksum in software.
+ *
+ * The sender has already placed the pseudo-header sum at
+ * csum_start + csum_offset, so folding the sum from csum_start
+ * to the end of packet gives the final checksum. The mbuf must
+ * be linear and writable (for example, obtained using m_dup()).
+ */
+int m_csum_help(struct vmm_mbuf *m)
+{
+	u8 *buf;
+	u32 start, off;
+
+	if (!m || !(m->m_flags & M_PKTHDR)) {
+		return VMM_EINVALID;
+	}
+	if (!(m->m_csum_flags & M_CSUM_PARTIAL)) {
+		return VMM_OK;
+	}
+	if (m->m_next || M_READONLY(m)) {
+		return VMM_EINVALID;
+	}
+
+	start = m->m_csum_start;
+	off = start + m->m_csum_offset;
+	if ((start >= m->m_len) || ((off + 2) > m->m_len)) {
+		return VMM_EINVALID;
+	}
+
+	buf = mtod(m, u8 *);
+	m_csum_store(buf + off,
+		     m_csum_fold(m_csum_add(0, buf + start, m->m_len - start)));
+	m->m_csum_flags &= ~M_CSUM_PARTIAL;
+	m->m_csum_flags |= M_CSUM_VALID;
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(m_csum_help);
+
+#define M_GSO_MAX_HDR_LEN	(ETHER_HLEN + VLAN_HLEN + 60 + 60)
+
+/*
+ * m_gso_segment: Split a TCP large segment into MSS sized frames.
+ *
+ * Each resulting frame is a new linear mbuf with fixed up IP
+ * length/id/checksum and TCP sequence/flags/checksum, added to
+ * the "segs" list through m_list. The source mbuf is not modified.
+ */
+int m_gso_segment(struct vmm_mbuf *m, struct dlist *segs)
+{
+	int rc;
+	bool ipv6;
+	u8 *p, *l3, *l4, hbuf[M_GSO_MAX_HDR_LEN];
+	u16 etype, ipid, tflags, flags;
+	u32 len, l3off, l4off, hlen, tlen, plen, seglen, off, seq, i, sum;
+	struct vmm_mbuf *n, *nn;
+
+	if (!m || !segs || !(m->m_flags & M_PKTHDR)) {
+		return VMM_EINVALID;
+	}
+
+	switch (m->m_gso_type & M_GSO_TYPE_MASK) {
+	case M_GSO_TCPV4:
+		ipv6 = FALSE;
+		break;
+	case M_GSO_TCPV6:
+		ipv6 = TRUE;
+		break;
+	default:
+		return VMM_ENOTSUPP;
+	};
+	if (!m->m_gso_size) {
+		return VMM_EINVALID;
+	}
+
+	/* Parse L2/L3/L4 headers from a copy of packet start */
+	len = min((u32)m->m_pktlen, (u32)sizeof(hbuf));
+	if (len < (ETHER_HLEN + VLAN_HLEN)) {
+		return VMM_EINVALID;
+	}
+	rc = m_copydata(m, 0, len, hbuf);
+	if (rc) {
+		return rc;
+	}
+
+	l3off = ETHER_HLEN;
+	etype = ether_type(hbuf);
+	if (etype == ETHER_TYPE_VLAN) {
+		etype = (hbuf[l3off + 2] << 8) | hbuf[l3off + 3];
+		l3off += VLAN_HLEN;
+	}
+
+	if (!ipv6) {
+		if ((etype != ETHER_TYPE_IP) ||
+		    (len < (l3off + IP4_HLEN)) ||
+		    (ip_protocol(hbuf + l3off) != IP_PROTOCOL_TCP)) {
+			return VMM_EINVALID;
+		}
+		/* Header length is guest supplied so validate it */
+		if ((ip_hlen(hbuf + l3off) < IP4_HLEN) ||
+		    (len < (l3off + ip_hlen(hbuf + l3off)))) {
+			return VMM_EINVALID;
+		}
+		l4off = l3off + ip_hlen(hbuf + l3off);
+		ipid = vmm_be16_to_cpu(((struct ip_header *)
+					(hbuf + l3off))->ipid);
+	} else {
+		/* IPv6 extension headers are not handled */
+		if ((etype != ETHER_TYPE_IPV6) ||
+		    (len < (l3off + IP6_HLEN)) ||
+		    (ip6_nexthdr(hbuf + l3off) != IP_PROTOCOL_TCP)) {
+			return VMM_EINVALID;
+		}
+		l4off = l3off + IP6_HLEN;
+		ipid = 0;
+	}
+	if (len < (l4off + TCP_HLEN)) {
+		return VMM_EINVALID;
+	}
+
+	hlen = l4off + tcp_hlen(hbuf + l4off);
+	if ((hlen < (l4off + TCP_HLEN)) || (hlen > len)) {
+		return VMM_EINVALID;
+	}
+	plen = m->m_pktlen - hlen;
+	seq = tcp_sequence(hbuf + l4off);
+	tflags = tcp_flags(hbuf + l4off);
+
+	for (i = 0, off = 0; off < plen; i++, off += seglen) {
+		seglen = min(plen - off, (u32)m->m_gso_size);
+		tlen = (hlen - l4off) + seglen;
+
+		n = m_get_linear(hlen + seglen);
+		if (!n) {
+			rc = VMM_ENOMEM;
+			goto fail;
+		}
+
+		p = mtod(n, u8 *);
+		memcpy(p, hbuf, hlen);
+		rc = m_copydata(m, hlen + off, seglen, p + hlen);
+		if (rc) {
+			m_freem(n);
+			goto fail;
+		}
+		l3 = p + l3off;
+		l4 = p + l4off;
+
+		/* Fixup L3 header and start pseudo-header sum */
+		if (!ipv6) {
+			struct ip_header *ip = (struct ip_header *)l3;
+
+			ip->len = vmm_cpu_to_be16((l4off - l3off) + tlen);
+			ip->ipid = vmm_cpu_to_be16(ipid + i);
+			ip->ipchksum = 0;
+			m_csum_store((u8 *)&ip->ipchksum,
+				m_csum_fold(m_csum_add(0, l3, l4off - l3off)));
+			sum = m_csum_add(0, ip->srcipaddr,
+					 sizeof(ip->srcipaddr) +
+					 sizeof(ip->dstipaddr));
+		} else {
+			struct ip6_header *ip6 = (struct ip6_header *)l3;
+
+			ip6->len = vmm_cpu_to_be16(tlen);
+			sum = m_csum_add(0, ip6->srcipaddr,
+					 sizeof(ip6->srcipaddr) +
+					 sizeof(ip6->dstipaddr));
+		}
+		sum += IP_PROTOCOL_TCP + tlen;
+
+		/* Fixup TCP header: CWR only on first frame,
+		 * FIN and PSH only on last frame.
+		 */
+		flags = tflags;
+		if (i) {
+			flags &= ~TCP_FLAG_CWR;
+		}
+		if ((off + seglen) < plen) {
+			flags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+		}
+		((struct tcp_header *)l4)->sequence = vmm_cpu_to_be32(seq + off);
+		((struct tcp_header *)l4)->flags = vmm_cpu_to_be16(flags);
+		((struct tcp_header *)l4)->checksum = 0;
+		m_csum_store((u8 *)&((struct tcp_header *)l4)->checksum,
+			     m_csum_fold(m_csum_add(sum, l4, tlen)));
+
+		n->m_csum_flags = M_CSUM_VALID;
+		list_add_tail(&n->m_list, segs);
+	}
+
+	return VMM_OK;
+
+fail:
+	list_for_each_entry_safe(n, nn, segs, m_list) {
+		list_del(&n->m_list);
+		m_freem(n);
+	}
+	return rc;
+}
+VMM_EXPORT_SYMBOL(m_gso_segment);
+
+#define M_FLOW_HASH_HDR_LEN	(ETHER_HLEN + VLAN_HLEN + 60 + 4)
+
+static u32 m_flow_hash_add(u32 hash, const u8 *buf, u32 len)
+{
+	while (len--) {
+		hash ^= *buf++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+/*
+ * m_flow_hash: Compute a flow hash of packet based on IP addresses,
+ * L4 protocol and TCP/UDP ports. Non-IP frames are hashed using the
+ * MAC addresses. Frames of same flow always get the same hash.
+ */
+u32 m_flow_hash(struct vmm_mbuf *m)
+{
+	u8 proto, hbuf[M_FLOW_HASH_HDR_LEN];
+	u16 etype;
+	u32 len, l3off, l4off, hash = 2166136261U;
+
+	if (!m || !(m->m_flags & M_PKTHDR)) {
+		return 0;
+	}
+
+	len = min((u32)m->m_pktlen, (u32)sizeof(hbuf));
+	if (len < ETHER_HLEN) {
+		return 0;
+	}
+	if (m_copydata(m, 0, len, hbuf)) {
+		return 0;
+	}
+
+	l3off = ETHER_HLEN;
+	etype = ether_type(hbuf);
+	if ((etype == ETHER_TYPE_VLAN) && (len >= (l3off + VLAN_HLEN))) {
+		etype = (hbuf[l3off + 2] << 8) | hbuf[l3off + 3];
+		l3off += VLAN_HLEN;
+	}
+
+	if ((etype == ETHER_TYPE_IP) && (len >= (l3off + IP4_HLEN))) {
+		hash = m_flow_hash_add(hash, ip_srcaddr(hbuf + l3off), 8);
+		proto = ip_protocol(hbuf + l3off);
+		l4off = l3off + ip_hlen(hbuf + l3off);
+		/* Only first fragment with sane header has L4 ports */
+		if ((vmm_be16_to_cpu(((struct ip_header *)
+				      (hbuf + l3off))->ipoffset) & 0x3fff) ||
+		    (ip_hlen(hbuf + l3off) < IP4_HLEN) || (len < l4off)) {
+			proto = 0;
+		}
+	} else if ((etype == ETHER_TYPE_IPV6) &&
+		   (len >= (l3off + IP6_HLEN))) {
+		hash = m_flow_hash_add(hash,
+			((struct ip6_header *)(hbuf + l3off))->srcipaddr, 32);
+		proto = ip6_nexthdr(hbuf + l3off);
+		l4off = l3off + IP6_HLEN;
+	} else {
+		hash = m_flow_hash_add(hash, hbuf, 12);
+		return hash ^ (hash >> 16);
+	}
+
+	if (((proto == IP_PROTOCOL_TCP) || (proto == IP_PROTOCOL_UDP)) &&
+	    (len >= (l4off + 4))) {
+		hash = m_flow_hash_add(hash, hbuf + l4off, 4);
+	}
+	hash = m_flow_hash_add(hash, &proto, 1);
+
+	return hash ^ (hash >> 16);
+}
+VMM_EXPORT_SYMBOL(m_flow_hash);
+
 static void mbuf_pool_free(struct vmm_mbuf *m)
 {
-	mempool_free(mbpctrl.mpool, m);
+	mbufpool_free(MBUF_POOL, m);
 }
 
 static void mbuf_heap_free(struct vmm_mbuf *m)
@@ -272,8 +892,9 @@ struct vmm_mbuf *m_get(int nowait, int flags)
 
 	/* TODO: implement non-blocking variant */
 
-	m = mempool_zalloc(mbpctrl.mpool);
+	m = mbufpool_alloc(MBUF_POOL);
 	if (m) {
+		memset(m, 0, sizeof(struct vmm_mbuf));
 		m->m_freefn = mbuf_pool_free;
 	} else if (NULL != (m = vmm_zalloc(sizeof(struct vmm_mbuf)))) {
 		m->m_freefn = mbuf_heap_free;
@@ -289,6 +910,12 @@ struct vmm_mbuf *m_get(int nowait, int flags)
 	m->m_flags = flags;
 	if (flags & M_PKTHDR) {
 		m->m_pktlen = 0;
+		m->m_csum_flags = 0;
+		m->m_csum_start = 0;
+		m->m_csum_offset = 0;
+		m->m_gso_type = M_GSO_NONE;
+		m->m_gso_size = 0;
+		m->m_hdr_len = 0;
 	}
 	m->m_ref = 1;
 
@@ -298,9 +925,7 @@ VMM_EXPORT_SYMBOL(m_get);
 
 static void ext_pool_free(struct vmm_mbuf *m, void *ptr, u32 size, void *arg)
 {
-	struct mempool *mp = arg;
-
-	mempool_free(mp, ptr);
+	mbufpool_free((u32)(unsigned long)arg, ptr);
 }
 
 static void ext_heap_free(struct vmm_mbuf *m, void *ptr, u32 size, void *arg)
@@ -315,9 +940,8 @@ static void ext_dma_free(struct vmm_mbuf *m, void *ptr, u32 size, void *arg)
 
 void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how)
 {
-	void *buf;
+	void *buf = NULL;
 	u32 slab;
-	struct mempool *mp = NULL;
 
 	if (VMM_MBUF_ALLOC_DMA == how) {
 		buf = vmm_dma_malloc(size);
@@ -329,14 +953,15 @@ void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how)
 	} else {
 		for (slab = 0; slab < EPOOL_SLAB_COUNT; slab++) {
 			if (size <= epool_slab_buf_size(slab)) {
-				mp = mbpctrl.epool_slabs[slab];
+				buf = mbufpool_alloc(1 + slab);
 				break;
 			}
 		}
 
-		if (mp && (buf = mempool_malloc(mp))) {
+		if (buf) {
 			m->m_flags |= M_EXT_POOL;
-			MEXTADD(m, buf, size, ext_pool_free, mp);
+			MEXTADD(m, buf, size, ext_pool_free,
+				(void *)(unsigned long)(1 + slab));
 		} else if ((buf = vmm_malloc(size))) {
 			m->m_flags |= M_EXT_HEAP;
 			MEXTADD(m, buf, size, ext_heap_free, NULL);
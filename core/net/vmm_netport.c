@@ -27,12 +27,17 @@
 #include <vmm_modules.h>
 #include <vmm_devdrv.h>
 #include <net/vmm_protocol.h>
+#include <net/vmm_mbuf.h>
 #include <net/vmm_netswitch.h>
 #include <net/vmm_netport.h>
 #include <libs/stringlib.h>
+#include <libs/log2.h>
 
 struct vmm_netport *vmm_netport_alloc(char *name, u32 queue_size)
 {
+	u32 c, ring_size;
+	struct vmm_mbuf **slots;
+	struct vmm_netport_ring *r;
 	struct vmm_netport *port;
 
 	port = vmm_zalloc(sizeof(struct vmm_netport));
@@ -50,19 +55,60 @@ struct vmm_netport *vmm_netport_alloc(char *name, u32 queue_size)
 
 	port->queue_size = (queue_size < VMM_NETPORT_MAX_QUEUE_SIZE) ?
 				queue_size : VMM_NETPORT_MAX_QUEUE_SIZE;
+	if (!port->queue_size) {
+		port->queue_size = VMM_NETPORT_DEF_QUEUE_SIZE;
+	}
+	ring_size = roundup_pow_of_two(port->queue_size);
 
 	INIT_SPIN_LOCK(&port->switch2port_xfer_lock);
 
+	port->rings = vmm_zalloc(sizeof(*port->rings) * CONFIG_CPU_COUNT);
+	if (!port->rings) {
+		vmm_free(port);
+		return NULL;
+	}
+
+	slots = vmm_zalloc(sizeof(*slots) * ring_size * CONFIG_CPU_COUNT);
+	if (!slots) {
+		vmm_free(port->rings);
+		vmm_free(port);
+		return NULL;
+	}
+
+	for (c = 0; c < CONFIG_CPU_COUNT; c++) {
+		r = &port->rings[c];
+		INIT_LIST_HEAD(&r->head);
+		r->port = port;
+		ARCH_ATOMIC_INIT(&r->sched, 0);
+		r->mask = ring_size - 1;
+		r->prod = r->cons = 0;
+		r->slots = &slots[c * ring_size];
+	}
+
 	return port;
 }
 VMM_EXPORT_SYMBOL(vmm_netport_alloc);
 
 int vmm_netport_free(struct vmm_netport *port)
 {
+	u32 c;
+	struct vmm_netport_ring *r;
+
 	if (!port) {
 		return VMM_EFAIL;
 	}
 
+	/* Free mbufs left over in rings */
+	for (c = 0; c < CONFIG_CPU_COUNT; c++) {
+		r = &port->rings[c];
+		while (r->cons != r->prod) {
+			m_freem(r->slots[r->cons & r->mask]);
+			r->cons++;
+		}
+	}
+
+	vmm_free(port->rings[0].slots);
+	vmm_free(port->rings);
 	vmm_free(port);
 
 	return VMM_OK;
@@ -33,6 +33,9 @@
 #include <vmm_modules.h>
 #include <vmm_threads.h>
 #include <vmm_completion.h>
+#include <arch_cpu_irq.h>
+#include <arch_barrier.h>
+#include <arch_atomic64.h>
 #include <net/vmm_mbuf.h>
 #include <net/vmm_protocol.h>
 #include <net/vmm_netswitch.h>
@@ -131,8 +134,10 @@ struct vmm_netswitch_bh_ctrl {
 	struct vmm_thread *thread;
 	struct vmm_completion bh_cmpl;
 	vmm_spinlock_t bh_list_lock;
-	struct dlist mbuf_list;
+	struct dlist ring_list;
 	struct dlist lazy_list;
+	struct vmm_mbuf *burst[CONFIG_NET_BH_BURST_SIZE];
+	struct vmm_netswitch_bh_stats stats;
 };
 
 static DEFINE_PER_CPU(struct vmm_netswitch_bh_ctrl, nbctrl);
@@ -144,23 +149,62 @@ static void __init netswitch_bh_init(struct vmm_netswitch_bh_ctrl *nbp)
 {
 	INIT_COMPLETION(&nbp->bh_cmpl);
 	INIT_SPIN_LOCK(&nbp->bh_list_lock);
-	INIT_LIST_HEAD(&nbp->mbuf_list);
+	INIT_LIST_HEAD(&nbp->ring_list);
 	INIT_LIST_HEAD(&nbp->lazy_list);
+	memset(&nbp->stats, 0, sizeof(nbp->stats));
+}
+
+/* Must be called on the CPU owning the ring with interrupts disabled */
+static bool netswitch_ring_enqueue(struct vmm_netport_ring *r,
+				   struct vmm_mbuf *mbuf)
+{
+	u32 prod = r->prod;
+
+	if ((prod - r->cons) > r->mask) {
+		return FALSE;
+	}
+
+	r->slots[prod & r->mask] = mbuf;
+	arch_smp_wmb();
+	r->prod = prod + 1;
+
+	return TRUE;
+}
+
+/* Must be called only from bottom-half thread of CPU owning the ring */
+static u32 netswitch_ring_dequeue_burst(struct vmm_netport_ring *r,
+					struct vmm_mbuf **mbufs, u32 max)
+{
+	u32 i, count, cons = r->cons;
+
+	count = r->prod - cons;
+	arch_smp_rmb();
+	if (count > max) {
+		count = max;
+	}
+
+	for (i = 0; i < count; i++) {
+		mbufs[i] = r->slots[(cons + i) & r->mask];
+	}
+	arch_smp_mb();
+	r->cons = cons + count;
+
+	return count;
 }
 
 static int netswitch_bh_enqueue(struct vmm_netswitch_bh_ctrl *nbp,
-				struct vmm_mbuf *mbuf,
+				struct vmm_netport_ring *ring,
 				struct vmm_netport_lazy *lazy)
 {
 	irq_flags_t flags;
 
-	if (!nbp || (!mbuf && !lazy)) {
+	if (!nbp || (!ring && !lazy)) {
 		return VMM_EINVALID;
 	}
 
 	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
-	if (mbuf) {
-		list_add_tail(&mbuf->m_list, &nbp->mbuf_list);
+	if (ring) {
+		list_add_tail(&ring->head, &nbp->ring_list);
 	}
 	if (lazy) {
 		list_add_tail(&lazy->head, &nbp->lazy_list);
@@ -173,26 +217,27 @@ static int netswitch_bh_enqueue(struct vmm_netswitch_bh_ctrl *nbp,
 }
 
 static int netswitch_bh_dequeue(struct vmm_netswitch_bh_ctrl *nbp,
-				struct vmm_mbuf **mbufp,
+				struct vmm_netport_ring **ringp,
 				struct vmm_netport_lazy **lazyp)
 {
 	irq_flags_t flags;
 
-	if (!nbp || !mbufp || !lazyp) {
+	if (!nbp || !ringp || !lazyp) {
 		return VMM_EINVALID;
 	}
 
 	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
 
-	while (list_empty(&nbp->mbuf_list) && list_empty(&nbp->lazy_list)) {
+	while (list_empty(&nbp->ring_list) && list_empty(&nbp->lazy_list)) {
 		vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
 		vmm_completion_wait(&nbp->bh_cmpl);
 		vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
 	}
 
-	if (!list_empty(&nbp->mbuf_list)) {
-		*mbufp = list_entry(list_pop(&nbp->mbuf_list),
-				    struct vmm_mbuf, m_list);
+	if (!list_empty(&nbp->ring_list)) {
+		*ringp = list_entry(list_pop(&nbp->ring_list),
+				    struct vmm_netport_ring, head);
+		INIT_LIST_HEAD(&(*ringp)->head);
 	}
 
 	if (!list_empty(&nbp->lazy_list)) {
@@ -206,20 +251,25 @@ static int netswitch_bh_dequeue(struct vmm_netswitch_bh_ctrl *nbp,
 }
 
 static void netswitch_bh_port_flush(struct vmm_netswitch_bh_ctrl *nbp,
-					 struct vmm_netport *port)
+				    struct vmm_netport_ring *ring)
 {
 	irq_flags_t flags;
-	struct vmm_mbuf *mbuf, *nmbuf;
+	struct vmm_netport *port = ring->port;
 	struct vmm_netport_lazy *lazy, *nlazy;
 
 	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
 
-	list_for_each_entry_safe(mbuf, nmbuf, &nbp->mbuf_list, m_list) {
-		if (mbuf->m_list_priv == port) {
-			list_del(&mbuf->m_list);
-			mbuf->m_list_priv = NULL;
-			m_freem(mbuf);
+	/* Ring waiting in bottom-half queue is not being consumed
+	 * so it is safe to drain it here. A ring being consumed
+	 * right now is drained by bottom-half thread itself.
+	 */
+	if (!list_empty(&ring->head)) {
+		list_del_init(&ring->head);
+		while (ring->cons != ring->prod) {
+			m_freem(ring->slots[ring->cons & ring->mask]);
+			ring->cons++;
 		}
+		arch_atomic_write(&ring->sched, 0);
 	}
 
 	list_for_each_entry_safe(lazy, nlazy, &nbp->lazy_list, head) {
@@ -231,51 +281,86 @@ static void netswitch_bh_port_flush(struct vmm_netswitch_bh_ctrl *nbp,
 	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
 }
 
+static void netswitch_bh_ring_process(struct vmm_netswitch_bh_ctrl *nbp,
+				      struct vmm_netport_ring *ring)
+{
+	u32 i, count;
+	struct vmm_netport *port = ring->port;
+	struct vmm_netswitch *nsw = port->nsw;
+
+	/* Take next burst of mbufs from the ring */
+	count = netswitch_ring_dequeue_burst(ring, nbp->burst,
+					     CONFIG_NET_BH_BURST_SIZE);
+	if (count) {
+		nbp->stats.bursts++;
+		nbp->stats.frames += count;
+		if (nbp->stats.max_burst < count) {
+			nbp->stats.max_burst = count;
+		}
+	}
+
+	/* Print debug info */
+	DPRINTF("%s: nsw=%s port=%s burst=%d\n", __func__,
+		(nsw) ? nsw->name : "--", port->name, count);
+
+	/* Port might have been removed from netswitch */
+	if (count && nsw) {
+		arch_atomic64_add(&nsw->stats.rx_frames, count);
+		if (nsw->port2switch_xfer_burst) {
+			nsw->port2switch_xfer_burst(nsw, port,
+						    nbp->burst, count);
+		} else {
+			for (i = 0; i < count; i++) {
+				/* Dump packet */
+				DUMP_NETSWITCH_PKT(nbp->burst[i]);
+
+				nsw->port2switch_xfer(nsw, port,
+						      nbp->burst[i]);
+			}
+		}
+	}
+
+	/* Free mbufs */
+	for (i = 0; i < count; i++) {
+		m_freem(nbp->burst[i]);
+	}
+
+	/* Reschedule the ring if it is not empty. The sched flag is
+	 * cleared before checking ring so that producer either sees
+	 * cleared flag or we see the newly produced mbuf.
+	 */
+	arch_atomic_write(&ring->sched, 0);
+	arch_smp_mb();
+	if ((ring->prod != ring->cons) &&
+	    !arch_atomic_xchg(&ring->sched, 1)) {
+		if (netswitch_bh_enqueue(nbp, ring, NULL)) {
+			vmm_printf("%s: port=%s ring bh enqueue failed.\n",
+				   __func__, port->name);
+		}
+	}
+}
+
 static int netswitch_bh_main(void *param)
 {
 	int rc;
 	struct vmm_netport *port;
 	struct vmm_netswitch *nsw;
-	struct vmm_mbuf *mbuf;
+	struct vmm_netport_ring *ring;
 	struct vmm_netport_lazy *lazy;
 	struct vmm_netswitch_bh_ctrl *nbp = param;
 
 	while (1) {
 		/* Try to get next request from list or block if empty */
 		lazy = NULL;
-		mbuf = NULL;
-		rc = netswitch_bh_dequeue(nbp, &mbuf, &lazy);
+		ring = NULL;
+		rc = netswitch_bh_dequeue(nbp, &ring, &lazy);
 		if (rc) {
 			continue;
 		}
 
-		/* Process mbuf request */
-		if (mbuf) {
-			/* Extract port from mbuf */
-			port = mbuf->m_list_priv;
-			nsw = port->nsw;
-			mbuf->m_list_priv = NULL;
-
-			/* Port might have been removed from netswitch */
-			if (!port || !nsw) {
-				if (mbuf) {
-					m_freem(mbuf);
-				}
-				continue;
-			}
-
-			/* Print debug info */
-			DPRINTF("%s: nsw=%s port=%s mbuf\n", __func__,
-				nsw->name, port->name);
-
-			/* Dump packet */
-			DUMP_NETSWITCH_PKT(mbuf);
-
-			/* Call the rx function of net switch */
-			nsw->port2switch_xfer(nsw, port, mbuf);
-
-			/* Free mbuf */
-			m_freem(mbuf);
+		/* Process burst of mbufs from port ring */
+		if (ring) {
+			netswitch_bh_ring_process(nbp, ring);
 		}
 
 		/* Process lazy request */
@@ -309,8 +394,12 @@ static int netswitch_bh_main(void *param)
 
 int vmm_port2switch_xfer_mbuf(struct vmm_netport *src, struct vmm_mbuf *mbuf)
 {
-	int rc;
+	int rc = VMM_OK;
+	u32 cpu;
+	bool sched;
+	irq_flags_t flags;
 	struct vmm_netswitch *nsw;
+	struct vmm_netport_ring *ring;
 	struct vmm_netswitch_bh_ctrl *nbp;
 
 	if (!mbuf) {
@@ -322,26 +411,55 @@ int vmm_port2switch_xfer_mbuf(struct vmm_netport *src, struct vmm_mbuf *mbuf)
 		return VMM_EFAIL;
 	}
 	nsw = src->nsw;
-	nbp = &this_cpu(nbctrl);
 
 	/* Print debug info */
 	DPRINTF("%s: nsw=%s src=%s\n", __func__, nsw->name, src->name);
 
-	/* Save port in mbuf */
-	mbuf->m_list_priv = src;
+	/* Interrupts are disabled so that we are the only producer
+	 * of this CPU's ring and we don't migrate to other CPU.
+	 */
+	arch_cpu_irq_save(flags);
 
-	/* Add mbuf bh queue */
-	rc = netswitch_bh_enqueue(nbp, mbuf, NULL);
-	if (rc) {
-		vmm_printf("%s: nsw=%s src=%s mbuf bh enqueue failed.\n",
-			   __func__, nsw->name, src->name);
-		mbuf->m_list_priv = NULL;
+	cpu = vmm_smp_processor_id();
+	nbp = &per_cpu(nbctrl, cpu);
+	ring = &src->rings[cpu];
+
+	if (!netswitch_ring_enqueue(ring, mbuf)) {
+		nbp->stats.drops++;
+		arch_cpu_irq_restore(flags);
+		m_freem(mbuf);
+		return VMM_ENOSPC;
+	}
+
+	sched = (arch_atomic_xchg(&ring->sched, 1)) ? FALSE : TRUE;
+
+	arch_cpu_irq_restore(flags);
+
+	/* Add ring to bh queue if not already there */
+	if (sched) {
+		rc = netswitch_bh_enqueue(nbp, ring, NULL);
+		if (rc) {
+			vmm_printf("%s: nsw=%s src=%s ring bh enqueue "
+				   "failed.\n", __func__, nsw->name, src->name);
+		}
 	}
 
 	return rc;
 }
 VMM_EXPORT_SYMBOL(vmm_port2switch_xfer_mbuf);
 
+int vmm_netswitch_bh_stats(u32 cpu, struct vmm_netswitch_bh_stats *stats)
+{
+	if ((CONFIG_CPU_COUNT <= cpu) || !vmm_cpu_online(cpu) || !stats) {
+		return VMM_EINVALID;
+	}
+
+	memcpy(stats, &per_cpu(nbctrl, cpu).stats, sizeof(*stats));
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_netswitch_bh_stats);
+
 int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy)
 {
 	int rc = VMM_EBUSY;
@@ -377,12 +495,84 @@ int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy)
 }
 VMM_EXPORT_SYMBOL(vmm_port2switch_xfer_lazy);
 
+static bool netswitch_need_sw_offload(struct vmm_netport *dst,
+				      struct vmm_mbuf *mbuf)
+{
+	u32 need = 0;
+
+	if (mbuf->m_csum_flags & M_CSUM_PARTIAL) {
+		need |= VMM_NETPORT_F_CSUM;
+	}
+
+	switch (mbuf->m_gso_type & M_GSO_TYPE_MASK) {
+	case M_GSO_TCPV4:
+		need |= VMM_NETPORT_F_TSO4;
+		break;
+	case M_GSO_TCPV6:
+		need |= VMM_NETPORT_F_TSO6;
+		break;
+	default:
+		break;
+	};
+	if (mbuf->m_gso_type & M_GSO_ECN) {
+		need |= VMM_NETPORT_F_TSO_ECN;
+	}
+
+	return (dst->features & need) != need;
+}
+
+/*
+ * Destination port cannot take the offloaded frame as-is so do
+ * segmentation and/or checksum in software on private copies.
+ * The original mbuf is shared with other destination ports hence
+ * it is never modified here.
+ */
+static int netswitch_sw_offload_xfer(struct vmm_netport *dst,
+				     struct vmm_mbuf *mbuf)
+{
+	int rc;
+	irq_flags_t f;
+	struct vmm_mbuf *m, *nm;
+	LIST_HEAD(segs);
+
+	if ((mbuf->m_gso_type & M_GSO_TYPE_MASK) != M_GSO_NONE) {
+		rc = m_gso_segment(mbuf, &segs);
+		if (rc) {
+			DPRINTF("%s: dst=%s gso segment failed (error %d)\n",
+				__func__, dst->name, rc);
+			return rc;
+		}
+	} else {
+		m = m_dup(mbuf);
+		if (!m) {
+			return VMM_ENOMEM;
+		}
+		rc = m_csum_help(m);
+		if (rc) {
+			m_freem(m);
+			return rc;
+		}
+		list_add_tail(&m->m_list, &segs);
+	}
+
+	rc = VMM_OK;
+	list_for_each_entry_safe(m, nm, &segs, m_list) {
+		list_del_init(&m->m_list);
+		vmm_spin_lock_irqsave_lite(&dst->switch2port_xfer_lock, f);
+		rc = dst->switch2port_xfer(dst, m);
+		vmm_spin_unlock_irqrestore_lite(&dst->switch2port_xfer_lock, f);
+	}
+
+	return rc;
+}
+
 int vmm_switch2port_xfer_mbuf(struct vmm_netswitch *nsw,
 			      struct vmm_netport *dst,
 			      struct vmm_mbuf *mbuf)
 {
 	int rc;
 	irq_flags_t f;
+	struct vmm_mbuf *lmbuf;
 
 	if (!nsw || !dst || !mbuf) {
 		return VMM_EFAIL;
@@ -395,6 +585,26 @@ int vmm_switch2port_xfer_mbuf(struct vmm_netswitch *nsw,
 		return VMM_OK;
 	}
 
+	/* Frame data referenced through host physical scatter list
+	 * is copied into a linear mbuf for ports which cannot take
+	 * it directly or which need software offload.
+	 */
+	if ((mbuf->m_flags & M_EXT_SG) &&
+	    (!(dst->features & VMM_NETPORT_F_SG) ||
+	     netswitch_need_sw_offload(dst, mbuf))) {
+		lmbuf = m_dup(mbuf);
+		if (!lmbuf) {
+			return VMM_ENOMEM;
+		}
+		rc = vmm_switch2port_xfer_mbuf(nsw, dst, lmbuf);
+		m_freem(lmbuf);
+		return rc;
+	}
+
+	if (netswitch_need_sw_offload(dst, mbuf)) {
+		return netswitch_sw_offload_xfer(dst, mbuf);
+	}
+
 	MADDREFERENCE(mbuf);
 	MCLADDREFERENCE(mbuf);
 
@@ -427,6 +637,13 @@ struct vmm_netswitch *vmm_netswitch_alloc(struct vmm_netswitch_policy *nsp,
 	INIT_RW_LOCK(&nsw->port_list_lock);
 	INIT_LIST_HEAD(&nsw->port_list);
 
+	ARCH_ATOMIC64_INIT(&nsw->stats.rx_frames, 0);
+	ARCH_ATOMIC64_INIT(&nsw->stats.unicast, 0);
+	ARCH_ATOMIC64_INIT(&nsw->stats.flood, 0);
+	ARCH_ATOMIC64_INIT(&nsw->stats.lookup_ns, 0);
+	ARCH_ATOMIC64_INIT(&nsw->stats.learned, 0);
+	ARCH_ATOMIC64_INIT(&nsw->stats.aged, 0);
+
 	goto vmm_netswitch_alloc_done;
 
 vmm_netswitch_alloc_failed:
@@ -506,7 +723,7 @@ static void netswitch_port_remove(struct vmm_netswitch *nsw,
 	/* Flush all xfer request related to this port */
 	for_each_online_cpu(c) {
 		nbp = &per_cpu(nbctrl, c);
-		netswitch_bh_port_flush(nbp, port);
+		netswitch_bh_port_flush(nbp, &port->rings[c]);
 	}
 
 	/* Remove the port from port_list */
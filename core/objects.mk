@@ -69,5 +69,7 @@ core-objs-y+= vmm_chardev.o
 core-objs-y+= vmm_modules.o
 core-objs-y+= vmm_params.o
 core-objs-$(CONFIG_PROFILE)+= vmm_profiler.o
+core-objs-$(CONFIG_PROFILE_SAMPLING)+= vmm_profiler_sample.o
+core-objs-$(CONFIG_TRACE)+= vmm_trace.o
 core-objs-$(CONFIG_LOADBAL)+= vmm_loadbal.o
 core-objs-y+= vmm_extable.o
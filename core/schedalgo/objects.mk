@@ -23,4 +23,5 @@
 
 core-objs-$(CONFIG_SCHEDALGO_PRR) += schedalgo/vmm_schedalgo_prr.o
 core-objs-$(CONFIG_SCHEDALGO_PRM) += schedalgo/vmm_schedalgo_prm.o
+core-objs-$(CONFIG_SCHEDALGO_CFS) += schedalgo/vmm_schedalgo_cfs.o
 
@@ -0,0 +1,414 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_schedalgo_cfs.c
+ * @author agent (agent@local)
+ * @brief implementation of weighted fair-share scheduling algorithm
+ *
+ * Each VCPU accumulates virtual runtime which is its running time
+ * scaled down by its weight. The ready queue is a rbtree sorted by
+ * virtual runtime so the VCPU which got least share of host CPU is
+ * picked next in O(log n). The VCPU weight is derived from priority
+ * and for normal VCPUs also from "sched_weight" attribute of guest
+ * which is shared among all VCPUs of the guest.
+ *
+ * VCPUs with minimum priority (i.e. idle VCPU) are only picked when
+ * there is no other ready VCPU.
+ */
+
+#include <vmm_error.h>
+#include <vmm_heap.h>
+#include <vmm_devtree.h>
+#include <vmm_timer.h>
+#include <vmm_schedalgo.h>
+#include <libs/list.h>
+#include <libs/mathlib.h>
+#include <libs/rbtree.h>
+
+#define CFS_NICE_WEIGHT			1024
+#define CFS_MIN_WEIGHT			2
+#define CFS_SCHED_LATENCY		(2 * VMM_VCPU_DEF_TIME_SLICE)
+#define CFS_MIN_GRANULARITY		(VMM_VCPU_DEF_TIME_SLICE / 4)
+#define CFS_WAKEUP_GRANULARITY		(VMM_VCPU_DEF_TIME_SLICE / 2)
+#define CFS_SLEEPER_CREDIT		(CFS_SCHED_LATENCY / 2)
+
+/* Weight of each priority relative to default priority
+ * (every priority level is roughly 25% more host CPU)
+ */
+static const u32 cfs_prio_to_weight[VMM_VCPU_MAX_PRIORITY + 1] = {
+	/* 0 */ 3,
+	/* 1 */ 655,
+	/* 2 */ 820,
+	/* 3 */ 1024,
+	/* 4 */ 1280,
+	/* 5 */ 1600,
+	/* 6 */ 2000,
+	/* 7 */ 2500,
+};
+
+struct vmm_schedalgo_rq;
+
+struct vmm_schedalgo_rq_entry {
+	struct rb_node rb;
+	struct dlist head;
+	struct vmm_vcpu *vcpu;
+	struct vmm_schedalgo_rq *rq;
+	u64 vruntime;
+	u64 accounted_nsecs;
+	u32 guest_weight;
+	u32 guest_vcpu_count;
+	u32 weight;
+};
+
+struct vmm_schedalgo_rq {
+	struct rb_root root;
+	struct dlist idle_list;
+	u64 min_vruntime;
+	u64 total_weight;
+	u32 count[VMM_VCPU_MAX_PRIORITY+1];
+};
+
+static void cfs_update_weight(struct vmm_schedalgo_rq_entry *e)
+{
+	u32 weight = cfs_prio_to_weight[e->vcpu->priority];
+	struct vmm_guest *guest = e->vcpu->guest;
+
+	/* Guest weight is shared among all its VCPUs */
+	if (e->vcpu->is_normal && guest) {
+		if (e->guest_vcpu_count == guest->vcpu_count) {
+			return;
+		}
+		e->guest_vcpu_count = guest->vcpu_count;
+		weight = udiv64((u64)weight * e->guest_weight,
+				CFS_NICE_WEIGHT);
+		if (e->guest_vcpu_count) {
+			weight = udiv32(weight, e->guest_vcpu_count);
+		}
+	}
+
+	e->weight = (weight < CFS_MIN_WEIGHT) ? CFS_MIN_WEIGHT : weight;
+}
+
+/* Charge running time not yet accounted to virtual runtime */
+static void cfs_update_vruntime(struct vmm_schedalgo_rq_entry *e)
+{
+	u64 delta;
+
+	/* Running time restarts from zero upon VCPU reset */
+	if (e->vcpu->state_running_nsecs < e->accounted_nsecs) {
+		e->accounted_nsecs = 0;
+	}
+
+	delta = e->vcpu->state_running_nsecs - e->accounted_nsecs;
+	if (!delta) {
+		return;
+	}
+	e->accounted_nsecs = e->vcpu->state_running_nsecs;
+
+	if (e->weight == CFS_NICE_WEIGHT) {
+		e->vruntime += delta;
+	} else {
+		e->vruntime += udiv64(delta * CFS_NICE_WEIGHT, e->weight);
+	}
+}
+
+static bool cfs_is_idle(struct vmm_vcpu *vcpu)
+{
+	return (vcpu->priority == VMM_VCPU_MIN_PRIORITY) ? TRUE : FALSE;
+}
+
+int vmm_schedalgo_vcpu_setup(struct vmm_vcpu *vcpu)
+{
+	u32 val;
+	struct vmm_schedalgo_rq_entry *rq_entry;
+
+	if (!vcpu) {
+		return VMM_EFAIL;
+	}
+
+	rq_entry = vmm_zalloc(sizeof(struct vmm_schedalgo_rq_entry));
+	if (!rq_entry) {
+		return VMM_EFAIL;
+	}
+
+	RB_CLEAR_NODE(&rq_entry->rb);
+	INIT_LIST_HEAD(&rq_entry->head);
+	rq_entry->vcpu = vcpu;
+	rq_entry->rq = NULL;
+	rq_entry->vruntime = 0;
+	rq_entry->accounted_nsecs = vcpu->state_running_nsecs;
+	rq_entry->guest_weight = CFS_NICE_WEIGHT;
+	if (vcpu->is_normal && vcpu->guest && vcpu->guest->node &&
+	    (vmm_devtree_read_u32(vcpu->guest->node,
+			VMM_DEVTREE_SCHED_WEIGHT_ATTR_NAME, &val) == VMM_OK) &&
+	    val) {
+		rq_entry->guest_weight = val;
+	}
+	rq_entry->guest_vcpu_count = 0;
+	rq_entry->weight = CFS_NICE_WEIGHT;
+	cfs_update_weight(rq_entry);
+	vcpu->sched_priv = rq_entry;
+
+	return VMM_OK;
+}
+
+int vmm_schedalgo_vcpu_cleanup(struct vmm_vcpu *vcpu)
+{
+	if (!vcpu) {
+		return VMM_EFAIL;
+	}
+
+	if (vcpu->sched_priv) {
+		vmm_free(vcpu->sched_priv);
+		vcpu->sched_priv = NULL;
+	}
+
+	return VMM_OK;
+}
+
+u64 vmm_schedalgo_vcpu_vruntime(struct vmm_vcpu *vcpu)
+{
+	struct vmm_schedalgo_rq_entry *rq_entry;
+
+	if (!vcpu || !vcpu->sched_priv) {
+		return 0;
+	}
+
+	rq_entry = vcpu->sched_priv;
+
+	return rq_entry->vruntime;
+}
+
+int vmm_schedalgo_rq_length(void *rq, u8 priority)
+{
+	struct vmm_schedalgo_rq *rqi = rq;
+
+	if (!rqi) {
+		return -1;
+	}
+
+	return rqi->count[priority];
+}
+
+int vmm_schedalgo_rq_enqueue(void *rq, struct vmm_vcpu *vcpu)
+{
+	u64 lag;
+	struct vmm_schedalgo_rq_entry *rq_entry, *parent_e;
+	struct vmm_schedalgo_rq *rqi = rq;
+	struct rb_node **new = NULL, *parent = NULL;
+
+	if (!rqi || !vcpu) {
+		return VMM_EFAIL;
+	}
+
+	rq_entry = vcpu->sched_priv;
+	if (!rq_entry) {
+		return VMM_EFAIL;
+	}
+
+	cfs_update_weight(rq_entry);
+	cfs_update_vruntime(rq_entry);
+
+	if (cfs_is_idle(vcpu)) {
+		list_add_tail(&rq_entry->head, &rqi->idle_list);
+		rqi->count[vcpu->priority]++;
+		return VMM_OK;
+	}
+
+	/* Virtual runtime is relative to ready queue so keep only
+	 * the lag when VCPU moves to another host CPU.
+	 */
+	if (rq_entry->rq && (rq_entry->rq != rqi)) {
+		lag = (rq_entry->vruntime > rq_entry->rq->min_vruntime) ?
+			rq_entry->vruntime - rq_entry->rq->min_vruntime : 0;
+		rq_entry->vruntime = rqi->min_vruntime + lag;
+	}
+	rq_entry->rq = rqi;
+
+	/* Sleeping VCPUs get bounded credit so that they can run
+	 * soon after wakeup without starving others.
+	 */
+	if ((rq_entry->vruntime + CFS_SLEEPER_CREDIT) < rqi->min_vruntime) {
+		rq_entry->vruntime = rqi->min_vruntime - CFS_SLEEPER_CREDIT;
+	}
+
+	new = &(rqi->root.rb_node);
+	while (*new) {
+		parent = *new;
+		parent_e = rb_entry(parent, struct vmm_schedalgo_rq_entry, rb);
+		if (rq_entry->vruntime < parent_e->vruntime) {
+			new = &parent->rb_left;
+		} else {
+			new = &parent->rb_right;
+		}
+	}
+	rb_link_node(&rq_entry->rb, parent, new);
+	rb_insert_color(&rq_entry->rb, &rqi->root);
+	rqi->total_weight += rq_entry->weight;
+	rqi->count[vcpu->priority]++;
+
+	return VMM_OK;
+}
+
+static void cfs_rq_erase(struct vmm_schedalgo_rq *rqi,
+			 struct vmm_schedalgo_rq_entry *rq_entry)
+{
+	rb_erase(&rq_entry->rb, &rqi->root);
+	RB_CLEAR_NODE(&rq_entry->rb);
+	rqi->total_weight -= rq_entry->weight;
+	rqi->count[rq_entry->vcpu->priority]--;
+}
+
+int vmm_schedalgo_rq_dequeue(void *rq,
+			     struct vmm_vcpu **next,
+			     u64 *next_time_slice)
+{
+	u64 slice, total_weight;
+	struct rb_node *n;
+	struct vmm_schedalgo_rq_entry *rq_entry;
+	struct vmm_schedalgo_rq *rqi = rq;
+
+	if (!rqi) {
+		return VMM_EFAIL;
+	}
+
+	n = rb_first(&rqi->root);
+	if (n) {
+		rq_entry = rb_entry(n, struct vmm_schedalgo_rq_entry, rb);
+		total_weight = rqi->total_weight;
+		cfs_rq_erase(rqi, rq_entry);
+
+		/* Minimum virtual runtime never goes backward */
+		if (rqi->min_vruntime < rq_entry->vruntime) {
+			rqi->min_vruntime = rq_entry->vruntime;
+		}
+
+		/* Share of scheduling latency based on weight */
+		slice = udiv64((u64)CFS_SCHED_LATENCY * rq_entry->weight,
+			       total_weight);
+		if (slice < CFS_MIN_GRANULARITY) {
+			slice = CFS_MIN_GRANULARITY;
+		}
+		if (rq_entry->vcpu->time_slice < slice) {
+			slice = rq_entry->vcpu->time_slice;
+		}
+	} else if (!list_empty(&rqi->idle_list)) {
+		rq_entry = list_first_entry(&rqi->idle_list,
+				struct vmm_schedalgo_rq_entry, head);
+		list_del_init(&rq_entry->head);
+		rqi->count[rq_entry->vcpu->priority]--;
+		slice = rq_entry->vcpu->time_slice;
+	} else {
+		return VMM_ENOTAVAIL;
+	}
+
+	if (next) {
+		*next = rq_entry->vcpu;
+	}
+	if (next_time_slice) {
+		*next_time_slice = slice;
+	}
+
+	return VMM_OK;
+}
+
+int vmm_schedalgo_rq_detach(void *rq, struct vmm_vcpu *vcpu)
+{
+	struct vmm_schedalgo_rq_entry *rq_entry;
+	struct vmm_schedalgo_rq *rqi = rq;
+
+	if (!vcpu || !rqi) {
+		return VMM_EFAIL;
+	}
+
+	rq_entry = vcpu->sched_priv;
+	if (!rq_entry) {
+		return VMM_EFAIL;
+	}
+
+	if (!list_empty(&rq_entry->head)) {
+		list_del_init(&rq_entry->head);
+		rqi->count[vcpu->priority]--;
+	} else if (!RB_EMPTY_NODE(&rq_entry->rb)) {
+		cfs_rq_erase(rqi, rq_entry);
+	} else {
+		return VMM_ENOTAVAIL;
+	}
+
+	return VMM_OK;
+}
+
+bool vmm_schedalgo_rq_prempt_needed(void *rq, struct vmm_vcpu *current)
+{
+	u64 vruntime, running;
+	struct rb_node *n;
+	struct vmm_schedalgo_rq_entry *cur_entry, *rq_entry;
+	struct vmm_schedalgo_rq *rqi = rq;
+
+	if (!rqi || !current || !current->sched_priv) {
+		return FALSE;
+	}
+
+	n = rb_first(&rqi->root);
+	if (!n) {
+		return FALSE;
+	}
+	if (cfs_is_idle(current)) {
+		return TRUE;
+	}
+
+	/* Virtual runtime of current VCPU including ongoing run */
+	cur_entry = current->sched_priv;
+	running = (current->state_running_nsecs > cur_entry->accounted_nsecs) ?
+		current->state_running_nsecs - cur_entry->accounted_nsecs : 0;
+	if (arch_atomic_read(&current->state) == VMM_VCPU_STATE_RUNNING) {
+		running += vmm_timer_timestamp() - current->state_tstamp;
+	}
+	vruntime = cur_entry->vruntime +
+		   udiv64(running * CFS_NICE_WEIGHT, cur_entry->weight);
+
+	rq_entry = rb_entry(n, struct vmm_schedalgo_rq_entry, rb);
+
+	return ((rq_entry->vruntime + CFS_WAKEUP_GRANULARITY) < vruntime) ?
+								TRUE : FALSE;
+}
+
+void *vmm_schedalgo_rq_create(void)
+{
+	struct vmm_schedalgo_rq *rq =
+			vmm_zalloc(sizeof(struct vmm_schedalgo_rq));
+
+	if (rq) {
+		rq->root = RB_ROOT;
+		INIT_LIST_HEAD(&rq->idle_list);
+		rq->min_vruntime = 0;
+		rq->total_weight = 0;
+	}
+
+	return rq;
+}
+
+int vmm_schedalgo_rq_destroy(void *rq)
+{
+	if (rq) {
+		vmm_free(rq);
+		return VMM_OK;
+	}
+
+	return VMM_EFAIL;
+}
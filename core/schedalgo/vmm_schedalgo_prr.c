@@ -69,6 +69,11 @@ int vmm_schedalgo_vcpu_cleanup(struct vmm_vcpu *vcpu)
 	return VMM_OK;
 }
 
+u64 vmm_schedalgo_vcpu_vruntime(struct vmm_vcpu *vcpu)
+{
+	return 0;
+}
+
 int vmm_schedalgo_rq_length(void *rq, u8 priority)
 {
 	struct vmm_schedalgo_rq_entry *rq_entry;
@@ -203,6 +203,8 @@ int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
 		vreq->r.bcnt =
 			udiv32(data_len, vdisk->block_size) * vdisk->blk_factor;
 		vreq->r.data = data;
+		vreq->r.sg = NULL;
+		vreq->r.sg_count = 0;
 		vreq->r.completed = vdisk_req_completed;
 		vreq->r.failed = vdisk_req_failed;
 		vreq->r.priv = NULL;
@@ -220,6 +222,75 @@ int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
 }
 VMM_EXPORT_SYMBOL(vmm_vdisk_submit_request);
 
+bool vmm_vdisk_can_sg(struct vmm_vdisk *vdisk)
+{
+	bool ret;
+	irq_flags_t flags;
+
+	if (!vdisk) {
+		return FALSE;
+	}
+
+	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	ret = (vdisk->blk && (vdisk->blk->flags & VMM_BLOCKDEV_SG)) ?
+							TRUE : FALSE;
+	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+
+	return ret;
+}
+VMM_EXPORT_SYMBOL(vmm_vdisk_can_sg);
+
+int vmm_vdisk_submit_sg_request(struct vmm_vdisk *vdisk,
+				struct vmm_vdisk_request *vreq,
+				enum vmm_vdisk_request_type type,
+				u64 lba, struct vmm_request_sg *sg,
+				u32 sg_count, u32 data_len)
+{
+	int rc;
+	irq_flags_t flags;
+
+	if (!vdisk || !vreq || !sg || !sg_count) {
+		return VMM_EINVALID;
+	}
+	if (data_len < vdisk->block_size) {
+		return VMM_EINVALID;
+	}
+	if ((type < VMM_VDISK_REQUEST_READ) ||
+	    (VMM_VDISK_REQUEST_WRITE < type)) {
+		return VMM_EINVALID;
+	}
+
+	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	if (vdisk->blk && !(vdisk->blk->flags & VMM_BLOCKDEV_SG)) {
+		/* Let caller fallback to vmm_vdisk_submit_request() */
+		rc = VMM_ENOTSUPP;
+	} else if (vdisk->blk) {
+		vreq->vdisk = vdisk;
+		vmm_vdisk_set_request_type(vreq, type);
+		vreq->r.lba = (lba + vdisk->blk->start_lba) * vdisk->blk_factor;
+		vreq->r.bcnt =
+			udiv32(data_len, vdisk->block_size) * vdisk->blk_factor;
+		vreq->r.data = NULL;
+		vreq->r.sg = sg;
+		vreq->r.sg_count = sg_count;
+		vreq->r.completed = vdisk_req_completed;
+		vreq->r.failed = vdisk_req_failed;
+		vreq->r.priv = NULL;
+		rc = vmm_blockdev_submit_request(vdisk->blk, &vreq->r);
+	} else {
+		vdisk->failed(vdisk, vreq);
+		rc = VMM_ENODEV;
+	}
+	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+
+	DPRINTF("%s: vdisk=%s lba=0x%llx bcnt=%d sg_count=%d rc=%d\n",
+		__func__, vdisk->name, (u64)vreq->r.lba, vreq->r.bcnt,
+		sg_count, rc);
+
+	return rc;
+}
+VMM_EXPORT_SYMBOL(vmm_vdisk_submit_sg_request);
+
 int vmm_vdisk_abort_request(struct vmm_vdisk *vdisk,
 			    struct vmm_vdisk_request *vreq)
 {
@@ -40,6 +40,9 @@
 #define	MODULE_INIT		vmm_virtio_core_init
 #define	MODULE_EXIT		vmm_virtio_core_exit
 
+/* Number of descriptors fetched from split ring in one go */
+#define VIRTIO_DESC_BATCH	8
+
 /*
  * virtio_mutex protects entire virtio subsystem and is taken every time
  * virtio device or emulator is registered or unregistered.
@@ -168,6 +171,16 @@ u16 vmm_virtio_queue_pop(struct vmm_virtio_queue *vq)
 	return val;
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_pop);
+
+void vmm_virtio_queue_unpop(struct vmm_virtio_queue *vq, u16 count)
+{
+	if (!vq || !vq->guest) {
+		return;
+	}
+
+	vq->last_avail_idx -= count;
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_unpop);
 /**
  * @description: 检查VirtIO队列中是否有新的描述符可供设备处理
  * @param {vmm_virtio_queue} *vq
@@ -352,6 +365,11 @@ int vmm_virtio_queue_cleanup(struct vmm_virtio_queue *vq)
 	vq->host_addr = 0;
 	vq->total_size = 0;
 
+	if (vq->indirect_desc) {
+		vmm_free(vq->indirect_desc);
+		vq->indirect_desc = NULL;
+	}
+
 done:
 	return VMM_OK;
 }
@@ -407,6 +425,12 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 			   __func__);
 		return VMM_EINVALID;
 	}
+	vq->indirect_desc = vmm_malloc(desc_count *
+				       sizeof(struct vmm_vring_desc));
+	if (!vq->indirect_desc) {
+		return VMM_ENOMEM;
+	}
+
 	// 调用vmm_vring_init函数初始化队列的vring结构
 	vmm_vring_init(&vq->vring, desc_count, NULL, gphys_addr, align);
 	// 设置队列的其他属性，包括它所属的客户机、描述符计数、对齐要求、客户机页面大小等
@@ -425,40 +449,69 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_setup);
 
 /*
- * Each buffer in the virtqueues is actually a chain of descriptors.  This
- * function returns the next descriptor in the chain, max descriptor count
- * if we're at the end.
+ * Each buffer in the virtqueues is actually a chain of descriptors. To
+ * avoid one guest memory read per descriptor, we read a small window of
+ * consecutive descriptors from the split ring (drivers mostly allocate
+ * chains from consecutive free descriptors) and whole indirect tables
+ * in one go.
  */
+struct virtio_desc_window {
+	u32 base;
+	u32 count;
+	struct vmm_vring_desc desc[VIRTIO_DESC_BATCH];
+};
+
+static int virtio_desc_window_get(struct vmm_virtio_queue *vq,
+				  struct virtio_desc_window *win,
+				  u32 idx, struct vmm_vring_desc *desc)
+{
+	u32 ret, count;
+	physical_addr_t desc_pa;
 
-/**
- * @description: 获取VirtIO队列中下一个描述符
- * @param {vmm_virtio_queue} *vq 指向VirtIO队列的指针
- * @param {vmm_vring_desc} *desc 当前描述符
- * @param {u32} i  当前描述符的索引
- * @param {u32} max 描述符数量的上限
- * @return {*}
- */
-static unsigned next_desc(struct vmm_virtio_queue *vq,
-			  struct vmm_vring_desc *desc,
-			  u32 i, u32 max)
-{
-	int rc;
-	u32 next;
-	// 检查当前描述符是否有NEXT标志，即是否有后续描述符
-	if (!(desc->flags & VMM_VRING_DESC_F_NEXT)) {
-		return max;
-	}
-	// 计算下一个描述符的索引
-	next = desc->next;
-	// 从客户机的物理内存中读取下一个描述符的内容
-	rc = vmm_virtio_queue_get_desc(vq, next, desc);
-	if (rc) {
-		vmm_printf("%s: failed to get descriptor next=%d error=%d\n",
-			   __func__, next, rc);
-		return max;
+	if ((idx < win->base) || ((win->base + win->count) <= idx)) {
+		count = vq->desc_count - idx;
+		if (VIRTIO_DESC_BATCH < count) {
+			count = VIRTIO_DESC_BATCH;
+		}
+		desc_pa = vq->vring.desc_pa + idx * sizeof(*desc);
+		ret = vmm_guest_memory_read(vq->guest, desc_pa, win->desc,
+					    count * sizeof(*desc), TRUE);
+		if (ret != (count * sizeof(*desc))) {
+			win->count = 0;
+			return VMM_EIO;
+		}
+		win->base = idx;
+		win->count = count;
+	}
+
+	memcpy(desc, &win->desc[idx - win->base], sizeof(*desc));
+
+	return VMM_OK;
+}
+
+static int virtio_indirect_table_read(struct vmm_virtio_queue *vq,
+				      struct vmm_vring_desc *desc,
+				      u32 *ret_count)
+{
+	u32 ret, count;
+
+	if (!desc->len || (desc->len % sizeof(*desc))) {
+		return VMM_EINVALID;
+	}
+	count = desc->len / sizeof(*desc);
+	if (vq->desc_count < count) {
+		return VMM_EINVALID;
 	}
 
-	return next;
+	ret = vmm_guest_memory_read(vq->guest, desc->addr,
+				    vq->indirect_desc, desc->len, TRUE);
+	if (ret != desc->len) {
+		return VMM_EIO;
+	}
+
+	*ret_count = count;
+
+	return VMM_OK;
 }
 
 /**
@@ -476,9 +529,11 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 				    u32 *ret_iov_cnt, u32 *ret_total_len,
 				    u16 *ret_head)
 {
-	int i, rc = VMM_OK;
-	u16 idx, max;
+	int rc = VMM_EINVALID;
+	u32 i, idx, max;
+	bool indirect = FALSE;
 	struct vmm_vring_desc desc;
+	struct virtio_desc_window win;
 
 	if (!vq || !vq->guest || !iov) {
 		goto fail;
@@ -497,29 +552,44 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 	}
 	// 获取队列中描述符的最大数量
 	max = vmm_virtio_queue_max_desc(vq);
+	if (max <= idx) {
+		vmm_printf("%s: invalid head=%d\n", __func__, idx);
+		goto fail;
+	}
 	// 从队列中获取头描述符
-	rc = vmm_virtio_queue_get_desc(vq, idx, &desc);
+	win.base = 0;
+	win.count = 0;
+	rc = virtio_desc_window_get(vq, &win, idx, &desc);
 	if (rc) {
 		vmm_printf("%s: failed to get descriptor idx=%d error=%d\n",
 			   __func__, idx, rc);
 		goto fail;
 	}
-	//如果头描述符是一个间接描述符（即它引用了另一组描述符），则当前不支持处理，函数会返回不支持的错误
+	// 间接描述符: 一次读取整个描述符表
 	if (desc.flags & VMM_VRING_DESC_F_INDIRECT) {
-#if 0
-		max = desc[idx].len / sizeof(struct vring_desc);
-		desc = guest_flat_to_host(kvm, desc[idx].addr);
+		rc = virtio_indirect_table_read(vq, &desc, &max);
+		if (rc) {
+			vmm_printf("%s: failed to read indirect table "
+				   "idx=%d error=%d\n", __func__, idx, rc);
+			goto fail;
+		}
+		indirect = TRUE;
 		idx = 0;
-#endif
-		vmm_printf("%s: indirect descriptor not supported idx=%d\n",
-			   __func__, idx);
-		rc = VMM_ENOTSUPP;
-		goto fail;
+		memcpy(&desc, &vq->indirect_desc[0], sizeof(desc));
 	}
 
 	i = 0;
-	/*循环通过调用next_desc函数遍历描述符链，直到到达链尾*/
-	do {
+	/*遍历描述符链，直到到达链尾*/
+	while (1) {
+		/* Chain can never be longer than queue size */
+		if ((vq->desc_count <= i) ||
+		    (indirect && (desc.flags & VMM_VRING_DESC_F_INDIRECT))) {
+			vmm_printf("%s: invalid descriptor chain head=%d\n",
+				   __func__, head);
+			rc = VMM_EINVALID;
+			goto fail;
+		}
+
 		//在循环中，每个描述符的地址和长度被存储到iov数组中
 		iov[i].addr = desc.addr;
 		iov[i].len = desc.len;
@@ -534,8 +604,31 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 			iov[i].flags = 0; /* Read */
 		}
 
-		i++; //更新返回的总长度
-	} while ((idx = next_desc(vq, &desc, idx, max)) != max);
+		i++;
+
+		if (!(desc.flags & VMM_VRING_DESC_F_NEXT)) {
+			break;
+		}
+
+		idx = desc.next;
+		if (max <= idx) {
+			vmm_printf("%s: invalid next=%d head=%d\n",
+				   __func__, idx, head);
+			rc = VMM_EINVALID;
+			goto fail;
+		}
+		if (indirect) {
+			memcpy(&desc, &vq->indirect_desc[idx], sizeof(desc));
+		} else {
+			rc = virtio_desc_window_get(vq, &win, idx, &desc);
+			if (rc) {
+				vmm_printf("%s: failed to get descriptor "
+					   "next=%d error=%d\n",
+					   __func__, idx, rc);
+				goto fail;
+			}
+		}
+	}
 
 	if (ret_iov_cnt) {
 		*ret_iov_cnt = i;
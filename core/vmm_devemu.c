@@ -27,9 +27,12 @@
 #include <vmm_host_io.h>
 #include <vmm_host_irq.h>
 #include <vmm_mutex.h>
+#include <vmm_notifier.h>
 #include <vmm_guest_aspace.h>
 #include <vmm_devemu.h>
 #include <vmm_devemu_debug.h>
+#include <vmm_trace.h>
+#include <arch_atomic.h>
 #include <libs/stringlib.h>
 
 struct vmm_devemu_guest_irq {
@@ -41,6 +44,7 @@ struct vmm_devemu_guest_irq {
 struct vmm_devemu_guest_context {
 	u32 g_irq_count;
 	struct dlist *g_irq;
+	atomic_t reg_gen;
 };
 
 struct vmm_devemu_ctrl {
@@ -412,6 +416,98 @@ static int devemu_dowrite(struct vmm_emudev *edev,
 	return rc;
 }
 
+static void devemu_rcache_flush(struct vmm_vcpu_rcache *rc, u32 gen)
+{
+	u32 i;
+
+	for (i = 0; i < CONFIG_VGPA2REG_CACHE_SIZE; i++) {
+		rc->ent[i].reg = NULL;
+	}
+	rc->victim = 0;
+	rc->gen = gen;
+}
+
+/*
+ * Find virtual region using per-VCPU region lookup cache.
+ *
+ * The cache is only accessed from the VCPU's own context so it
+ * requires no locking. Cached entries are dropped whenever the
+ * region generation of the guest changes (i.e. region added or
+ * deleted) hence stale regions are never returned.
+ */
+static struct vmm_region *devemu_find_region(struct vmm_vcpu *vcpu,
+					     physical_addr_t gphys_addr,
+					     u32 reg_flags)
+{
+	u32 i, gen;
+	struct vmm_region *reg;
+	struct vmm_vcpu_rcache *rc = &vcpu->rcache;
+	struct vmm_vcpu_rcache_entry *e;
+	struct vmm_devemu_guest_context *eg = vcpu->guest->aspace.devemu_priv;
+
+	if (!eg) {
+		return vmm_guest_find_region(vcpu->guest, gphys_addr,
+					     reg_flags, FALSE);
+	}
+
+	gen = arch_atomic_read(&eg->reg_gen);
+	if (rc->gen != gen) {
+		devemu_rcache_flush(rc, gen);
+	}
+
+	for (i = 0; i < CONFIG_VGPA2REG_CACHE_SIZE; i++) {
+		e = &rc->ent[i];
+		if (e->reg && (e->reg_flags == reg_flags) &&
+		    (e->start <= gphys_addr) && (gphys_addr < e->end)) {
+			rc->hit_count++;
+			return e->reg;
+		}
+	}
+	rc->miss_count++;
+
+	reg = vmm_guest_find_region(vcpu->guest, gphys_addr,
+				    reg_flags, FALSE);
+	if (reg) {
+		e = &rc->ent[rc->victim];
+		e->start = VMM_REGION_GPHYS_START(reg);
+		e->end = VMM_REGION_GPHYS_END(reg);
+		e->reg_flags = reg_flags;
+		e->reg = reg;
+		rc->victim++;
+		if (rc->victim >= CONFIG_VGPA2REG_CACHE_SIZE) {
+			rc->victim = 0;
+		}
+	}
+
+	return reg;
+}
+
+void vmm_devemu_vcpu_rcache_init(struct vmm_vcpu *vcpu)
+{
+	if (!vcpu) {
+		return;
+	}
+
+	devemu_rcache_flush(&vcpu->rcache, 0);
+	vcpu->rcache.hit_count = 0;
+	vcpu->rcache.miss_count = 0;
+}
+
+void vmm_devemu_vcpu_rcache_stats(struct vmm_vcpu *vcpu,
+				  u64 *hit_count, u64 *miss_count)
+{
+	if (!vcpu) {
+		return;
+	}
+
+	if (hit_count) {
+		*hit_count = vcpu->rcache.hit_count;
+	}
+	if (miss_count) {
+		*miss_count = vcpu->rcache.miss_count;
+	}
+}
+
 int vmm_devemu_emulate_read(struct vmm_vcpu *vcpu,
 			    physical_addr_t gphys_addr,
 			    void *dst, u32 dst_len,
@@ -424,8 +520,8 @@ int vmm_devemu_emulate_read(struct vmm_vcpu *vcpu,
 		return VMM_EFAIL;
 	}
 
-	reg = vmm_guest_find_region(vcpu->guest, gphys_addr,
-			VMM_REGION_VIRTUAL | VMM_REGION_MEMORY, FALSE);
+	reg = devemu_find_region(vcpu, gphys_addr,
+				 VMM_REGION_VIRTUAL | VMM_REGION_MEMORY);
 	if (!reg) {
 		rc = VMM_ENOTAVAIL;
 		goto skip;
@@ -435,6 +531,7 @@ int vmm_devemu_emulate_read(struct vmm_vcpu *vcpu,
 			   gphys_addr - reg->gphys_addr,
 			   dst, dst_len, dst_endian);
 skip:
+	vmm_trace(VMM_TRACE_MMIO_READ, vcpu, gphys_addr, dst_len, rc);
 	if (rc) {
 		vmm_printf("%s: vcpu=%s gphys=0x%"PRIPADDR" dst_len=%d "
 			   "failed (error %d)\n", __func__,
@@ -457,8 +554,8 @@ int vmm_devemu_emulate_write(struct vmm_vcpu *vcpu,
 		return VMM_EFAIL;
 	}
 
-	reg = vmm_guest_find_region(vcpu->guest, gphys_addr,
-			VMM_REGION_VIRTUAL | VMM_REGION_MEMORY, FALSE);
+	reg = devemu_find_region(vcpu, gphys_addr,
+				 VMM_REGION_VIRTUAL | VMM_REGION_MEMORY);
 	if (!reg) {
 		rc = VMM_ENOTAVAIL;
 		goto skip;
@@ -468,6 +565,7 @@ int vmm_devemu_emulate_write(struct vmm_vcpu *vcpu,
 			    gphys_addr - reg->gphys_addr,
 			    src, src_len, src_endian);
 skip:
+	vmm_trace(VMM_TRACE_MMIO_WRITE, vcpu, gphys_addr, src_len, rc);
 	if (rc) {
 		vmm_printf("%s: vcpu=%s gphys=0x%"PRIPADDR" src_len=%d "
 			   "failed (error %d)\n", __func__,
@@ -490,8 +588,8 @@ int vmm_devemu_emulate_ioread(struct vmm_vcpu *vcpu,
 		return VMM_EFAIL;
 	}
 
-	reg = vmm_guest_find_region(vcpu->guest, gphys_addr,
-			VMM_REGION_VIRTUAL | VMM_REGION_IO, FALSE);
+	reg = devemu_find_region(vcpu, gphys_addr,
+				 VMM_REGION_VIRTUAL | VMM_REGION_IO);
 	if (!reg) {
 		rc = VMM_ENOTAVAIL;
 		goto skip;
@@ -523,8 +621,8 @@ int vmm_devemu_emulate_iowrite(struct vmm_vcpu *vcpu,
 		return VMM_EFAIL;
 	}
 
-	reg = vmm_guest_find_region(vcpu->guest, gphys_addr,
-			VMM_REGION_VIRTUAL | VMM_REGION_IO, FALSE);
+	reg = devemu_find_region(vcpu, gphys_addr,
+				 VMM_REGION_VIRTUAL | VMM_REGION_IO);
 	if (!reg) {
 		rc = VMM_ENOTAVAIL;
 		goto skip;
@@ -1398,6 +1496,7 @@ int vmm_devemu_init_context(struct vmm_guest *guest)
 
 	eg->g_irq = NULL;
 	eg->g_irq_count = 0;
+	ARCH_ATOMIC_INIT(&eg->reg_gen, 0);
 	rc = vmm_devtree_read_u32(guest->aspace.node,
 				  VMM_DEVTREE_GUESTIRQCNT_ATTR_NAME,
 				  &eg->g_irq_count);
@@ -1448,6 +1547,34 @@ int vmm_devemu_deinit_context(struct vmm_guest *guest)
 	return rc;
 }
 
+static int devemu_aspace_notification(struct vmm_notifier_block *nb,
+				      unsigned long evt, void *data)
+{
+	struct vmm_guest_aspace_event *edata = data;
+	struct vmm_devemu_guest_context *eg;
+
+	switch (evt) {
+	case VMM_GUEST_ASPACE_EVENT_ADD_REGION:
+	case VMM_GUEST_ASPACE_EVENT_DEL_REGION:
+		eg = edata->guest->aspace.devemu_priv;
+		if (!eg) {
+			return NOTIFY_DONE;
+		}
+		/* Invalidate region lookup cache of all VCPUs */
+		arch_atomic_add(&eg->reg_gen, 1);
+		return NOTIFY_OK;
+	default:
+		break;
+	};
+
+	return NOTIFY_DONE;
+}
+
+static struct vmm_notifier_block devemu_aspace_nb = {
+	.notifier_call = devemu_aspace_notification,
+	.priority = 0,
+};
+
 int __init vmm_devemu_init(void)
 {
 	memset(&dectrl, 0, sizeof(dectrl));
@@ -1461,5 +1588,5 @@ int __init vmm_devemu_init(void)
 	INIT_MUTEX(&dectrl.emu_lock);
 	INIT_LIST_HEAD(&dectrl.emu_list);
 
-	return VMM_OK;
+	return vmm_guest_aspace_register_client(&devemu_aspace_nb);
 }
@@ -34,6 +34,10 @@
 #include <vmm_guest_aspace.h>
 #include <vmm_stdio.h>
 #include <vmm_notifier.h>
+#include <vmm_host_vapool.h>
+#include <vmm_cache.h>
+#include <arch_cpu_aspace.h>
+#include <arch_atomic64.h>
 #include <arch_guest.h>
 #include <libs/stringlib.h>
 #include <libs/mathlib.h>
@@ -315,6 +319,128 @@ int vmm_guest_overwrite_real_device_mapping(struct vmm_guest *guest,
 	return VMM_OK;
 }
 
+#ifdef CONFIG_GUEST_RAM_HOSTMAP
+static bool region_hostmap_possible(struct vmm_region *reg)
+{
+	if ((reg->flags & (VMM_REGION_ALIAS | VMM_REGION_VIRTUAL)) ||
+	    !(reg->flags & VMM_REGION_REAL) ||
+	    !(reg->flags & VMM_REGION_MEMORY) ||
+	    !(reg->flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM))) {
+		return FALSE;
+	}
+
+	if ((reg->phys_size & VMM_PAGE_MASK) ||
+	    (reg->map_order < VMM_PAGE_SHIFT)) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void region_hostmap_unmap(struct vmm_region *reg,
+				 virtual_addr_t va, virtual_size_t sz)
+{
+	virtual_addr_t off;
+
+	for (off = 0; off < sz; off += VMM_PAGE_SIZE) {
+		arch_cpu_aspace_unmap(va + off);
+	}
+}
+
+static void region_hostmap_create(struct vmm_guest *guest,
+				  struct vmm_region *reg)
+{
+	u32 i;
+	int rc;
+	virtual_addr_t va, map_va, off;
+	physical_size_t map_size;
+
+	reg->hmap_va = 0;
+
+	if (!region_hostmap_possible(reg)) {
+		return;
+	}
+
+	/* Not having enough VAPOOL space is not fatal */
+	if (vmm_host_vapool_alloc(&va, reg->phys_size)) {
+		return;
+	}
+
+	for (i = 0; i < reg->maps_count; i++) {
+		map_va = va + mapping_gphys_offset(reg, i);
+		map_size = mapping_phys_size(reg, i);
+		for (off = 0; off < map_size; off += VMM_PAGE_SIZE) {
+			rc = arch_cpu_aspace_map(map_va + off, VMM_PAGE_SIZE,
+						 reg->maps[i].hphys_addr + off,
+						 VMM_MEMORY_FLAGS_NORMAL);
+			if (rc) {
+				vmm_printf("%s: Failed to map %s/%s in host "
+					   "(error %d)\n", __func__,
+					   guest->name, reg->node->name, rc);
+				region_hostmap_unmap(reg, va,
+						     (map_va + off) - va);
+				vmm_host_vapool_free(va, reg->phys_size);
+				return;
+			}
+		}
+	}
+
+	reg->hmap_va = va;
+}
+
+static void region_hostmap_destroy(struct vmm_guest *guest,
+				   struct vmm_region *reg)
+{
+	if (!reg->hmap_va) {
+		return;
+	}
+
+	region_hostmap_unmap(reg, reg->hmap_va, reg->phys_size);
+	vmm_host_vapool_free(reg->hmap_va, reg->phys_size);
+	reg->hmap_va = 0;
+}
+
+static u32 region_hostmap_copy(struct vmm_region *reg,
+			       physical_addr_t gphys_addr,
+			       void *buf, u32 len,
+			       bool cacheable, bool is_write)
+{
+	virtual_addr_t va;
+	physical_size_t avail;
+
+	if (!reg->hmap_va ||
+	    (gphys_addr < VMM_REGION_GPHYS_START(reg)) ||
+	    (VMM_REGION_GPHYS_END(reg) <= gphys_addr)) {
+		return 0;
+	}
+
+	avail = VMM_REGION_GPHYS_END(reg) - gphys_addr;
+	if (avail < len) {
+		len = avail;
+	}
+	va = reg->hmap_va + (gphys_addr - VMM_REGION_GPHYS_START(reg));
+
+	/*
+	 * The persistent mapping is always cacheable so for
+	 * non-cacheable access we flush the touched lines to
+	 * make memory and caches agree.
+	 */
+	if (is_write) {
+		memcpy((void *)va, buf, len);
+		if (!cacheable) {
+			vmm_flush_dcache_range(va, va + len);
+		}
+	} else {
+		if (!cacheable) {
+			vmm_flush_dcache_range(va, va + len);
+		}
+		memcpy(buf, (void *)va, len);
+	}
+
+	return len;
+}
+#endif
+
 u32 vmm_guest_memory_read(struct vmm_guest *guest,
 			  physical_addr_t gphys_addr,
 			  void *dst, u32 len, bool cacheable)
@@ -335,6 +461,19 @@ u32 vmm_guest_memory_read(struct vmm_guest *guest,
 			break;
 		}
 
+#ifdef CONFIG_GUEST_RAM_HOSTMAP
+		to_read = region_hostmap_copy(reg, gphys_addr, dst,
+					      len - bytes_read,
+					      cacheable, FALSE);
+		if (to_read) {
+			arch_atomic64_add(&guest->aspace.hmap_copy_count, 1);
+			gphys_addr += to_read;
+			bytes_read += to_read;
+			dst += to_read;
+			continue;
+		}
+#endif
+
 		vmm_guest_find_mapping(guest, reg, gphys_addr,
 				       &hphys_addr, &avail_size);
 		to_read = (avail_size < U32_MAX) ? avail_size : U32_MAX;
@@ -346,6 +485,7 @@ u32 vmm_guest_memory_read(struct vmm_guest *guest,
 		if (!to_read) {
 			break;
 		}
+		arch_atomic64_add(&guest->aspace.legacy_copy_count, 1);
 
 		gphys_addr += to_read;
 		bytes_read += to_read;
@@ -375,6 +515,19 @@ u32 vmm_guest_memory_write(struct vmm_guest *guest,
 			break;
 		}
 
+#ifdef CONFIG_GUEST_RAM_HOSTMAP
+		to_write = region_hostmap_copy(reg, gphys_addr, src,
+					       len - bytes_written,
+					       cacheable, TRUE);
+		if (to_write) {
+			arch_atomic64_add(&guest->aspace.hmap_copy_count, 1);
+			gphys_addr += to_write;
+			bytes_written += to_write;
+			src += to_write;
+			continue;
+		}
+#endif
+
 		vmm_guest_find_mapping(guest, reg, gphys_addr,
 				       &hphys_addr, &avail_size);
 		to_write = (avail_size < U32_MAX) ? avail_size : U32_MAX;
@@ -386,6 +539,7 @@ u32 vmm_guest_memory_write(struct vmm_guest *guest,
 		if (!to_write) {
 			break;
 		}
+		arch_atomic64_add(&guest->aspace.legacy_copy_count, 1);
 
 		gphys_addr += to_write;
 		bytes_written += to_write;
@@ -395,6 +549,23 @@ u32 vmm_guest_memory_write(struct vmm_guest *guest,
 	return bytes_written;
 }
 
+void vmm_guest_memory_copy_stats(struct vmm_guest *guest,
+				 u64 *hmap_count, u64 *legacy_count)
+{
+	if (!guest) {
+		return;
+	}
+
+	if (hmap_count) {
+		*hmap_count =
+			arch_atomic64_read(&guest->aspace.hmap_copy_count);
+	}
+	if (legacy_count) {
+		*legacy_count =
+			arch_atomic64_read(&guest->aspace.legacy_copy_count);
+	}
+}
+
 int vmm_guest_physical_map(struct vmm_guest *guest,
 			   physical_addr_t gphys_addr,
 			   physical_size_t gphys_size,
@@ -693,6 +864,7 @@ static int region_add(struct vmm_guest *guest,
 	struct vmm_region *reg = NULL, *pnode_reg = NULL;
 	struct vmm_guest_aspace *aspace = &guest->aspace;
 	struct vmm_region *reg_overlap = NULL;
+	struct vmm_guest_aspace_event evt;
 
 	/* Increment ref count of region node */
 	vmm_devtree_ref_node(rnode);
@@ -788,6 +960,13 @@ static int region_add(struct vmm_guest *guest,
 		reg->flags |= VMM_REGION_CACHEABLE;
 		reg->flags |= VMM_REGION_BUFFERABLE;
 	}
+	if ((reg->flags & VMM_REGION_REAL) &&
+	    (reg->flags & VMM_REGION_MEMORY) &&
+	    (reg->flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM)) &&
+	    vmm_devtree_getattr(reg->node,
+				VMM_DEVTREE_PREPOPULATE_ATTR_NAME)) {
+		reg->flags |= VMM_REGION_PREPOPULATE;
+	}
 
 	/* Determine region guest physical address */
 	rc = vmm_devtree_read_physaddr(reg->node,
@@ -1066,6 +1245,11 @@ static int region_add(struct vmm_guest *guest,
 		goto region_unprobe_fail;
 	}
 
+#ifdef CONFIG_GUEST_RAM_HOSTMAP
+	/* Create persistent host mapping for RAM/ROM regions */
+	region_hostmap_create(guest, reg);
+#endif
+
 	/* Add region to tree and probe list */
 	if (reg->flags & VMM_REGION_IO) {
 		root = &aspace->reg_iotree;
@@ -1100,6 +1284,16 @@ static int region_add(struct vmm_guest *guest,
 	}
 	vmm_write_unlock_irqrestore_lite(root_lock, flags);
 
+	/*
+	 * Notify the listeners about new region.
+	 * No locks taken at this point.
+	 */
+	evt.guest = guest;
+	evt.data = reg;
+	vmm_blocking_notifier_call(&guest_aspace_notifier_chain,
+				   VMM_GUEST_ASPACE_EVENT_ADD_REGION,
+				   &evt);
+
 	if (new_reg) {
 		*new_reg = reg;
 	}
@@ -1107,6 +1301,9 @@ static int region_add(struct vmm_guest *guest,
 	return VMM_OK;
 
 region_arch_del_fail:
+#ifdef CONFIG_GUEST_RAM_HOSTMAP
+	region_hostmap_destroy(guest, reg);
+#endif
 	arch_guest_del_region(guest, reg);
 region_unprobe_fail:
 	if ((reg->flags & VMM_REGION_ISDEVICE) &&
@@ -1152,6 +1349,7 @@ static int region_del(struct vmm_guest *guest,
 	struct rb_root *root = NULL;
 	struct vmm_devtree_node *rnode = reg->node;
 	struct vmm_guest_aspace *aspace = &guest->aspace;
+	struct vmm_guest_aspace_event evt;
 
 	/* Remove it from region tree if not removed already */
 	if (del_reg_tree) {
@@ -1167,6 +1365,17 @@ static int region_del(struct vmm_guest *guest,
 		vmm_write_unlock_irqrestore_lite(root_lock, flags);
 	}
 
+	/*
+	 * Notify the listeners that region is no more reachable
+	 * from region tree. Region is still valid at this point.
+	 * No locks taken at this point.
+	 */
+	evt.guest = guest;
+	evt.data = reg;
+	vmm_blocking_notifier_call(&guest_aspace_notifier_chain,
+				   VMM_GUEST_ASPACE_EVENT_DEL_REGION,
+				   &evt);
+
 	/* Remove it from probe list if not removed already */
 	if (del_probe_list) {
 		if (reg->flags & VMM_REGION_IO) {
@@ -1179,6 +1388,11 @@ static int region_del(struct vmm_guest *guest,
 		vmm_write_unlock_irqrestore_lite(root_lock, flags);
 	}
 
+#ifdef CONFIG_GUEST_RAM_HOSTMAP
+	/* Destroy persistent host mapping of region */
+	region_hostmap_destroy(guest, reg);
+#endif
+
 	/* Call arch specific del region callback */
 	rc = arch_guest_del_region(guest, reg);
 	if (rc) {
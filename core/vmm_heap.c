@@ -30,7 +30,11 @@
 #include <vmm_stdio.h>
 #include <vmm_host_vapool.h>
 #include <vmm_host_aspace.h>
+#include <vmm_smp.h>
+#include <vmm_scheduler.h>
+#include <arch_cpu_irq.h>
 #include <libs/stringlib.h>
+#include <libs/mathlib.h>
 #include <libs/buddy.h>
 
 struct vmm_heap_control {
@@ -50,6 +54,57 @@ static struct vmm_heap_control dma_heap;
 #define HEAP_MIN_BIN		(VMM_CACHE_LINE_SHIFT)
 #define HEAP_MAX_BIN		(VMM_PAGE_SHIFT)
 
+#ifdef CONFIG_HEAP_MAGAZINE
+
+/*
+ * Per-CPU magazine layer for small Normal heap allocations.
+ *
+ * Each power-of-two size class from HEAP_MIN_BIN to HEAP_MAX_BIN has
+ * a per-CPU object stack which can hold two magazines worth objects.
+ * When the stack is empty we refill one magazine from the depot (or
+ * buddy heap) and when the stack is full we drain one magazine to the
+ * depot (or buddy heap). Per-CPU stacks are only accessed with IRQs
+ * disabled on owner CPU hence require no locking.
+ *
+ * Objects cached in magazines are still allocated as far as buddy
+ * heap is concerned. To find size class at free time we keep one
+ * tag byte for every HEAP_MIN_BIN sized block of heap memory. The
+ * tag also marks objects sitting in magazines to catch double free.
+ * When buddy heap runs out, all magazines are flushed back to it.
+ */
+
+#define HEAP_MAG_CLASSES	(HEAP_MAX_BIN - HEAP_MIN_BIN + 1)
+#define HEAP_MAG_SIZE		CONFIG_HEAP_MAGAZINE_SIZE
+#define HEAP_MAG_DEPOT_MAX	CONFIG_HEAP_MAGAZINE_DEPOT_SIZE
+#define HEAP_MAG_TAG_CACHED	0x80
+
+struct heap_mag_cpu {
+	u32 count[HEAP_MAG_CLASSES];
+	void *objs[HEAP_MAG_CLASSES][2 * HEAP_MAG_SIZE];
+	u64 alloc_hit;
+	u64 alloc_miss;
+	u64 free_hit;
+	u64 free_miss;
+} __cacheline_aligned;
+
+struct heap_mag_depot {
+	vmm_spinlock_t lock;
+	/* Magazines chained via second word of first object */
+	void *mags;
+	u32 mag_count;
+};
+
+struct heap_mag_control {
+	bool enabled;
+	u8 *tags;
+	unsigned long tags_count;
+	struct heap_mag_depot depot[HEAP_MAG_CLASSES];
+	struct heap_mag_cpu cpu[CONFIG_CPU_COUNT];
+};
+
+static struct heap_mag_control heap_mag;
+#endif
+
 static void *heap_malloc(struct vmm_heap_control *heap,
 			 virtual_size_t size)
 {
@@ -239,8 +294,331 @@ fail_free_pages:
 	return rc;
 }
 
+#ifdef CONFIG_HEAP_MAGAZINE
+static inline u8 *heap_mag_tag(struct vmm_heap_control *heap, const void *ptr)
+{
+	unsigned long off;
+
+	if ((ptr < heap->mem_start) ||
+	    ((heap->mem_start + heap->mem_size) <= ptr)) {
+		return NULL;
+	}
+
+	off = (unsigned long)ptr - (unsigned long)heap->mem_start;
+	if (off & (VMM_CACHE_LINE_SIZE - 1)) {
+		return NULL;
+	}
+
+	return &heap_mag.tags[off >> HEAP_MIN_BIN];
+}
+
+/* Build a magazine by chaining objects via their first word */
+static void *heap_mag_chain(void **objs, u32 count)
+{
+	u32 i;
+
+	for (i = 0; i < count; i++) {
+		*(void **)objs[i] = (i + 1 < count) ? objs[i + 1] : NULL;
+	}
+
+	return (count) ? objs[0] : NULL;
+}
+
+static void heap_mag_release(struct vmm_heap_control *heap, void *mag)
+{
+	u8 *tag;
+	void *obj;
+
+	while (mag) {
+		obj = mag;
+		mag = *(void **)obj;
+		tag = heap_mag_tag(heap, obj);
+		if (tag) {
+			*tag = 0;
+		}
+		heap_free(heap, obj);
+	}
+}
+
+/* NOTE: Must be called with IRQs disabled */
+static u32 heap_mag_refill(struct vmm_heap_control *heap,
+			   struct heap_mag_cpu *mc, u32 c)
+{
+	int rc;
+	u32 i;
+	u8 *tag;
+	void *mag = NULL;
+	unsigned long addr;
+	struct heap_mag_depot *d = &heap_mag.depot[c];
+
+	vmm_spin_lock_lite(&d->lock);
+	if (d->mags) {
+		mag = d->mags;
+		d->mags = ((void **)mag)[1];
+		d->mag_count--;
+	}
+	vmm_spin_unlock_lite(&d->lock);
+
+	i = 0;
+	if (mag) {
+		while (mag && (i < HEAP_MAG_SIZE)) {
+			mc->objs[c][i++] = mag;
+			mag = *(void **)mag;
+		}
+	} else {
+		while (i < HEAP_MAG_SIZE) {
+			rc = buddy_mem_alloc(&heap->ba,
+				(1UL << (c + HEAP_MIN_BIN)), &addr);
+			if (rc) {
+				break;
+			}
+			tag = heap_mag_tag(heap, (void *)addr);
+			BUG_ON(!tag);
+			*tag = (c + 1) | HEAP_MAG_TAG_CACHED;
+			mc->objs[c][i++] = (void *)addr;
+		}
+	}
+	mc->count[c] = i;
+
+	return i;
+}
+
+/* NOTE: Must be called with IRQs disabled */
+static void heap_mag_drain(struct vmm_heap_control *heap,
+			   struct heap_mag_cpu *mc, u32 c)
+{
+	void *mag;
+	struct heap_mag_depot *d = &heap_mag.depot[c];
+
+	mc->count[c] -= HEAP_MAG_SIZE;
+	mag = heap_mag_chain(&mc->objs[c][mc->count[c]], HEAP_MAG_SIZE);
+
+	vmm_spin_lock_lite(&d->lock);
+	if (d->mag_count < HEAP_MAG_DEPOT_MAX) {
+		((void **)mag)[1] = d->mags;
+		d->mags = mag;
+		d->mag_count++;
+		mag = NULL;
+	}
+	vmm_spin_unlock_lite(&d->lock);
+
+	/* Depot is full so give objects back to buddy heap */
+	heap_mag_release(heap, mag);
+}
+
+static void heap_mag_flush_cpu(void *arg0, void *arg1, void *arg2)
+{
+	u32 c;
+	irq_flags_t flags;
+	struct heap_mag_cpu *mc;
+	struct vmm_heap_control *heap = arg0;
+
+	arch_cpu_irq_save(flags);
+
+	mc = &heap_mag.cpu[vmm_smp_processor_id()];
+	for (c = 0; c < HEAP_MAG_CLASSES; c++) {
+		heap_mag_release(heap,
+				 heap_mag_chain(mc->objs[c], mc->count[c]));
+		mc->count[c] = 0;
+	}
+
+	arch_cpu_irq_restore(flags);
+}
+
+/* Give objects cached by this CPU and depot back to buddy heap.
+ * Other CPUs flush their magazines asynchronously so we never wait
+ * on remote CPUs from the allocator.
+ */
+static void heap_mag_flush(struct vmm_heap_control *heap)
+{
+	u32 c;
+	void *mag, *next;
+	irq_flags_t flags;
+	struct heap_mag_depot *d;
+
+	if (vmm_scheduler_irq_context() || arch_cpu_irq_disabled()) {
+		heap_mag_flush_cpu(heap, NULL, NULL);
+	} else {
+		/* Runs inline for this CPU */
+		vmm_smp_ipi_async_call(cpu_online_mask,
+				       heap_mag_flush_cpu, heap, NULL, NULL);
+	}
+
+	for (c = 0; c < HEAP_MAG_CLASSES; c++) {
+		d = &heap_mag.depot[c];
+
+		vmm_spin_lock_irqsave_lite(&d->lock, flags);
+		mag = d->mags;
+		d->mags = NULL;
+		d->mag_count = 0;
+		vmm_spin_unlock_irqrestore_lite(&d->lock, flags);
+
+		while (mag) {
+			next = ((void **)mag)[1];
+			heap_mag_release(heap, mag);
+			mag = next;
+		}
+	}
+}
+
+static void *heap_mag_get(struct vmm_heap_control *heap, u32 c)
+{
+	u8 *tag;
+	void *ret = NULL;
+	irq_flags_t flags;
+	struct heap_mag_cpu *mc;
+
+	arch_cpu_irq_save(flags);
+
+	mc = &heap_mag.cpu[vmm_smp_processor_id()];
+	if (mc->count[c]) {
+		mc->alloc_hit++;
+	} else {
+		mc->alloc_miss++;
+		heap_mag_refill(heap, mc, c);
+	}
+	if (mc->count[c]) {
+		ret = mc->objs[c][--mc->count[c]];
+		tag = heap_mag_tag(heap, ret);
+		*tag &= ~HEAP_MAG_TAG_CACHED;
+	}
+
+	arch_cpu_irq_restore(flags);
+
+	return ret;
+}
+
+static void *heap_mag_malloc(struct vmm_heap_control *heap,
+			     virtual_size_t size)
+{
+	u32 c, try;
+	void *ret = NULL;
+	unsigned long addr;
+
+	for (c = 0; c < HEAP_MAG_CLASSES; c++) {
+		if (size <= (1UL << (c + HEAP_MIN_BIN))) {
+			break;
+		}
+	}
+
+	for (try = 0; try < 2; try++) {
+		if (c < HEAP_MAG_CLASSES) {
+			ret = heap_mag_get(heap, c);
+		} else if (!buddy_mem_alloc(&heap->ba, size, &addr)) {
+			ret = (void *)addr;
+		}
+		if (ret || try) {
+			break;
+		}
+
+		/* Buddy heap might only be short because free
+		 * objects are cached in magazines so flush them.
+		 */
+		heap_mag_flush(heap);
+	}
+
+	if (!ret) {
+		vmm_printf("%s: Failed to alloc size=%"PRISIZE"\n",
+			   __func__, size);
+	}
+
+	return ret;
+}
+
+static bool heap_mag_free(struct vmm_heap_control *heap, void *ptr)
+{
+	u8 *tag;
+	u32 c;
+	irq_flags_t flags;
+	struct heap_mag_cpu *mc;
+
+	tag = heap_mag_tag(heap, ptr);
+	if (!tag || !*tag) {
+		return FALSE;
+	}
+	if (*tag & HEAP_MAG_TAG_CACHED) {
+		vmm_printf("%s: Double free of ptr=%p\n", __func__, ptr);
+		return TRUE;
+	}
+	c = *tag - 1;
+	*tag |= HEAP_MAG_TAG_CACHED;
+
+	arch_cpu_irq_save(flags);
+
+	mc = &heap_mag.cpu[vmm_smp_processor_id()];
+	if (mc->count[c] < (2 * HEAP_MAG_SIZE)) {
+		mc->free_hit++;
+	} else {
+		mc->free_miss++;
+		heap_mag_drain(heap, mc, c);
+	}
+	mc->objs[c][mc->count[c]++] = ptr;
+
+	arch_cpu_irq_restore(flags);
+
+	return TRUE;
+}
+
+static void heap_mag_print_state(struct vmm_chardev *cdev)
+{
+	u32 cpu, c, cached;
+	u64 hit, total;
+	struct heap_mag_cpu *mc;
+
+	if (!heap_mag.enabled) {
+		return;
+	}
+
+	vmm_cprintf(cdev, "Normal Heap Magazine State\n");
+	for_each_online_cpu(cpu) {
+		mc = &heap_mag.cpu[cpu];
+		cached = 0;
+		for (c = 0; c < HEAP_MAG_CLASSES; c++) {
+			cached += mc->count[c];
+		}
+		hit = mc->alloc_hit + mc->free_hit;
+		total = hit + mc->alloc_miss + mc->free_miss;
+		vmm_cprintf(cdev, "  [CPU%d]: %"PRIu64"/%"PRIu64" alloc "
+			    "hit/miss, %"PRIu64"/%"PRIu64" free hit/miss, "
+			    "%u cached, %"PRIu64"%% hit rate\n", cpu,
+			    mc->alloc_hit, mc->alloc_miss,
+			    mc->free_hit, mc->free_miss, cached,
+			    (total) ? udiv64(hit * 100, total) : 0);
+	}
+	for (c = 0; c < HEAP_MAG_CLASSES; c++) {
+		vmm_cprintf(cdev, "  [DEPOT %4luB]: %u magazine(s)\n",
+			    1UL << (c + HEAP_MIN_BIN),
+			    heap_mag.depot[c].mag_count);
+	}
+}
+
+static void heap_mag_init(struct vmm_heap_control *heap)
+{
+	u32 c;
+
+	memset(&heap_mag, 0, sizeof(heap_mag));
+	for (c = 0; c < HEAP_MAG_CLASSES; c++) {
+		INIT_SPIN_LOCK(&heap_mag.depot[c].lock);
+	}
+
+	heap_mag.tags_count = heap->mem_size >> HEAP_MIN_BIN;
+	heap_mag.tags = heap_malloc(heap, heap_mag.tags_count);
+	if (!heap_mag.tags) {
+		return;
+	}
+	memset(heap_mag.tags, 0, heap_mag.tags_count);
+
+	heap_mag.enabled = TRUE;
+}
+#endif
+
 void *vmm_malloc(virtual_size_t size)
 {
+#ifdef CONFIG_HEAP_MAGAZINE
+	if (heap_mag.enabled && size) {
+		return heap_mag_malloc(&normal_heap, size);
+	}
+#endif
 	return heap_malloc(&normal_heap, size);
 }
 
@@ -289,6 +667,11 @@ virtual_size_t vmm_alloc_size(const void *ptr)
 
 void vmm_free(void *ptr)
 {
+#ifdef CONFIG_HEAP_MAGAZINE
+	if (heap_mag.enabled && heap_mag_free(&normal_heap, ptr)) {
+		return;
+	}
+#endif
 	heap_free(&normal_heap, ptr);
 }
 
@@ -314,7 +697,18 @@ virtual_size_t vmm_normal_heap_free_size(void)
 
 int vmm_normal_heap_print_state(struct vmm_chardev *cdev)
 {
-	return heap_print_state(&normal_heap, cdev, "Normal");
+	int rc;
+
+	rc = heap_print_state(&normal_heap, cdev, "Normal");
+	if (rc) {
+		return rc;
+	}
+
+#ifdef CONFIG_HEAP_MAGAZINE
+	heap_mag_print_state(cdev);
+#endif
+
+	return VMM_OK;
 }
 
 int __init vmm_heap_init(void)
@@ -334,6 +728,11 @@ int __init vmm_heap_init(void)
 		return rc;
 	}
 
+#ifdef CONFIG_HEAP_MAGAZINE
+	/* Setup per-CPU magazines for Normal heap */
+	heap_mag_init(&normal_heap);
+#endif
+
 	return VMM_OK;
 }
 
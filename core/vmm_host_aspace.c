@@ -37,6 +37,7 @@
 #include <libs/rbtree_augmented.h>
 
 static virtual_addr_t host_mem_rw_va[CONFIG_CPU_COUNT];
+static virtual_addr_t host_mem_copy_va[CONFIG_CPU_COUNT];
 
 struct host_mhash_entry {
 	struct rb_node rb;
@@ -732,6 +733,58 @@ u32 vmm_host_memory_write(physical_addr_t hpa,
 	return bytes_written;
 }
 
+u32 vmm_host_memory_copy(physical_addr_t dst_hpa,
+			 physical_addr_t src_hpa,
+			 u32 len, bool cacheable)
+{
+	int rc;
+	irq_flags_t flags;
+	u32 bytes_copied = 0, page_offset, page_copy, copied;
+	virtual_addr_t tmp_va;
+
+	/* Map one destination page at time with irqs disabled and
+	 * read source directly into it using vmm_host_memory_read().
+	 */
+	while (bytes_copied < len) {
+		page_offset = dst_hpa & VMM_PAGE_MASK;
+
+		page_copy = VMM_PAGE_SIZE - page_offset;
+		page_copy = (page_copy < (len - bytes_copied)) ?
+			     page_copy : (len - bytes_copied);
+
+		arch_cpu_irq_save(flags);
+
+		tmp_va = host_mem_copy_va[vmm_smp_processor_id()];
+		rc = arch_cpu_aspace_map(tmp_va, VMM_PAGE_SIZE,
+					 dst_hpa & ~VMM_PAGE_MASK,
+					 (cacheable) ?
+					 VMM_MEMORY_FLAGS_NORMAL :
+					 VMM_MEMORY_FLAGS_NORMAL_NOCACHE);
+		if (rc) {
+			arch_cpu_irq_restore(flags);
+			break;
+		}
+
+		copied = vmm_host_memory_read(src_hpa,
+					(void *)(tmp_va + page_offset),
+					page_copy, cacheable);
+
+		rc = arch_cpu_aspace_unmap(tmp_va);
+
+		arch_cpu_irq_restore(flags);
+
+		bytes_copied += copied;
+		if (rc || (copied < page_copy)) {
+			break;
+		}
+
+		dst_hpa += page_copy;
+		src_hpa += page_copy;
+	}
+
+	return bytes_copied;
+}
+
 u32 vmm_host_memory_set(physical_addr_t hpa,
 			  u8 byte, u32 len, bool cacheable)
 {
@@ -1044,6 +1097,11 @@ static int __init host_aspace_init_primary(void)
 		if (rc) {
 			return rc;
 		}
+		rc = vmm_host_vapool_alloc(&host_mem_copy_va[cpu],
+					   VMM_PAGE_SIZE);
+		if (rc) {
+			return rc;
+		}
 	}
 
 #if defined(ARCH_HAS_MEMORY_READWRITE)
@@ -28,6 +28,7 @@
 #include <vmm_heap.h>
 #include <vmm_timer.h>
 #include <vmm_guest_aspace.h>
+#include <vmm_devemu.h>
 #include <vmm_vcpu_irq.h>
 #include <vmm_scheduler.h>
 #include <vmm_waitqueue.h>
@@ -545,6 +546,7 @@ struct vmm_vcpu *vmm_manager_vcpu_orphan_create(const char *name,
 	INIT_RW_LOCK(&vcpu->sched_lock);
 	vcpu->state_tstamp = vmm_timer_timestamp();
 	vcpu->state_ready_nsecs = 0;
+	vcpu->state_ready_max_nsecs = 0;
 	vcpu->state_running_nsecs = 0;
 	vcpu->state_paused_nsecs = 0;
 	vcpu->state_halted_nsecs = 0;
@@ -553,6 +555,9 @@ struct vmm_vcpu *vmm_manager_vcpu_orphan_create(const char *name,
 	vcpu->reset_tstamp = 0;
 	vcpu->preempt_count = 0;
 	vcpu->resumed = FALSE;
+	vcpu->preempted = FALSE;
+	vcpu->migrate_tstamp = 0;
+	INIT_LIST_HEAD(&vcpu->ready_head);
 	vcpu->sched_priv = NULL;
 
 	/* Intialize static scheduling context */
@@ -566,6 +571,9 @@ struct vmm_vcpu *vmm_manager_vcpu_orphan_create(const char *name,
 		vcpu->periodicity = vcpu->deadline;
 	}
 
+	/* Orphan VCPUs are always in normal class */
+	memset(&vcpu->dl, 0, sizeof(vcpu->dl));
+
 	/* Initialize architecture specific context */
 	vcpu->arch_priv = NULL;
 	if (arch_vcpu_init(vcpu)) {
@@ -1378,6 +1386,7 @@ struct vmm_guest *vmm_manager_guest_create(struct vmm_devtree_node *gnode)
 		INIT_RW_LOCK(&vcpu->sched_lock);
 		vcpu->state_tstamp = vmm_timer_timestamp();
 		vcpu->state_ready_nsecs = 0;
+		vcpu->state_ready_max_nsecs = 0;
 		vcpu->state_running_nsecs = 0;
 		vcpu->state_paused_nsecs = 0;
 		vcpu->state_halted_nsecs = 0;
@@ -1386,6 +1395,9 @@ struct vmm_guest *vmm_manager_guest_create(struct vmm_devtree_node *gnode)
 		vcpu->reset_tstamp = 0;
 		vcpu->preempt_count = 0;
 		vcpu->resumed = FALSE;
+		vcpu->preempted = FALSE;
+		vcpu->migrate_tstamp = 0;
+		INIT_LIST_HEAD(&vcpu->ready_head);
 		vcpu->sched_priv = NULL;
 
 		/* Initialize static scheduling context */
@@ -1410,6 +1422,19 @@ struct vmm_guest *vmm_manager_guest_create(struct vmm_devtree_node *gnode)
 		if (vcpu->periodicity < vcpu->deadline) {
 			vcpu->periodicity = vcpu->deadline;
 		}
+		memset(&vcpu->dl, 0, sizeof(vcpu->dl));
+		if (vmm_devtree_read_u64(vnode,
+			VMM_DEVTREE_DL_RUNTIME_ATTR_NAME, &vcpu->dl.runtime)) {
+			vcpu->dl.runtime = 0;
+		}
+		if (vmm_devtree_read_u64(vnode,
+			VMM_DEVTREE_DL_PERIOD_ATTR_NAME, &vcpu->dl.period)) {
+			vcpu->dl.period = 0;
+		}
+		if (vmm_devtree_read_u64(vnode,
+			VMM_DEVTREE_DL_DEADLINE_ATTR_NAME, &vcpu->dl.deadline)) {
+			vcpu->dl.deadline = vcpu->dl.period;
+		}
 
 		/* Initialize architecture specific context */
 		vcpu->arch_priv = NULL;
@@ -1427,6 +1452,9 @@ struct vmm_guest *vmm_manager_guest_create(struct vmm_devtree_node *gnode)
 			goto fail_dref_vsnode;
 		}
 
+		/* Initialize region lookup cache */
+		vmm_devemu_vcpu_rcache_init(vcpu);
+
 		/* Initialize virtual IRQ context */
 		if (vmm_vcpu_irq_init(vcpu)) {
 			arch_vcpu_deinit(vcpu);
@@ -1725,6 +1753,7 @@ int __init vmm_manager_init(void)
 				  VMM_VCPU_STATE_UNKNOWN);
 		mngr.vcpu_array[vnum].state_tstamp = 0;
 		mngr.vcpu_array[vnum].state_ready_nsecs = 0;
+		mngr.vcpu_array[vnum].state_ready_max_nsecs = 0;
 		mngr.vcpu_array[vnum].state_running_nsecs = 0;
 		mngr.vcpu_array[vnum].state_paused_nsecs = 0;
 		mngr.vcpu_array[vnum].state_halted_nsecs = 0;
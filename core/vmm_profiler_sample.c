@@ -0,0 +1,226 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_profiler_sample.c
+ * @author agent (agent@local)
+ * @brief source file of hypervisor sampling profiler.
+ *
+ * Each host CPU has a periodic timer event which records interrupted
+ * program counter, current VCPU/Guest and a short frame pointer stack
+ * into a per-CPU ring buffer. The ring buffer is only written by its
+ * host CPU from timer event handler hence no locking is required and
+ * samples are only read when sampling profiler is stopped.
+ */
+
+#include <vmm_error.h>
+#include <vmm_heap.h>
+#include <vmm_smp.h>
+#include <vmm_percpu.h>
+#include <vmm_mutex.h>
+#include <vmm_timer.h>
+#include <vmm_manager.h>
+#include <vmm_scheduler.h>
+#include <vmm_profiler.h>
+#include <libs/stacktrace.h>
+
+#define SAMPLE_BUFFER_SIZE	CONFIG_PROFILE_SAMPLE_BUFFER_SIZE
+#define SAMPLE_PERIOD_NSECS	\
+		((u64)CONFIG_PROFILE_SAMPLE_PERIOD_USECS * 1000ULL)
+#define SAMPLE_IPI_TIMEOUT_MSECS	1000
+
+struct profiler_sample_ctrl {
+	struct vmm_timer_event ev;
+	struct vmm_profiler_sample *ring;
+	u32 head;
+	u32 count;
+	u64 total;
+};
+
+static DEFINE_PER_CPU(struct profiler_sample_ctrl, psctrl);
+static DEFINE_MUTEX(sample_lock);
+static bool sample_active;
+static u64 sample_period_ns = SAMPLE_PERIOD_NSECS;
+
+static void profiler_sample_event(struct vmm_timer_event *ev)
+{
+	struct stack_trace trace;
+	struct vmm_vcpu *vcpu;
+	struct vmm_profiler_sample *s;
+	struct profiler_sample_ctrl *pscp = ev->priv;
+	arch_regs_t *regs = vmm_scheduler_irq_regs();
+
+	if (!sample_active) {
+		return;
+	}
+
+	s = &pscp->ring[pscp->head];
+	s->tstamp = vmm_timer_timestamp();
+
+	vcpu = vmm_scheduler_current_vcpu();
+	s->vcpu_id = (vcpu) ? vcpu->id : VMM_PROFILE_SAMPLE_NO_ID;
+	s->guest_id = (vcpu && vcpu->guest) ?
+			vcpu->guest->id : VMM_PROFILE_SAMPLE_NO_ID;
+
+	trace.nr_entries = 0;
+	trace.max_entries = VMM_PROFILE_SAMPLE_DEPTH;
+	trace.entries = s->pc;
+	trace.skip = 0;
+	if (regs) {
+		arch_sample_stacktrace(regs, &trace);
+	}
+	s->depth = trace.nr_entries;
+
+	pscp->head = (pscp->head + 1 < SAMPLE_BUFFER_SIZE) ?
+			pscp->head + 1 : 0;
+	if (pscp->count < SAMPLE_BUFFER_SIZE) {
+		pscp->count++;
+	}
+	pscp->total++;
+
+	vmm_timer_event_start(ev, sample_period_ns);
+}
+
+static void profiler_sample_ipi_start(void *arg0, void *arg1, void *arg2)
+{
+	struct profiler_sample_ctrl *pscp = &this_cpu(psctrl);
+
+	if (!pscp->ring) {
+		return;
+	}
+
+	INIT_TIMER_EVENT(&pscp->ev, profiler_sample_event, pscp);
+	vmm_timer_event_start(&pscp->ev, sample_period_ns);
+}
+
+static void profiler_sample_ipi_stop(void *arg0, void *arg1, void *arg2)
+{
+	vmm_timer_event_stop(&this_cpu(psctrl).ev);
+}
+
+bool vmm_profiler_sample_isactive(void)
+{
+	return sample_active;
+}
+
+int vmm_profiler_sample_start(u64 period_nsecs)
+{
+	u32 cpu;
+	struct profiler_sample_ctrl *pscp;
+
+	vmm_mutex_lock(&sample_lock);
+
+	if (sample_active) {
+		vmm_mutex_unlock(&sample_lock);
+		return VMM_EBUSY;
+	}
+
+	for_each_online_cpu(cpu) {
+		pscp = &per_cpu(psctrl, cpu);
+		if (!pscp->ring) {
+			pscp->ring = vmm_malloc(SAMPLE_BUFFER_SIZE *
+					sizeof(struct vmm_profiler_sample));
+			if (!pscp->ring) {
+				vmm_mutex_unlock(&sample_lock);
+				return VMM_ENOMEM;
+			}
+		}
+		pscp->head = 0;
+		pscp->count = 0;
+		pscp->total = 0;
+	}
+
+	sample_period_ns = (period_nsecs) ? period_nsecs : SAMPLE_PERIOD_NSECS;
+	sample_active = TRUE;
+
+	vmm_smp_ipi_sync_call(cpu_online_mask, SAMPLE_IPI_TIMEOUT_MSECS,
+			      profiler_sample_ipi_start, NULL, NULL, NULL);
+
+	vmm_mutex_unlock(&sample_lock);
+
+	return VMM_OK;
+}
+
+int vmm_profiler_sample_stop(void)
+{
+	vmm_mutex_lock(&sample_lock);
+
+	if (!sample_active) {
+		vmm_mutex_unlock(&sample_lock);
+		return VMM_EFAIL;
+	}
+
+	sample_active = FALSE;
+
+	vmm_smp_ipi_sync_call(cpu_online_mask, SAMPLE_IPI_TIMEOUT_MSECS,
+			      profiler_sample_ipi_stop, NULL, NULL, NULL);
+
+	vmm_mutex_unlock(&sample_lock);
+
+	return VMM_OK;
+}
+
+u64 vmm_profiler_sample_period(void)
+{
+	return sample_period_ns;
+}
+
+u64 vmm_profiler_sample_count(u32 cpu)
+{
+	if (CONFIG_CPU_COUNT <= cpu) {
+		return 0;
+	}
+
+	return per_cpu(psctrl, cpu).total;
+}
+
+int vmm_profiler_sample_iterate(u32 cpu,
+			int (*iter)(struct vmm_profiler_sample *, void *),
+			void *priv)
+{
+	int rc = VMM_OK;
+	u32 i, pos;
+	struct profiler_sample_ctrl *pscp;
+
+	if ((CONFIG_CPU_COUNT <= cpu) || !iter) {
+		return VMM_EINVALID;
+	}
+	pscp = &per_cpu(psctrl, cpu);
+
+	vmm_mutex_lock(&sample_lock);
+
+	if (sample_active) {
+		vmm_mutex_unlock(&sample_lock);
+		return VMM_EBUSY;
+	}
+
+	if (pscp->ring) {
+		pos = (pscp->head + SAMPLE_BUFFER_SIZE - pscp->count) %
+							SAMPLE_BUFFER_SIZE;
+		for (i = 0; i < pscp->count; i++) {
+			rc = iter(&pscp->ring[pos], priv);
+			if (rc) {
+				break;
+			}
+			pos = (pos + 1 < SAMPLE_BUFFER_SIZE) ? pos + 1 : 0;
+		}
+	}
+
+	vmm_mutex_unlock(&sample_lock);
+
+	return rc;
+}
@@ -31,10 +31,13 @@
 #include <vmm_timer.h>
 #include <vmm_schedalgo.h>
 #include <vmm_scheduler.h>
+#include <vmm_trace.h>
 #include <vmm_stdio.h>
 #include <arch_regs.h>
+#include <arch_barrier.h>
 #include <arch_cpu_irq.h>
 #include <arch_vcpu.h>
+#include <libs/mathlib.h>
 #include <libs/stringlib.h>
 
 #define IDLE_VCPU_STACK_SZ 	CONFIG_THREAD_STACK_SIZE
@@ -45,6 +48,11 @@
 
 #define SAMPLE_EVENT_PERIOD	(CONFIG_IDLE_PERIOD_SECS * 1000000000ULL)
 
+#define DL_BW_SHIFT		20
+#define DL_BW_MAX		\
+	udiv64((u64)CONFIG_SCHED_DL_MAX_BW_PERCENT << DL_BW_SHIFT, 100)
+#define DL_MISS_TRACE_SIZE	CONFIG_SCHED_DL_MISS_TRACE_SIZE
+
 enum vmm_scheduler_resched_state {
 	VMM_SCHEDULER_RESCHED_IDLE=0,
 	VMM_SCHEDULER_RESCHED_TRIGGERED
@@ -54,10 +62,16 @@ enum vmm_scheduler_resched_state {
 struct vmm_scheduler_ctrl {
 	void *rq;
 	vmm_spinlock_t rq_lock;
+	struct dlist rq_ready_list;
+	u32 steal_order[CONFIG_CPU_COUNT];
+	u32 steal_order_count;
+	u64 steal_count;
 	atomic_t rq_resched_state;
 	u64 current_vcpu_irq_ns;
 	u64 current_vcpu_exp_ns;
+	bool current_vcpu_yielded;
 	struct vmm_vcpu *current_vcpu;
+	struct vmm_vcpu *boost_vcpu;
 	struct vmm_vcpu *idle_vcpu;
 	bool irq_context;
 	arch_regs_t *irq_regs;
@@ -66,17 +80,212 @@ struct vmm_scheduler_ctrl {
 	u64 exp_process_ns;
 	bool yield_on_irq_exit;
 	struct vmm_timer_event ev;
+	bool tick_stopped;
+	u64 tick_slice_ns;
 	struct vmm_timer_event sample_ev;
 	vmm_rwlock_t sample_lock;
+	bool sample_stopped;
+	u64 sample_tstamp;
 	u64 sample_period_ns;
 	u64 sample_idle_ns;
 	u64 sample_idle_last_ns;
 	u64 sample_irq_ns;
 	u64 sample_irq_last_ns;
+	struct rb_root dl_root;
+	u32 dl_count;
+	u32 dl_prio_count[VMM_VCPU_MAX_PRIORITY+1];
+	u64 dl_total_bw;
+	u32 dl_miss_head;
+	u32 dl_miss_count;
+	struct vmm_scheduler_dl_miss dl_miss[DL_MISS_TRACE_SIZE];
 };
 
 static DEFINE_PER_CPU(struct vmm_scheduler_ctrl, sched);
 
+/* NOTE: Must be called with schedp->rq_lock held */
+static void __dl_miss(struct vmm_scheduler_ctrl *schedp,
+		      struct vmm_vcpu *vcpu, u64 tstamp)
+{
+	struct vmm_scheduler_dl_miss *m;
+
+	vcpu->dl.missed = TRUE;
+	vcpu->dl.miss_count++;
+
+	m = &schedp->dl_miss[schedp->dl_miss_head];
+	m->tstamp = tstamp;
+	m->vcpu_id = vcpu->id;
+	m->deadline = vcpu->dl.abs_deadline;
+	m->lateness = tstamp - vcpu->dl.abs_deadline;
+
+	schedp->dl_miss_head++;
+	if (schedp->dl_miss_head == DL_MISS_TRACE_SIZE) {
+		schedp->dl_miss_head = 0;
+	}
+	if (schedp->dl_miss_count < DL_MISS_TRACE_SIZE) {
+		schedp->dl_miss_count++;
+	}
+}
+
+/* NOTE: Must be called with vcpu->sched_lock held */
+static void __dl_new_period(struct vmm_vcpu *vcpu, u64 tstamp)
+{
+	vcpu->dl.period_tstamp = tstamp;
+	vcpu->dl.abs_deadline = tstamp + vcpu->dl.deadline;
+	vcpu->dl.remaining = vcpu->dl.runtime;
+	vcpu->dl.missed = FALSE;
+}
+
+/* NOTE: Must be called with vcpu->sched_lock held */
+static void __dl_charge(struct vmm_vcpu *vcpu)
+{
+	u64 delta;
+
+	/* Running time restarts from zero upon VCPU reset */
+	if (vcpu->state_running_nsecs < vcpu->dl.accounted_nsecs) {
+		vcpu->dl.accounted_nsecs = 0;
+	}
+
+	delta = vcpu->state_running_nsecs - vcpu->dl.accounted_nsecs;
+	vcpu->dl.accounted_nsecs = vcpu->state_running_nsecs;
+	vcpu->dl.remaining = (delta < vcpu->dl.remaining) ?
+				vcpu->dl.remaining - delta : 0;
+}
+
+/* NOTE: Must be called with vcpu->sched_lock and schedp->rq_lock held
+ * NOTE: Returns VMM_EAGAIN when VCPU is throttled instead of queued
+ */
+static int __dl_enqueue(struct vmm_scheduler_ctrl *schedp,
+			struct vmm_vcpu *vcpu)
+{
+	u64 tstamp, replenish_tstamp;
+	bool runnable;
+	struct vmm_vcpu *e;
+	struct vmm_vcpu_dl *dl = &vcpu->dl;
+	struct rb_node **new = &schedp->dl_root.rb_node, *parent = NULL;
+
+	if (dl->queued || dl->throttled) {
+		return VMM_EALREADY;
+	}
+
+	tstamp = vmm_timer_timestamp();
+	__dl_charge(vcpu);
+
+	/* VCPU already in READY state is being preempted or migrated
+	 * whereas other VCPUs are waking up.
+	 */
+	runnable = (arch_atomic_read(&vcpu->state) == VMM_VCPU_STATE_READY) ?
+								TRUE : FALSE;
+	if (runnable && dl->remaining &&
+	    (dl->abs_deadline < tstamp) && !dl->missed) {
+		__dl_miss(schedp, vcpu, tstamp);
+	}
+
+	if (!dl->remaining) {
+		/* Budget exhausted so throttle till next period */
+		replenish_tstamp = dl->period_tstamp + dl->period;
+		if (tstamp < replenish_tstamp) {
+			dl->throttled = TRUE;
+			dl->throttle_count++;
+			vmm_timer_event_start(&dl->replenish_ev,
+					      replenish_tstamp - tstamp);
+			return VMM_EAGAIN;
+		}
+		__dl_new_period(vcpu, tstamp);
+	} else if (dl->abs_deadline <= tstamp) {
+		__dl_new_period(vcpu, tstamp);
+	} else if (!runnable &&
+		   (udiv64((dl->abs_deadline - tstamp) * dl->bw,
+			   1ULL << DL_BW_SHIFT) < dl->remaining)) {
+		/* Waking up with left-over budget which cannot be
+		 * consumed before current deadline without exceeding
+		 * reserved bandwidth so start new period.
+		 */
+		__dl_new_period(vcpu, tstamp);
+	}
+
+	while (*new) {
+		parent = *new;
+		e = rb_entry(parent, struct vmm_vcpu, dl.rb);
+		if (dl->abs_deadline < e->dl.abs_deadline) {
+			new = &parent->rb_left;
+		} else {
+			new = &parent->rb_right;
+		}
+	}
+	rb_link_node(&dl->rb, parent, new);
+	rb_insert_color(&dl->rb, &schedp->dl_root);
+	dl->queued = TRUE;
+	schedp->dl_count++;
+	schedp->dl_prio_count[vcpu->priority]++;
+
+	return VMM_OK;
+}
+
+/* NOTE: Must be called with schedp->rq_lock held */
+static void __dl_erase(struct vmm_scheduler_ctrl *schedp,
+		       struct vmm_vcpu *vcpu)
+{
+	rb_erase(&vcpu->dl.rb, &schedp->dl_root);
+	RB_CLEAR_NODE(&vcpu->dl.rb);
+	vcpu->dl.queued = FALSE;
+	schedp->dl_count--;
+	schedp->dl_prio_count[vcpu->priority]--;
+}
+
+/* NOTE: Must be called with schedp->rq_lock held */
+static int __dl_dequeue(struct vmm_scheduler_ctrl *schedp,
+			struct vmm_vcpu **next,
+			u64 *next_time_slice)
+{
+	u64 tstamp;
+	struct vmm_vcpu *vcpu;
+	struct rb_node *n = rb_first(&schedp->dl_root);
+
+	if (!n) {
+		return VMM_ENOTAVAIL;
+	}
+
+	vcpu = rb_entry(n, struct vmm_vcpu, dl.rb);
+	__dl_erase(schedp, vcpu);
+
+	tstamp = vmm_timer_timestamp();
+	if ((vcpu->dl.abs_deadline < tstamp) && !vcpu->dl.missed) {
+		__dl_miss(schedp, vcpu, tstamp);
+	}
+
+	*next = vcpu;
+	*next_time_slice = vcpu->dl.remaining;
+
+	return VMM_OK;
+}
+
+/* NOTE: Must be called with schedp->rq_lock held */
+static bool __dl_prempt_needed(struct vmm_scheduler_ctrl *schedp,
+			       bool *decided)
+{
+	struct vmm_vcpu *e, *current = schedp->current_vcpu;
+	struct rb_node *n = rb_first(&schedp->dl_root);
+
+	*decided = TRUE;
+
+	if (!n) {
+		/* Deadline class VCPU is never preempted by normal class */
+		if (current && current->dl.runtime) {
+			return FALSE;
+		}
+		*decided = FALSE;
+		return FALSE;
+	}
+
+	if (!current || !current->dl.runtime) {
+		return TRUE;
+	}
+
+	e = rb_entry(n, struct vmm_vcpu, dl.rb);
+
+	return (e->dl.abs_deadline < current->dl.abs_deadline) ? TRUE : FALSE;
+}
+
 static int rq_dequeue(struct vmm_scheduler_ctrl *schedp,
 		      struct vmm_vcpu **next,
 		      u64 *next_time_slice)
@@ -85,23 +294,166 @@ static int rq_dequeue(struct vmm_scheduler_ctrl *schedp,
 	irq_flags_t flags;
 
 	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
-	ret = vmm_schedalgo_rq_dequeue(schedp->rq, next, next_time_slice);
+	if (schedp->dl_count) {
+		ret = __dl_dequeue(schedp, next, next_time_slice);
+	} else if (schedp->boost_vcpu) {
+		*next = schedp->boost_vcpu;
+		*next_time_slice = schedp->boost_vcpu->time_slice;
+		schedp->boost_vcpu = NULL;
+		ret = VMM_OK;
+	} else {
+		ret = vmm_schedalgo_rq_dequeue(schedp->rq,
+						next, next_time_slice);
+	}
+	if (!ret && *next) {
+		list_del_init(&(*next)->ready_head);
+	}
 	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
 
 	return ret;
 }
 
+#ifdef CONFIG_SCHED_TICKLESS
+
+/* Restart time-slice timer if it was stopped but is required again
+ * NOTE: Must be called with interrupts disabled on owner host CPU
+ */
+static void scheduler_tick_restart(struct vmm_scheduler_ctrl *schedp)
+{
+	if (!schedp->tick_stopped &&
+	    !vmm_timer_event_pending(&schedp->ev)) {
+		vmm_timer_event_start(&schedp->ev, schedp->tick_slice_ns);
+	}
+}
+
+/* Restart stopped time-slice timer of given host CPU
+ * NOTE: Must be called with interrupts disabled
+ */
+static void scheduler_tick_kick(u32 hcpu)
+{
+	if (hcpu == vmm_smp_processor_id()) {
+		scheduler_tick_restart(&this_cpu(sched));
+	} else {
+		/* Resched IPI restarts timer on remote host CPU */
+		vmm_scheduler_force_resched(hcpu);
+	}
+}
+
+/* Check whether time-slice timer is not required for next VCPU
+ * because there is no other VCPU READY to run (apart from idle VCPU
+ * when next VCPU has higher priority than idle VCPU).
+ * NOTE: Must be called with interrupts disabled
+ */
+static bool rq_tick_stop(struct vmm_scheduler_ctrl *schedp,
+			 struct vmm_vcpu *next, u64 time_slice)
+{
+	bool ret = TRUE;
+	struct vmm_vcpu *vcpu;
+
+	/* Deadline class relies on time-slice timer for budget */
+	if (next->dl.runtime ||
+	    ((next != schedp->idle_vcpu) &&
+	     (next->priority == IDLE_VCPU_PRIORITY))) {
+		ret = FALSE;
+	}
+
+	vmm_spin_lock_lite(&schedp->rq_lock);
+	if (ret) {
+		list_for_each_entry(vcpu, &schedp->rq_ready_list, ready_head) {
+			if (vcpu != schedp->idle_vcpu) {
+				ret = FALSE;
+				break;
+			}
+		}
+	}
+	schedp->tick_stopped = ret;
+	schedp->tick_slice_ns = time_slice;
+	vmm_spin_unlock_lite(&schedp->rq_lock);
+
+	return ret;
+}
+
+#else
+
+static inline void scheduler_tick_restart(struct vmm_scheduler_ctrl *schedp)
+{
+}
+
+static inline void scheduler_tick_kick(u32 hcpu)
+{
+}
+
+static inline bool rq_tick_stop(struct vmm_scheduler_ctrl *schedp,
+				struct vmm_vcpu *next, u64 time_slice)
+{
+	return FALSE;
+}
+
+#endif
+
 /* NOTE: Must be called with vcpu->sched_lock held */
 static int rq_enqueue(struct vmm_scheduler_ctrl *schedp,
 		      struct vmm_vcpu *vcpu)
 {
 	int ret;
+	bool kick = FALSE;
 	irq_flags_t flags;
 
 	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
-	ret = vmm_schedalgo_rq_enqueue(schedp->rq, vcpu);
+	if (vcpu->dl.runtime) {
+		ret = __dl_enqueue(schedp, vcpu);
+		if (ret == VMM_EAGAIN) {
+			/* Throttled VCPU is not runnable so keep it off
+			 * the ready list until replenish event enqueues it.
+			 */
+			vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock,
+							flags);
+			return VMM_OK;
+		}
+	} else {
+		ret = vmm_schedalgo_rq_enqueue(schedp->rq, vcpu);
+	}
+	if (!ret) {
+		list_add_tail(&vcpu->ready_head, &schedp->rq_ready_list);
+		/* Time-slice timer is required again */
+		if (schedp->tick_stopped &&
+		    (schedp->current_vcpu != vcpu)) {
+			schedp->tick_stopped = FALSE;
+			kick = TRUE;
+		}
+	}
 	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
 
+	if (kick) {
+		scheduler_tick_kick(vcpu->hcpu);
+	}
+
+	return ret;
+}
+
+/* NOTE: Must be called with vcpu->sched_lock and schedp->rq_lock held */
+static int __rq_detach(struct vmm_scheduler_ctrl *schedp,
+		       struct vmm_vcpu *vcpu)
+{
+	int ret;
+
+	if (vcpu->dl.queued) {
+		__dl_erase(schedp, vcpu);
+		ret = VMM_OK;
+	} else if (vcpu->dl.throttled) {
+		vcpu->dl.throttled = FALSE;
+		vmm_timer_event_stop(&vcpu->dl.replenish_ev);
+		ret = VMM_OK;
+	} else if (schedp->boost_vcpu == vcpu) {
+		schedp->boost_vcpu = NULL;
+		ret = VMM_OK;
+	} else {
+		ret = vmm_schedalgo_rq_detach(schedp->rq, vcpu);
+	}
+	if (!ret) {
+		list_del_init(&vcpu->ready_head);
+	}
+
 	return ret;
 }
 
@@ -113,19 +465,59 @@ static int rq_detach(struct vmm_scheduler_ctrl *schedp,
 	irq_flags_t flags;
 
 	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
-	ret = vmm_schedalgo_rq_detach(schedp->rq, vcpu);
+	ret = __rq_detach(schedp, vcpu);
 	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
 
 	return ret;
 }
 
+/* NOTE: Must be called with vcpu->sched_lock held */
+static int rq_boost(struct vmm_scheduler_ctrl *schedp,
+		    struct vmm_vcpu *vcpu)
+{
+	int ret;
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
+	if (schedp->boost_vcpu || vcpu->dl.runtime) {
+		ret = VMM_EBUSY;
+	} else {
+		ret = vmm_schedalgo_rq_detach(schedp->rq, vcpu);
+		if (!ret) {
+			schedp->boost_vcpu = vcpu;
+		}
+	}
+	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
+
+	return ret;
+}
+
+/* NOTE: Must be called with vcpu->sched_lock held */
+static void rq_ready_unlink(struct vmm_scheduler_ctrl *schedp,
+			    struct vmm_vcpu *vcpu)
+{
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
+	if (!list_empty(&vcpu->ready_head)) {
+		list_del_init(&vcpu->ready_head);
+	}
+	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
+}
+
 static bool rq_prempt_needed(struct vmm_scheduler_ctrl *schedp)
 {
-	bool ret;
+	bool ret, decided;
 	irq_flags_t flags;
 
 	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
-	ret = vmm_schedalgo_rq_prempt_needed(schedp->rq, schedp->current_vcpu);
+	ret = __dl_prempt_needed(schedp, &decided);
+	if (!decided && schedp->boost_vcpu) {
+		ret = TRUE;
+	} else if (!decided) {
+		ret = vmm_schedalgo_rq_prempt_needed(schedp->rq,
+						     schedp->current_vcpu);
+	}
 	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
 
 	return ret;
@@ -138,11 +530,130 @@ static u32 rq_length(struct vmm_scheduler_ctrl *schedp, u32 priority)
 
 	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
 	ret = vmm_schedalgo_rq_length(schedp->rq, priority);
+	ret += schedp->dl_prio_count[priority];
+	if (schedp->boost_vcpu && (schedp->boost_vcpu->priority == priority)) {
+		ret++;
+	}
 	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
 
 	return ret;
 }
 
+#if defined(CONFIG_SCHED_IDLE_STEAL)
+
+#define STEAL_HYSTERESIS_NSECS	\
+		((u64)CONFIG_SCHED_IDLE_STEAL_HYSTERESIS_MSECS * 1000000ULL)
+
+/* NOTE: Must be called with interrupts disabled */
+static bool rq_only_idle(struct vmm_scheduler_ctrl *schedp)
+{
+	bool ret = TRUE;
+	struct vmm_vcpu *vcpu;
+
+	vmm_spin_lock_lite(&schedp->rq_lock);
+	list_for_each_entry(vcpu, &schedp->rq_ready_list, ready_head) {
+		if (vcpu != schedp->idle_vcpu) {
+			ret = FALSE;
+			break;
+		}
+	}
+	vmm_spin_unlock_lite(&schedp->rq_lock);
+
+	return ret;
+}
+
+/* Pull one READY VCPU from ready queue of peer host CPU without
+ * blocking on any lock.
+ * NOTE: Must be called with interrupts disabled
+ */
+static bool scheduler_steal_from(struct vmm_scheduler_ctrl *schedp,
+				 u32 hcpu, u32 peer, u64 tstamp)
+{
+	struct vmm_vcpu *vcpu, *found = NULL;
+	struct vmm_scheduler_ctrl *peerp = &per_cpu(sched, peer);
+
+	if (!vmm_spin_trylock_lite(&peerp->rq_lock)) {
+		return FALSE;
+	}
+
+	/* Peer running idle VCPU will pick its READY VCPUs itself */
+	if (!peerp->current_vcpu ||
+	    (peerp->current_vcpu == peerp->idle_vcpu)) {
+		goto done;
+	}
+
+	list_for_each_entry(vcpu, &peerp->rq_ready_list, ready_head) {
+		if ((vcpu->priority == IDLE_VCPU_PRIORITY) ||
+		    vcpu->dl.runtime ||
+		    (vcpu == peerp->boost_vcpu) ||
+		    !vmm_cpumask_test_cpu(hcpu, vcpu->cpu_affinity) ||
+		    ((tstamp - vcpu->migrate_tstamp) <
+						STEAL_HYSTERESIS_NSECS)) {
+			continue;
+		}
+		if (!vmm_write_trylock_lite(&vcpu->sched_lock)) {
+			continue;
+		}
+		if ((arch_atomic_read(&vcpu->state) != VMM_VCPU_STATE_READY) ||
+		    (vcpu->hcpu != peer) ||
+		    __rq_detach(peerp, vcpu)) {
+			vmm_write_unlock_lite(&vcpu->sched_lock);
+			continue;
+		}
+		found = vcpu;
+		break;
+	}
+
+done:
+	vmm_spin_unlock_lite(&peerp->rq_lock);
+
+	if (!found) {
+		return FALSE;
+	}
+
+	found->hcpu = hcpu;
+	found->migrate_tstamp = tstamp;
+	rq_enqueue(schedp, found);
+
+	vmm_write_unlock_lite(&found->sched_lock);
+
+	return TRUE;
+}
+
+/* Steal READY VCPU from peer host CPUs when we are about to go idle
+ * NOTE: Must be called with interrupts disabled
+ */
+static void scheduler_idle_steal(struct vmm_scheduler_ctrl *schedp)
+{
+	u32 i, peer, count, hcpu = vmm_smp_processor_id();
+	u64 tstamp;
+
+	if (!rq_only_idle(schedp)) {
+		return;
+	}
+
+	tstamp = vmm_timer_timestamp();
+	count = schedp->steal_order_count;
+	for (i = 0; i < count; i++) {
+		peer = schedp->steal_order[i];
+		if ((peer == hcpu) || !vmm_cpu_online(peer)) {
+			continue;
+		}
+		if (scheduler_steal_from(schedp, hcpu, peer, tstamp)) {
+			schedp->steal_count++;
+			break;
+		}
+	}
+}
+
+#else
+
+static inline void scheduler_idle_steal(struct vmm_scheduler_ctrl *schedp)
+{
+}
+
+#endif
+
 /* Should not be called from anywhere else */
 static struct vmm_vcpu *__vmm_scheduler_next1(struct vmm_scheduler_ctrl *schedp,
 					      arch_regs_t *regs)
@@ -163,13 +674,22 @@ static struct vmm_vcpu *__vmm_scheduler_next1(struct vmm_scheduler_ctrl *schedp,
 
 	arch_vcpu_switch(NULL, next, regs);
 	next->state_ready_nsecs += tstamp - next->state_tstamp;
+	if (next->state_ready_max_nsecs < (tstamp - next->state_tstamp)) {
+		next->state_ready_max_nsecs = tstamp - next->state_tstamp;
+	}
 	arch_atomic_write(&next->state, VMM_VCPU_STATE_RUNNING);
 	next->resumed = FALSE;
+	next->preempted = FALSE;
 	next->state_tstamp = tstamp;
 	schedp->current_vcpu = next;
+	schedp->current_vcpu_yielded = FALSE;
 	schedp->current_vcpu_irq_ns = schedp->irq_process_ns;
 	schedp->current_vcpu_exp_ns = schedp->exp_process_ns;
-	vmm_timer_event_start(&schedp->ev, next_time_slice);
+	if (rq_tick_stop(schedp, next, next_time_slice)) {
+		vmm_timer_event_stop(&schedp->ev);
+	} else {
+		vmm_timer_event_start(&schedp->ev, next_time_slice);
+	}
 
 	vmm_write_unlock_irqrestore_lite(&next->sched_lock, nf);
 
@@ -212,11 +732,16 @@ static struct vmm_vcpu *__vmm_scheduler_next2(struct vmm_scheduler_ctrl *schedp,
 				tstamp - current->state_tstamp;
 			arch_atomic_write(&current->state, VMM_VCPU_STATE_READY);
 			current->state_tstamp = tstamp;
+			/* Remember involuntary preemption for directed yield */
+			current->preempted = !schedp->current_vcpu_yielded;
 			rq_enqueue(schedp, current);
 		}
 		tcurrent = current;
 	}
 
+	/* Try to find work on peer host CPUs before going idle */
+	scheduler_idle_steal(schedp);
+
 dequeue_again:
 	rc = rq_dequeue(schedp, &next, &next_time_slice);
 	if (rc) {
@@ -243,13 +768,22 @@ dequeue_again:
 	}
 
 	next->state_ready_nsecs += tstamp - next->state_tstamp;
+	if (next->state_ready_max_nsecs < (tstamp - next->state_tstamp)) {
+		next->state_ready_max_nsecs = tstamp - next->state_tstamp;
+	}
 	arch_atomic_write(&next->state, VMM_VCPU_STATE_RUNNING);
 	next->resumed = FALSE;
+	next->preempted = FALSE;
 	next->state_tstamp = tstamp;
 	schedp->current_vcpu = next;
+	schedp->current_vcpu_yielded = FALSE;
 	schedp->current_vcpu_irq_ns = schedp->irq_process_ns;
 	schedp->current_vcpu_exp_ns = schedp->exp_process_ns;
-	vmm_timer_event_start(&schedp->ev, next_time_slice);
+	if (rq_tick_stop(schedp, next, next_time_slice)) {
+		vmm_timer_event_stop(&schedp->ev);
+	} else {
+		vmm_timer_event_start(&schedp->ev, next_time_slice);
+	}
 
 	if (next != current) {
 		vmm_write_unlock_irqrestore_lite(&next->sched_lock, nf);
@@ -258,6 +792,8 @@ dequeue_again:
 	return (next != current) ? next : NULL;
 }
 
+static void scheduler_sample_resume(struct vmm_scheduler_ctrl *schedp);
+
 static void vmm_scheduler_switch(struct vmm_scheduler_ctrl *schedp,
 				 arch_regs_t *regs)
 {
@@ -300,6 +836,11 @@ static void vmm_scheduler_switch(struct vmm_scheduler_ctrl *schedp,
 	if (next) {
 		arch_vcpu_post_switch(next, regs);
 	}
+
+	/* Resume sampling when time-slice timer is running again */
+	if (schedp->sample_stopped && !schedp->tick_stopped) {
+		scheduler_sample_resume(schedp);
+	}
 }
 
 static void scheduler_timer_event(struct vmm_timer_event *ev)
@@ -361,6 +902,8 @@ static void scheduler_ipi_resched(void *arg0, void *arg1, void *arg2)
 	arch_atomic_write(&schedp->rq_resched_state,
 			  VMM_SCHEDULER_RESCHED_IDLE);
 
+	scheduler_tick_restart(schedp);
+
 	if (schedp->irq_regs && rq_prempt_needed(schedp)) {
 		vmm_scheduler_switch(schedp, schedp->irq_regs);
 	}
@@ -415,7 +958,8 @@ int vmm_scheduler_stats(struct vmm_vcpu *vcpu,
 			u32 *reset_count, u64 *last_reset_nsecs,
 			u64 *ready_nsecs, u64 *running_nsecs,
 			u64 *paused_nsecs, u64 *halted_nsecs,
-			u64 *system_nsecs)
+			u64 *system_nsecs, u64 *ready_max_nsecs,
+			u64 *vruntime_nsecs)
 {
 	int rc;
 	irq_flags_t flags;
@@ -486,35 +1030,301 @@ int vmm_scheduler_stats(struct vmm_vcpu *vcpu,
 		break;
 	}
 
-	/* Retrive statistics */
-	if (reset_count) {
-		*reset_count = vcpu->reset_count;
+	/* Retrive statistics */
+	if (reset_count) {
+		*reset_count = vcpu->reset_count;
+	}
+	if (last_reset_nsecs) {
+		*last_reset_nsecs = current_tstamp - vcpu->reset_tstamp;
+	}
+	if (ready_nsecs) {
+		*ready_nsecs = vcpu->state_ready_nsecs;
+	}
+	if (running_nsecs) {
+		*running_nsecs = vcpu->state_running_nsecs;
+	}
+	if (paused_nsecs) {
+		*paused_nsecs = vcpu->state_paused_nsecs;
+	}
+	if (halted_nsecs) {
+		*halted_nsecs = vcpu->state_halted_nsecs;
+	}
+	if (system_nsecs) {
+		*system_nsecs = vcpu->system_nsecs;
+	}
+	if (ready_max_nsecs) {
+		*ready_max_nsecs = vcpu->state_ready_max_nsecs;
+	}
+	if (vruntime_nsecs) {
+		*vruntime_nsecs = vmm_schedalgo_vcpu_vruntime(vcpu);
+	}
+
+	/* Release scheduling lock */
+	vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+
+	return VMM_OK;
+}
+
+static void scheduler_dl_replenish_event(struct vmm_timer_event *ev)
+{
+	u32 hcpu;
+	irq_flags_t flags;
+	struct vmm_vcpu *vcpu = ev->priv;
+	struct vmm_scheduler_ctrl *schedp;
+
+	vmm_write_lock_irqsave_lite(&vcpu->sched_lock, flags);
+
+	if (!vcpu->dl.throttled) {
+		vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+		return;
+	}
+	vcpu->dl.throttled = FALSE;
+
+	hcpu = vcpu->hcpu;
+	schedp = &per_cpu(sched, hcpu);
+	if (arch_atomic_read(&vcpu->state) == VMM_VCPU_STATE_READY) {
+		rq_enqueue(schedp, vcpu);
+	}
+
+	vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+
+	if (hcpu == vmm_smp_processor_id()) {
+		if (schedp->irq_regs && rq_prempt_needed(schedp)) {
+			vmm_scheduler_switch(schedp, schedp->irq_regs);
+		}
+	} else {
+		vmm_scheduler_force_resched(hcpu);
+	}
+}
+
+static int dl_validate(u64 runtime, u64 *deadline, u64 period, u64 *bw)
+{
+	if (!runtime) {
+		*bw = 0;
+		return VMM_OK;
+	}
+
+	if (!*deadline) {
+		*deadline = period;
+	}
+	if (!period || (*deadline < runtime) || (period < *deadline)) {
+		return VMM_EINVALID;
+	}
+	*bw = udiv64(runtime << DL_BW_SHIFT, period);
+
+	return VMM_OK;
+}
+
+/* Admission control for changing bandwidth reserved by a VCPU */
+static int dl_admit(struct vmm_scheduler_ctrl *schedp,
+		    u64 old_bw, u64 new_bw)
+{
+	int rc = VMM_OK;
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
+	if ((schedp->dl_total_bw - old_bw + new_bw) > DL_BW_MAX) {
+		rc = VMM_ENOSPC;
+	} else {
+		schedp->dl_total_bw = schedp->dl_total_bw - old_bw + new_bw;
+	}
+	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
+
+	return rc;
+}
+
+/* NOTE: Must be called with vcpu->sched_lock held */
+static int dl_setup(struct vmm_scheduler_ctrl *schedp, struct vmm_vcpu *vcpu)
+{
+	int rc;
+	struct vmm_vcpu_dl *dl = &vcpu->dl;
+
+	RB_CLEAR_NODE(&dl->rb);
+	dl->queued = FALSE;
+	dl->throttled = FALSE;
+	dl->missed = FALSE;
+	dl->period_tstamp = 0;
+	dl->abs_deadline = 0;
+	dl->remaining = dl->runtime;
+	dl->accounted_nsecs = 0;
+	dl->throttle_count = 0;
+	dl->miss_count = 0;
+	INIT_TIMER_EVENT(&dl->replenish_ev,
+			 &scheduler_dl_replenish_event, vcpu);
+
+	rc = dl_validate(dl->runtime, &dl->deadline, dl->period, &dl->bw);
+	if (rc) {
+		return rc;
+	}
+
+	return dl_admit(schedp, 0, dl->bw);
+}
+
+/* NOTE: Must be called with vcpu->sched_lock held */
+static void dl_cleanup(struct vmm_scheduler_ctrl *schedp,
+		       struct vmm_vcpu *vcpu)
+{
+	vmm_timer_event_stop(&vcpu->dl.replenish_ev);
+	vcpu->dl.throttled = FALSE;
+	dl_admit(schedp, vcpu->dl.bw, 0);
+	vcpu->dl.runtime = 0;
+	vcpu->dl.bw = 0;
+}
+
+int vmm_scheduler_dl_set(struct vmm_vcpu *vcpu,
+			 u64 runtime, u64 deadline, u64 period)
+{
+	int rc;
+	u64 bw;
+	u32 hcpu, state;
+	bool requeue;
+	irq_flags_t flags;
+	struct vmm_scheduler_ctrl *schedp;
+
+	if (!vcpu) {
+		return VMM_EFAIL;
+	}
+
+	rc = dl_validate(runtime, &deadline, period, &bw);
+	if (rc) {
+		return rc;
+	}
+
+	vmm_write_lock_irqsave_lite(&vcpu->sched_lock, flags);
+
+	state = arch_atomic_read(&vcpu->state);
+	if (state == VMM_VCPU_STATE_UNKNOWN) {
+		vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+		return VMM_EINVALID;
+	}
+
+	hcpu = vcpu->hcpu;
+	schedp = &per_cpu(sched, hcpu);
+
+	rc = dl_admit(schedp, vcpu->dl.bw, bw);
+	if (rc) {
+		vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+		return rc;
+	}
+
+	/* Take VCPU out of ready queue while changing its class */
+	requeue = FALSE;
+	if ((state == VMM_VCPU_STATE_READY) &&
+	    (schedp->current_vcpu != vcpu)) {
+		requeue = (rq_detach(schedp, vcpu) == VMM_OK) ? TRUE : FALSE;
+	}
+
+	vcpu->dl.runtime = runtime;
+	vcpu->dl.deadline = (runtime) ? deadline : 0;
+	vcpu->dl.period = (runtime) ? period : 0;
+	vcpu->dl.bw = bw;
+	vcpu->dl.missed = FALSE;
+	vcpu->dl.period_tstamp = 0;
+	vcpu->dl.abs_deadline = 0;
+	vcpu->dl.remaining = runtime;
+	vcpu->dl.accounted_nsecs = vcpu->state_running_nsecs;
+
+	if (requeue) {
+		rq_enqueue(schedp, vcpu);
 	}
-	if (last_reset_nsecs) {
-		*last_reset_nsecs = current_tstamp - vcpu->reset_tstamp;
+
+	vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+
+	vmm_scheduler_force_resched(hcpu);
+
+	return VMM_OK;
+}
+
+int vmm_scheduler_dl_stats(struct vmm_vcpu *vcpu,
+			   u64 *runtime, u64 *deadline, u64 *period,
+			   u64 *remaining, bool *throttled,
+			   u32 *throttle_count, u32 *miss_count)
+{
+	irq_flags_t flags;
+
+	if (!vcpu) {
+		return VMM_EFAIL;
 	}
-	if (ready_nsecs) {
-		*ready_nsecs = vcpu->state_ready_nsecs;
+
+	vmm_read_lock_irqsave_lite(&vcpu->sched_lock, flags);
+
+	if (runtime) {
+		*runtime = vcpu->dl.runtime;
 	}
-	if (running_nsecs) {
-		*running_nsecs = vcpu->state_running_nsecs;
+	if (deadline) {
+		*deadline = vcpu->dl.deadline;
 	}
-	if (paused_nsecs) {
-		*paused_nsecs = vcpu->state_paused_nsecs;
+	if (period) {
+		*period = vcpu->dl.period;
 	}
-	if (halted_nsecs) {
-		*halted_nsecs = vcpu->state_halted_nsecs;
+	if (remaining) {
+		*remaining = vcpu->dl.remaining;
 	}
-	if (system_nsecs) {
-		*system_nsecs = vcpu->system_nsecs;
+	if (throttled) {
+		*throttled = vcpu->dl.throttled;
+	}
+	if (throttle_count) {
+		*throttle_count = vcpu->dl.throttle_count;
+	}
+	if (miss_count) {
+		*miss_count = vcpu->dl.miss_count;
 	}
 
-	/* Release scheduling lock */
-	vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vcpu->sched_lock, flags);
 
 	return VMM_OK;
 }
 
+u32 vmm_scheduler_dl_bandwidth(u32 hcpu)
+{
+	u64 bw;
+	irq_flags_t flags;
+	struct vmm_scheduler_ctrl *schedp;
+
+	if ((CONFIG_CPU_COUNT <= hcpu) ||
+	    !vmm_cpu_online(hcpu)) {
+		return 0;
+	}
+
+	schedp = &per_cpu(sched, hcpu);
+
+	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
+	bw = schedp->dl_total_bw;
+	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
+
+	return (u32)((bw * 1000) >> DL_BW_SHIFT);
+}
+
+u32 vmm_scheduler_dl_misses(u32 hcpu,
+			    struct vmm_scheduler_dl_miss *misses, u32 count)
+{
+	u32 i, pos;
+	irq_flags_t flags;
+	struct vmm_scheduler_ctrl *schedp;
+
+	if ((CONFIG_CPU_COUNT <= hcpu) ||
+	    !vmm_cpu_online(hcpu) || !misses) {
+		return 0;
+	}
+
+	schedp = &per_cpu(sched, hcpu);
+
+	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
+
+	if (schedp->dl_miss_count < count) {
+		count = schedp->dl_miss_count;
+	}
+	pos = schedp->dl_miss_head;
+	for (i = 0; i < count; i++) {
+		pos = (pos) ? pos - 1 : DL_MISS_TRACE_SIZE - 1;
+		misses[i] = schedp->dl_miss[pos];
+	}
+
+	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
+
+	return count;
+}
+
 int vmm_scheduler_state_change(struct vmm_vcpu *vcpu, u32 new_state)
 {
 	u64 tstamp;
@@ -541,12 +1351,20 @@ int vmm_scheduler_state_change(struct vmm_vcpu *vcpu, u32 new_state)
 	switch (new_state) {
 	case VMM_VCPU_STATE_UNKNOWN:
 		/* Existing VCPU being destroyed */
+		rq_ready_unlink(schedp, vcpu);
+		dl_cleanup(schedp, vcpu);
 		rc = vmm_schedalgo_vcpu_cleanup(vcpu);
 		break;
 	case VMM_VCPU_STATE_RESET:
 		if (current_state == VMM_VCPU_STATE_UNKNOWN) {
 			/* New VCPU */
 			rc = vmm_schedalgo_vcpu_setup(vcpu);
+			if (!rc) {
+				rc = dl_setup(schedp, vcpu);
+				if (rc) {
+					vmm_schedalgo_vcpu_cleanup(vcpu);
+				}
+			}
 		} else if (current_state != VMM_VCPU_STATE_RESET) {
 			/* Existing VCPU */
 			/* Clear resumed flag */
@@ -656,6 +1474,7 @@ int vmm_scheduler_state_change(struct vmm_vcpu *vcpu, u32 new_state)
 		}
 		if (new_state == VMM_VCPU_STATE_RESET) {
 			vcpu->state_ready_nsecs = 0;
+			vcpu->state_ready_max_nsecs = 0;
 			vcpu->state_running_nsecs = 0;
 			vcpu->state_paused_nsecs = 0;
 			vcpu->state_halted_nsecs = 0;
@@ -664,6 +1483,8 @@ int vmm_scheduler_state_change(struct vmm_vcpu *vcpu, u32 new_state)
 		}
 		arch_atomic_write(&vcpu->state, new_state);
 		vcpu->state_tstamp = tstamp;
+		vmm_trace(VMM_TRACE_VCPU_STATE, vcpu,
+			  current_state, new_state, 0);
 	}
 
 skip_state_change:
@@ -753,6 +1574,7 @@ static void scheduler_ipi_migrate_vcpu(void *arg0, void *arg1, void *arg2)
 
 	/* Enqueue VCPU to new hcpu ready queue */
 	vcpu->hcpu = new_hcpu;
+	vcpu->migrate_tstamp = vmm_timer_timestamp();
 	rq_enqueue(&per_cpu(sched, new_hcpu), vcpu);
 
 	/* Trigger re-scheduling on new hcpu */
@@ -791,6 +1613,16 @@ int vmm_scheduler_set_hcpu(struct vmm_vcpu *vcpu, u32 hcpu)
 		return VMM_EINVALID;
 	}
 
+	/* Move deadline class reservation to new hcpu */
+	if (vcpu->dl.bw) {
+		if (dl_admit(&per_cpu(sched, hcpu), 0, vcpu->dl.bw)) {
+			vmm_write_unlock_irqrestore_lite(&vcpu->sched_lock,
+							 flags);
+			return VMM_ENOSPC;
+		}
+		dl_admit(&per_cpu(sched, old_hcpu), vcpu->dl.bw, 0);
+	}
+
 	/* Check if we don't need to migrate VCPU to new hcpu */
 	state = arch_atomic_read(&vcpu->state);
 	if ((state == VMM_VCPU_STATE_READY) ||
@@ -830,6 +1662,12 @@ void vmm_scheduler_irq_enter(arch_regs_t *regs, bool vcpu_context)
 
 	/* Ensure that yield on exit is disabled */
 	schedp->yield_on_irq_exit = FALSE;
+
+	/* Normal VCPU being current means we came out of guest */
+	if (schedp->current_vcpu && schedp->current_vcpu->is_normal) {
+		vmm_trace(VMM_TRACE_GUEST_EXIT, schedp->current_vcpu,
+			  vcpu_context, 0, 0);
+	}
 }
 
 arch_regs_t *vmm_scheduler_irq_regs(void)
@@ -874,6 +1712,12 @@ void vmm_scheduler_irq_exit(arch_regs_t *regs)
 
 	/* Clear pointer to IRQ registers */
 	schedp->irq_regs = NULL;
+
+	/* Normal VCPU being current means we go back to guest */
+	if (schedp->current_vcpu->is_normal) {
+		vmm_trace(VMM_TRACE_GUEST_ENTRY, schedp->current_vcpu,
+			  0, 0, 0);
+	}
 }
 
 bool vmm_scheduler_irq_context(void)
@@ -927,16 +1771,86 @@ u32 vmm_scheduler_ready_count(u32 hcpu, u8 priority)
 	return rq_length(&per_cpu(sched, hcpu), priority);
 }
 
+int vmm_scheduler_ready_iterate(u32 hcpu,
+				int (*iter)(struct vmm_vcpu *, void *),
+				void *priv)
+{
+	int rc = VMM_OK;
+	irq_flags_t flags;
+	struct vmm_vcpu *vcpu;
+	struct vmm_scheduler_ctrl *schedp;
+
+	if ((CONFIG_CPU_COUNT <= hcpu) ||
+	    !vmm_cpu_online(hcpu) || !iter) {
+		return VMM_EINVALID;
+	}
+
+	schedp = &per_cpu(sched, hcpu);
+
+	vmm_spin_lock_irqsave_lite(&schedp->rq_lock, flags);
+	list_for_each_entry(vcpu, &schedp->rq_ready_list, ready_head) {
+		rc = iter(vcpu, priv);
+		if (rc) {
+			break;
+		}
+	}
+	vmm_spin_unlock_irqrestore_lite(&schedp->rq_lock, flags);
+
+	return rc;
+}
+
+int vmm_scheduler_set_steal_order(u32 hcpu, const u32 *order, u32 count)
+{
+	u32 i;
+	struct vmm_scheduler_ctrl *schedp;
+
+	if ((CONFIG_CPU_COUNT <= hcpu) || !order ||
+	    (CONFIG_CPU_COUNT < count)) {
+		return VMM_EINVALID;
+	}
+	for (i = 0; i < count; i++) {
+		if (CONFIG_CPU_COUNT <= order[i]) {
+			return VMM_EINVALID;
+		}
+	}
+
+	/* Every entry is always a valid host CPU so a stealing host
+	 * CPU racing with this update only sees a different order.
+	 */
+	schedp = &per_cpu(sched, hcpu);
+	if (count < schedp->steal_order_count) {
+		schedp->steal_order_count = count;
+		arch_smp_wmb();
+	}
+	for (i = 0; i < count; i++) {
+		schedp->steal_order[i] = order[i];
+	}
+	arch_smp_wmb();
+	schedp->steal_order_count = count;
+
+	return VMM_OK;
+}
+
+u64 vmm_scheduler_steal_count(u32 hcpu)
+{
+	if (CONFIG_CPU_COUNT <= hcpu) {
+		return 0;
+	}
+
+	return per_cpu(sched, hcpu).steal_count;
+}
+
 static void scheduler_sample_event(struct vmm_timer_event *ev)
 {
 	irq_flags_t flags;
+	bool stop_sample = FALSE;
 	u64 idle_ns, irq_ns, next_period;
 	struct vmm_scheduler_ctrl *schedp = &this_cpu(sched);
 
 	idle_ns = 0;
 	vmm_scheduler_stats(schedp->idle_vcpu,
 			    NULL, NULL, NULL, NULL, NULL, NULL,
-			    &idle_ns, NULL, NULL, NULL);
+			    &idle_ns, NULL, NULL, NULL, NULL, NULL);
 
 	irq_ns = 0;
 	arch_cpu_irq_save(flags);
@@ -949,14 +1863,152 @@ static void scheduler_sample_event(struct vmm_timer_event *ev)
 	schedp->sample_idle_last_ns = idle_ns;
 	schedp->sample_irq_ns = irq_ns - schedp->sample_irq_last_ns;
 	schedp->sample_irq_last_ns = irq_ns;
+	schedp->sample_tstamp = vmm_timer_timestamp();
 
 	next_period = schedp->sample_period_ns;
 
+#ifdef CONFIG_SCHED_TICKLESS
+	/* Next sample is computed lazily when time-slice timer is stopped */
+	if (schedp->tick_stopped) {
+		schedp->sample_stopped = TRUE;
+		stop_sample = TRUE;
+	}
+#endif
+
+	vmm_write_unlock_irqrestore_lite(&schedp->sample_lock, flags);
+
+	if (!stop_sample) {
+		vmm_timer_event_start(&schedp->sample_ev, next_period);
+	}
+}
+
+#ifdef CONFIG_SCHED_TICKLESS
+
+/* Scale delta measured over elapsed nanoseconds to given period */
+static u64 sample_scale(u64 delta, u64 elapsed, u64 period)
+{
+	while (delta && (period > udiv64(~0ULL, delta))) {
+		delta >>= 1;
+		elapsed >>= 1;
+	}
+
+	if (!elapsed) {
+		return period;
+	}
+
+	return udiv64(delta * period, elapsed);
+}
+
+/* Idle time of host CPU (i.e. running time of idle VCPU) till given
+ * timestamp without doing system time sync with host CPU.
+ */
+static u64 scheduler_idle_ns(struct vmm_scheduler_ctrl *schedp, u64 tstamp)
+{
+	u64 ret;
+	irq_flags_t flags;
+	struct vmm_vcpu *idle = schedp->idle_vcpu;
+
+	vmm_read_lock_irqsave_lite(&idle->sched_lock, flags);
+	ret = idle->state_running_nsecs;
+	if ((arch_atomic_read(&idle->state) == VMM_VCPU_STATE_RUNNING) &&
+	    (idle->state_tstamp < tstamp)) {
+		ret += tstamp - idle->state_tstamp;
+	}
+	vmm_read_unlock_irqrestore_lite(&idle->sched_lock, flags);
+
+	return ret;
+}
+
+/* Retrive lazy sample of stopped sampling for given timestamp and
+ * return FALSE if last sample is still valid.
+ * NOTE: Must be called with schedp->sample_lock held
+ */
+static bool __scheduler_sample_lazy(struct vmm_scheduler_ctrl *schedp,
+				    u64 tstamp, u64 *idle_ns, u64 *irq_ns)
+{
+	u64 elapsed;
+
+	if (!schedp->sample_stopped ||
+	    (tstamp < schedp->sample_tstamp)) {
+		return FALSE;
+	}
+
+	elapsed = tstamp - schedp->sample_tstamp;
+	if (elapsed < schedp->sample_period_ns) {
+		return FALSE;
+	}
+
+	if (idle_ns) {
+		*idle_ns = sample_scale(scheduler_idle_ns(schedp, tstamp) -
+					schedp->sample_idle_last_ns,
+					elapsed, schedp->sample_period_ns);
+	}
+	if (irq_ns) {
+		*irq_ns = sample_scale(schedp->irq_process_ns -
+				       schedp->sample_irq_last_ns,
+				       elapsed, schedp->sample_period_ns);
+	}
+
+	return TRUE;
+}
+
+/* Restart sampling which was stopped along with time-slice timer
+ * NOTE: Must be called on host CPU of given scheduler control
+ */
+static void scheduler_sample_resume(struct vmm_scheduler_ctrl *schedp)
+{
+	irq_flags_t flags;
+	u64 tstamp, elapsed, idle_ns, irq_ns, next_period;
+
+	tstamp = vmm_timer_timestamp();
+	idle_ns = scheduler_idle_ns(schedp, tstamp);
+
+	vmm_write_lock_irqsave_lite(&schedp->sample_lock, flags);
+
+	if (!schedp->sample_stopped) {
+		vmm_write_unlock_irqrestore_lite(&schedp->sample_lock, flags);
+		return;
+	}
+	schedp->sample_stopped = FALSE;
+
+	irq_ns = schedp->irq_process_ns;
+	elapsed = tstamp - schedp->sample_tstamp;
+	if (elapsed < schedp->sample_period_ns) {
+		/* Sample period not over yet */
+		next_period = schedp->sample_period_ns - elapsed;
+	} else {
+		schedp->sample_idle_ns =
+			sample_scale(idle_ns - schedp->sample_idle_last_ns,
+				     elapsed, schedp->sample_period_ns);
+		schedp->sample_idle_last_ns = idle_ns;
+		schedp->sample_irq_ns =
+			sample_scale(irq_ns - schedp->sample_irq_last_ns,
+				     elapsed, schedp->sample_period_ns);
+		schedp->sample_irq_last_ns = irq_ns;
+		schedp->sample_tstamp = tstamp;
+		next_period = schedp->sample_period_ns;
+	}
+
 	vmm_write_unlock_irqrestore_lite(&schedp->sample_lock, flags);
 
 	vmm_timer_event_start(&schedp->sample_ev, next_period);
 }
 
+#else
+
+static inline bool __scheduler_sample_lazy(struct vmm_scheduler_ctrl *schedp,
+					   u64 tstamp, u64 *idle_ns,
+					   u64 *irq_ns)
+{
+	return FALSE;
+}
+
+static inline void scheduler_sample_resume(struct vmm_scheduler_ctrl *schedp)
+{
+}
+
+#endif
+
 u64 vmm_scheduler_get_sample_period(u32 hcpu)
 {
 	u64 ret;
@@ -1009,6 +2061,7 @@ u64 vmm_scheduler_irq_time(u32 hcpu)
 
 	vmm_read_lock_irqsave_lite(&schedp->sample_lock, flags);
 	ret = schedp->sample_irq_ns;
+	__scheduler_sample_lazy(schedp, vmm_timer_timestamp(), NULL, &ret);
 	vmm_read_unlock_irqrestore_lite(&schedp->sample_lock, flags);
 
 	return ret;
@@ -1029,6 +2082,7 @@ u64 vmm_scheduler_idle_time(u32 hcpu)
 
 	vmm_read_lock_irqsave_lite(&schedp->sample_lock, flags);
 	ret = schedp->sample_idle_ns;
+	__scheduler_sample_lazy(schedp, vmm_timer_timestamp(), &ret, NULL);
 	vmm_read_unlock_irqrestore_lite(&schedp->sample_lock, flags);
 
 	return ret;
@@ -1077,10 +2131,132 @@ void vmm_scheduler_yield(void)
 	}
 
 	if (vmm_manager_vcpu_get_state(vcpu) == VMM_VCPU_STATE_RUNNING) {
+		schedp->current_vcpu_yielded = TRUE;
 		vmm_scheduler_state_change(vcpu, VMM_VCPU_STATE_READY);
 	}
 }
 
+/* NOTE: Must be called on host CPU of given VCPU with irqs disabled */
+static bool scheduler_boost(struct vmm_scheduler_ctrl *schedp,
+			    struct vmm_vcpu *vcpu)
+{
+	bool ret = FALSE;
+	struct vmm_vcpu *current = schedp->current_vcpu;
+
+	vmm_write_lock_lite(&vcpu->sched_lock);
+
+	if ((arch_atomic_read(&vcpu->state) == VMM_VCPU_STATE_READY) &&
+	    (vcpu->hcpu == vmm_smp_processor_id()) &&
+	    (current != vcpu) &&
+	    (!current || (current->priority <= vcpu->priority))) {
+		ret = (rq_boost(schedp, vcpu) == VMM_OK) ? TRUE : FALSE;
+	}
+
+	vmm_write_unlock_lite(&vcpu->sched_lock);
+
+	return ret;
+}
+
+static void scheduler_ipi_boost(void *arg0, void *arg1, void *arg2)
+{
+	irq_flags_t flags;
+	struct vmm_vcpu *vcpu = arg0;
+	struct vmm_scheduler_ctrl *schedp = &this_cpu(sched);
+
+	arch_cpu_irq_save(flags);
+
+	if (scheduler_boost(schedp, vcpu) && schedp->irq_regs) {
+		vmm_scheduler_switch(schedp, schedp->irq_regs);
+	}
+
+	arch_cpu_irq_restore(flags);
+}
+
+int vmm_scheduler_yield_to(struct vmm_vcpu *vcpu)
+{
+	u32 hcpu;
+	irq_flags_t flags;
+	struct vmm_scheduler_ctrl *schedp = &this_cpu(sched);
+
+	if (!vcpu || (vcpu == schedp->current_vcpu)) {
+		return VMM_EINVALID;
+	}
+
+	vmm_scheduler_get_hcpu(vcpu, &hcpu);
+	if (hcpu == vmm_smp_processor_id()) {
+		arch_cpu_irq_save(flags);
+		scheduler_boost(schedp, vcpu);
+		arch_cpu_irq_restore(flags);
+	} else {
+		/* Boost on its own host CPU so that we don't race with
+		 * scheduling decisions of that host CPU. Sync IPI is
+		 * handled in interrupt context where we can preempt
+		 * current VCPU of that host CPU.
+		 */
+		vmm_smp_ipi_sync_call(vmm_cpumask_of(hcpu), 0,
+				      scheduler_ipi_boost, vcpu, NULL, NULL);
+	}
+
+	vmm_scheduler_yield();
+
+	return VMM_OK;
+}
+
+struct scheduler_yield_candidate {
+	struct vmm_vcpu *current;
+	struct vmm_vcpu *local;
+	struct vmm_vcpu *remote;
+	u32 hcpu;
+};
+
+static int scheduler_yield_candidate_iter(struct vmm_vcpu *vcpu, void *priv)
+{
+	struct scheduler_yield_candidate *c = priv;
+
+	if ((vcpu == c->current) || !vcpu->preempted ||
+	    (arch_atomic_read(&vcpu->state) != VMM_VCPU_STATE_READY)) {
+		return VMM_OK;
+	}
+
+	if (vcpu->hcpu == c->hcpu) {
+		c->local = vcpu;
+		return VMM_EALREADY;
+	}
+	if (!c->remote) {
+		c->remote = vcpu;
+	}
+
+	return VMM_OK;
+}
+
+void vmm_scheduler_yield_directed(void)
+{
+	struct scheduler_yield_candidate c;
+	struct vmm_vcpu *vcpu = this_cpu(sched).current_vcpu;
+
+	if (!IS_ENABLED(CONFIG_SCHED_DIRECTED_YIELD) ||
+	    !vcpu || !vcpu->is_normal || !vcpu->guest) {
+		vmm_scheduler_yield();
+		return;
+	}
+
+	/* Prefer sibling preempted on same host CPU over other host CPUs */
+	c.current = vcpu;
+	c.local = NULL;
+	c.remote = NULL;
+	c.hcpu = vmm_smp_processor_id();
+	vmm_manager_guest_vcpu_iterate(vcpu->guest,
+				       scheduler_yield_candidate_iter, &c);
+
+	if (c.local) {
+		vmm_scheduler_yield_to(c.local);
+	} else if (c.remote) {
+		vmm_scheduler_yield_to(c.remote);
+	} else {
+		vmm_scheduler_yield();
+	}
+}
+
 static void idle_orphan(void)
 {
 	struct vmm_scheduler_ctrl *schedp = &this_cpu(sched);
@@ -1097,6 +2273,7 @@ static void idle_orphan(void)
 static int scheduler_startup(struct vmm_cpuhp_notify *cpuhp, u32 cpu)
 {
 	int rc;
+	u32 i;
 	char vcpu_name[VMM_FIELD_NAME_SIZE];
 	struct vmm_scheduler_ctrl *schedp = &per_cpu(sched, cpu);
 
@@ -1109,9 +2286,23 @@ static int scheduler_startup(struct vmm_cpuhp_notify *cpuhp, u32 cpu)
 		return VMM_EFAIL;
 	}
 	INIT_SPIN_LOCK(&schedp->rq_lock);
+	INIT_LIST_HEAD(&schedp->rq_ready_list);
+
+	/* By default, steal from peer host CPUs in round-robin order */
+	for (i = 1; i < CONFIG_CPU_COUNT; i++) {
+		schedp->steal_order[i - 1] = (cpu + i) % CONFIG_CPU_COUNT;
+	}
+	schedp->steal_order_count = CONFIG_CPU_COUNT - 1;
 	ARCH_ATOMIC_INIT(&schedp->rq_resched_state,
 			 VMM_SCHEDULER_RESCHED_IDLE);
 
+	/* Initialize deadline class ready queue (Per Host CPU) */
+	schedp->dl_root = RB_ROOT;
+	schedp->dl_count = 0;
+	schedp->dl_total_bw = 0;
+	schedp->dl_miss_head = 0;
+	schedp->dl_miss_count = 0;
+
 	/* Initialize current VCPU and IDLE VCPU. (Per Host CPU) */
 	schedp->current_vcpu_irq_ns = 0;
 	schedp->current_vcpu_exp_ns = 0;
@@ -1130,11 +2321,17 @@ static int scheduler_startup(struct vmm_cpuhp_notify *cpuhp, u32 cpu)
 
 	/* Initialize timer events (Per Host CPU) */
 	INIT_TIMER_EVENT(&schedp->ev, &scheduler_timer_event, schedp);
+	schedp->tick_stopped = FALSE;
+	schedp->tick_slice_ns = 0;
 	INIT_TIMER_EVENT(&schedp->sample_ev,
 				&scheduler_sample_event, schedp);
+	vmm_timer_event_set_slack(&schedp->sample_ev,
+				  CONFIG_TIMER_SLACK_USECS * 1000ULL);
 
 	/* Initialize sampling info (Per Host CPU) */
 	INIT_RW_LOCK(&schedp->sample_lock);
+	schedp->sample_stopped = FALSE;
+	schedp->sample_tstamp = 0;
 	schedp->sample_period_ns = SAMPLE_EVENT_PERIOD;
 	schedp->sample_idle_ns = 0;
 	schedp->sample_idle_last_ns = 0;
@@ -1168,6 +2365,7 @@ static int scheduler_startup(struct vmm_cpuhp_notify *cpuhp, u32 cpu)
 
 	/* Start timer events */
 	vmm_timer_event_start(&schedp->ev, 0);
+	schedp->sample_tstamp = vmm_timer_timestamp();
 	vmm_timer_event_start(&schedp->sample_ev, SAMPLE_EVENT_PERIOD);
 
 	return VMM_OK;
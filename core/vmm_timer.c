@@ -33,16 +33,25 @@
 #include <arch_cpu_irq.h>
 #include <libs/stringlib.h>
 
+/** Maximum number of events looked-up for coalescing */
+#define TIMER_COALESCE_SCAN_MAX		16
+
 /** Control structure for Timer Subsystem */
 struct vmm_timer_local_ctrl {
 	struct vmm_timecounter tc;
 	struct vmm_clockchip *cc;
 	bool started;
 	bool inprocess;
+	bool programmed;
 	u64 next_event;
 	struct vmm_timer_event *curr;
-	vmm_rwlock_t event_list_lock;
-	struct dlist event_list;
+	vmm_rwlock_t event_tree_lock;
+	struct rb_root event_tree;
+	struct rb_node *event_first;
+	u64 start_count;
+	u64 program_count;
+	u64 program_skip_count;
+	u64 coalesced_count;
 };
 
 static DEFINE_PER_CPU(struct vmm_timer_local_ctrl, tlc);
@@ -111,38 +120,120 @@ u64 vmm_timer_timestamp(void)
 	return ret;
 }
 
-/* Note: This function must be called with tlcp->event_list_lock held. */
-static void __timer_schedule_next_event(struct vmm_timer_local_ctrl *tlcp)
+/* Note: This function must be called with tlcp->event_tree_lock held.
+ *
+ * Events are sorted by expiry time so the first event gives the earliest
+ * deadline which is further delayed within its slack. Subsequent events
+ * expiring before this deadline can share the same clockchip programming
+ * provided the deadline is within their slack as well.
+ */
+static u64 __timer_next_deadline(struct vmm_timer_local_ctrl *tlcp)
 {
-	u64 tstamp;
+	u32 i;
+	u64 deadline;
+	struct rb_node *n;
 	struct vmm_timer_event *e;
 
+	e = rb_entry(tlcp->event_first, struct vmm_timer_event, active_rb);
+	deadline = e->expiry_tstamp + e->slack_nsecs;
+
+	n = rb_next(tlcp->event_first);
+	for (i = 0; n && (i < TIMER_COALESCE_SCAN_MAX); i++) {
+		e = rb_entry(n, struct vmm_timer_event, active_rb);
+		if (deadline < e->expiry_tstamp) {
+			return deadline;
+		}
+		if ((e->expiry_tstamp + e->slack_nsecs) < deadline) {
+			deadline = e->expiry_tstamp + e->slack_nsecs;
+		}
+		n = rb_next(n);
+	}
+
+	/* Too many events to look-up so don't go beyond next event */
+	if (n) {
+		e = rb_entry(n, struct vmm_timer_event, active_rb);
+		if (e->expiry_tstamp < deadline) {
+			deadline = e->expiry_tstamp;
+		}
+	}
+
+	return deadline;
+}
+
+/* Note: This function must be called with tlcp->event_tree_lock held. */
+static void __timer_schedule_next_event(struct vmm_timer_local_ctrl *tlcp)
+{
+	u64 tstamp, deadline;
+
 	/* If not started yet or still processing events then we give up */
 	if ((tlcp->started == FALSE) || (tlcp->inprocess == TRUE)) {
 		return;
 	}
 
 	/* If no events, we give up */
-	if (list_empty(&tlcp->event_list)) {
+	if (!tlcp->event_first) {
 		return;
 	}
 
-	/* Retrieve first event from list of active events */
-	e = list_entry(list_first(&tlcp->event_list),
-		       struct vmm_timer_event,
-		       active_head);
-
 	/* Configure clockevent device for first event */
-	tlcp->curr = e;
+	tlcp->curr = rb_entry(tlcp->event_first,
+			      struct vmm_timer_event, active_rb);
+	deadline = __timer_next_deadline(tlcp);
+
+	/* If clockchip will fire before deadline then nothing to do
+	 * because expired events are processed and clockchip is
+	 * re-programmed from the clockchip event handler.
+	 */
+	if (tlcp->programmed && (tlcp->next_event <= deadline)) {
+		tlcp->program_skip_count++;
+		return;
+	}
+
 	tstamp = vmm_timer_timestamp();
-	if (tstamp < e->expiry_tstamp) {
-		tlcp->next_event = e->expiry_tstamp;
-		vmm_clockchip_program_event(tlcp->cc,
-				    tstamp, e->expiry_tstamp);
-	} else {
-		tlcp->next_event = tstamp;
-		vmm_clockchip_program_event(tlcp->cc, tstamp, tstamp);
+	tlcp->next_event = (tstamp < deadline) ? deadline : tstamp;
+	tlcp->programmed = TRUE;
+	tlcp->program_count++;
+	vmm_clockchip_program_event(tlcp->cc, tstamp, tlcp->next_event);
+}
+
+/* Note: This function must be called with tlcp->event_tree_lock held. */
+static void __timer_event_enqueue(struct vmm_timer_local_ctrl *tlcp,
+				  struct vmm_timer_event *ev)
+{
+	bool leftmost = TRUE;
+	struct vmm_timer_event *e;
+	struct rb_node **new = &tlcp->event_tree.rb_node, *parent = NULL;
+
+	/* Events with same expiry time are kept in FIFO order */
+	while (*new) {
+		parent = *new;
+		e = rb_entry(parent, struct vmm_timer_event, active_rb);
+		if (ev->expiry_tstamp < e->expiry_tstamp) {
+			new = &parent->rb_left;
+		} else {
+			new = &parent->rb_right;
+			leftmost = FALSE;
+		}
+	}
+
+	rb_link_node(&ev->active_rb, parent, new);
+	rb_insert_color(&ev->active_rb, &tlcp->event_tree);
+
+	if (leftmost) {
+		tlcp->event_first = &ev->active_rb;
+	}
+}
+
+/* Note: This function must be called with tlcp->event_tree_lock held. */
+static void __timer_event_dequeue(struct vmm_timer_local_ctrl *tlcp,
+				  struct vmm_timer_event *ev)
+{
+	if (tlcp->event_first == &ev->active_rb) {
+		tlcp->event_first = rb_next(&ev->active_rb);
 	}
+
+	rb_erase(&ev->active_rb, &tlcp->event_tree);
+	RB_CLEAR_NODE(&ev->active_rb);
 }
 
 /* Note: This function must be called with ev->active_lock held. */
@@ -157,36 +248,38 @@ static void __timer_event_stop(struct vmm_timer_event *ev)
 
 	tlcp = &per_cpu(tlc, ev->active_hcpu);
 
-	vmm_write_lock_irqsave_lite(&tlcp->event_list_lock, flags);
+	vmm_write_lock_irqsave_lite(&tlcp->event_tree_lock, flags);
 
 	ev->active_state = FALSE;
-	list_del(&ev->active_head);
+	__timer_event_dequeue(tlcp, ev);
 	ev->expiry_tstamp = 0;
 
-	vmm_write_unlock_irqrestore_lite(&tlcp->event_list_lock, flags);
+	vmm_write_unlock_irqrestore_lite(&tlcp->event_tree_lock, flags);
 }
 
 /* This is called from interrupt context. We need to protect the
- * event list when manipulating it.
+ * event tree when manipulating it.
  */
 static void timer_clockchip_event_handler(struct vmm_clockchip *cc)
 {
+	u32 expired = 0;
 	irq_flags_t flags, flags1;
 	struct vmm_timer_event *e;
 	struct vmm_timer_local_ctrl *tlcp = &this_cpu(tlc);
 
-	vmm_read_lock_irqsave_lite(&tlcp->event_list_lock, flags);
+	vmm_read_lock_irqsave_lite(&tlcp->event_tree_lock, flags);
 
 	tlcp->inprocess = TRUE;
+	tlcp->programmed = FALSE;
 
 	/* Process expired active events */
-	while (!list_empty(&tlcp->event_list)) {
-		e = list_entry(list_first(&tlcp->event_list),
-			       struct vmm_timer_event, active_head);
+	while (tlcp->event_first) {
+		e = rb_entry(tlcp->event_first,
+			     struct vmm_timer_event, active_rb);
 		/* Current timestamp */
 		if (e->expiry_tstamp <= vmm_timer_timestamp()) {
-			/* Unlock event list for processing expired event */
-			vmm_read_unlock_irqrestore_lite(&tlcp->event_list_lock, flags);
+			/* Unlock event tree for processing expired event */
+			vmm_read_unlock_irqrestore_lite(&tlcp->event_tree_lock, flags);
 			/* Set current CPU event to NULL */
 			tlcp->curr = NULL;
 			/* Stop expired active event */
@@ -195,20 +288,26 @@ static void timer_clockchip_event_handler(struct vmm_clockchip *cc)
 			vmm_spin_unlock_irqrestore_lite(&e->active_lock, flags1);
 			/* Call event handler */
 			e->handler(e);
-			/* Lock back event list */
-			vmm_read_lock_irqsave_lite(&tlcp->event_list_lock, flags);
+			/* Lock back event tree */
+			vmm_read_lock_irqsave_lite(&tlcp->event_tree_lock, flags);
+			expired++;
 		} else {
 			/* No more expired events */
 			break;
 		}
 	}
 
+	/* Events expired beyond first one share same clockchip event */
+	if (expired > 1) {
+		tlcp->coalesced_count += expired - 1;
+	}
+
 	tlcp->inprocess = FALSE;
 
 	/* Schedule next timer event */
 	__timer_schedule_next_event(tlcp);
 
-	vmm_read_unlock_irqrestore_lite(&tlcp->event_list_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&tlcp->event_tree_lock, flags);
 }
 
 bool vmm_timer_event_pending(struct vmm_timer_event *ev)
@@ -248,9 +347,7 @@ int vmm_timer_event_start2(struct vmm_timer_event *ev,
 {
 	u32 hcpu;
 	u64 tstamp;
-	bool found_pos = FALSE;
 	irq_flags_t flags, flags1;
-	struct vmm_timer_event *e = NULL;
 	struct vmm_timer_local_ctrl *tlcp;
 
 	if (!ev) {
@@ -274,30 +371,33 @@ int vmm_timer_event_start2(struct vmm_timer_event *ev,
 		*ret_expiry_tstamp = ev->expiry_tstamp;
 	}
 
-	vmm_write_lock_irqsave_lite(&tlcp->event_list_lock, flags1);
+	vmm_write_lock_irqsave_lite(&tlcp->event_tree_lock, flags1);
 
-	list_for_each_entry(e, &tlcp->event_list, active_head) {
-		if (ev->expiry_tstamp < e->expiry_tstamp) {
-			found_pos = TRUE;
-			break;
-		}
-	}
-
-	if (!found_pos) {
-		list_add_tail(&ev->active_head, &tlcp->event_list);
-	} else {
-		list_add_tail(&ev->active_head, &e->active_head);
-	}
+	__timer_event_enqueue(tlcp, ev);
+	tlcp->start_count++;
 
 	__timer_schedule_next_event(tlcp);
 
-	vmm_write_unlock_irqrestore_lite(&tlcp->event_list_lock, flags1);
+	vmm_write_unlock_irqrestore_lite(&tlcp->event_tree_lock, flags1);
 
 	vmm_spin_unlock_irqrestore_lite(&ev->active_lock, flags);
 
 	return VMM_OK;
 }
 
+void vmm_timer_event_set_slack(struct vmm_timer_event *ev, u64 slack_nsecs)
+{
+	irq_flags_t flags;
+
+	if (!ev) {
+		return;
+	}
+
+	vmm_spin_lock_irqsave_lite(&ev->active_lock, flags);
+	ev->slack_nsecs = slack_nsecs;
+	vmm_spin_unlock_irqrestore_lite(&ev->active_lock, flags);
+}
+
 int vmm_timer_event_restart(struct vmm_timer_event *ev)
 {
 	if (!ev) {
@@ -324,6 +424,32 @@ int vmm_timer_event_stop(struct vmm_timer_event *ev)
 	return VMM_OK;
 }
 
+int vmm_timer_stats(u32 hcpu, u64 *start_count, u64 *program_count,
+		    u64 *program_skip_count, u64 *coalesced_count)
+{
+	struct vmm_timer_local_ctrl *tlcp;
+
+	if (!vmm_cpu_online(hcpu)) {
+		return VMM_EINVALID;
+	}
+	tlcp = &per_cpu(tlc, hcpu);
+
+	if (start_count) {
+		*start_count = tlcp->start_count;
+	}
+	if (program_count) {
+		*program_count = tlcp->program_count;
+	}
+	if (program_skip_count) {
+		*program_skip_count = tlcp->program_skip_count;
+	}
+	if (coalesced_count) {
+		*coalesced_count = tlcp->coalesced_count;
+	}
+
+	return VMM_OK;
+}
+
 bool vmm_timer_started(void)
 {
 	return this_cpu(tlc).started;
@@ -341,6 +467,8 @@ void vmm_timer_start(void)
 	tlcp->next_event = tstamp + tlcp->cc->min_delta_ns;
 
 	tlcp->started = TRUE;
+	tlcp->programmed = TRUE;
+	tlcp->program_count++;
 
 	vmm_clockchip_program_event(tlcp->cc, tstamp, tlcp->next_event);
 }
@@ -352,6 +480,7 @@ void vmm_timer_stop(void)
 	vmm_clockchip_set_mode(tlcp->cc, VMM_CLOCKCHIP_MODE_SHUTDOWN);
 
 	tlcp->started = FALSE;
+	tlcp->programmed = FALSE;
 }
 
 static int timer_startup(struct vmm_cpuhp_notify *cpuhp, u32 cpu)
@@ -365,13 +494,15 @@ static int timer_startup(struct vmm_cpuhp_notify *cpuhp, u32 cpu)
 	/* Initialize Per CPU event status */
 	tlcp->started = FALSE;
 	tlcp->inprocess = FALSE;
+	tlcp->programmed = FALSE;
 
 	/* Initialize Per CPU current event pointer */
 	tlcp->curr = NULL;
 
-	/* Initialize Per CPU event list */
-	INIT_RW_LOCK(&tlcp->event_list_lock);
-	INIT_LIST_HEAD(&tlcp->event_list);
+	/* Initialize Per CPU event tree */
+	INIT_RW_LOCK(&tlcp->event_tree_lock);
+	tlcp->event_tree = RB_ROOT;
+	tlcp->event_first = NULL;
 
 	/* Bind suitable clockchip to current host CPU */
 	tlcp->cc = vmm_clockchip_bind_best(cpu);
@@ -0,0 +1,267 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_trace.c
+ * @author agent (agent@local)
+ * @brief source file of hypervisor event tracing.
+ *
+ * Each host CPU has a ring buffer of fixed size binary records which
+ * is only written by its owner host CPU with local interrupts disabled,
+ * so writers never take a lock. The head index is published after the
+ * record is filled and readers (from any host CPU) discard records which
+ * could have been overwritten while being copied.
+ */
+
+#include <vmm_error.h>
+#include <vmm_heap.h>
+#include <vmm_smp.h>
+#include <vmm_percpu.h>
+#include <vmm_mutex.h>
+#include <vmm_timer.h>
+#include <vmm_manager.h>
+#include <vmm_trace.h>
+#include <arch_cpu_irq.h>
+#include <arch_barrier.h>
+
+#define TRACE_BUFFER_SIZE	(1U << CONFIG_TRACE_BUFFER_SHIFT)
+#define TRACE_BUFFER_MASK	(TRACE_BUFFER_SIZE - 1)
+#define TRACE_IPI_TIMEOUT_MSECS	1000
+
+struct trace_cpu_buffer {
+	struct vmm_trace_record *ring;
+	u32 head;
+	u32 tail;
+	u64 lost;
+};
+
+static DEFINE_PER_CPU(struct trace_cpu_buffer, tbuf);
+static DEFINE_MUTEX(trace_lock);
+u32 vmm_trace_event_mask;
+
+static const char *const trace_event_names[VMM_TRACE_MAX_EVENT] = {
+	[VMM_TRACE_GUEST_EXIT] = "guest_exit",
+	[VMM_TRACE_GUEST_ENTRY] = "guest_entry",
+	[VMM_TRACE_MMIO_READ] = "mmio_read",
+	[VMM_TRACE_MMIO_WRITE] = "mmio_write",
+	[VMM_TRACE_STAGE2_FAULT] = "stage2_fault",
+	[VMM_TRACE_VCPU_STATE] = "vcpu_state",
+	[VMM_TRACE_IRQ_ASSERT] = "irq_assert",
+	[VMM_TRACE_VIRTQ_NOTIFY] = "virtq_notify",
+};
+
+void __vmm_trace(u32 event, struct vmm_vcpu *vcpu,
+		 u64 arg0, u64 arg1, u32 arg2)
+{
+	irq_flags_t flags;
+	struct vmm_trace_record *r;
+	struct trace_cpu_buffer *tb;
+
+	arch_cpu_irq_save(flags);
+
+	tb = &this_cpu(tbuf);
+	if (!tb->ring || !(vmm_trace_event_mask & (1U << event))) {
+		goto done;
+	}
+
+	r = &tb->ring[tb->head & TRACE_BUFFER_MASK];
+	r->tstamp = vmm_timer_timestamp();
+	r->event = event;
+	r->cpu = vmm_smp_processor_id();
+	r->vcpu_id = (vcpu) ? vcpu->id : VMM_TRACE_NO_ID;
+	r->guest_id = (vcpu && vcpu->guest) ?
+			vcpu->guest->id : VMM_TRACE_NO_ID;
+	r->arg0 = arg0;
+	r->arg1 = arg1;
+	r->arg2 = arg2;
+
+	/* Publish record only after it is completely written */
+	arch_smp_wmb();
+	tb->head++;
+
+done:
+	arch_cpu_irq_restore(flags);
+}
+
+bool vmm_trace_isactive(void)
+{
+	return (vmm_trace_event_mask) ? TRUE : FALSE;
+}
+
+u32 vmm_trace_get_event_mask(void)
+{
+	return vmm_trace_event_mask;
+}
+
+const char *vmm_trace_event_name(u32 event)
+{
+	if (VMM_TRACE_MAX_EVENT <= event) {
+		return "unknown";
+	}
+
+	return trace_event_names[event];
+}
+
+static void trace_buffer_reset(struct trace_cpu_buffer *tb)
+{
+	tb->head = 0;
+	tb->tail = 0;
+	tb->lost = 0;
+}
+
+static void trace_ipi_reset(void *arg0, void *arg1, void *arg2)
+{
+	irq_flags_t flags;
+
+	arch_cpu_irq_save(flags);
+	trace_buffer_reset(&this_cpu(tbuf));
+	arch_cpu_irq_restore(flags);
+}
+
+int vmm_trace_start(u32 event_mask)
+{
+	u32 cpu;
+	struct trace_cpu_buffer *tb;
+
+	event_mask &= VMM_TRACE_ALL_EVENTS;
+	if (!event_mask) {
+		event_mask = VMM_TRACE_ALL_EVENTS;
+	}
+
+	vmm_mutex_lock(&trace_lock);
+
+	for_each_possible_cpu(cpu) {
+		tb = &per_cpu(tbuf, cpu);
+		if (tb->ring) {
+			continue;
+		}
+		tb->ring = vmm_malloc(TRACE_BUFFER_SIZE *
+				      sizeof(struct vmm_trace_record));
+		if (!tb->ring) {
+			vmm_mutex_unlock(&trace_lock);
+			return VMM_ENOMEM;
+		}
+		trace_buffer_reset(tb);
+	}
+
+	/* Writers only run on their own host CPU so reset over there */
+	vmm_trace_event_mask = 0;
+	vmm_smp_ipi_sync_call(cpu_online_mask, TRACE_IPI_TIMEOUT_MSECS,
+			      trace_ipi_reset, NULL, NULL, NULL);
+	for_each_possible_cpu(cpu) {
+		if (!vmm_cpu_online(cpu)) {
+			trace_buffer_reset(&per_cpu(tbuf, cpu));
+		}
+	}
+
+	arch_smp_mb();
+	vmm_trace_event_mask = event_mask;
+
+	vmm_mutex_unlock(&trace_lock);
+
+	return VMM_OK;
+}
+
+int vmm_trace_stop(void)
+{
+	vmm_mutex_lock(&trace_lock);
+
+	if (!vmm_trace_event_mask) {
+		vmm_mutex_unlock(&trace_lock);
+		return VMM_EFAIL;
+	}
+
+	vmm_trace_event_mask = 0;
+	arch_smp_mb();
+
+	vmm_mutex_unlock(&trace_lock);
+
+	return VMM_OK;
+}
+
+u32 vmm_trace_buffer_size(void)
+{
+	return TRACE_BUFFER_SIZE;
+}
+
+u32 vmm_trace_pending(u32 cpu)
+{
+	u32 avail;
+	struct trace_cpu_buffer *tb;
+
+	if (CONFIG_CPU_COUNT <= cpu) {
+		return 0;
+	}
+	tb = &per_cpu(tbuf, cpu);
+
+	avail = tb->head - tb->tail;
+
+	return (avail < TRACE_BUFFER_SIZE) ? avail : TRACE_BUFFER_SIZE;
+}
+
+u64 vmm_trace_lost(u32 cpu)
+{
+	if (CONFIG_CPU_COUNT <= cpu) {
+		return 0;
+	}
+
+	return per_cpu(tbuf, cpu).lost;
+}
+
+u32 vmm_trace_read(u32 cpu, struct vmm_trace_record *recs, u32 count)
+{
+	u32 head, ret = 0;
+	struct trace_cpu_buffer *tb;
+
+	if ((CONFIG_CPU_COUNT <= cpu) || !recs || !count) {
+		return 0;
+	}
+	tb = &per_cpu(tbuf, cpu);
+
+	vmm_mutex_lock(&trace_lock);
+
+	if (!tb->ring) {
+		goto done;
+	}
+
+	head = tb->head;
+	arch_smp_rmb();
+
+	/* Skip records already overwritten by writer */
+	if (TRACE_BUFFER_SIZE < (head - tb->tail)) {
+		tb->lost += (head - tb->tail) - TRACE_BUFFER_SIZE;
+		tb->tail = head - TRACE_BUFFER_SIZE;
+	}
+
+	while ((tb->tail != head) && (ret < count)) {
+		recs[ret] = tb->ring[tb->tail & TRACE_BUFFER_MASK];
+		arch_smp_rmb();
+
+		/* Drop the copy if writer could have reused this slot */
+		if (TRACE_BUFFER_SIZE <= (tb->head - tb->tail)) {
+			tb->lost++;
+		} else {
+			ret++;
+		}
+		tb->tail++;
+	}
+
+done:
+	vmm_mutex_unlock(&trace_lock);
+
+	return ret;
+}
@@ -27,9 +27,11 @@
 #include <vmm_stdio.h>
 #include <vmm_timer.h>
 #include <vmm_scheduler.h>
+#include <vmm_trace.h>
 #include <vmm_devtree.h>
 #include <vmm_vcpu_irq.h>
 #include <libs/stringlib.h>
+#include <libs/bitops.h>
 
 #define DEASSERTED	0
 #define ASSERTED	1
@@ -37,25 +39,105 @@
 
 #define WFI_YIELD_THRESHOLD	100
 
+/* Pending bitmap has one bit per irq rank and irq ranks are ordered
+ * by decreasing irq priority (ties ordered by irq number) so the first
+ * set bit gives highest priority ASSERTED irq. The irqs with zero
+ * priority are never executed hence they have no pending bit.
+ *
+ * Bitmap words are 32-bit wide because arch_atomic_cmpxchg() only
+ * updates 32 bits on some 64-bit architectures.
+ */
+#define PENDING_BITS			32
+#define PENDING_WORDS(irq_count)	\
+			(((irq_count) + PENDING_BITS - 1) / PENDING_BITS)
+#define PENDING_WORD(rank)		((rank) / PENDING_BITS)
+#define PENDING_MASK(rank)		(1U << ((rank) % PENDING_BITS))
+
+static void vcpu_irq_pending_set(struct vmm_vcpu *vcpu, u32 rank)
+{
+	u32 old, mask = PENDING_MASK(rank);
+	atomic_t *word = &vcpu->irqs.pending[PENDING_WORD(rank)];
+
+	do {
+		old = (u32)arch_atomic_read(word);
+		if (old & mask) {
+			return;
+		}
+	} while (arch_atomic_cmpxchg(word, old, old | mask) != old);
+}
+
+static void vcpu_irq_pending_clear(struct vmm_vcpu *vcpu, u32 rank)
+{
+	u32 old, mask = PENDING_MASK(rank);
+	atomic_t *word = &vcpu->irqs.pending[PENDING_WORD(rank)];
+
+	do {
+		old = (u32)arch_atomic_read(word);
+		if (!(old & mask)) {
+			return;
+		}
+	} while (arch_atomic_cmpxchg(word, old, old & ~mask) != old);
+}
+
+/* Update pending bit of given irq based on its assert state. The assert
+ * state is checked again after updating pending bit so that concurrent
+ * assert state changes can't leave pending bit out of sync.
+ */
+static void vcpu_irq_pending_sync(struct vmm_vcpu *vcpu, u32 irq_no)
+{
+	bool asserted;
+	struct vmm_vcpu_irq *irq = &vcpu->irqs.irq[irq_no];
+
+	if (vcpu->irqs.rank_count <= irq->rank) {
+		return;
+	}
+
+	do {
+		asserted = (arch_atomic_read(&irq->assert) == ASSERTED);
+		if (asserted) {
+			vcpu_irq_pending_set(vcpu, irq->rank);
+		} else {
+			vcpu_irq_pending_clear(vcpu, irq->rank);
+		}
+	} while (asserted !=
+		 (arch_atomic_read(&irq->assert) == ASSERTED));
+}
+
+/* Find highest priority ASSERTED irq using pending bitmap */
+static int vcpu_irq_pending_find(struct vmm_vcpu *vcpu)
+{
+	u32 i, word, rank, irq_no, words;
+
+	words = PENDING_WORDS(vcpu->irqs.rank_count);
+	for (i = 0; i < words; i++) {
+		while ((word = (u32)arch_atomic_read(
+					&vcpu->irqs.pending[i]))) {
+			rank = i * PENDING_BITS + __ffs(word);
+			/* Bits beyond last rank are never valid */
+			if (vcpu->irqs.rank_count <= rank) {
+				break;
+			}
+			irq_no = vcpu->irqs.rank_irq[rank];
+			if (arch_atomic_read(&vcpu->irqs.irq[irq_no].assert) ==
+			    ASSERTED) {
+				return irq_no;
+			}
+			/* Stale pending bit so sync it and look again */
+			vcpu_irq_pending_sync(vcpu, irq_no);
+		}
+	}
+
+	return -1;
+}
+
 static bool vcpu_irq_process_one(struct vmm_vcpu *vcpu, arch_regs_t *regs)
 {
 	/* Proceed only if we have pending execute */
 	if (arch_atomic_dec_if_positive(&vcpu->irqs.execute_pending) >= 0) {
-		int irq_no = -1;
-		u32 i, tmp_prio, irq_count = vcpu->irqs.irq_count;
-		u32 irq_prio = 0;
+		int irq_no;
 
 		/* Find the irq number to process */
-		for (i = 0; i < irq_count; i++) {
-			if (arch_atomic_read(&vcpu->irqs.irq[i].assert) ==
-			    ASSERTED) {
-				tmp_prio = arch_vcpu_irq_priority(vcpu, i);
-				if (tmp_prio > irq_prio) {
-					irq_no = i;
-					irq_prio = tmp_prio;
-				}
-			}
-		}
+		irq_no = vcpu_irq_pending_find(vcpu);
 		if (irq_no == -1) {
 			return FALSE;
 		}
@@ -63,6 +145,7 @@ static bool vcpu_irq_process_one(struct vmm_vcpu *vcpu, arch_regs_t *regs)
 		/* If irq number found then execute it */
 		if (arch_atomic_cmpxchg(&vcpu->irqs.irq[irq_no].assert,
 					ASSERTED, PENDING) == ASSERTED) {
+			vcpu_irq_pending_sync(vcpu, irq_no);
 			if (arch_vcpu_irq_execute(vcpu, regs, irq_no,
 			    	vcpu->irqs.irq[irq_no].reason) == VMM_OK) {
 				arch_atomic_write(&vcpu->irqs.
@@ -81,6 +164,7 @@ static bool vcpu_irq_process_one(struct vmm_vcpu *vcpu, arch_regs_t *regs)
 				arch_atomic_write(&vcpu->irqs.
 						  irq[irq_no].assert,
 						  ASSERTED);
+				vcpu_irq_pending_sync(vcpu, irq_no);
 			}
 		}
 
@@ -175,7 +259,7 @@ void vmm_vcpu_irq_assert(struct vmm_vcpu *vcpu, u32 irq_no, u64 reason)
 	}
 
 	/* Check irq number */
-	if (irq_no > vcpu->irqs.irq_count) {
+	if (irq_no >= vcpu->irqs.irq_count) {
 		return;
 	}
 
@@ -184,6 +268,7 @@ void vmm_vcpu_irq_assert(struct vmm_vcpu *vcpu, u32 irq_no, u64 reason)
 				DEASSERTED, ASSERTED) == DEASSERTED) {
 		if (arch_vcpu_irq_assert(vcpu, irq_no, reason) == VMM_OK) {
 			vcpu->irqs.irq[irq_no].reason = reason;
+			vcpu_irq_pending_sync(vcpu, irq_no);
 			arch_atomic_inc(&vcpu->irqs.execute_pending);
 			arch_atomic64_inc(&vcpu->irqs.assert_count);
 			asserted = TRUE;
@@ -195,6 +280,7 @@ void vmm_vcpu_irq_assert(struct vmm_vcpu *vcpu, u32 irq_no, u64 reason)
 
 	/* Resume VCPU from wfi */
 	if (asserted) {
+		vmm_trace(VMM_TRACE_IRQ_ASSERT, vcpu, irq_no, reason, 0);
 		vmm_manager_vcpu_hcpu_func(vcpu,
 					   VMM_VCPU_STATE_INTERRUPTIBLE,
 					   vcpu_irq_wfi_resume, NULL, FALSE);
@@ -209,7 +295,7 @@ void vmm_vcpu_irq_clear(struct vmm_vcpu *vcpu, u32 irq_no)
 	}
 
 	/* Check irq number */
-	if (irq_no > vcpu->irqs.irq_count) {
+	if (irq_no >= vcpu->irqs.irq_count) {
 		return;
 	}
 
@@ -224,6 +310,7 @@ void vmm_vcpu_irq_clear(struct vmm_vcpu *vcpu, u32 irq_no)
 
 	/* Reset VCPU irq assert state */
 	arch_atomic_write(&vcpu->irqs.irq[irq_no].assert, DEASSERTED);
+	vcpu_irq_pending_sync(vcpu, irq_no);
 
 	/* Ensure irq reason is zeroed */
 	vcpu->irqs.irq[irq_no].reason = 0x0;
@@ -237,7 +324,7 @@ void vmm_vcpu_irq_deassert(struct vmm_vcpu *vcpu, u32 irq_no)
 	}
 
 	/* Check irq number */
-	if (irq_no > vcpu->irqs.irq_count) {
+	if (irq_no >= vcpu->irqs.irq_count) {
 		return;
 	}
 
@@ -249,6 +336,7 @@ void vmm_vcpu_irq_deassert(struct vmm_vcpu *vcpu, u32 irq_no)
 
 	/* Reset VCPU irq assert state */
 	arch_atomic_write(&vcpu->irqs.irq[irq_no].assert, DEASSERTED);
+	vcpu_irq_pending_sync(vcpu, irq_no);
 
 	/* Ensure irq reason is zeroed */
 	vcpu->irqs.irq[irq_no].reason = 0x0;
@@ -371,6 +459,33 @@ bool vmm_vcpu_irq_wait_state(struct vmm_vcpu *vcpu)
 	return ret;
 }
 
+/* Order irqs by decreasing priority (stable w.r.t. irq number) */
+static void vcpu_irq_rank_init(struct vmm_vcpu *vcpu)
+{
+	u32 i, j, prio, irq_count = vcpu->irqs.irq_count;
+	u32 *rank_irq = vcpu->irqs.rank_irq;
+
+	vcpu->irqs.rank_count = 0;
+	for (i = 0; i < irq_count; i++) {
+		prio = arch_vcpu_irq_priority(vcpu, i);
+		for (j = i; j > 0; j--) {
+			if (prio <= arch_vcpu_irq_priority(vcpu,
+							   rank_irq[j - 1])) {
+				break;
+			}
+			rank_irq[j] = rank_irq[j - 1];
+		}
+		rank_irq[j] = i;
+		if (prio) {
+			vcpu->irqs.rank_count++;
+		}
+	}
+
+	for (i = 0; i < irq_count; i++) {
+		vcpu->irqs.irq[rank_irq[i]].rank = i;
+	}
+}
+
 int vmm_vcpu_irq_init(struct vmm_vcpu *vcpu)
 {
 	int rc;
@@ -402,9 +517,32 @@ int vmm_vcpu_irq_init(struct vmm_vcpu *vcpu)
 			return VMM_ENOMEM;
 		}
 
+		/* Allocate memory for irq ranks */
+		vcpu->irqs.rank_irq = vmm_zalloc(sizeof(u32) * irq_count);
+		if (!vcpu->irqs.rank_irq) {
+			vmm_free(vcpu->irqs.irq);
+			vcpu->irqs.irq = NULL;
+			return VMM_ENOMEM;
+		}
+
+		/* Allocate memory for pending bitmap */
+		vcpu->irqs.pending = vmm_zalloc(sizeof(atomic_t) *
+						PENDING_WORDS(irq_count));
+		if (!vcpu->irqs.pending) {
+			vmm_free(vcpu->irqs.rank_irq);
+			vcpu->irqs.rank_irq = NULL;
+			vmm_free(vcpu->irqs.irq);
+			vcpu->irqs.irq = NULL;
+			return VMM_ENOMEM;
+		}
+
 		/* Create wfi_timeout event */
 		ev = vmm_zalloc(sizeof(struct vmm_timer_event));
 		if (!ev) {
+			vmm_free(vcpu->irqs.pending);
+			vcpu->irqs.pending = NULL;
+			vmm_free(vcpu->irqs.rank_irq);
+			vcpu->irqs.rank_irq = NULL;
 			vmm_free(vcpu->irqs.irq);
 			vcpu->irqs.irq = NULL;
 			return VMM_ENOMEM;
@@ -435,12 +573,20 @@ int vmm_vcpu_irq_init(struct vmm_vcpu *vcpu)
 		vcpu->irqs.irq[ite].reason = 0;
 		arch_atomic_write(&vcpu->irqs.irq[ite].assert, DEASSERTED);
 	}
+	for (ite = 0; ite < PENDING_WORDS(irq_count); ite++) {
+		arch_atomic_write(&vcpu->irqs.pending[ite], 0);
+	}
+	vcpu_irq_rank_init(vcpu);
 
 	/* Setup wait for irq context */
 	vcpu->irqs.wfi.yield_count = 0;
 	vcpu->irqs.wfi.state = FALSE;
 	rc = vmm_timer_event_stop(vcpu->irqs.wfi.priv);
 	if (rc != VMM_OK) {
+		vmm_free(vcpu->irqs.pending);
+		vcpu->irqs.pending = NULL;
+		vmm_free(vcpu->irqs.rank_irq);
+		vcpu->irqs.rank_irq = NULL;
 		vmm_free(vcpu->irqs.irq);
 		vcpu->irqs.irq = NULL;
 		vmm_free(vcpu->irqs.wfi.priv);
@@ -469,6 +615,12 @@ int vmm_vcpu_irq_deinit(struct vmm_vcpu *vcpu)
 	vmm_free(vcpu->irqs.wfi.priv);
 	vcpu->irqs.wfi.priv = NULL;
 
+	/* Free pending bitmap and irq ranks */
+	vmm_free(vcpu->irqs.pending);
+	vcpu->irqs.pending = NULL;
+	vmm_free(vcpu->irqs.rank_irq);
+	vcpu->irqs.rank_irq = NULL;
+
 	/* Free flags */
 	vmm_free(vcpu->irqs.irq);
 	vcpu->irqs.irq = NULL;
@@ -291,6 +291,8 @@ int vmm_workqueue_schedule_delayed_work(struct vmm_workqueue *wq,
 
 	work->work.wq = wq;
 	INIT_TIMER_EVENT(&work->event, delayed_work_timer_event, work);
+	vmm_timer_event_set_slack(&work->event,
+				  CONFIG_TIMER_SLACK_USECS * 1000ULL);
 
 	return vmm_timer_event_start(&work->event, nsecs);
 }
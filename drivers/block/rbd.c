@@ -43,6 +43,28 @@
 static LIST_HEAD(rbd_list);
 static DEFINE_SPINLOCK(rbd_list_lock);
 
+static void rbd_sg_copy(struct rbd *d, struct vmm_request *r)
+{
+	u32 i;
+	physical_addr_t pa;
+	physical_size_t len, sz;
+
+	pa = d->addr + r->lba * RBD_BLOCK_SIZE;
+	sz = r->bcnt * RBD_BLOCK_SIZE;
+
+	/* Scatter list can be longer than request so stop at bcnt */
+	for (i = 0; (i < r->sg_count) && sz; i++) {
+		len = min(sz, (physical_size_t)r->sg[i].len);
+		if (r->type == VMM_REQUEST_READ) {
+			vmm_host_memory_copy(r->sg[i].addr, pa, len, TRUE);
+		} else {
+			vmm_host_memory_copy(pa, r->sg[i].addr, len, TRUE);
+		}
+		pa += len;
+		sz -= len;
+	}
+}
+
 static int rbd_read_cache(struct vmm_blockrq *brq,
 			  struct vmm_request *r, void *priv)
 {
@@ -50,6 +72,11 @@ static int rbd_read_cache(struct vmm_blockrq *brq,
 	physical_addr_t pa;
 	physical_size_t sz;
 
+	if (r->sg) {
+		rbd_sg_copy(d, r);
+		return VMM_OK;
+	}
+
 	pa = d->addr + r->lba * RBD_BLOCK_SIZE;
 	sz = r->bcnt * RBD_BLOCK_SIZE;
 
@@ -65,6 +92,11 @@ static int rbd_write_cache(struct vmm_blockrq *brq,
 	physical_addr_t pa;
 	physical_size_t sz;
 
+	if (r->sg) {
+		rbd_sg_copy(d, r);
+		return VMM_OK;
+	}
+
 	pa = d->addr + r->lba * RBD_BLOCK_SIZE;
 	sz = r->bcnt * RBD_BLOCK_SIZE;
 
@@ -110,7 +142,7 @@ static struct rbd *__rbd_create(struct vmm_device *dev,
 	strncpy(d->bdev->desc, "RAM backed block device",
 		VMM_FIELD_DESC_SIZE);
 	d->bdev->dev.parent = dev;
-	d->bdev->flags = VMM_BLOCKDEV_RW;
+	d->bdev->flags = VMM_BLOCKDEV_RW | VMM_BLOCKDEV_SG;
 	d->bdev->start_lba = 0;
 	d->bdev->num_blocks = udiv64(d->size, RBD_BLOCK_SIZE);
 	d->bdev->block_size = RBD_BLOCK_SIZE;
@@ -27,6 +27,8 @@
 #include <vmm_spinlocks.h>
 #include <vmm_modules.h>
 #include <vmm_devemu.h>
+#include <vmm_guest_aspace.h>
+#include <arch_atomic.h>
 #include <vio/vmm_vdisk.h>
 #include <vio/vmm_virtio.h>
 #include <vio/vmm_virtio_blk.h>
@@ -49,12 +51,16 @@
 #define MODULE_EXIT			virtio_blk_exit
 
 #define VIRTIO_BLK_QUEUE_SIZE		128
-#define VIRTIO_BLK_IO_QUEUE		0
+#define VIRTIO_BLK_MIN_QUEUE_SIZE	4
+#define VIRTIO_BLK_MAX_QUEUE_SIZE	1024
 #define VIRTIO_BLK_NUM_QUEUES		1
+#define VIRTIO_BLK_MAX_QUEUES		64
 #define VIRTIO_BLK_SECTOR_SIZE		512
-#define VIRTIO_BLK_DISK_SEG_MAX		(VIRTIO_BLK_QUEUE_SIZE - 2)
+
+struct virtio_blk_queue;
 
 struct virtio_blk_dev_req {
+	struct virtio_blk_queue		*q;
 	struct vmm_virtio_queue		*vq;
 	u16				head;
 	struct vmm_virtio_iovec		*read_iov;
@@ -62,15 +68,27 @@ struct virtio_blk_dev_req {
 	u32				len;
 	struct vmm_virtio_iovec		status_iov;
 	void				*data;
+	struct vmm_request_sg		*sg;
 	struct vmm_vdisk_request	r;
 };
 
+struct virtio_blk_queue {
+	struct vmm_virtio_queue 	vq;
+	/* Consumer of available ring (and iov) plus pending kicks */
+	atomic_t			avail_busy;
+	/* Serialize producers of used ring */
+	vmm_spinlock_t			used_lock;
+	struct vmm_virtio_iovec		*iov;
+	struct virtio_blk_dev_req	*reqs;
+};
+
 struct virtio_blk_dev {
 	struct vmm_virtio_device 	*vdev;
 
-	struct vmm_virtio_queue 	vqs[VIRTIO_BLK_NUM_QUEUES];
-	struct vmm_virtio_iovec		iov[VIRTIO_BLK_QUEUE_SIZE];
-	struct virtio_blk_dev_req	reqs[VIRTIO_BLK_QUEUE_SIZE];
+	u32				num_queues;
+	u32				queue_size;
+	u32				seg_max;
+	struct virtio_blk_queue		*queues;
 	u64 				features;
 
 	struct vmm_virtio_blk_config 	config;
@@ -79,13 +97,19 @@ struct virtio_blk_dev {
 
 static u64 virtio_blk_get_host_features(struct vmm_virtio_device *dev)
 {
-	return	1UL << VMM_VIRTIO_BLK_F_SEG_MAX
+	struct virtio_blk_dev *vbdev = dev->emu_data;
+	u64 features;
+
+	features = 1UL << VMM_VIRTIO_BLK_F_SEG_MAX
 		| 1UL << VMM_VIRTIO_BLK_F_BLK_SIZE
 		| 1UL << VMM_VIRTIO_BLK_F_FLUSH
-		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX;
-#if 0
+		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
 		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC;
-#endif
+	if (vbdev->num_queues > 1) {
+		features |= 1UL << VMM_VIRTIO_BLK_F_MQ;
+	}
+
+	return features;
 }
 
 static void virtio_blk_set_guest_features(struct vmm_virtio_device *dev,
@@ -104,53 +128,32 @@ static int virtio_blk_init_vq(struct vmm_virtio_device *dev,
 			      u32 vq, u32 page_size, u32 align,
 			      u32 pfn)
 {
-	int rc;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		rc = vmm_virtio_queue_setup(&vbdev->vqs[vq], dev->guest,
-				pfn, page_size, VIRTIO_BLK_QUEUE_SIZE, align);
-		break;
-	default:
-		rc = VMM_EINVALID;
-		break;
-	};
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
 
-	return rc;
+	return vmm_virtio_queue_setup(&vbdev->queues[vq].vq, dev->guest,
+				pfn, page_size, vbdev->queue_size, align);
 }
 
 static int virtio_blk_get_pfn_vq(struct vmm_virtio_device *dev, u32 vq)
 {
-	int rc;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		rc = vmm_virtio_queue_guest_pfn(&vbdev->vqs[vq]);
-		break;
-	default:
-		rc = VMM_EINVALID;
-		break;
-	};
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
 
-	return rc;
+	return vmm_virtio_queue_guest_pfn(&vbdev->queues[vq].vq);
 }
 
 static int virtio_blk_get_size_vq(struct vmm_virtio_device *dev, u32 vq)
 {
-	int rc;
-
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		rc = VIRTIO_BLK_QUEUE_SIZE;
-		break;
-	default:
-		rc = 0;
-		break;
-	};
+	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	return rc;
+	return (vq < vbdev->num_queues) ? vbdev->queue_size : 0;
 }
 
 static int virtio_blk_set_size_vq(struct vmm_virtio_device *dev,
@@ -163,8 +166,10 @@ static int virtio_blk_set_size_vq(struct vmm_virtio_device *dev,
 static void virtio_blk_req_done(struct virtio_blk_dev *vbdev,
 				struct virtio_blk_dev_req *req, u8 status)
 {
+	irq_flags_t flags;
 	struct vmm_virtio_device *dev = vbdev->vdev;
-	int queueid = req->vq - vbdev->vqs;
+	struct virtio_blk_queue *q = req->q;
+	int queueid = q - vbdev->queues;
 
 	if (req->read_iov && req->len && req->data &&
 	    (status == VMM_VIRTIO_BLK_S_OK) &&
@@ -190,11 +195,13 @@ static void virtio_blk_req_done(struct virtio_blk_dev *vbdev,
 
 	vmm_virtio_buf_to_iovec_write(dev, &req->status_iov, 1, &status, 1);
 
+	/* Completion always goes back to the queue of submitter */
+	vmm_spin_lock_irqsave(&q->used_lock, flags);
 	vmm_virtio_queue_set_used_elem(req->vq, req->head, req->len);
-
 	if (vmm_virtio_queue_should_signal(req->vq)) {
 		dev->tra->notify(dev, queueid);
 	}
+	vmm_spin_unlock_irqrestore(&q->used_lock, flags);
 }
 
 static void virtio_blk_attached(struct vmm_vdisk *vdisk)
@@ -205,7 +212,7 @@ static void virtio_blk_attached(struct vmm_vdisk *vdisk)
 		__func__, vmm_vdisk_name(vdisk));
 
 	vbdev->config.capacity = vmm_vdisk_capacity(vbdev->vdisk);
-	vbdev->config.seg_max = VIRTIO_BLK_DISK_SEG_MAX,
+	vbdev->config.seg_max = vbdev->seg_max;
 	vbdev->config.blk_size = vmm_vdisk_block_size(vbdev->vdisk);
 }
 
@@ -217,7 +224,7 @@ static void virtio_blk_detached(struct vmm_vdisk *vdisk)
 		__func__, vmm_vdisk_name(vdisk));
 
 	vbdev->config.capacity = 0;
-	vbdev->config.seg_max = VIRTIO_BLK_DISK_SEG_MAX,
+	vbdev->config.seg_max = vbdev->seg_max;
 	vbdev->config.blk_size = VIRTIO_BLK_SECTOR_SIZE;
 }
 
@@ -243,20 +250,117 @@ static void virtio_blk_req_failed(struct vmm_vdisk *vdisk,
 			    VMM_VIRTIO_BLK_S_IOERR);
 }
 
+static u32 virtio_blk_req_build_sg(struct vmm_virtio_device *dev,
+				   struct virtio_blk_dev *vbdev,
+				   struct virtio_blk_dev_req *req,
+				   struct vmm_virtio_iovec *iov,
+				   u32 iov_cnt)
+{
+	u32 i, sg_cnt = 0, reg_flags;
+	physical_addr_t gphys, hphys;
+	physical_size_t len, avail;
+
+	/* Scatter list is allocated on first use and kept for
+	 * subsequent requests using the same descriptor head.
+	 */
+	if (!req->sg) {
+		req->sg = vmm_malloc(sizeof(*req->sg) * vbdev->seg_max);
+		if (!req->sg) {
+			return 0;
+		}
+	}
+
+	for (i = 0; i < iov_cnt; i++) {
+		gphys = iov[i].addr;
+		len = iov[i].len;
+		while (len) {
+			reg_flags = 0x0;
+			if (vmm_guest_physical_map(dev->guest, gphys, len,
+						   &hphys, &avail, &reg_flags)) {
+				return 0;
+			}
+			/* Only real guest RAM can be accessed directly */
+			if (!avail ||
+			    !(reg_flags & VMM_REGION_REAL) ||
+			    !(reg_flags & VMM_REGION_ISRAM)) {
+				return 0;
+			}
+			if (sg_cnt &&
+			    ((req->sg[sg_cnt - 1].addr +
+			      req->sg[sg_cnt - 1].len) == hphys)) {
+				req->sg[sg_cnt - 1].len += avail;
+			} else if (sg_cnt < vbdev->seg_max) {
+				req->sg[sg_cnt].addr = hphys;
+				req->sg[sg_cnt].len = avail;
+				sg_cnt++;
+			} else {
+				return 0;
+			}
+			gphys += avail;
+			len -= avail;
+		}
+	}
+
+	return sg_cnt;
+}
+
+static int virtio_blk_req_submit_sg(struct vmm_virtio_device *dev,
+				    struct virtio_blk_dev *vbdev,
+				    struct virtio_blk_dev_req *req,
+				    enum vmm_vdisk_request_type type,
+				    u64 sector, u32 iov_cnt)
+{
+	u32 sg_cnt;
+
+	/* Don't bother building scatter list if it won't be used */
+	if (!vmm_vdisk_can_sg(vbdev->vdisk)) {
+		return VMM_ENOTSUPP;
+	}
+
+	sg_cnt = virtio_blk_req_build_sg(dev, vbdev, req,
+					 &req->q->iov[1], iov_cnt);
+	if (!sg_cnt) {
+		return VMM_ENOTSUPP;
+	}
+
+	/* Note: We will get failed() or complete() callback
+	 * even when no block device attached to virtual disk
+	 * but not when attached block device does not support
+	 * scatter list IO.
+	 */
+	return vmm_vdisk_submit_sg_request(vbdev->vdisk, &req->r, type,
+					   sector, req->sg, sg_cnt, req->len);
+}
+
 static void virtio_blk_do_io(struct vmm_virtio_device *dev,
-			     struct virtio_blk_dev *vbdev)
+			     struct virtio_blk_dev *vbdev,
+			     struct virtio_blk_queue *q)
 {
 	int rc;
 	u16 head, thead;
 	u32 i, iov_cnt, len;
+	irq_flags_t uflags;
 	struct virtio_blk_dev_req *req;
-	struct vmm_virtio_queue *vq = &vbdev->vqs[VIRTIO_BLK_IO_QUEUE];
+	struct vmm_virtio_queue *vq = &q->vq;
+	struct vmm_virtio_iovec *iov = q->iov;
 	struct vmm_virtio_blk_outhdr hdr;
 
+	/* Each queue is drained by one VCPU at a time so that
+	 * queues of different VCPUs are processed in parallel.
+	 * A VCPU notifying a queue which is being drained does
+	 * not wait; instead the draining VCPU takes another pass
+	 * so no lock is held across allocations and disk I/O.
+	 */
+	if (arch_atomic_add_return(&q->avail_busy, 1) > 1) {
+		return;
+	}
+
+again:
+	arch_atomic_write(&q->avail_busy, 1);
 	while (vmm_virtio_queue_available(vq)) {
 		thead = vmm_virtio_queue_pop(vq);
-		req = &vbdev->reqs[thead];
-		rc = vmm_virtio_queue_get_head_iovec(vq, thead, vbdev->iov,
+		req = &q->reqs[thead];
+		rc = vmm_virtio_queue_get_head_iovec(vq, thead, iov,
 						     &iov_cnt, &len, &head);
 		if (rc) {
 			vmm_printf("%s: failed to get iovec (error %d)\n",
@@ -264,22 +368,25 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 			continue;
 		}
 
+		req->q = q;
 		req->vq = vq;
 		req->head = head;
 		req->read_iov = NULL;
 		req->read_iov_cnt = 0;
 		req->len = 0;
 		for (i = 1; i < (iov_cnt - 1); i++) {
-			req->len += vbdev->iov[i].len;
+			req->len += iov[i].len;
 		}
-		req->status_iov.addr = vbdev->iov[iov_cnt - 1].addr;
-		req->status_iov.len = vbdev->iov[iov_cnt - 1].len;
+		req->status_iov.addr = iov[iov_cnt - 1].addr;
+		req->status_iov.len = iov[iov_cnt - 1].len;
 		vmm_vdisk_set_request_type(&req->r, VMM_VDISK_REQUEST_UNKNOWN);
 
-		len = vmm_virtio_iovec_to_buf_read(dev, &vbdev->iov[0], 1,
+		len = vmm_virtio_iovec_to_buf_read(dev, &iov[0], 1,
 						   &hdr, sizeof(hdr));
 		if (len < sizeof(hdr)) {
+			vmm_spin_lock_irqsave(&q->used_lock, uflags);
 			vmm_virtio_queue_set_used_elem(req->vq, req->head, 0);
+			vmm_spin_unlock_irqrestore(&q->used_lock, uflags);
 			continue;
 		}
 
@@ -287,6 +394,18 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 		case VMM_VIRTIO_BLK_T_IN:
 			vmm_vdisk_set_request_type(&req->r,
 						   VMM_VDISK_REQUEST_READ);
+			DPRINTF("%s: VIRTIO_BLK_T_IN dev=%s "
+				"hdr.sector=%"PRIu64" req->len=%d\n",
+				__func__, dev->name,
+				(u64)hdr.sector, req->len);
+			/* Try to read directly into guest pages */
+			if (virtio_blk_req_submit_sg(dev, vbdev, req,
+					VMM_VDISK_REQUEST_READ,
+					hdr.sector, iov_cnt - 2) !=
+							VMM_ENOTSUPP) {
+				break;
+			}
+			/* Fallback to bounce buffer */
 			req->data = vmm_malloc(req->len);
 			if (!req->data) {
 				virtio_blk_req_done(vbdev, req,
@@ -302,13 +421,9 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 			}
 			req->read_iov_cnt = iov_cnt - 2;
 			for (i = 0; i < req->read_iov_cnt; i++) {
-				req->read_iov[i].addr = vbdev->iov[i + 1].addr;
-				req->read_iov[i].len = vbdev->iov[i + 1].len;
+				req->read_iov[i].addr = iov[i + 1].addr;
+				req->read_iov[i].len = iov[i + 1].len;
 			}
-			DPRINTF("%s: VIRTIO_BLK_T_IN dev=%s "
-				"hdr.sector=%"PRIu64" req->len=%d\n",
-				__func__, dev->name,
-				(u64)hdr.sector, req->len);
 			/* Note: We will get failed() or complete() callback
 			 * even when no block device attached to virtual disk
 			 */
@@ -319,6 +434,18 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 		case VMM_VIRTIO_BLK_T_OUT:
 			vmm_vdisk_set_request_type(&req->r,
 						   VMM_VDISK_REQUEST_WRITE);
+			DPRINTF("%s: VIRTIO_BLK_T_OUT dev=%s "
+				"hdr.sector=%"PRIu64" req->len=%d\n",
+				__func__, dev->name,
+				(u64)hdr.sector, req->len);
+			/* Try to write directly from guest pages */
+			if (virtio_blk_req_submit_sg(dev, vbdev, req,
+					VMM_VDISK_REQUEST_WRITE,
+					hdr.sector, iov_cnt - 2) !=
+							VMM_ENOTSUPP) {
+				break;
+			}
+			/* Fallback to bounce buffer */
 			req->data = vmm_malloc(req->len);
 			if (!req->data) {
 				virtio_blk_req_done(vbdev, req,
@@ -326,15 +453,11 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 				continue;
 			} else {
 				vmm_virtio_iovec_to_buf_read(dev,
-							 &vbdev->iov[1],
+							 &iov[1],
 							 iov_cnt - 2,
 							 req->data,
 							 req->len);
 			}
-			DPRINTF("%s: VIRTIO_BLK_T_OUT dev=%s "
-				"hdr.sector=%"PRIu64" req->len=%d\n",
-				__func__, dev->name,
-				(u64)hdr.sector, req->len);
 			/* Note: We will get failed() or complete() callback
 			 * even when no block device attached to virtual disk
 			 */
@@ -373,8 +496,8 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 				continue;
 			}
 			req->read_iov_cnt = 1;
-			req->read_iov[0].addr = vbdev->iov[1].addr;
-			req->read_iov[0].len = vbdev->iov[1].len;
+			req->read_iov[0].addr = iov[1].addr;
+			req->read_iov[0].len = iov[1].len;
 			DPRINTF("%s: VIRTIO_BLK_T_GET_ID dev=%s req->len=%d\n",
 				__func__, dev->name, req->len);
 			if (vmm_vdisk_current_block_device(vbdev->vdisk,
@@ -392,25 +515,25 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 			break;
 		};
 	}
+
+	if (arch_atomic_sub_return(&q->avail_busy, 1) > 0) {
+		goto again;
+	}
 }
 
 static int virtio_blk_notify_vq(struct vmm_virtio_device *dev, u32 vq)
 {
-	int rc = VMM_OK;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
 	DPRINTF("%s: dev=%s vq=%d\n", __func__, dev->name, vq);
 
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		virtio_blk_do_io(dev, vbdev);
-		break;
-	default:
-		rc = VMM_EINVALID;
-		break;
-	};
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
 
-	return rc;
+	virtio_blk_do_io(dev, vbdev, &vbdev->queues[vq]);
+
+	return VMM_OK;
 }
 
 static void virtio_blk_status_changed(struct vmm_virtio_device *dev,
@@ -455,26 +578,89 @@ static int virtio_blk_write_config(struct vmm_virtio_device *dev,
 
 static int virtio_blk_reset(struct vmm_virtio_device *dev)
 {
-	int i, rc;
+	int rc;
+	u32 i, j;
+	struct vmm_request_sg *sg;
+	struct virtio_blk_queue *q;
 	struct virtio_blk_dev_req *req;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
 	DPRINTF("%s: dev=%s\n", __func__, dev->name);
 
-	for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
-		req = &vbdev->reqs[i];
-		if (vmm_vdisk_get_request_type(&req->r) !=
-					VMM_VDISK_REQUEST_UNKNOWN) {
-			vmm_vdisk_abort_request(vbdev->vdisk, &req->r);
+	for (i = 0; i < vbdev->num_queues; i++) {
+		q = &vbdev->queues[i];
+
+		for (j = 0; j < vbdev->queue_size; j++) {
+			req = &q->reqs[j];
+			if (vmm_vdisk_get_request_type(&req->r) !=
+						VMM_VDISK_REQUEST_UNKNOWN) {
+				vmm_vdisk_abort_request(vbdev->vdisk, &req->r);
+			}
+			sg = req->sg;
+			memset(req, 0, sizeof(*req));
+			req->sg = sg;
+			vmm_vdisk_set_request_type(&req->r,
+						   VMM_VDISK_REQUEST_UNKNOWN);
+		}
+
+		rc = vmm_virtio_queue_cleanup(&q->vq);
+		if (rc) {
+			return rc;
 		}
-		memset(req, 0, sizeof(*req));
-		vmm_vdisk_set_request_type(&req->r,
-					   VMM_VDISK_REQUEST_UNKNOWN);
 	}
 
-	rc = vmm_virtio_queue_cleanup(&vbdev->vqs[VIRTIO_BLK_IO_QUEUE]);
-	if (rc) {
-		return rc;
+	return VMM_OK;
+}
+
+static void virtio_blk_free_queues(struct virtio_blk_dev *vbdev)
+{
+	u32 i, j;
+	struct virtio_blk_queue *q;
+
+	if (!vbdev->queues) {
+		return;
+	}
+
+	for (i = 0; i < vbdev->num_queues; i++) {
+		q = &vbdev->queues[i];
+		if (q->reqs) {
+			for (j = 0; j < vbdev->queue_size; j++) {
+				if (q->reqs[j].sg) {
+					vmm_free(q->reqs[j].sg);
+				}
+			}
+			vmm_free(q->reqs);
+		}
+		if (q->iov) {
+			vmm_free(q->iov);
+		}
+	}
+
+	vmm_free(vbdev->queues);
+	vbdev->queues = NULL;
+}
+
+static int virtio_blk_alloc_queues(struct virtio_blk_dev *vbdev)
+{
+	u32 i;
+	struct virtio_blk_queue *q;
+
+	vbdev->queues = vmm_zalloc(sizeof(*vbdev->queues) *
+				   vbdev->num_queues);
+	if (!vbdev->queues) {
+		return VMM_ENOMEM;
+	}
+
+	for (i = 0; i < vbdev->num_queues; i++) {
+		q = &vbdev->queues[i];
+		ARCH_ATOMIC_INIT(&q->avail_busy, 0);
+		INIT_SPIN_LOCK(&q->used_lock);
+		q->iov = vmm_zalloc(sizeof(*q->iov) * vbdev->queue_size);
+		q->reqs = vmm_zalloc(sizeof(*q->reqs) * vbdev->queue_size);
+		if (!q->iov || !q->reqs) {
+			virtio_blk_free_queues(vbdev);
+			return VMM_ENOMEM;
+		}
 	}
 
 	return VMM_OK;
@@ -483,6 +669,7 @@ static int virtio_blk_reset(struct vmm_virtio_device *dev)
 static int virtio_blk_connect(struct vmm_virtio_device *dev,
 			      struct vmm_virtio_emulator *emu)
 {
+	int rc;
 	const char *attr;
 	struct virtio_blk_dev *vbdev;
 
@@ -495,9 +682,42 @@ static int virtio_blk_connect(struct vmm_virtio_device *dev,
 	}
 	vbdev->vdev = dev;
 
+	if (vmm_devtree_read_u32(dev->edev->node, "num_queues",
+				 &vbdev->num_queues)) {
+		vbdev->num_queues = VIRTIO_BLK_NUM_QUEUES;
+	}
+	if (!vbdev->num_queues ||
+	    (VIRTIO_BLK_MAX_QUEUES < vbdev->num_queues)) {
+		vmm_printf("%s: invalid num_queues=%d\n",
+			   dev->name, vbdev->num_queues);
+		rc = VMM_EINVALID;
+		goto fail_free_vbdev;
+	}
+
+	if (vmm_devtree_read_u32(dev->edev->node, "queue_size",
+				 &vbdev->queue_size)) {
+		vbdev->queue_size = VIRTIO_BLK_QUEUE_SIZE;
+	}
+	if ((vbdev->queue_size < VIRTIO_BLK_MIN_QUEUE_SIZE) ||
+	    (VIRTIO_BLK_MAX_QUEUE_SIZE < vbdev->queue_size) ||
+	    (vbdev->queue_size & (vbdev->queue_size - 1))) {
+		vmm_printf("%s: invalid queue_size=%d\n",
+			   dev->name, vbdev->queue_size);
+		rc = VMM_EINVALID;
+		goto fail_free_vbdev;
+	}
+	vbdev->seg_max = vbdev->queue_size - 2;
+
+	rc = virtio_blk_alloc_queues(vbdev);
+	if (rc) {
+		vmm_printf("Failed to allocate virtio block queues....\n");
+		goto fail_free_vbdev;
+	}
+
 	vbdev->config.capacity = 0;
-	vbdev->config.seg_max = VIRTIO_BLK_DISK_SEG_MAX,
+	vbdev->config.seg_max = vbdev->seg_max;
 	vbdev->config.blk_size = VIRTIO_BLK_SECTOR_SIZE;
+	vbdev->config.num_queues = vbdev->num_queues;
 
 	vbdev->vdisk = vmm_vdisk_create(dev->name, VIRTIO_BLK_SECTOR_SIZE,
 					virtio_blk_attached,
@@ -506,8 +726,8 @@ static int virtio_blk_connect(struct vmm_virtio_device *dev,
 					virtio_blk_req_failed,
 					vbdev);
 	if (!vbdev->vdisk) {
-		vmm_free(vbdev);
-		return VMM_EFAIL;
+		rc = VMM_EFAIL;
+		goto fail_free_queues;
 	}
 
 	/* Attach block device */
@@ -519,15 +739,26 @@ static int virtio_blk_connect(struct vmm_virtio_device *dev,
 	dev->emu_data = vbdev;
 
 	return VMM_OK;
+
+fail_free_queues:
+	virtio_blk_free_queues(vbdev);
+fail_free_vbdev:
+	vmm_free(vbdev);
+	return rc;
 }
 
 static void virtio_blk_disconnect(struct vmm_virtio_device *dev)
 {
+	u32 i;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
 	DPRINTF("%s: dev=%s\n", __func__, dev->name);
 
 	vmm_vdisk_destroy(vbdev->vdisk);
+	for (i = 0; i < vbdev->num_queues; i++) {
+		vmm_virtio_queue_cleanup(&vbdev->queues[i].vq);
+	}
+	virtio_blk_free_queues(vbdev);
 	vmm_free(vbdev);
 }
 
@@ -65,6 +65,7 @@ static u64 virtio_console_get_host_features(struct vmm_virtio_device *dev)
 {
 	/* We support emergency write. */
 	return 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
+		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC
 		| 1UL << VMM_VIRTIO_CONSOLE_F_EMERG_WRITE;
 }
 
@@ -378,6 +379,8 @@ static void virtio_console_disconnect(struct vmm_virtio_device *dev)
 
 	fifo_free(cdev->emerg_rd);
 	vmm_vserial_destroy(cdev->vser);
+	vmm_virtio_queue_cleanup(&cdev->vqs[VIRTIO_CONSOLE_RX_QUEUE]);
+	vmm_virtio_queue_cleanup(&cdev->vqs[VIRTIO_CONSOLE_TX_QUEUE]);
 	vmm_free(cdev);
 }
 
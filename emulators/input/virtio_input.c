@@ -80,10 +80,8 @@ struct virtio_input_dev {
 static u64 virtio_input_get_host_features(struct vmm_virtio_device *dev)
 {
 	return	1ULL << VMM_VIRTIO_F_VERSION_1
-		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX;
-#if 0
+		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
 		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC;
-#endif
 }
 
 static void virtio_input_set_guest_features(struct vmm_virtio_device *dev,
@@ -622,6 +620,8 @@ static void virtio_input_disconnect(struct vmm_virtio_device *dev)
 
 	vmm_vmouse_destroy(videv->vmou);
 	vmm_vkeyboard_destroy(videv->vkbd);
+	vmm_virtio_queue_cleanup(&videv->vqs[VIRTIO_INPUT_EVENT_QUEUE]);
+	vmm_virtio_queue_cleanup(&videv->vqs[VIRTIO_INPUT_STATUS_QUEUE]);
 	vmm_free(videv);
 }
 
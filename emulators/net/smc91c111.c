@@ -421,8 +421,16 @@ static int smc91c111_switch2port_xfer(struct vmm_netport *port,
 		/* Cannot avoid a copy in case of fragmented mbuf data */
 		len = min(SMC91C111_MTU, mbuf->m_pktlen);
 		buf = vmm_malloc(len);
-		m_copydata(mbuf, 0, len, buf);
+		if (!buf) {
+			m_freem(mbuf);
+			return VMM_ENOMEM;
+		}
+		rc = m_copydata(mbuf, 0, len, buf);
 		m_freem(mbuf);
+		if (rc) {
+			vmm_free(buf);
+			return rc;
+		}
 		MGETHDR(mbuf, 0, 0);
 		MEXTADD(mbuf, buf, len, 0, 0);
 	}
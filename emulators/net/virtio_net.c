@@ -25,6 +25,10 @@
 #include <vmm_heap.h>
 #include <vmm_modules.h>
 #include <vmm_devemu.h>
+#include <vmm_delay.h>
+#include <vmm_host_aspace.h>
+#include <vmm_guest_aspace.h>
+#include <arch_atomic.h>
 #include <vio/vmm_virtio.h>
 #include <vio/vmm_virtio_net.h>
 
@@ -34,6 +38,7 @@
 #include <net/vmm_netswitch.h>
 #include <net/vmm_netport.h>
 #include <net/vmm_mbuf.h>
+#include <libs/mathlib.h>
 
 #define MODULE_DESC			"VirtIO Net Emulator"
 #define MODULE_AUTHOR			"Pranav Sawargaonkar"
@@ -50,9 +55,34 @@
 #define VIRTIO_NET_CTRL_QUEUE		3
 
 #define VIRTIO_NET_MTU			1514
+#define VIRTIO_NET_GSO_MAX_LEN		(65536 + VIRTIO_NET_MTU)
 
 #define VIRTIO_NET_TX_LAZY_BUDGET	(VIRTIO_NET_QUEUE_SIZE / 4)
 
+/* Zero-copy TX: frames smaller than VIRTIO_NET_ZC_MIN_LEN are always
+ * copied whereas bigger frames have first VIRTIO_NET_ZC_COPY_LEN bytes
+ * (i.e. protocol headers) copied and remaining data referenced in
+ * sender guest memory using at most VIRTIO_NET_ZC_MAX_SG entries.
+ */
+#define VIRTIO_NET_ZC_MIN_LEN		256
+#define VIRTIO_NET_ZC_COPY_LEN		128
+#define VIRTIO_NET_ZC_MAX_SG		20
+#define VIRTIO_NET_ZC_WAIT_MSECS	1000
+
+struct virtio_net_queue;
+
+struct virtio_net_zc_tx {
+	struct virtio_net_queue *q;
+	/* Held for read by receivers copying from sg */
+	vmm_rwlock_t sg_lock;
+	bool busy;
+	u16 head;
+	u32 len;
+	u32 gen;
+	struct vmm_mbuf_sg sg[VIRTIO_NET_ZC_MAX_SG];
+	u8 data[VIRTIO_NET_ZC_COPY_LEN];
+};
+
 struct virtio_net_queue {
 	int num;
 	int valid;
@@ -61,6 +91,12 @@ struct virtio_net_queue {
 	struct vmm_virtio_queue vq;
 	struct vmm_virtio_iovec iov[VIRTIO_NET_QUEUE_SIZE];
 	struct virtio_net_dev *ndev;
+
+	/* Lock to serialize used ring updates of TX queue */
+	vmm_spinlock_t used_lock;
+	/* Zero-copy TX contexts indexed by descriptor head */
+	struct virtio_net_zc_tx *zc;
+	u32 zc_gen;
 };
 
 struct virtio_net_dev {
@@ -69,11 +105,20 @@ struct virtio_net_dev {
 	struct virtio_net_queue *vqs;
 	u32 cq;		/* Configuration queue number */
 	u32 max_queues;
+	u32 curr_queue_pairs;
 	u32 can_receive;
 	struct vmm_virtio_net_config config;
 	u64 features;
 
+	/* RX scratch state (serialized by switch2port_xfer_lock) */
+	u16 rx_heads[VIRTIO_NET_QUEUE_SIZE];
+	u32 rx_lens[VIRTIO_NET_QUEUE_SIZE];
+	struct vmm_virtio_iovec rx_hiov[VIRTIO_NET_QUEUE_SIZE];
+
 	int mode;
+	bool zero_copy;
+	/* Zero-copy TX mbufs in flight plus one for device itself */
+	atomic_t zc_pending;
 	struct vmm_netport *port;
 	char name[VMM_VIRTIO_DEVICE_MAX_NAME_LEN];
 };
@@ -81,19 +126,17 @@ struct virtio_net_dev {
 static u64 virtio_net_get_host_features(struct vmm_virtio_device *dev)
 {
 	return 1UL << VMM_VIRTIO_NET_F_MAC
-#if 0
 		| 1UL << VMM_VIRTIO_NET_F_CSUM
-		| 1UL << VMM_VIRTIO_NET_F_HOST_UFO
+		| 1UL << VMM_VIRTIO_NET_F_GUEST_CSUM
 		| 1UL << VMM_VIRTIO_NET_F_HOST_TSO4
 		| 1UL << VMM_VIRTIO_NET_F_HOST_TSO6
-		| 1UL << VMM_VIRTIO_NET_F_GUEST_UFO
+		| 1UL << VMM_VIRTIO_NET_F_HOST_ECN
 		| 1UL << VMM_VIRTIO_NET_F_GUEST_TSO4
 		| 1UL << VMM_VIRTIO_NET_F_GUEST_TSO6
-#endif
+		| 1UL << VMM_VIRTIO_NET_F_GUEST_ECN
+		| 1UL << VMM_VIRTIO_NET_F_MRG_RXBUF
 		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
-#if 0
 		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC
-#endif
 		| 1UL << VMM_VIRTIO_NET_F_MQ
 		| 1UL << VMM_VIRTIO_NET_F_CTRL_VQ
 		;
@@ -109,6 +152,88 @@ static void virtio_net_set_guest_features(struct vmm_virtio_device *dev,
 
 	ndev->features &= ~((u64)UINT_MAX << (select * 32));
 	ndev->features |= ((u64)features << (select * 32));
+
+	/* Offloads which guest can accept on RX side */
+	features = VMM_NETPORT_F_SG;
+	if (ndev->features & (1UL << VMM_VIRTIO_NET_F_GUEST_CSUM)) {
+		features |= VMM_NETPORT_F_CSUM;
+		if (ndev->features & (1UL << VMM_VIRTIO_NET_F_GUEST_TSO4)) {
+			features |= VMM_NETPORT_F_TSO4;
+		}
+		if (ndev->features & (1UL << VMM_VIRTIO_NET_F_GUEST_TSO6)) {
+			features |= VMM_NETPORT_F_TSO6;
+		}
+		if (ndev->features & (1UL << VMM_VIRTIO_NET_F_GUEST_ECN)) {
+			features |= VMM_NETPORT_F_TSO_ECN;
+		}
+	}
+	ndev->port->features = features;
+}
+
+static int virtio_net_hdr_to_mbuf(struct vmm_virtio_net_hdr *hdr,
+				  struct vmm_mbuf *mb)
+{
+	if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+		if ((hdr->csum_start + hdr->csum_offset + 2) > mb->m_pktlen) {
+			return VMM_EINVALID;
+		}
+		mb->m_csum_flags = M_CSUM_PARTIAL;
+		mb->m_csum_start = hdr->csum_start;
+		mb->m_csum_offset = hdr->csum_offset;
+	}
+
+	switch (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+	case VIRTIO_NET_HDR_GSO_NONE:
+		return VMM_OK;
+	case VIRTIO_NET_HDR_GSO_TCPV4:
+		mb->m_gso_type = M_GSO_TCPV4;
+		break;
+	case VIRTIO_NET_HDR_GSO_TCPV6:
+		mb->m_gso_type = M_GSO_TCPV6;
+		break;
+	default:
+		return VMM_ENOTSUPP;
+	};
+	if (!hdr->gso_size) {
+		return VMM_EINVALID;
+	}
+	if (hdr->gso_type & VIRTIO_NET_HDR_GSO_ECN) {
+		mb->m_gso_type |= M_GSO_ECN;
+	}
+	mb->m_gso_size = hdr->gso_size;
+	mb->m_hdr_len = hdr->hdr_len;
+
+	return VMM_OK;
+}
+
+static void virtio_net_mbuf_to_hdr(struct vmm_mbuf *mb,
+				   struct vmm_virtio_net_hdr *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+
+	if (mb->m_csum_flags & M_CSUM_PARTIAL) {
+		hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		hdr->csum_start = mb->m_csum_start;
+		hdr->csum_offset = mb->m_csum_offset;
+	} else if (mb->m_csum_flags & M_CSUM_VALID) {
+		hdr->flags = VIRTIO_NET_HDR_F_DATA_VALID;
+	}
+
+	switch (mb->m_gso_type & M_GSO_TYPE_MASK) {
+	case M_GSO_TCPV4:
+		hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+		break;
+	case M_GSO_TCPV6:
+		hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+		break;
+	default:
+		return;
+	};
+	if (mb->m_gso_type & M_GSO_ECN) {
+		hdr->gso_type |= VIRTIO_NET_HDR_GSO_ECN;
+	}
+	hdr->gso_size = mb->m_gso_size;
+	hdr->hdr_len = mb->m_hdr_len;
 }
 
 static int virtio_net_init_vq(struct vmm_virtio_device *dev,
@@ -154,16 +279,174 @@ static int virtio_net_set_size_vq(struct vmm_virtio_device *dev,
 
 static void virtio_net_tx_poke(struct virtio_net_dev *ndev, u32 vq);
 
+static void virtio_net_tx_done(struct virtio_net_queue *q,
+			       u32 gen, u16 head, u32 len)
+{
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
+	/* Completions of descriptors taken before reset are dropped */
+	if (q->valid && (gen == q->zc_gen)) {
+		vmm_virtio_queue_set_used_elem(&q->vq, head, len);
+	}
+	vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
+}
+
+static void virtio_net_tx_signal(struct virtio_net_queue *q)
+{
+	bool notify = FALSE;
+	irq_flags_t flags;
+	struct vmm_virtio_device *dev = q->ndev->vdev;
+
+	vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
+	if (q->valid) {
+		notify = vmm_virtio_queue_should_signal(&q->vq);
+	}
+	vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
+
+	if (notify) {
+		dev->tra->notify(dev, q->num);
+	}
+}
+
+static void virtio_net_free_vqs(struct virtio_net_dev *ndev);
+
+static void virtio_net_zc_put(struct virtio_net_dev *ndev)
+{
+	/* Last reference frees device detached by disconnect */
+	if (!arch_atomic_sub_return(&ndev->zc_pending, 1)) {
+		virtio_net_free_vqs(ndev);
+		vmm_free(ndev);
+	}
+}
+
+static void virtio_net_zc_tx_free(struct vmm_mbuf *m,
+				  void *ptr, u32 size, void *arg)
+{
+	struct virtio_net_zc_tx *zc = arg;
+	struct virtio_net_queue *q = zc->q;
+	struct virtio_net_dev *ndev = q->ndev;
+
+	/* Receivers are done with sender guest memory so hand
+	 * the descriptor back to sender guest.
+	 */
+	virtio_net_tx_done(q, zc->gen, zc->head, zc->len);
+	virtio_net_tx_signal(q);
+	zc->busy = FALSE;
+	virtio_net_zc_put(ndev);
+}
+
+static u32 virtio_net_iovec_to_sg(struct vmm_virtio_device *dev,
+				  struct vmm_virtio_iovec *iov, u32 iov_cnt,
+				  u32 off, struct vmm_mbuf_sg *sg, u32 max_sg)
+{
+	int rc;
+	u32 i, sg_cnt = 0, reg_flags;
+	physical_addr_t gpa, hpa;
+	physical_size_t len, hlen;
+
+	for (i = 0; i < iov_cnt; i++) {
+		if (off >= iov[i].len) {
+			off -= iov[i].len;
+			continue;
+		}
+		gpa = iov[i].addr + off;
+		len = iov[i].len - off;
+		off = 0;
+		while (len) {
+			if (sg_cnt == max_sg) {
+				return 0;
+			}
+			rc = vmm_guest_physical_map(dev->guest, gpa, len,
+						    &hpa, &hlen, &reg_flags);
+			if (rc || !hlen ||
+			    !(reg_flags & VMM_REGION_REAL) ||
+			    !(reg_flags & VMM_REGION_MEMORY) ||
+			    (reg_flags & VMM_REGION_ISDEVICE)) {
+				return 0;
+			}
+			sg[sg_cnt].addr = hpa;
+			sg[sg_cnt].len = hlen;
+			sg_cnt++;
+			gpa += hlen;
+			len -= hlen;
+		}
+	}
+
+	return sg_cnt;
+}
+
+/* Build mbuf referencing frame data in sender guest memory. The
+ * descriptor is completed only when the mbuf is freed.
+ */
+static struct vmm_mbuf *virtio_net_zc_tx_mbuf(struct virtio_net_queue *q,
+					      struct vmm_virtio_iovec *iov,
+					      u32 iov_cnt, u16 head,
+					      u32 total_len, u32 pkt_len)
+{
+	u32 sg_cnt;
+	struct vmm_mbuf *mb;
+	struct virtio_net_zc_tx *zc;
+	struct virtio_net_dev *ndev = q->ndev;
+	struct vmm_virtio_device *dev = ndev->vdev;
+
+	if (!q->zc || (VIRTIO_NET_QUEUE_SIZE <= head) ||
+	    (pkt_len < VIRTIO_NET_ZC_MIN_LEN)) {
+		return NULL;
+	}
+
+	zc = &q->zc[head];
+	if (zc->busy) {
+		return NULL;
+	}
+
+	sg_cnt = virtio_net_iovec_to_sg(dev, iov, iov_cnt,
+					VIRTIO_NET_ZC_COPY_LEN,
+					zc->sg, VIRTIO_NET_ZC_MAX_SG);
+	if (!sg_cnt) {
+		return NULL;
+	}
+
+	MGETHDR(mb, 0, 0);
+	if (!mb) {
+		return NULL;
+	}
+
+	if (vmm_virtio_iovec_to_buf_read(dev, iov, iov_cnt, zc->data,
+			VIRTIO_NET_ZC_COPY_LEN) != VIRTIO_NET_ZC_COPY_LEN) {
+		m_freem(mb);
+		return NULL;
+	}
+
+	zc->busy = TRUE;
+	zc->head = head;
+	zc->len = total_len;
+	zc->gen = q->zc_gen;
+	arch_atomic_add(&ndev->zc_pending, 1);
+
+	MEXTADD(mb, zc->data, VIRTIO_NET_ZC_COPY_LEN,
+		virtio_net_zc_tx_free, zc);
+	mb->m_flags |= M_EXT_SG;
+	mb->m_extsg = zc->sg;
+	mb->m_extsgcnt = sg_cnt;
+	mb->m_extsglock = &zc->sg_lock;
+	mb->m_len = VIRTIO_NET_ZC_COPY_LEN;
+	mb->m_pktlen = pkt_len;
+
+	return mb;
+}
+
 static void virtio_net_tx_lazy(struct vmm_netport *port, void *arg, int budget)
 {
 	int rc;
 	u16 head = 0;
-	u32 iov_cnt = 0, pkt_len = 0, total_len = 0;
+	u32 iov_cnt = 0, pkt_len = 0, max_len, total_len = 0;
 	struct virtio_net_queue *q = arg;
 	struct virtio_net_dev *ndev = q->ndev;
 	struct vmm_virtio_queue *vq = &q->vq;
 	struct vmm_virtio_device *dev = ndev->vdev;
 	struct vmm_virtio_iovec *iov = q->iov;
+	struct vmm_virtio_net_hdr hdr;
 	struct vmm_mbuf *mb;
 
 	while ((budget > 0) && vmm_virtio_queue_available(vq)) {
@@ -177,25 +460,55 @@ static void virtio_net_tx_lazy(struct vmm_netport *port, void *arg, int budget)
 
 		/* iov[0] is offload info */
 		pkt_len = total_len - iov[0].len;
+		memset(&hdr, 0, sizeof(hdr));
+		vmm_virtio_iovec_to_buf_read(dev, &iov[0], 1,
+					     &hdr, sizeof(hdr));
+
+		/* Large segments are carried intact through netswitch */
+		if (hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+			max_len = VIRTIO_NET_GSO_MAX_LEN;
+		} else {
+			max_len = VIRTIO_NET_MTU;
+		}
+
+		mb = NULL;
+		if ((pkt_len <= max_len) && ndev->zero_copy) {
+			mb = virtio_net_zc_tx_mbuf(q, &iov[1], iov_cnt - 1,
+						   head, total_len, pkt_len);
+			if (mb) {
+				/* Descriptor completed when mbuf is freed */
+				if (virtio_net_hdr_to_mbuf(&hdr, mb) ==
+								VMM_OK) {
+					vmm_port2switch_xfer_mbuf(ndev->port,
+								  mb);
+				} else {
+					m_freem(mb);
+				}
+				budget--;
+				continue;
+			}
+		}
 
-		if (pkt_len <= VIRTIO_NET_MTU) {
+		if (pkt_len <= max_len) {
 			MGETHDR(mb, 0, 0);
 			MEXTMALLOC(mb, pkt_len, 0);
 			vmm_virtio_iovec_to_buf_read(dev,
 						 &iov[1], iov_cnt - 1,
 						 M_BUFADDR(mb), pkt_len);
 			mb->m_len = mb->m_pktlen = pkt_len;
-			vmm_port2switch_xfer_mbuf(ndev->port, mb);
+			if (virtio_net_hdr_to_mbuf(&hdr, mb) == VMM_OK) {
+				vmm_port2switch_xfer_mbuf(ndev->port, mb);
+			} else {
+				m_freem(mb);
+			}
 		}
 
-		vmm_virtio_queue_set_used_elem(vq, head, total_len);
+		virtio_net_tx_done(q, q->zc_gen, head, total_len);
 
 		budget--;
 	}
 
-	if (vmm_virtio_queue_should_signal(vq)) {
-		dev->tra->notify(dev, q->num);
-	}
+	virtio_net_tx_signal(q);
 
 	virtio_net_tx_poke(ndev, q->num);
 }
@@ -254,7 +567,14 @@ static void virtio_net_handle_ctrl(struct virtio_net_dev *ndev, u32 qnum)
 			vmm_virtio_iovec_to_buf_read(dev, &iov[1], 1,
 						     &ctrl_mq, sizeof(ctrl_mq));
 
-			if (ctrl_mq.virtqueue_pairs < ndev->max_queues) {
+			if ((ctrl_hdr.cmd ==
+			     VMM_VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) &&
+			    (VMM_VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN <=
+			     ctrl_mq.virtqueue_pairs) &&
+			    (ctrl_mq.virtqueue_pairs <=
+			     ndev->config.max_virtqueue_pairs)) {
+				ndev->curr_queue_pairs =
+						ctrl_mq.virtqueue_pairs;
 				status = VMM_VIRTIO_NET_OK;
 			}
 			break;
@@ -331,63 +651,270 @@ static int virtio_net_can_receive(struct vmm_netport *p)
 	return ndev->can_receive;
 }
 
-static int virtio_net_switch2port_xfer(struct vmm_netport *p,
-				       struct vmm_mbuf *mb)
+static u32 virtio_net_iovec_write(struct vmm_virtio_device *dev,
+				  struct vmm_virtio_iovec *iov, u32 iov_cnt,
+				  u32 off, void *buf, u32 buf_len)
+{
+	u32 i, ret;
+	struct vmm_virtio_iovec tiov;
+
+	for (i = 0; (i < iov_cnt) && (off >= iov[i].len); i++) {
+		off -= iov[i].len;
+	}
+	if ((i == iov_cnt) || !buf_len) {
+		return 0;
+	}
+
+	tiov = iov[i];
+	tiov.addr += off;
+	tiov.len -= off;
+	ret = vmm_virtio_buf_to_iovec_write(dev, &tiov, 1, buf, buf_len);
+	if ((ret < buf_len) && ((i + 1) < iov_cnt)) {
+		ret += vmm_virtio_buf_to_iovec_write(dev, &iov[i + 1],
+						     iov_cnt - (i + 1),
+						     buf + ret, buf_len - ret);
+	}
+
+	return ret;
+}
+
+static u32 virtio_net_iovec_copy(struct vmm_virtio_device *dev,
+				 struct vmm_virtio_iovec *iov, u32 iov_cnt,
+				 u32 off, physical_addr_t src, u32 len)
 {
 	int rc;
+	u32 i, ret = 0, reg_flags, copied;
+	physical_addr_t gpa, hpa;
+	physical_size_t glen, hlen;
+
+	for (i = 0; (i < iov_cnt) && (ret < len); i++) {
+		if (off >= iov[i].len) {
+			off -= iov[i].len;
+			continue;
+		}
+		gpa = iov[i].addr + off;
+		glen = min((u32)(iov[i].len - off), len - ret);
+		off = 0;
+		while (glen) {
+			rc = vmm_guest_physical_map(dev->guest, gpa, glen,
+						    &hpa, &hlen, &reg_flags);
+			if (rc || !hlen ||
+			    !(reg_flags & VMM_REGION_REAL) ||
+			    !(reg_flags & VMM_REGION_MEMORY) ||
+			    (reg_flags & VMM_REGION_ISDEVICE)) {
+				return ret;
+			}
+			copied = vmm_host_memory_copy(hpa, src + ret,
+						      hlen, TRUE);
+			ret += copied;
+			if (copied < hlen) {
+				return ret;
+			}
+			gpa += hlen;
+			glen -= hlen;
+		}
+	}
+
+	return ret;
+}
+
+/* Write frame data starting at pos to guest buffers. Frame data
+ * referenced through host physical scatter list is copied directly
+ * from sender guest memory.
+ */
+static u32 virtio_net_mbuf_write(struct vmm_virtio_device *dev,
+				 struct vmm_virtio_iovec *iov, u32 iov_cnt,
+				 u32 off, struct vmm_mbuf *mb,
+				 u32 pos, u32 len)
+{
+	u32 i, cnt, copied, ret = 0;
+	irq_flags_t flags;
+	struct vmm_mbuf_sg *sg;
+
+	if (pos < mb->m_len) {
+		cnt = min(len, mb->m_len - pos);
+		ret = virtio_net_iovec_write(dev, iov, iov_cnt, off,
+					     M_BUFADDR(mb) + pos, cnt);
+		if ((ret < cnt) || (ret == len)) {
+			return ret;
+		}
+		pos = 0;
+	} else {
+		pos -= mb->m_len;
+	}
+
+	if (!(mb->m_flags & M_EXT_SG)) {
+		return ret;
+	}
+
+	if (mb->m_extsglock) {
+		vmm_read_lock_irqsave_lite(mb->m_extsglock, flags);
+	}
+	for (i = 0; (i < mb->m_extsgcnt) && (ret < len); i++) {
+		sg = &mb->m_extsg[i];
+		if (pos >= sg->len) {
+			pos -= sg->len;
+			continue;
+		}
+		cnt = min(len - ret, sg->len - pos);
+		copied = virtio_net_iovec_copy(dev, iov, iov_cnt, off + ret,
+					       sg->addr + pos, cnt);
+		ret += copied;
+		if (copied < cnt) {
+			break;
+		}
+		pos = 0;
+	}
+	if (mb->m_extsglock) {
+		vmm_read_unlock_irqrestore_lite(mb->m_extsglock, flags);
+	}
+
+	return ret;
+}
+
+static struct virtio_net_queue *virtio_net_rx_queue(struct virtio_net_dev *ndev,
+						    struct vmm_mbuf *mb)
+{
+	u32 pair = 0;
+	struct virtio_net_queue *q;
+
+	if (ndev->curr_queue_pairs > 1) {
+		pair = umod32(m_flow_hash(mb), ndev->curr_queue_pairs);
+	}
+
+	/* RX queue of pair N is 2N and TX queue of pair N is 2N + 1 */
+	q = &ndev->vqs[pair * 2];
+	if (!q->valid) {
+		q = &ndev->vqs[0];
+	}
+
+	return q;
+}
+
+static int virtio_net_rx_fill(struct virtio_net_dev *ndev,
+			      struct virtio_net_queue *q,
+			      struct vmm_mbuf *mb)
+{
+	int rc = VMM_OK;
 	u16 head = 0;
-	u64 iov0_addr;
-	u32 iov_cnt = 0, iov0_len, total_len = 0, pkt_len = 0;
-	struct virtio_net_dev *ndev = p->priv;
-	/* FIXME: Select correct RX queue here  */
-	struct virtio_net_queue *q = &ndev->vqs[0];
+	bool mrg_rxbuf;
+	u32 i, off, len, pos, count, hdr_len, pkt_len;
+	u32 iov_cnt = 0, total_len = 0, hiov_cnt = 0;
 	struct vmm_virtio_queue *vq = &q->vq;
-	struct vmm_virtio_iovec *iov = q->iov;
 	struct vmm_virtio_device *dev = ndev->vdev;
-	struct vmm_virtio_net_hdr hdr;
+	struct vmm_virtio_iovec *iov;
+	struct vmm_virtio_net_hdr_mrg_rxbuf hdr;
 
-	pkt_len = min(VIRTIO_NET_MTU, mb->m_pktlen);
+	mrg_rxbuf = (ndev->features &
+		     (1UL << VMM_VIRTIO_NET_F_MRG_RXBUF)) ? TRUE : FALSE;
+	hdr_len = (mrg_rxbuf) ? sizeof(hdr) : sizeof(hdr.hdr);
+	pkt_len = mb->m_pktlen;
 
-	if (vmm_virtio_queue_available(vq)) {
+	memset(&hdr, 0, sizeof(hdr));
+	virtio_net_mbuf_to_hdr(mb, &hdr.hdr);
+
+	/* Without mergeable RX buffers frame must fit one descriptor
+	 * chain so it is truncated if required. With mergeable RX
+	 * buffers frame is spread across as many chains as required
+	 * and the first chain carries the header.
+	 */
+	pos = count = 0;
+	do {
+		if (!vmm_virtio_queue_available(vq)) {
+			rc = VMM_ENOSPC;
+			break;
+		}
+
+		iov = (count) ? q->iov : ndev->rx_hiov;
 		rc = vmm_virtio_queue_get_iovec(vq, iov,
 						&iov_cnt, &total_len, &head);
 		if (rc) {
 			vmm_printf("%s: failed to get iovec (error %d)\n",
 				   __func__, rc);
-			return rc;
+			break;
 		}
+
+		off = (count) ? 0 : hdr_len;
+		if (total_len < off) {
+			vmm_virtio_queue_set_used_elem(vq, head, 0);
+			rc = VMM_EINVALID;
+			break;
+		}
+		if (!count) {
+			hiov_cnt = iov_cnt;
+		}
+
+		len = min(pkt_len - pos, total_len - off);
+		ndev->rx_heads[count] = head;
+		ndev->rx_lens[count] = off + len;
+		count++;
+		if (virtio_net_mbuf_write(dev, iov, iov_cnt,
+					  off, mb, pos, len) < len) {
+			/* Don't hand partially written frame to guest */
+			rc = VMM_EIO;
+			break;
+		}
+		pos += len;
+	} while (mrg_rxbuf && (pos < pkt_len) &&
+		 (count < VIRTIO_NET_QUEUE_SIZE));
+
+	if (mrg_rxbuf && (pos < pkt_len) && !rc) {
+		rc = VMM_ENOSPC;
 	}
 
-	memset(&hdr, 0, sizeof(hdr));
-	if (iov_cnt == 1) {
-		vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1,
-					      &hdr, sizeof(hdr));
-		iov0_addr = iov[0].addr;
-		iov0_len = iov[0].len;
-		iov[0].addr += sizeof(hdr);
-		iov[0].len -= sizeof(hdr);
-		vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1,
-					      M_BUFADDR(mb), pkt_len);
-		vmm_virtio_queue_set_used_elem(vq, head,
-					       sizeof(hdr) + pkt_len);
-		iov[0].addr = iov0_addr;
-		iov[0].len = iov0_len;
-	} else if (iov_cnt > 1) {
-		vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1,
-					      &hdr, sizeof(hdr));
-		vmm_virtio_buf_to_iovec_write(dev, &iov[1], iov_cnt - 1,
-					      M_BUFADDR(mb), pkt_len);
-		vmm_virtio_queue_set_used_elem(vq, head, iov[0].len + pkt_len);
+	if (rc == VMM_ENOSPC) {
+		/* Give back chains so that next frame can use them */
+		vmm_virtio_queue_unpop(vq, count);
+		return rc;
+	} else if (rc) {
+		/* Return chains consumed so far as empty buffers */
+		for (i = 0; i < count; i++) {
+			vmm_virtio_queue_set_used_elem(vq,
+						       ndev->rx_heads[i], 0);
+		}
+		return rc;
 	}
 
-	if (vmm_virtio_queue_should_signal(vq)) {
-		/* FIXME: Select correct RX queue here  */
-		dev->tra->notify(dev, 0);
+	hdr.num_buffers = count;
+	vmm_virtio_buf_to_iovec_write(dev, ndev->rx_hiov, hiov_cnt,
+				      &hdr, hdr_len);
+
+	for (i = 0; i < count; i++) {
+		vmm_virtio_queue_set_used_elem(vq, ndev->rx_heads[i],
+					       ndev->rx_lens[i]);
+	}
+
+	return VMM_OK;
+}
+
+static int virtio_net_switch2port_xfer(struct vmm_netport *p,
+				       struct vmm_mbuf *mb)
+{
+	int rc;
+	struct vmm_mbuf *lmb;
+	struct virtio_net_dev *ndev = p->priv;
+	struct virtio_net_queue *q = virtio_net_rx_queue(ndev, mb);
+	struct vmm_virtio_device *dev = ndev->vdev;
+
+	/* Frame data is expected in a single buffer */
+	if (mb->m_next) {
+		lmb = m_dup(mb);
+		m_freem(mb);
+		if (!lmb) {
+			return VMM_ENOMEM;
+		}
+		mb = lmb;
+	}
+
+	rc = virtio_net_rx_fill(ndev, q, mb);
+
+	if (vmm_virtio_queue_should_signal(&q->vq)) {
+		dev->tra->notify(dev, q->num);
 	}
 
 	m_freem(mb);
 
-	return VMM_OK;
+	return (rc == VMM_ENOSPC) ? VMM_OK : rc;
 }
 
 static int virtio_net_read_config(struct vmm_virtio_device *dev,
@@ -421,22 +948,102 @@ static int virtio_net_write_config(struct vmm_virtio_device *dev,
 static int virtio_net_reset(struct vmm_virtio_device *dev)
 {
 	int rc, i;
+	irq_flags_t flags;
 	struct virtio_net_dev *ndev = dev->emu_data;
 
 	for (i = 0; i < ndev->max_queues; i++) {
+		vmm_spin_lock_irqsave_lite(&ndev->vqs[i].used_lock, flags);
+		/* Zero-copy TX descriptors in flight become stale */
+		ndev->vqs[i].zc_gen++;
 		if (ndev->vqs[i].valid) {
 			rc = vmm_virtio_queue_cleanup(&ndev->vqs[i].vq);
 			if (rc) {
+				vmm_spin_unlock_irqrestore_lite(
+					&ndev->vqs[i].used_lock, flags);
 				return rc;
 			}
 		}
 		ndev->vqs[i].valid = 0;
+		vmm_spin_unlock_irqrestore_lite(&ndev->vqs[i].used_lock, flags);
 	}
 	ndev->can_receive = 0;
+	ndev->curr_queue_pairs = 1;
+	ndev->port->features = 0;
 
 	return VMM_OK;
 }
 
+static void virtio_net_zc_alloc(struct virtio_net_queue *q)
+{
+	u32 i;
+
+	/* Without contexts zero-copy TX falls back to copying */
+	q->zc = vmm_zalloc(sizeof(*q->zc) * VIRTIO_NET_QUEUE_SIZE);
+	if (!q->zc) {
+		return;
+	}
+
+	for (i = 0; i < VIRTIO_NET_QUEUE_SIZE; i++) {
+		q->zc[i].q = q;
+		INIT_RW_LOCK(&q->zc[i].sg_lock);
+	}
+}
+
+static void virtio_net_zc_wait(struct virtio_net_dev *ndev)
+{
+	u32 i, j, k, msecs = VIRTIO_NET_ZC_WAIT_MSECS;
+	irq_flags_t flags;
+	struct virtio_net_zc_tx *zc;
+	struct virtio_net_queue *q;
+
+	/* Wait for receivers to release sender guest memory but
+	 * not forever because a receiver might hold mbufs for long.
+	 */
+	while ((1 < arch_atomic_read(&ndev->zc_pending)) && msecs) {
+		vmm_msleep(1);
+		msecs--;
+	}
+
+	if (arch_atomic_read(&ndev->zc_pending) <= 1) {
+		return;
+	}
+
+	vmm_printf("%s: detaching %ld zero-copy TX buffers\n",
+		   ndev->name, arch_atomic_read(&ndev->zc_pending) - 1);
+
+	/* Detach outstanding mbufs from sender guest memory so that
+	 * receivers find their data short and drop them. Taking the
+	 * scatter list lock for write waits for receivers which are
+	 * still copying from sender guest memory.
+	 */
+	for (i = 0; i < ndev->max_queues; i++) {
+		q = &ndev->vqs[i];
+		if (!q->zc) {
+			continue;
+		}
+		for (j = 0; j < VIRTIO_NET_QUEUE_SIZE; j++) {
+			zc = &q->zc[j];
+			vmm_write_lock_irqsave_lite(&zc->sg_lock, flags);
+			for (k = 0; k < VIRTIO_NET_ZC_MAX_SG; k++) {
+				zc->sg[k].len = 0;
+			}
+			vmm_write_unlock_irqrestore_lite(&zc->sg_lock, flags);
+		}
+	}
+}
+
+static void virtio_net_free_vqs(struct virtio_net_dev *ndev)
+{
+	u32 i;
+
+	for (i = 0; i < ndev->max_queues; i++) {
+		if (ndev->vqs[i].zc) {
+			vmm_free(ndev->vqs[i].zc);
+		}
+	}
+	vmm_free(ndev->vqs);
+}
+
 static int virtio_net_connect(struct vmm_virtio_device *dev,
 			      struct vmm_virtio_emulator *emu)
 {
@@ -477,14 +1084,20 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 		return VMM_ENOMEM;
 	}
 	ndev->config.status = VMM_VIRTIO_NET_S_LINK_UP;
+	ndev->curr_queue_pairs = 1;
 	ndev->cq = ndev->config.max_virtqueue_pairs * 2;
 	ndev->max_queues = ndev->config.max_virtqueue_pairs * 2 + 1;
 	dev->emu_data = ndev;
 
+	ndev->zero_copy = vmm_devtree_getattr(dev->edev->node,
+					      "zero_copy") ? TRUE : FALSE;
+	ARCH_ATOMIC_INIT(&ndev->zc_pending, 1);
+
 	for (i = 0; i < ndev->max_queues; i++) {
 		ndev->vqs[i].num = i;
 		ndev->vqs[i].valid = 0;
 		ndev->vqs[i].ndev = ndev;
+		INIT_SPIN_LOCK(&ndev->vqs[i].used_lock);
 		if (i == ndev->cq) {
 			ndev->vqs[i].type = VIRTIO_NET_CTRL_QUEUE;
 		} else {
@@ -495,6 +1108,9 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 						  &ndev->vqs[i],
 						  virtio_net_tx_lazy);
 				ndev->vqs[i].type = VIRTIO_NET_TX_QUEUE;
+				if (ndev->zero_copy) {
+					virtio_net_zc_alloc(&ndev->vqs[i]);
+				}
 			} else {
 				ndev->vqs[i].type = VIRTIO_NET_RX_QUEUE;
 			}
@@ -503,7 +1119,7 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 
 	rc = vmm_netport_register(ndev->port);
 	if (rc) {
-		vmm_free(ndev->vqs);
+		virtio_net_free_vqs(ndev);
 		vmm_netport_free(ndev->port);
 		vmm_free(ndev);
 		return rc;
@@ -529,12 +1145,26 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 
 static void virtio_net_disconnect(struct vmm_virtio_device *dev)
 {
+	u32 i;
+	irq_flags_t flags;
 	struct virtio_net_dev *ndev = dev->emu_data;
 
 	vmm_netport_unregister(ndev->port);
-	vmm_free(ndev->vqs);
+	virtio_net_zc_wait(ndev);
+	for (i = 0; i < ndev->max_queues; i++) {
+		vmm_spin_lock_irqsave_lite(&ndev->vqs[i].used_lock, flags);
+		/* Late zero-copy TX completions are dropped */
+		ndev->vqs[i].zc_gen++;
+		ndev->vqs[i].valid = 0;
+		vmm_spin_unlock_irqrestore_lite(&ndev->vqs[i].used_lock, flags);
+		vmm_virtio_queue_cleanup(&ndev->vqs[i].vq);
+	}
 	vmm_netport_free(ndev->port);
-	vmm_free(ndev);
+
+	/* Zero-copy TX mbufs still held by receivers keep queues and
+	 * their contexts alive and the last one frees the device.
+	 */
+	virtio_net_zc_put(ndev);
 }
 
 struct vmm_virtio_device_id virtio_net_emu_id[] = {
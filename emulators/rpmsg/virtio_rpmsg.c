@@ -89,7 +89,8 @@ struct virtio_rpmsg_dev {
 
 static u64 virtio_rpmsg_get_host_features(struct vmm_virtio_device *dev)
 {
-	return 1UL << VMM_VIRTIO_RPMSG_F_NS;
+	return 1UL << VMM_VIRTIO_RPMSG_F_NS
+		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC;
 }
 
 static void virtio_rpmsg_set_guest_features(struct vmm_virtio_device *dev,
@@ -586,6 +587,8 @@ static void virtio_rpmsg_disconnect(struct vmm_virtio_device *dev)
 
 	vmm_vmsg_node_destroy(rdev->node);
 	mempool_destroy(rdev->tx_buf_pool);
+	vmm_virtio_queue_cleanup(&rdev->vqs[VIRTIO_RPMSG_RX_QUEUE]);
+	vmm_virtio_queue_cleanup(&rdev->vqs[VIRTIO_RPMSG_TX_QUEUE]);
 	vmm_free(rdev);
 }
 
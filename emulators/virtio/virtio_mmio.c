@@ -26,6 +26,8 @@
 #include <vmm_stdio.h>
 #include <vmm_modules.h>
 #include <vmm_devemu.h>
+#include <vmm_scheduler.h>
+#include <vmm_trace.h>
 #include <vio/vmm_virtio.h>
 #include <vio/vmm_virtio_mmio.h>
 
@@ -168,6 +170,8 @@ static int virtio_mmio_config_write(struct virtio_mmio_dev *m,
 				    val);
 		break;
 	case VMM_VIRTIO_MMIO_QUEUE_NOTIFY:
+		vmm_trace(VMM_TRACE_VIRTQ_NOTIFY, vmm_scheduler_current_vcpu(),
+			  val, m->dev.id.type, 0);
 		m->dev.emu->notify_vq(&m->dev, val);
 		break;
 	case VMM_VIRTIO_MMIO_INTERRUPT_ACK:
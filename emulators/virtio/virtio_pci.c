@@ -26,6 +26,8 @@
 #include <vmm_heap.h>
 #include <vmm_modules.h>
 #include <vmm_devemu.h>
+#include <vmm_scheduler.h>
+#include <vmm_trace.h>
 #include <vio/vmm_virtio.h>
 #include <vio/vmm_virtio_pci.h>
 #include <emu/pci/pci_emu_core.h>
@@ -138,6 +140,9 @@ static int virtio_pci_config_write(struct virtio_pci_dev *m,
 		break;
 	case VMM_VIRTIO_PCI_QUEUE_NOTIFY:
 		if (val < VMM_VIRTIO_PCI_QUEUE_MAX) {
+			vmm_trace(VMM_TRACE_VIRTQ_NOTIFY,
+				  vmm_scheduler_current_vcpu(),
+				  val, m->dev.id.type, 0);
 			m->dev.emu->notify_vq(&m->dev, val);
 		}
 		break;
@@ -33,6 +33,11 @@ void __weak arch_save_stacktrace(struct stack_trace *trace)
 {
 }
 
+void __weak arch_sample_stacktrace(struct arch_regs *regs,
+				   struct stack_trace *trace)
+{
+}
+
 void print_stacktrace(struct stack_trace *trace)
 {
 	int i;
@@ -61,6 +61,16 @@ bool fifo_enqueue(struct fifo *f, void *src, bool overwrite);
  */
 bool fifo_dequeue(struct fifo *f, void *dst);
 
+/** Enqueue upto given number of elements to FIFO under single lock
+ *  @returns number of elements enqueued
+ */
+u32 fifo_enqueue_bulk(struct fifo *f, void *src, u32 count);
+
+/** Dequeue upto given number of elements from FIFO under single lock
+ *  @returns number of elements dequeued
+ */
+u32 fifo_dequeue_bulk(struct fifo *f, void *dst, u32 count);
+
 /** Clear (or empty) the FIFO
  *  @returns TRUE on success and FALSE on failure
  */
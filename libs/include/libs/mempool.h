@@ -110,4 +110,14 @@ void *mempool_zalloc(struct mempool *mp);
 /** Free a entity to MEMPOOL */
 int mempool_free(struct mempool *mp, void *entity);
 
+/** Alloc upto given number of entities from MEMPOOL in one go
+ *  @returns number of entities allocated
+ */
+u32 mempool_malloc_bulk(struct mempool *mp, void **entities, u32 count);
+
+/** Free given number of entities to MEMPOOL in one go
+ *  @returns number of entities freed
+ */
+u32 mempool_free_bulk(struct mempool *mp, void **entities, u32 count);
+
 #endif /* __MEMPOOL_H__ */
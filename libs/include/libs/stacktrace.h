@@ -30,6 +30,16 @@ struct stack_trace {
 	int skip;	/* input argument: how many entries to skip */
 };
 
+struct arch_regs;
+
 void dump_stacktrace(void);
 
+/* Save short stack trace of hypervisor context interrupted with given
+ * registers where first entry is the interrupted program counter.
+ * Nothing is saved if given registers belong to guest context.
+ * Note: This is called from interrupt context (e.g. sampling profiler)
+ * so it must not print anything or unwind beyond interrupted stack.
+ */
+void arch_sample_stacktrace(struct arch_regs *regs, struct stack_trace *trace);
+
 #endif /* __STACKTRACE__ */
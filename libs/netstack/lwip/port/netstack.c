@@ -708,6 +708,7 @@ static int lwip_can_receive(struct vmm_netport *port)
 static int lwip_switch2port_xfer(struct vmm_netport *port,
 			 	 struct vmm_mbuf *mbuf)
 {
+	int rc;
 	u32 pbuf_len;
 	struct eth_hdr *ethhdr;
 	struct pbuf *p, *q;
@@ -722,7 +723,12 @@ static int lwip_switch2port_xfer(struct vmm_netport *port,
 	}
 
 	for (q = p; q != NULL; q = q->next) {
-		m_copydata(mbuf, lcopied, q->len, q->payload);
+		rc = m_copydata(mbuf, lcopied, q->len, q->payload);
+		if (rc) {
+			pbuf_free(p);
+			m_freem(mbuf);
+			return rc;
+		}
 		lcopied += q->len;
 	}
 